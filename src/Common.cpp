@@ -3,15 +3,32 @@
 #include "containers/records/CreateR.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
+#include "Metrics.hpp"
+#include "Tracer.hpp"
 #include "crypto/ed25519.h"
-#include <botan/sha2_64.h>
-#include <botan/base64.h>
+#include "crypto/KeyCache.hpp"
+#include "pow/Scrypt.hpp"
+#include "encoding/Codec.hpp"
+#include "containers/ValidationCache.hpp"
+#include "containers/RootSignatureCache.hpp"
+#include <botan/x509_key.h>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <unordered_map>
+#include <algorithm>
 #include <fstream>
 
+const size_t Common::DEFAULT_VALIDATION_BUDGET;
+const size_t Common::DEFAULT_INGEST_BATCH;
+const size_t Common::MAX_RECORD_LENGTH;
+const size_t Common::MAX_BATCH_NAMES;
 
-RecordPtr Common::parseRecord(const std::string& json)
+// accepts either the JSON form or the binary one from Record::asBinary
+RecordPtr Common::parseRecord(const std::string& data)
 {
-  return parseRecord(toJSON(json));
+  RecordPtr r = assembleRecord(data);
+  checkValidity(r);
+  return r;
 }
 
 
@@ -25,10 +42,124 @@ RecordPtr Common::parseRecord(const Json::Value& rVal)
 
 
 
+// restores a Record from trusted local storage, only performing the full
+// validation if the Record no longer matches the hash it was stored with
+RecordPtr Common::parseRecord(const std::string& data,
+                              const SHA384_HASH& knownHash)
+{
+  RecordPtr r = assembleRecord(data);
+  if (!r->restoreValidity(knownHash))
+  {
+    Log::get().warn("Stored Record does not match its hash, revalidating.");
+    checkValidity(r);
+  }
+
+  return r;
+}
+
+
+
+// Parses and validates many Records at once, such as a mirror's full set.
+// Parsing is spread across the pool, then workers take multi-lane batches
+// of Records to validate, with as many in flight as the scrypt memory of
+// memoryBudget allows. Failures are reported per Record, not thrown.
+std::vector<Common::Validation> Common::parseRecords(
+    const std::vector<std::string>& jsons,
+    size_t memoryBudget,
+    ThreadPool& pool)
+{
+  Tracer::Span span("parseRecords");
+  std::vector<Validation> results(jsons.size());
+  size_t nScrypted = parseBatch(jsons.data(), jsons.size(), results.data(),
+                                memoryBudget, pool);
+
+  size_t nValid = 0;
+  for (const auto& result : results)
+    nValid += result.valid;
+  LOG_NOTICE("Validated " + std::to_string(nValid) + " of " +
+             std::to_string(results.size()) + " Records, " +
+             std::to_string(results.size() - nScrypted) +
+             " without scrypt.");
+
+  return results;
+}
+
+
+
+// Reads newline-delimited Record JSON, such as a mirror's dump, and
+// validates it as it arrives, batchSize Records at a time, handing each
+// outcome to the callback in input order. Only one batch is held at once,
+// so memory stays bounded however long the input is. Lines longer than
+// MAX_RECORD_LENGTH are skipped. Returns the number of Records read.
+size_t Common::ingestRecords(std::istream& in,
+                             const ValidationCallback& callback,
+                             size_t batchSize,
+                             size_t memoryBudget,
+                             ThreadPool& pool)
+{
+  return ingest([&in](std::string& line)
+                {
+                  while (std::getline(in, line))
+                    if (line.size() <= MAX_RECORD_LENGTH)
+                      return true;
+                    else
+                      Log::get().warn("Skipping an overlong Record.");
+                  return false;
+                },
+                callback, batchSize, memoryBudget, pool);
+}
+
+
+
+// as above, reading from the socket until the peer closes it
+size_t Common::ingestRecords(boost::asio::ip::tcp::socket& socket,
+                             const ValidationCallback& callback,
+                             size_t batchSize,
+                             size_t memoryBudget,
+                             ThreadPool& pool)
+{
+  boost::asio::streambuf buffer(MAX_RECORD_LENGTH + 1);
+  std::istream in(&buffer);
+
+  return ingest([&](std::string& line)
+                {
+                  bool skipping = false;
+                  boost::system::error_code ec;
+                  while (true)
+                  {
+                    boost::asio::read_until(socket, buffer, '\n', ec);
+                    if (ec == boost::asio::error::not_found)
+                    {  // the buffer filled up without a newline
+                      if (!skipping)
+                        Log::get().warn("Skipping an overlong Record.");
+                      buffer.consume(buffer.size());
+                      skipping = true;
+                    }
+                    else if (!ec || buffer.size() > 0)
+                    {  // a whole line, or the last one if the stream ended
+                      std::getline(in, line);
+                      if (!skipping)
+                        return true;
+                      skipping = false;
+                    }
+                    else
+                    {
+                      if (ec != boost::asio::error::eof)
+                        Log::get().warn("Record stream failed: " +
+                                        ec.message());
+                      return false;
+                    }
+                  }
+                },
+                callback, batchSize, memoryBudget, pool);
+}
+
+
+
 Json::Value Common::toJSON(const std::string& json)
 {
+  static thread_local Json::Reader reader;  // reused, with its buffers
   Json::Value rVal;
-  Json::Reader reader;
 
   if (!reader.parse(json, rVal))
     Log::get().error("Failed to parse Record!");
@@ -41,16 +172,19 @@ Json::Value Common::toJSON(const std::string& json)
 std::string Common::getDestination(const RecordPtr& record,
                                    const std::string& source)
 {
-  if (record->getName() == source)
-    return record->getOnion();
+  return resolve(record, source).str();
+}
 
-  NameList list = record->getSubdomains();
-  for (auto subdomain : list)
-    if (subdomain.first + "." + record->getName() == source)
-      return subdomain.second;
 
-  Log::get().error("Record does not contain \"" + source + "\"!");
-  return "";
+
+// as getDestination, but without allocating: the destination stays in the
+// Record's arena, valid for as long as the Record is
+StringRef Common::resolve(const RecordPtr& record, const std::string& source)
+{
+  StringRef destination = record->resolve(source.data(), source.size());
+  if (destination.empty())
+    Log::get().error("Record does not contain \"" + source + "\"!");
+  return destination;
 }
 
 
@@ -60,96 +194,643 @@ std::pair<bool, int> Common::verifyRootSignature(const Json::Value& sigObj,
                                                  ED_SIGNATURE& sig,
                                                  const SHA384_HASH& root,
                                                  const std::string& key)
+{
+  Tracer::Span span("verifyRootSignature");
+  ED_KEY qPubKey;
+  if (!decodeRootSignature(sigObj, key, sig, qPubKey))
+    return std::make_pair(false, -1);
+
+  // check signature, reusing the decompressed key and any recent result
+  int status = RootSignatureCache::get().verify(root, qPubKey, sig);
+
+  // announce results
+  if (status == 0)
+    LOG_NOTICE("Valid Ed25519 Quorum signature on root.");
+  else if (status == 1)
+    Log::get().warn("Invalid Ed25519 Quorum signature on root.");
+  else
+    Log::get().warn("General Ed25519 signature failure on root.");
+
+  return std::make_pair(status == 0, sigObj["count"].asInt());
+}
+
+
+
+// Verifies the root signatures of many Quorum nodes or mirrors, each with
+// the key at the same position, in one Ed25519 batch verification. Only if
+// the batch fails are the signatures checked one by one, to find the bad
+// ones. Returns for each what verifyRootSignature would; sigs is resized.
+std::vector<std::pair<bool, int>> Common::verifyRootSignatures(
+    const std::vector<Json::Value>& sigObjs,
+    std::vector<ED_SIGNATURE>& sigs,
+    const SHA384_HASH& root,
+    const std::vector<std::string>& keys)
+{
+  Tracer::Span span("verifyRootSignatures");
+  if (keys.size() != sigObjs.size())
+    Log::get().error("Need one Quorum key per root signature!");
+
+  std::vector<std::pair<bool, int>> results(sigObjs.size(),
+                                            std::make_pair(false, -1));
+  sigs.resize(sigObjs.size());
+  std::vector<ED_KEY> qPubKeys(sigObjs.size());
+
+  // gather the well-formed signatures not already verified for the batch
+  auto& cache = RootSignatureCache::get();
+  size_t nValid = 0;
+  std::vector<size_t> indices;
+  std::vector<const unsigned char*> messages, pubKeys, signatures;
+  for (size_t n = 0; n < sigObjs.size(); n++)
+  {
+    if (!decodeRootSignature(sigObjs[n], keys[n], sigs[n], qPubKeys[n]))
+      continue;
+
+    if (cache.isVerified(root, qPubKeys[n], sigs[n]))
+    {
+      results[n] = std::make_pair(true, sigObjs[n]["count"].asInt());
+      nValid++;
+    }
+    else
+    {
+      indices.push_back(n);
+      messages.push_back(root.data());
+      pubKeys.push_back(qPubKeys[n].data());
+      signatures.push_back(sigs[n].data());
+    }
+  }
+
+  static Metrics::Counter& verifications = Metrics::get().counter(
+      "onions_signature_verifications_total{algorithm=\"ed25519\"}",
+      "Signatures checked, by algorithm.");
+  verifications.add(indices.size());
+
+  std::vector<size_t> lengths(indices.size(), Const::SHA384_LEN);
+  std::vector<int> valid(indices.size(), 0);
+  if (!indices.empty())
+    ed25519_sign_open_batch(messages.data(), lengths.data(), pubKeys.data(),
+                            signatures.data(), indices.size(), valid.data());
+
+  for (size_t j = 0; j < indices.size(); j++)
+  {
+    const size_t n = indices[j];
+    results[n] = std::make_pair(valid[j] == 1, sigObjs[n]["count"].asInt());
+    if (valid[j] == 1)
+    {
+      cache.addVerified(root, qPubKeys[n], sigs[n]);
+      nValid++;
+    }
+  }
+
+  LOG_NOTICE(std::to_string(nValid) + " of " +
+             std::to_string(sigObjs.size()) +
+             " Ed25519 Quorum signatures on root are valid.");
+  return results;
+}
+
+
+
+// the value of a "batchQuery" request for the names
+std::string Common::makeBatchQuery(const std::vector<std::string>& names)
+{
+  if (names.empty() || names.size() > MAX_BATCH_NAMES)
+    Log::get().error("A batch query needs 1 to " +
+                     std::to_string(MAX_BATCH_NAMES) + " names!");
+
+  std::string query;
+  for (const auto& name : names)
+  {
+    if (!query.empty())
+      query += ',';
+    query += name;
+  }
+
+  return query;
+}
+
+
+
+// the names of a batch query, in order and without duplicates
+std::vector<std::string> Common::splitBatchQuery(const std::string& query)
+{
+  std::vector<std::string> names;
+  size_t start = 0;
+  while (start <= query.size())
+  {
+    size_t end = query.find(',', start);
+    if (end == std::string::npos)
+      end = query.size();
+
+    std::string name = query.substr(start, end - start);
+    if (!name.empty() &&
+        std::find(names.begin(), names.end(), name) == names.end())
+      names.push_back(name);
+    start = end + 1;
+  }
+
+  if (names.empty() || names.size() > MAX_BATCH_NAMES)
+    Log::get().error("A batch query needs 1 to " +
+                     std::to_string(MAX_BATCH_NAMES) + " names!");
+  return names;
+}
+
+
+
+// Answers a batch query from a snapshot and the tree built from it. Each
+// distinct owning Record is sent once, and a single multi-proof under the
+// root covers them all, along with the absence of names that have none:
+//   {"root": base64, "records": [Record JSON, ...],
+//    "answers": {name: index into records, or null},
+//    "proof": from MerkleTree::generateMultiProof}
+// The stream's signature on the response then covers the whole batch.
+Json::Value Common::answerBatchQuery(const std::string& query,
+                                     const Cache::Snapshot& snapshot,
+                                     const MerkleTree& tree)
+{
+  const auto names = splitBatchQuery(query);
+  const SHA384_HASH root = tree.getRootHash();
+
+  Json::Value result;
+  result["root"] = Codec::base64Encode(root.data(), root.size());
+  result["records"] = Json::Value(Json::arrayValue);
+  result["answers"] = Json::Value(Json::objectValue);
+
+  std::vector<std::string> proven;
+  std::unordered_map<const Record*, Json::ArrayIndex> indices;
+  for (const auto& name : names)
+  {
+    const std::string owner = getOwnerName(name);
+    RecordPtr record = snapshot.get(owner);
+    if (!record)
+    {
+      result["answers"][name] = Json::Value();
+      proven.push_back(owner);
+      continue;
+    }
+
+    auto entry = indices.find(record.get());
+    if (entry == indices.end())
+    {
+      entry = indices.emplace(record.get(), result["records"].size()).first;
+      result["records"].append(record->asJSONObj());
+      proven.push_back(record->getName());
+    }
+
+    result["answers"][name] = entry->second;
+  }
+
+  result["proof"] = tree.generateMultiProof(proven);
+  return result;
+}
+
+
+
+// Checks a batch query's response against a trusted root and returns an
+// answer for each of the names, in order. Every Record must be valid and
+// one of the proof's leaves, each name must be answered by the Record of
+// its owner name, and each name without one must be shown to be absent;
+// otherwise this throws, as the response cannot be trusted.
+std::vector<Common::Lookup> Common::checkBatchQuery(
+    const Json::Value& response,
+    const std::vector<std::string>& names,
+    const SHA384_HASH& root)
+{
+  const Json::Value& proof = response["proof"];
+  if (!response["records"].isArray() || !response["answers"].isObject() ||
+      !MerkleTree::verifyMultiProof(proof, root))
+    Log::get().error("Invalid Merkle proof for the batch query.");
+
+  std::vector<RecordPtr> records;
+  for (const auto& rVal : response["records"])
+  {
+    RecordPtr record = parseRecord(rVal);
+    if (!MerkleTree::doesContain(proof, record) ||
+        MerkleTree::doesExclude(proof, record->getName()))
+      Log::get().error("Batch query Record is not under the root.");
+    records.push_back(record);
+  }
+
+  std::vector<Lookup> lookups;
+  lookups.reserve(names.size());
+  for (const auto& name : names)
+  {
+    Lookup lookup;
+    lookup.name = name;
+
+    const std::string owner = getOwnerName(name);
+    const Json::Value& answer = response["answers"][name];
+    if (answer.isUInt() && answer.asUInt() < records.size())
+    {
+      lookup.record = records[answer.asUInt()];
+      if (lookup.record->getName() != owner)
+        Log::get().error("Batch query answers \"" + name +
+                         "\" with another name's Record.");
+
+      StringRef destination =
+          lookup.record->resolve(name.data(), name.size());
+      lookup.destination = destination.str();
+    }
+    else if (!answer.isNull() || !MerkleTree::doesExclude(proof, owner))
+      Log::get().error("No proof of absence for \"" + name + "\".");
+
+    lookups.push_back(lookup);
+  }
+
+  return lookups;
+}
+
+
+
+// the Record name that a name falls under: its last two labels, such as
+// example.tor for a.b.example.tor
+std::string Common::getOwnerName(const std::string& name)
+{
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos || dot == 0)
+    return name;
+
+  dot = name.rfind('.', dot - 1);
+  return dot == std::string::npos ? name : name.substr(dot + 1);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// Checks the shape of a root signature object and decodes its signature
+// and the node's key, warning and returning false if either is malformed.
+bool Common::decodeRootSignature(const Json::Value& sigObj,
+                                 const std::string& key,
+                                 ED_SIGNATURE& sig,
+                                 ED_KEY& qPubKey)
 {
   // sanity check
   if (!sigObj.isMember("signature") || !sigObj.isMember("count"))
   {
     Log::get().warn("Invalid root signature.");
-    return std::make_pair(false, -1);
+    return false;
   }
 
   // decode signature
-  if (Botan::base64_decode(sig.data(), sigObj["signature"].asString()) !=
-      sig.size())
+  auto sig64 = sigObj["signature"].asString();
+  if (Codec::base64Decode(sig64, sig.data(), sig.size()) != sig.size())
   {
     Log::get().warn("Invalid root signature length from Quorum node.");
-    return std::make_pair(false, -1);
+    return false;
   }
 
-  // decode public key
-  ED_KEY qPubKey;
-  if (Botan::base64_decode(qPubKey.data(), key) != Const::ED25519_KEY_LEN)
+  // decode public key, which is usually one of the few Quorum nodes'
+  if (!RootSignatureCache::get().decodeKey(key, qPubKey))
   {
     Log::get().warn("Quorum node key has an invalid length.");
-    return std::make_pair(false, -1);
+    return false;
   }
 
-  // check signature
-  int status = ed25519_sign_open(root.data(), Const::SHA384_LEN, qPubKey.data(),
-                                 sig.data());
-
-  // announce results
-  if (status == 0)
-    Log::get().notice("Valid Ed25519 Quorum signature on root.");
-  else if (status == 1)
-    Log::get().warn("Invalid Ed25519 Quorum signature on root.");
-  else
-    Log::get().warn("General Ed25519 signature failure on root.");
-
-  return std::make_pair(status == 0, sigObj["count"].asInt());
+  return true;
 }
 
 
 
-// ************************** PRIVATE METHODS ****************************** //
+// the binary form starts with its version byte, which JSON text never does
+RecordPtr Common::assembleRecord(const std::string& data)
+{
+  if (!data.empty() && data[0] == Record::ENCODING_VERSION)
+    return assembleRecord(reinterpret_cast<const uint8_t*>(data.data()),
+                          data.size());
+
+  return assembleRecord(toJSON(data));
+}
 
 
 
 RecordPtr Common::assembleRecord(const Json::Value& rVal)
 {
-  auto contact = rVal["contact"].asString();
-  auto nonce = rVal["nonce"].asString();
-  auto pow = rVal["pow"].asString();
-  auto pubHSKey = rVal["pubHSKey"].asString();
-  auto sig = rVal["recordSig"].asString();
-  auto type = rVal["type"].asString();
-  auto name = rVal["name"].asString();
+  // views into the document, which outlives the Record's construction
+  auto view = [](const Json::Value& value)
+  {
+    const char *begin = nullptr, *end = nullptr;
+    if (value.isNull())
+      return StringRef();
+    if (!value.getString(&begin, &end))
+      Log::get().error("Record parsing: fields must be strings!");
+    return StringRef(begin, end - begin);
+  };
+
+  auto contact = view(rVal["contact"]);
+  auto nonce = view(rVal["nonce"]);
+  auto pow = view(rVal["pow"]);
+  auto pubHSKey = view(rVal["pubHSKey"]);
+  auto sig = view(rVal["recordSig"]);
+  auto name = view(rVal["name"]);
+
+  if (view(rVal["type"]) != std::string("Create"))
+    Log::get().error("Record parsing: not a Create Record!");
+
+  std::vector<Record::SubdomainRef> subdomains;
+  const Json::Value& list = rVal["subd"];
+  if (!list.isNull() && !list.isObject())
+    Log::get().error("Record parsing: subdomains must be an object!");
+  for (auto entry = list.begin(); entry != list.end(); ++entry)
+    {
+      const char* end = nullptr;
+      const char* source = entry.memberName(&end);
+      subdomains.push_back(
+          Record::SubdomainRef(StringRef(source, end - source), view(*entry)));
+    }
+
+  uint8_t ber[KeyCache::MAX_DER_LEN];
+  const size_t berLen = Codec::base64Decode(pubHSKey.data(), pubHSKey.size(),
+                                            ber, sizeof(ber));
+  if (berLen == Codec::INVALID || berLen == 0)
+    Log::get().error("Record parsing: the key is not a RSA key!");
+
+  return std::make_shared<CreateR>(
+      contact, name, subdomains, nonce, pow, sig,
+      StringRef(reinterpret_cast<const char*>(ber), berLen));
+}
+
+
 
-  if (type != "Create")
+// reads the encoding described in Record.hpp, with or without the proof
+RecordPtr Common::assembleRecord(const uint8_t* data, size_t length)
+{
+  const uint8_t* end = data + length;
+  auto take = [&data, end](size_t size)
+  {
+    if (size_t(end - data) < size)
+      Log::get().error("Record parsing: binary Record is truncated!");
+    const uint8_t* field = data;
+    data += size;
+    return field;
+  };
+
+  // views into the buffer, which outlives the Record's construction
+  auto takeString = [&take](bool wide)
+  {
+    size_t size = *take(1);
+    if (wide)
+      size = (size << 8) | *take(1);
+    return StringRef(reinterpret_cast<const char*>(take(size)), size);
+  };
+
+  if (*take(1) != Record::ENCODING_VERSION)
+    Log::get().error("Record parsing: unknown binary encoding!");
+  if (*take(1) != static_cast<uint8_t>(Record::Type::Create))
     Log::get().error("Record parsing: not a Create Record!");
 
-  NameList subdomains;
-  if (rVal.isMember("subd"))
+  auto name = takeString(false);
+  auto contact = takeString(true);
+
+  std::vector<Record::SubdomainRef> subdomains(*take(1));
+  for (auto& subdomain : subdomains)
+  {
+    subdomain.first = takeString(false);
+    subdomain.second = takeString(false);
+  }
+
+  size_t berLen = *take(1);
+  berLen = (berLen << 8) | *take(1);
+  const uint8_t* ber = take(berLen);
+  const uint8_t* nonce = take(Const::RECORD_NONCE_LEN);
+
+  // the proof is only present if the sender's Record was valid
+  const uint8_t *pow = nullptr, *sig = nullptr;
+  if (data != end)
+  {
+    pow = take(Const::RECORD_SCRYPTED_LEN);
+    sig = take(Const::SIGNATURE_LEN);
+    if (data != end)
+      Log::get().error("Record parsing: trailing bytes after binary Record!");
+  }
+
+  if (berLen == 0 || berLen > KeyCache::MAX_DER_LEN)
+    Log::get().error("Record parsing: the key is not a RSA key!");
+
+  return std::make_shared<CreateR>(
+      contact, name, subdomains, nonce, pow, sig,
+      StringRef(reinterpret_cast<const char*>(ber), berLen));
+}
+
+
+
+// Parses and validates count Records into results, as parseRecords does,
+// returning how many of them needed scrypt.
+size_t Common::parseBatch(const std::string* jsons,
+                          size_t count,
+                          Validation* results,
+                          size_t memoryBudget,
+                          ThreadPool& pool)
+{
+  std::vector<SHA384_HASH> contents(count);
+  std::vector<uint8_t> known(count, false);
+  pool.parallelFor(0, count, [&](size_t from, size_t to)
+                   {
+                     for (size_t n = from; n < to; n++)
+                     {
+                       results[n].valid = false;
+                       try
+                       {
+                         auto r = assembleRecord(jsons[n]);
+                         contents[n] = r->getContentHash();
+
+                         ValidationCache::Outcome outcome;
+                         known[n] = restoreOutcome(r, contents[n], outcome);
+                         if (known[n])
+                           setOutcome(results[n], outcome);
+                         else
+                           r->loadKey();  // a bad key fails only this Record
+                         results[n].record = r;
+                       }
+                       catch (std::exception& e)
+                       {
+                         results[n].error = e.what();
+                       }
+                     }
+                   });
+
+  std::vector<size_t> pending;
+  for (size_t n = 0; n < count; n++)
+    if (results[n].record && !known[n])
+      pending.push_back(n);
+
+  // split the memory budget into workers of several lanes each
+  const uint64_t laneMemory = 128 * uint64_t(Const::RECORD_SCRYPT_N);
+  const size_t budgetLanes = std::max<size_t>(memoryBudget / laneMemory, 1);
+  const size_t lanes = std::min<size_t>(
+      Scrypt::getLaneCount(Const::RECORD_SCRYPT_N, 1), budgetLanes);
+  const size_t nWorkers = std::min<size_t>(pool.getThreadCount() + 1,
+                                           budgetLanes / lanes);
+
+  std::atomic<size_t> next(0);
+  pool.parallelFor(0, nWorkers, [&](size_t, size_t)
+                   {
+                     size_t first;
+                     while ((first = next.fetch_add(lanes)) < pending.size())
+                     {
+                       size_t batch = std::min(lanes, pending.size() - first);
+                       validate(results, contents.data(), &pending[first],
+                                batch);
+                     }
+                   });
+
+
+  return pending.size();
+}
+
+
+
+// reads lines into a batch until it is full or the input ends, then
+// validates the batch and reports it, reusing the strings for the next one
+size_t Common::ingest(const LineReader& readLine,
+                      const ValidationCallback& callback,
+                      size_t batchSize,
+                      size_t memoryBudget,
+                      ThreadPool& pool)
+{
+  batchSize = std::max<size_t>(batchSize, 1);
+  std::vector<std::string> lines(batchSize);
+  std::vector<Validation> results(batchSize);
+  size_t nRecords = 0, nValid = 0, nScrypted = 0;
+
+  bool more = true;
+  while (more)
   {
-    Json::Value list = rVal["subd"];
-    auto sources = list.getMemberNames();
-    for (auto source : sources)
-      subdomains.push_back(std::make_pair(source, list[source].asString()));
+    size_t count = 0;
+    while (count < batchSize && (more = readLine(lines[count])))
+    {
+      if (!lines[count].empty() && lines[count].back() == '\r')
+        lines[count].pop_back();
+      if (!lines[count].empty())
+        count++;
+    }
+
+    nScrypted += parseBatch(lines.data(), count, results.data(), memoryBudget,
+                            pool);
+    for (size_t n = 0; n < count; n++)
+    {
+      nValid += results[n].valid;
+      callback(results[n]);
+      results[n] = Validation();  // release the Record before the next batch
+    }
+
+    nRecords += count;
   }
 
-  auto key = Utils::base64ToRSA(pubHSKey);
-  return std::make_shared<CreateR>(contact, name, subdomains, nonce, pow, sig,
-                                   key);
+  LOG_NOTICE("Validated " + std::to_string(nValid) + " of " +
+             std::to_string(nRecords) + " streamed Records, " +
+             std::to_string(nRecords - nScrypted) + " without scrypt.");
+  return nRecords;
 }
 
 
 
+// validates the given results' Records together, recording the outcomes
+void Common::validate(Validation* results,
+                      const SHA384_HASH* contents,
+                      const size_t* indices,
+                      size_t count)
+{
+  Tracer::Span span("validate");
+  Record* batch[Scrypt::MAX_LANES];
+  for (size_t n = 0; n < count; n++)
+    batch[n] = results[indices[n]].record.get();
+
+  try
+  {
+    Record::computeValidity(batch, count, nullptr);
+  }
+  catch (std::exception& e)
+  {
+    for (size_t n = 0; n < count; n++)
+      results[indices[n]].error = e.what();
+    return;
+  }
+
+  for (size_t n = 0; n < count; n++)
+  {
+    const size_t index = indices[n];
+    setOutcome(results[index],
+               storeOutcome(results[index].record, contents[index]));
+  }
+}
+
+
+
+// Fully validates a Record, unless the ValidationCache already knows the
+// outcome for its exact content, throwing if it is not valid.
 void Common::checkValidity(const RecordPtr& r)
 {
-  Log::get().notice("Checking validity... ");
+  const SHA384_HASH content = r->getContentHash();
+  ValidationCache::Outcome outcome;
 
-  bool tmp = false;
-  r->computeValidity(&tmp);
+  if (restoreOutcome(r, content, outcome))
+    LOG_NOTICE("Record was validated before, skipping checks.");
+  else
+  {
+    LOG_NOTICE("Checking validity... ");
+    r->loadKey();
+    r->computeValidity();
+    outcome = storeOutcome(r, content);
+  }
 
-  if (r->hasValidSignature())
-    Log::get().notice("Record signature is valid.");
+  if (outcome.validSig)
+    LOG_NOTICE("Record signature is valid.");
   else
     Log::get().error("Bad signature on Record!");
 
-  if (r->isValid())  // todo: this does not actually check the PoW output
-    Log::get().notice("Record proof-of-work is valid.");
+  if (outcome.valid)  // todo: this does not actually check the PoW output
+    LOG_NOTICE("Record proof-of-work is valid.");
   else
     Log::get().error("Record is not valid!");
 
-  Log::get().notice("Record check complete.");
+  LOG_NOTICE("Record check complete.");
+}
+
+
+
+// looks up the outcome for the Record's received content, marking the
+// Record valid if it was; returns false if the content is not known
+bool Common::restoreOutcome(const RecordPtr& r,
+                            const SHA384_HASH& content,
+                            ValidationCache::Outcome& outcome)
+{
+  if (!ValidationCache::get().lookup(content, outcome))
+    return false;
+
+  if (outcome.valid && outcome.validSig && !r->restoreValidity(content))
+    return false;  // cannot happen for matching content, but be certain
+
+  return true;
+}
+
+
+
+// Remembers the outcome of having just validated the Record. Validation
+// recomputes the scrypt output rather than trusting the received one, so a
+// Record that arrived with a wrong one is only remembered if it failed;
+// restoring it as valid would keep the wrong output.
+ValidationCache::Outcome Common::storeOutcome(const RecordPtr& r,
+                                              const SHA384_HASH& content)
+{
+  ValidationCache::Outcome outcome;
+  outcome.valid = r->isValid();
+  outcome.validSig = r->hasValidSignature();
+
+  if (!(outcome.valid && outcome.validSig) || r->getContentHash() == content)
+    ValidationCache::get().insert(content, outcome);
+
+  return outcome;
+}
+
+
+
+void Common::setOutcome(Validation& result,
+                        const ValidationCache::Outcome& outcome)
+{
+  result.valid = outcome.valid && outcome.validSig;
+  if (!outcome.validSig)
+    result.error = "Bad signature on Record!";
+  else if (!outcome.valid)
+    result.error = "Record is not valid!";
 }
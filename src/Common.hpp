@@ -3,24 +3,114 @@
 #define COMMON_HPP
 
 #include "containers/records/Record.hpp"
+#include "containers/ValidationCache.hpp"
+#include "containers/MerkleTree.hpp"
+#include "containers/Cache.hpp"
+#include "ThreadPool.hpp"
+#include <boost/asio/ip/tcp.hpp>
 #include <json/json.h>
+#include <functional>
+#include <istream>
 #include <memory>
+#include <vector>
 
 class Common
 {
  public:
+  // the outcome of validating one Record of a batch
+  struct Validation
+  {
+    RecordPtr record;  // null if it could not be parsed
+    bool valid;
+    std::string error;
+  };
+
+  typedef std::function<void(Validation&)> ValidationCallback;
+
+  // one name's answer from a batch query
+  struct Lookup
+  {
+    std::string name;
+    RecordPtr record;         // null if no Record holds the name
+    std::string destination;  // empty if the name does not resolve
+  };
+
+  static const size_t DEFAULT_VALIDATION_BUDGET = 1024 * 1024 * 1024;
+  static const size_t DEFAULT_INGEST_BATCH = 256;
+  static const size_t MAX_RECORD_LENGTH = 128 * 1024;  // of its JSON
+  static const size_t MAX_BATCH_NAMES = 256;  // per batch query
+
   static RecordPtr parseRecord(const std::string&);
   static RecordPtr parseRecord(const Json::Value&);
+  static RecordPtr parseRecord(const std::string&, const SHA384_HASH&);
+  static std::vector<Validation> parseRecords(
+      const std::vector<std::string>&,
+      size_t memoryBudget = DEFAULT_VALIDATION_BUDGET,
+      ThreadPool& pool = ThreadPool::get());
+  static size_t ingestRecords(std::istream&,
+                              const ValidationCallback&,
+                              size_t batchSize = DEFAULT_INGEST_BATCH,
+                              size_t memoryBudget = DEFAULT_VALIDATION_BUDGET,
+                              ThreadPool& pool = ThreadPool::get());
+  static size_t ingestRecords(boost::asio::ip::tcp::socket&,
+                              const ValidationCallback&,
+                              size_t batchSize = DEFAULT_INGEST_BATCH,
+                              size_t memoryBudget = DEFAULT_VALIDATION_BUDGET,
+                              ThreadPool& pool = ThreadPool::get());
   static Json::Value toJSON(const std::string&);
   static std::string getDestination(const RecordPtr&, const std::string&);
+  static StringRef resolve(const RecordPtr&, const std::string&);
   static std::pair<bool, int> verifyRootSignature(const Json::Value&,
                                                   ED_SIGNATURE&,
                                                   const SHA384_HASH&,
                                                   const std::string&);
+  static std::vector<std::pair<bool, int>> verifyRootSignatures(
+      const std::vector<Json::Value>&,
+      std::vector<ED_SIGNATURE>&,
+      const SHA384_HASH&,
+      const std::vector<std::string>&);
+
+  static std::string makeBatchQuery(const std::vector<std::string>&);
+  static std::vector<std::string> splitBatchQuery(const std::string&);
+  static Json::Value answerBatchQuery(const std::string&,
+                                      const Cache::Snapshot&,
+                                      const MerkleTree&);
+  static std::vector<Lookup> checkBatchQuery(const Json::Value&,
+                                             const std::vector<std::string>&,
+                                             const SHA384_HASH&);
+  static std::string getOwnerName(const std::string&);
 
  private:
+  typedef std::function<bool(std::string&)> LineReader;
+
+  static bool decodeRootSignature(const Json::Value&,
+                                  const std::string&,
+                                  ED_SIGNATURE&,
+                                  ED_KEY&);
+  static RecordPtr assembleRecord(const std::string&);
   static RecordPtr assembleRecord(const Json::Value&);
+  static RecordPtr assembleRecord(const uint8_t*, size_t);
+  static size_t parseBatch(const std::string*,
+                           size_t,
+                           Validation*,
+                           size_t,
+                           ThreadPool&);
+  static size_t ingest(const LineReader&,
+                       const ValidationCallback&,
+                       size_t,
+                       size_t,
+                       ThreadPool&);
+  static void validate(Validation*,
+                       const SHA384_HASH*,
+                       const size_t*,
+                       size_t);
   static void checkValidity(const RecordPtr&);
+  static bool restoreOutcome(const RecordPtr&,
+                             const SHA384_HASH&,
+                             ValidationCache::Outcome&);
+  static ValidationCache::Outcome storeOutcome(const RecordPtr&,
+                                               const SHA384_HASH&);
+  static void setOutcome(Validation&, const ValidationCache::Outcome&);
 };
 
 #endif
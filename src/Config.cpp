@@ -1,38 +1,191 @@
 
 #include "Config.hpp"
 #include "Log.hpp"
+#include "encoding/Codec.hpp"
+#include "crypto/KeyCache.hpp"
 #include <fstream>
+#include <thread>
+#include <chrono>
 
 
 #ifndef INSTALL_PREFIX
 #error CMake has not defined INSTALL_PREFIX!
 #endif
 
+const unsigned Config::RELOAD_INTERVAL;
+
+
 
 Json::Value Config::getQuorumNode()
 {
-  return loadFile(INSTALL_PREFIX + "/lib/tor-onions/quorum.json");
+  return getQuorumNodes()->json;
 }
 
 
 
 Json::Value Config::getMirror()
 {
-  return loadFile(INSTALL_PREFIX + "/lib/tor-onions/mirrors.json");
+  return getMirrors()->json;
+}
+
+
+
+Config::SnapshotPtr Config::getQuorumNodes()
+{
+  return getQuorumResource().get();
+}
+
+
+
+Config::SnapshotPtr Config::getMirrors()
+{
+  return getMirrorResource().get();
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// never destroyed, as the watcher thread may outlive static destruction
+Config::Resource& Config::getQuorumResource()
+{
+  static Resource* quorum =
+      new Resource(INSTALL_PREFIX + "/lib/tor-onions/quorum.json");
+  startWatching();
+  return *quorum;
+}
+
+
+
+Config::Resource& Config::getMirrorResource()
+{
+  static Resource* mirrors =
+      new Resource(INSTALL_PREFIX + "/lib/tor-onions/mirrors.json");
+  startWatching();
+  return *mirrors;
+}
+
+
+
+void Config::startWatching()
+{
+  static std::once_flag started;
+  std::call_once(started, []()
+                 {
+                   std::thread([]()
+                               {
+                                 while (true)
+                                 {
+                                   std::this_thread::sleep_for(
+                                       std::chrono::seconds(RELOAD_INTERVAL));
+                                   getQuorumResource().refresh();
+                                   getMirrorResource().refresh();
+                                 }
+                               }).detach();
+                 });
 }
 
 
 
-Json::Value Config::loadFile(const std::string& path)
+Config::SnapshotPtr Config::parseFile(const std::string& path)
 {
-  Json::Value value;
+  auto snapshot = std::make_shared<Snapshot>();
 
   std::ifstream file;
   file.open(path, std::ifstream::binary);
-  if (file.is_open())
-    file >> value;
-  else
+  if (!file.is_open())
     Log::get().error("Cannot open resource " + path);
 
-  return value;
+  Json::Reader reader;
+  if (!reader.parse(file, snapshot->json) || !snapshot->json.isArray())
+    Log::get().error("Cannot parse resource " + path);
+
+  for (const auto& entry : snapshot->json)
+  {
+    Node node;
+    node.address = entry["addr"].asString();
+    node.key64 = entry["key"].asString();
+    if (Codec::base64Decode(node.key64, node.key.data(), node.key.size()) !=
+        node.key.size())
+      Log::get().error("Invalid Ed25519 key for " + node.address + " in " +
+                       path);
+    node.verifier = KeyCache::get().loadEd25519(node.key);
+
+    snapshot->nodes.push_back(node);
+  }
+
+  return snapshot;
+}
+
+
+
+Config::Resource::Resource(const std::string& path)
+    : path_(path), modified_(0), size_(0)
+{
+}
+
+
+
+// loads the file the first time, throwing if it cannot be read
+Config::SnapshotPtr Config::Resource::get()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (snapshot_)
+      return snapshot_;
+  }
+
+  struct stat status;
+  if (stat(path_.c_str(), &status) != 0)
+    status.st_mtime = status.st_size = 0;  // parseFile reports the error
+  install(parseFile(path_), status);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  return snapshot_;
+}
+
+
+
+// re-parses the file if it changed, returns true if the snapshot was replaced
+bool Config::Resource::refresh()
+{
+  struct stat status;
+  if (stat(path_.c_str(), &status) != 0)
+    return false;
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (!snapshot_ ||
+        (status.st_mtime == modified_ && status.st_size == size_))
+      return false;  // not loaded yet, or unchanged
+  }
+
+  try
+  {
+    install(parseFile(path_), status);
+  }
+  catch (std::runtime_error& e)
+  {
+    Log::get().warn("Keeping the previous " + path_ + ": " + e.what());
+    std::lock_guard<std::mutex> guard(mutex_);
+    modified_ = status.st_mtime;  // so that the warning is not repeated
+    size_ = status.st_size;
+    return false;
+  }
+
+  LOG_NOTICE("Reloaded " + path_);
+  return true;
+}
+
+
+
+void Config::Resource::install(const SnapshotPtr& snapshot,
+                               const struct stat& status)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  snapshot_ = snapshot;
+  modified_ = status.st_mtime;
+  size_ = status.st_size;
 }
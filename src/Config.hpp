@@ -1,18 +1,70 @@
-
 #ifndef CONFIG_HPP
 #define CONFIG_HPP
 
-#include <string>
+#include "Constants.hpp"
+#include "crypto/Ed25519Key.hpp"
 #include <json/json.h>
+#include <sys/stat.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <ctime>
 
+// The Quorum node and mirror lists, parsed once from INSTALL_PREFIX into
+// snapshots with their Ed25519 keys already decoded and precomputed, the
+// latter shared through the KeyCache. Reads only copy a shared pointer. A
+// background thread checks the files' modification times every
+// RELOAD_INTERVAL seconds and swaps in a new snapshot when one has changed;
+// a file that no longer parses leaves the old snapshot in place.
 class Config
 {
  public:
+  struct Node
+  {
+    std::string address;
+    std::string key64;
+    ED_KEY key;
+    Ed25519KeyPtr verifier;
+  };
+
+  struct Snapshot
+  {
+    Json::Value json;
+    std::vector<Node> nodes;
+  };
+
+  typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+  static const unsigned RELOAD_INTERVAL = 2;
+
   static Json::Value getQuorumNode();
   static Json::Value getMirror();
+  static SnapshotPtr getQuorumNodes();
+  static SnapshotPtr getMirrors();
 
  private:
-  static Json::Value loadFile(const std::string&);
+  class Resource
+  {
+   public:
+    Resource(const std::string&);
+    SnapshotPtr get();
+    bool refresh();
+
+   private:
+    void install(const SnapshotPtr&, const struct stat&);
+
+    const std::string path_;
+    std::mutex mutex_;
+    SnapshotPtr snapshot_;
+    time_t modified_;
+    off_t size_;
+  };
+
+  static Resource& getQuorumResource();
+  static Resource& getMirrorResource();
+  static void startWatching();
+  static SnapshotPtr parseFile(const std::string&);
 };
 
 #endif
@@ -2,6 +2,7 @@
 #ifndef CONSTANTS_HPP
 #define CONSTANTS_HPP
 
+#include <sys/types.h>
 #include <array>
 
 class Const
@@ -1,19 +1,50 @@
 
 #include "Log.hpp"
 #include <stdexcept>
-#include <ctime>
 #include <iostream>
+#include <cstddef>
+#include <chrono>
+
+const size_t Log::DEFAULT_QUEUE_SIZE;
+const int Log::FLUSH_INTERVAL;
 
 std::string Log::logPath_;
+std::atomic<Log::Level> Log::level_(Log::Level::Notice);
+bool Log::async_ = false;
+size_t Log::queueSize_ = Log::DEFAULT_QUEUE_SIZE;
 
 
 Log::Log()
+    : mask_(0),
+      head_(0),
+      tail_(0),
+      dropped_(0),
+      reported_(0),
+      stopping_(false),
+      cachedTime_(-1)
 {
+  cachedStr_[0] = '\0';
+
+  if (!logPath_.empty())
+    fout_.open(logPath_, std::fstream::out | std::fstream::app);
+
+  if (async_)
+  {
+    size_t size = 2;
+    while (size < queueSize_)
+      size <<= 1;
+
+    queue_.reset(new Entry[size]);
+    mask_ = size - 1;
+    for (size_t j = 0; j < size; j++)
+      queue_[j].sequence.store(j, std::memory_order_relaxed);
+
+    writer_ = std::thread(&Log::runWriter, this);
+  }
+
   if (logPath_.empty())
     return;  // don't open file
 
-  fout_.open(logPath_, std::fstream::out | std::fstream::app);
-
   if (fout_.is_open())
   {
     notice("Successfully opened log file.");
@@ -27,20 +58,40 @@ Log::Log()
 
 
 
+// writes out whatever is still queued
+Log::~Log()
+{
+  if (!writer_.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> guard(waitMutex_);
+    stopping_ = true;
+  }
+
+  wake_.notify_one();
+  writer_.join();
+}
+
+
+
 void Log::notice(const std::string& str)
 {
-  log("notice", str);
+  if (isEnabled(Level::Notice))
+    log("notice", str);
 }
 
 
 
 void Log::warn(const std::string& str)
 {
-  log("warn  ", str);
+  if (isEnabled(Level::Warn))
+    log("warn  ", str);
 }
 
 
 
+// always logged, and always throws
 void Log::error(const std::string& str)
 {
   log("error ", str);
@@ -49,27 +100,171 @@ void Log::error(const std::string& str)
 
 
 
-void Log::log(const std::string& type, const std::string& str)
+// messages that asynchronous mode has had to drop so far
+uint64_t Log::getDroppedCount() const
 {
-  std::time_t t = std::time(NULL);
-  char tStr[100];
-  std::strftime(tStr, sizeof(tStr), "%Y-%m-%d %H:%M:%S", std::localtime(&t));
+  return dropped_.load(std::memory_order_relaxed);
+}
 
-  if (fout_.is_open() || !logPath_.empty())
+
+
+void Log::setLogPath(const std::string& logPath)
+{
+  logPath_ = logPath;
+}
+
+
+
+// messages below the level are discarded; may be changed at any time
+void Log::setLevel(Level level)
+{
+  level_.store(level, std::memory_order_relaxed);
+}
+
+
+
+// like setLogPath, this only applies if called before the first get()
+void Log::setAsync(bool async, size_t queueSize)
+{
+  async_ = async;
+  queueSize_ = queueSize;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+void Log::log(const char* type, const std::string& str)
+{
+  const std::time_t t = std::time(NULL);
+  if (queue_)
   {
-    fout_ << "[" << type << " | " << tStr << "] " << str << std::endl;
-    fout_.flush();
+    enqueue(type, t, str);
+    return;
   }
-  else
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  write(type, t, str);
+  getStream().flush();
+}
+
+
+
+// Claims the next slot of the ring, or gives up if the writer has not yet
+// emptied it. A slot's sequence is its position when free and one past
+// that once filled, so producers only contend on head_.
+bool Log::enqueue(const char* type, std::time_t t, const std::string& str)
+{
+  size_t pos = head_.load(std::memory_order_relaxed);
+  Entry* entry;
+  while (true)
   {
-    std::cout << "[" << type << " | " << tStr << "] " << str << std::endl;
-    std::cout.flush();
+    entry = &queue_[pos & mask_];
+    const size_t seq = entry->sequence.load(std::memory_order_acquire);
+    const auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+    if (diff == 0)
+    {
+      if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;  // full
+    }
+    else
+      pos = head_.load(std::memory_order_relaxed);
   }
+
+  entry->type = type;
+  entry->time = t;
+  entry->message.assign(str);  // reuses the slot's capacity
+  entry->sequence.store(pos + 1, std::memory_order_release);
+  return true;
 }
 
 
 
-void Log::setLogPath(const std::string& logPath)
+// writes every filled slot in order and returns how many there were
+size_t Log::drain()
 {
-  logPath_ = logPath;
+  size_t count = 0;
+  while (true)
+  {
+    Entry& entry = queue_[tail_ & mask_];
+    if (entry.sequence.load(std::memory_order_acquire) != tail_ + 1)
+      break;
+
+    write(entry.type, entry.time, entry.message);
+    entry.sequence.store(tail_ + mask_ + 1, std::memory_order_release);
+    tail_++;
+    count++;
+  }
+
+  const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reported_)
+  {
+    write("warn  ", std::time(NULL), std::to_string(dropped - reported_) +
+                                         " log messages were dropped.");
+    reported_ = dropped;
+    count++;
+  }
+
+  return count;
+}
+
+
+
+// the asynchronous writer; flushes once per batch
+void Log::runWriter()
+{
+  while (true)
+  {
+    const bool stopping = stopping_.load();
+    if (drain() > 0)
+      getStream().flush();
+    if (stopping)
+      return;
+
+    std::unique_lock<std::mutex> lock(waitMutex_);
+    wake_.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL),
+                   [this]()
+                   {
+                     return stopping_.load();
+                   });
+  }
+}
+
+
+
+void Log::write(const char* type, std::time_t t, const std::string& str)
+{
+  getStream() << "[" << type << " | " << formatTime(t) << "] " << str << '\n';
+}
+
+
+
+// formats only when the second has changed since the last line
+const char* Log::formatTime(std::time_t t)
+{
+  if (t != cachedTime_)
+  {
+    std::tm local;
+    localtime_r(&t, &local);
+    std::strftime(cachedStr_, sizeof(cachedStr_), "%Y-%m-%d %H:%M:%S", &local);
+    cachedTime_ = t;
+  }
+
+  return cachedStr_;
+}
+
+
+
+std::ostream& Log::getStream()
+{
+  if (fout_.is_open() || !logPath_.empty())
+    return fout_;
+  return std::cout;
 }
@@ -1,32 +1,125 @@
-
 #ifndef LOG_HPP
 #define LOG_HPP
 
+#include <condition_variable>
 #include <fstream>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <thread>
+#include <mutex>
 #include <string>
+#include <ctime>
 
+// Writes timestamped lines to the log file, or to stdout if there is none.
+// By default each line is written and flushed on the caller's thread. In
+// asynchronous mode, callers only copy the message into a lock-free ring
+// and a background thread writes the lines out in batches, flushing once
+// per batch. When the ring is full, messages are dropped rather than wait,
+// and a count of them is logged once there is room again.
 class Log
 {
  public:
+  enum class Level : uint8_t
+  {
+    Notice,
+    Warn,
+    Error
+  };
+
+  static const size_t DEFAULT_QUEUE_SIZE = 4096;  // rounded up to a power of 2
+  static const int FLUSH_INTERVAL = 50;  // ms the writer sleeps when idle
+
   static Log& get()
   {
     static Log instance;
     return instance;
   }
 
+  ~Log();
+
   void notice(const std::string&);
   void warn(const std::string&);
   void error(const std::string&);
+  uint64_t getDroppedCount() const;
   static void setLogPath(const std::string&);
+  static void setLevel(Level);
+
+  // whether messages of the level are being written
+  static bool isEnabled(Level level)
+  {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+
+  static void setAsync(bool, size_t queueSize = DEFAULT_QUEUE_SIZE);
 
  private:
+  struct Entry
+  {
+    std::atomic<size_t> sequence;  // whose turn the slot is
+    const char* type;
+    std::time_t time;
+    std::string message;
+  };
+
   Log();
   Log(Log const&) = delete;
   void operator=(Log const&) = delete;
 
-  void log(const std::string&, const std::string&);
+  void log(const char*, const std::string&);
+  bool enqueue(const char*, std::time_t, const std::string&);
+  size_t drain();
+  void runWriter();
+  void write(const char*, std::time_t, const std::string&);
+  const char* formatTime(std::time_t);
+  std::ostream& getStream();
+
   std::fstream fout_;
+  std::mutex mutex_;  // keeps lines from interleaving between threads
+
+  // asynchronous mode; a bounded multi-producer ring, read by writer_ only
+  std::unique_ptr<Entry[]> queue_;
+  size_t mask_;
+  std::atomic<size_t> head_;
+  size_t tail_;
+  std::atomic<uint64_t> dropped_;
+  uint64_t reported_;
+  std::thread writer_;
+  std::atomic<bool> stopping_;
+  std::mutex waitMutex_;
+  std::condition_variable wake_;
+
+  // only touched by whichever thread writes, under mutex_ or as writer_
+  std::time_t cachedTime_;
+  char cachedStr_[32];
+
   static std::string logPath_;
+  static std::atomic<Level> level_;
+  static bool async_;
+  static size_t queueSize_;
 };
 
+// Logs a notice, but only builds the message if notices are enabled.
+// Building with ONIONS_NO_NOTICES compiles these out entirely.
+#ifdef ONIONS_NO_NOTICES
+#define LOG_NOTICES_COMPILED false
+#else
+#define LOG_NOTICES_COMPILED true
+#endif
+
+#define LOG_NOTICE(...)                                    \
+  do                                                       \
+  {                                                        \
+    if (LOG_NOTICES_COMPILED &&                            \
+        Log::isEnabled(Log::Level::Notice))                \
+      Log::get().notice(__VA_ARGS__);                      \
+  } while (false)
+
+#define LOG_WARN(...)                                      \
+  do                                                       \
+  {                                                        \
+    if (Log::isEnabled(Log::Level::Warn))                  \
+      Log::get().warn(__VA_ARGS__);                        \
+  } while (false)
+
 #endif
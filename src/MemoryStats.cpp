@@ -0,0 +1,135 @@
+
+#include "MemoryStats.hpp"
+#include "Metrics.hpp"
+#include "containers/Cache.hpp"
+#ifdef __linux__
+#include <malloc.h>
+#endif
+
+const size_t MemoryStats::NODE_OVERHEAD;
+
+// replaces any reporter already registered under the name
+void MemoryStats::setReporter(const std::string& subsystem,
+                              const Reporter& reporter)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  reporters_[subsystem] = reporter;
+}
+
+
+
+// for an owner whose structure is going away
+void MemoryStats::removeReporter(const std::string& subsystem)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  reporters_.erase(subsystem);
+}
+
+
+
+// every reporter's entries, measured now
+MemoryStats::Report MemoryStats::getReport() const
+{
+  std::map<std::string, Reporter> reporters;
+  {  // reporters take locks of their own, so call them without this one
+    std::lock_guard<std::mutex> guard(mutex_);
+    reporters = reporters_;
+  }
+
+  Report report;
+  for (const auto& entry : reporters)
+    entry.second(report);
+  return report;
+}
+
+
+
+// for programs linked against an allocator other than the C library's,
+// such as jemalloc or tcmalloc, which have statistics interfaces of their own
+void MemoryStats::setHeapHook(const HeapHook& hook)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  heapHook_ = hook;
+}
+
+
+
+bool MemoryStats::getHeapStats(HeapStats& stats) const
+{
+  HeapHook hook;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    hook = heapHook_;
+  }
+
+  return hook ? hook(stats) : getMallocStats(stats);
+}
+
+
+
+// Exports the report and the heap stats as the gauges
+// onions_memory_bytes{subsystem="..."} and onions_heap_bytes{kind="..."},
+// for calling before each scrape of the metrics.
+void MemoryStats::publish() const
+{
+  auto& metrics = Metrics::get();
+  for (const auto& entry : getReport())
+    metrics
+        .gauge("onions_memory_bytes{subsystem=\"" + entry.first + "\"}",
+               "Estimated bytes held by each subsystem.")
+        .set(entry.second);
+
+  HeapStats heap;
+  if (!getHeapStats(heap))
+    return;
+
+  const std::string HELP = "Heap bytes as the allocator reports them.";
+  metrics.gauge("onions_heap_bytes{kind=\"allocated\"}", HELP)
+      .set(heap.allocated);
+  metrics.gauge("onions_heap_bytes{kind=\"free\"}", HELP).set(heap.free);
+  metrics.gauge("onions_heap_bytes{kind=\"mapped\"}", HELP).set(heap.mapped);
+}
+
+
+
+// the heap bytes of a string beyond its own object, if it outgrew the
+// small-string buffer
+size_t MemoryStats::getStringMemoryUsage(const std::string& str)
+{
+  static const size_t INLINE = std::string().capacity();
+  return str.capacity() > INLINE ? str.capacity() + 1 : 0;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+MemoryStats::MemoryStats()
+{
+  reporters_["cache"] = [](Report& report)
+  {
+    auto usage = Cache::getMemoryUsage();
+    report["cache.records"] = usage.records;
+    report["cache.keys"] = usage.keys;
+    report["cache.strings"] = usage.strings;
+    report["cache.index"] = usage.index;
+  };
+}
+
+
+
+bool MemoryStats::getMallocStats(HeapStats& stats)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  stats.allocated = info.uordblks + info.hblkhd;
+  stats.free = info.fordblks;
+  stats.mapped = info.hblkhd;
+  return true;
+#else
+  (void)stats;
+  return false;
+#endif
+}
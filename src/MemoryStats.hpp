@@ -0,0 +1,66 @@
+#ifndef MEMORY_STATS_HPP
+#define MEMORY_STATS_HPP
+
+#include <functional>
+#include <cstddef>
+#include <string>
+#include <mutex>
+#include <map>
+
+// Reports how many bytes each subsystem holds, so that nodes can be sized
+// and cache limits set from real numbers. Subsystems are measured on
+// demand by reporters, each registered under a name and adding one or more
+// entries to the report. The Cache's is registered from the start, and
+// owners of other structures, such as a MerkleTree or a ProofCache,
+// register theirs. The heap as the allocator sees it comes
+// from mallinfo2 on glibc, or from a hook for other allocators, so the
+// subsystems can be compared with the whole. Figures are estimates from
+// container sizes and typical allocator overheads, not exact counts.
+class MemoryStats
+{
+ public:
+  typedef std::map<std::string, size_t> Report;  // bytes by subsystem
+  typedef std::function<void(Report&)> Reporter;
+
+  struct HeapStats
+  {
+    size_t allocated;  // in use by the program
+    size_t free;       // held by the allocator but not in use
+    size_t mapped;     // of the allocated bytes, those in their own mappings
+  };
+
+  // fills in the stats, returning false if the allocator cannot
+  typedef std::function<bool(HeapStats&)> HeapHook;
+
+  static MemoryStats& get()
+  {
+    static MemoryStats instance;
+    return instance;
+  }
+
+  void setReporter(const std::string&, const Reporter&);
+  void removeReporter(const std::string&);
+  Report getReport() const;
+
+  void setHeapHook(const HeapHook&);
+  bool getHeapStats(HeapStats&) const;
+
+  void publish() const;
+
+  // estimated heap overhead of a node-based container's entry
+  static const size_t NODE_OVERHEAD = 2 * sizeof(void*);
+  static size_t getStringMemoryUsage(const std::string&);
+
+ private:
+  MemoryStats();
+  MemoryStats(MemoryStats const&) = delete;
+  void operator=(MemoryStats const&) = delete;
+
+  static bool getMallocStats(HeapStats&);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Reporter> reporters_;
+  HeapHook heapHook_;
+};
+
+#endif
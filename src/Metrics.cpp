@@ -0,0 +1,251 @@
+
+#include "Metrics.hpp"
+#include "Log.hpp"
+#include <sstream>
+#include <cstdio>
+
+const size_t Metrics::Counter::STRIPES;
+const std::vector<double> Metrics::LATENCY_BOUNDS = {
+    0.00001, 0.0001, 0.001, 0.005, 0.01, 0.05, 0.1,
+    0.25,    0.5,    1,     2.5,   5,    10,   30, 60};
+
+Metrics::Counter::Counter()
+{
+  for (auto& stripe : stripes_)
+    stripe.value.store(0, std::memory_order_relaxed);
+}
+
+
+
+void Metrics::Counter::add(uint64_t n)
+{
+  stripes_[getStripe()].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+
+
+uint64_t Metrics::Counter::getValue() const
+{
+  uint64_t sum = 0;
+  for (const auto& stripe : stripes_)
+    sum += stripe.value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+
+
+Metrics::Gauge::Gauge() : value_(0)
+{
+}
+
+
+
+void Metrics::Gauge::set(double value)
+{
+  value_.store(value, std::memory_order_relaxed);
+}
+
+
+
+void Metrics::Gauge::add(double delta)
+{
+  double value = value_.load(std::memory_order_relaxed);
+  while (!value_.compare_exchange_weak(value, value + delta,
+                                       std::memory_order_relaxed))
+    ;
+}
+
+
+
+double Metrics::Gauge::getValue() const
+{
+  return value_.load(std::memory_order_relaxed);
+}
+
+
+
+// the bounds must be ascending; values above the last go to +Inf
+Metrics::Histogram::Histogram(const std::vector<double>& bounds)
+    : bounds_(bounds),
+      counts_(new std::atomic<uint64_t>[bounds.size() + 1]),
+      sum_(0)
+{
+  for (size_t j = 0; j <= bounds_.size(); j++)
+    counts_[j].store(0, std::memory_order_relaxed);
+}
+
+
+
+void Metrics::Histogram::observe(double value)
+{
+  size_t bucket = 0;
+  while (bucket < bounds_.size() && value > bounds_[bucket])
+    bucket++;
+  counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+  double sum = sum_.load(std::memory_order_relaxed);
+  while (!sum_.compare_exchange_weak(sum, sum + value,
+                                     std::memory_order_relaxed))
+    ;
+}
+
+
+
+const std::vector<double>& Metrics::Histogram::getBounds() const
+{
+  return bounds_;
+}
+
+
+
+uint64_t Metrics::Histogram::getCount(size_t bucket) const
+{
+  return counts_[bucket].load(std::memory_order_relaxed);
+}
+
+
+
+uint64_t Metrics::Histogram::getCount() const
+{
+  uint64_t count = 0;
+  for (size_t j = 0; j <= bounds_.size(); j++)
+    count += getCount(j);
+  return count;
+}
+
+
+
+double Metrics::Histogram::getSum() const
+{
+  return sum_.load(std::memory_order_relaxed);
+}
+
+
+
+// the first call with a name creates the counter; the help text is kept
+Metrics::Counter& Metrics::counter(const std::string& name,
+                                   const std::string& help)
+{
+  return *find(name, help, Type::Counter).counter;
+}
+
+
+
+Metrics::Gauge& Metrics::gauge(const std::string& name,
+                               const std::string& help)
+{
+  return *find(name, help, Type::Gauge).gauge;
+}
+
+
+
+Metrics::Histogram& Metrics::histogram(const std::string& name,
+                                       const std::string& help,
+                                       const std::vector<double>& bounds)
+{
+  return *find(name, help, Type::Histogram, bounds).histogram;
+}
+
+
+
+// every series in the Prometheus text exposition format
+std::string Metrics::exportText() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  std::ostringstream out;
+  std::string family;
+  for (const auto& entry : series_)
+  {
+    const std::string& name = entry.first;
+    const Series& series = entry.second;
+
+    const std::string base = name.substr(0, name.find('{'));
+    if (base != family)
+    {
+      static const char* TYPES[] = {"counter", "gauge", "histogram"};
+      family = base;
+      out << "# HELP " << base << " " << series.help << "\n";
+      out << "# TYPE " << base << " "
+          << TYPES[static_cast<size_t>(series.type)] << "\n";
+    }
+
+    if (series.type == Type::Counter)
+      out << name << " " << series.counter->getValue() << "\n";
+    else if (series.type == Type::Gauge)
+      out << name << " " << format(series.gauge->getValue()) << "\n";
+    else
+    {
+      const Histogram& histogram = *series.histogram;
+      const auto& bounds = histogram.getBounds();
+      uint64_t cumulative = 0;
+      for (size_t j = 0; j < bounds.size(); j++)
+      {
+        cumulative += histogram.getCount(j);
+        out << name << "_bucket{le=\"" << format(bounds[j]) << "\"} "
+            << cumulative << "\n";
+      }
+
+      cumulative += histogram.getCount(bounds.size());
+      out << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+      out << name << "_sum " << format(histogram.getSum()) << "\n";
+      out << name << "_count " << cumulative << "\n";
+    }
+  }
+
+  return out.str();
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// Each thread sticks to one stripe, handed out in turn as threads first
+// count something.
+size_t Metrics::Counter::getStripe()
+{
+  static std::atomic<size_t> next(0);
+  static thread_local size_t stripe =
+      next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+  return stripe;
+}
+
+
+
+Metrics::Series& Metrics::find(const std::string& name,
+                               const std::string& help,
+                               Type type,
+                               const std::vector<double>& bounds)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto entry = series_.find(name);
+  if (entry != series_.end())
+  {
+    if (entry->second.type != type)
+      Log::get().error("Metric " + name + " already has another type!");
+    return entry->second;
+  }
+
+  Series& series = series_[name];
+  series.type = type;
+  series.help = help;
+  if (type == Type::Counter)
+    series.counter.reset(new Counter());
+  else if (type == Type::Gauge)
+    series.gauge.reset(new Gauge());
+  else
+    series.histogram.reset(new Histogram(bounds));
+  return series;
+}
+
+
+
+std::string Metrics::format(double value)
+{
+  char str[32];
+  std::snprintf(str, sizeof(str), "%.9g", value);
+  return str;
+}
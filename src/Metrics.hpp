@@ -0,0 +1,126 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <map>
+
+// A registry of counters, gauges and histograms, exported in the
+// Prometheus text format. Instruments are created once by name and then
+// only touch atomics, so call sites keep a reference in a function-local
+// static. A name may carry Prometheus labels, such as
+// "onions_cache_lookups_total{result=\"hit\"}"; series with the same name
+// before the braces are exported as one metric. Histograms take no labels.
+class Metrics
+{
+ public:
+  // a monotonic count, spread over stripes so that threads incrementing it
+  // concurrently do not keep taking the same cache line from each other
+  class Counter
+  {
+   public:
+    static const size_t STRIPES = 16;
+
+    Counter();
+    void add(uint64_t n = 1);
+    uint64_t getValue() const;
+
+   private:
+    static size_t getStripe();
+
+    struct Stripe
+    {
+      std::atomic<uint64_t> value;
+      char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    Stripe stripes_[STRIPES];
+  };
+
+  class Gauge
+  {
+   public:
+    Gauge();
+    void set(double);
+    void add(double);
+    double getValue() const;
+
+   private:
+    std::atomic<double> value_;
+  };
+
+  // counts of observations by upper bound, along with their sum
+  class Histogram
+  {
+   public:
+    explicit Histogram(const std::vector<double>&);
+    void observe(double);
+    template <typename Duration>
+    void observeDuration(Duration duration)  // in seconds
+    {
+      observe(std::chrono::duration<double>(duration).count());
+    }
+
+    const std::vector<double>& getBounds() const;
+    uint64_t getCount(size_t) const;  // in the bucket, not cumulative
+    uint64_t getCount() const;
+    double getSum() const;
+
+   private:
+    const std::vector<double> bounds_;
+    std::unique_ptr<std::atomic<uint64_t>[]> counts_;  // one more for +Inf
+    std::atomic<double> sum_;
+  };
+
+  static const std::vector<double> LATENCY_BOUNDS;  // 10 us to 60 s
+
+  static Metrics& get()
+  {
+    static Metrics instance;
+    return instance;
+  }
+
+  Counter& counter(const std::string&, const std::string&);
+  Gauge& gauge(const std::string&, const std::string&);
+  Histogram& histogram(const std::string&,
+                       const std::string&,
+                       const std::vector<double>& bounds = LATENCY_BOUNDS);
+  std::string exportText() const;
+
+ private:
+  enum class Type : uint8_t
+  {
+    Counter,
+    Gauge,
+    Histogram
+  };
+
+  struct Series
+  {
+    Type type;
+    std::string help;
+    std::unique_ptr<Counter> counter;
+    std::unique_ptr<Gauge> gauge;
+    std::unique_ptr<Histogram> histogram;
+  };
+
+  Metrics() = default;
+  Metrics(Metrics const&) = delete;
+  void operator=(Metrics const&) = delete;
+
+  Series& find(const std::string&,
+               const std::string&,
+               Type,
+               const std::vector<double>& = LATENCY_BOUNDS);
+  static std::string format(double);
+
+  mutable std::mutex mutex_;  // guards series_, not the instruments
+  std::map<std::string, Series> series_;
+};
+
+#endif
@@ -0,0 +1,168 @@
+
+#include "ThreadPool.hpp"
+#include "WorkerPlacement.hpp"
+#include <algorithm>
+#include <exception>
+#include <memory>
+
+thread_local bool ThreadPool::isWorker_ = false;
+
+
+// 0 threads means one per hardware thread
+ThreadPool::ThreadPool(size_t nThreads) : stopping_(false)
+{
+  if (nThreads == 0)
+    nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  for (size_t n = 0; n < nThreads; n++)
+    threads_.push_back(std::thread(&ThreadPool::work, this, n));
+}
+
+
+
+// finishes any queued tasks before joining the workers
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+
+  ready_.notify_all();
+  for (auto& t : threads_)
+    t.join();
+}
+
+
+
+// the future rethrows any exception thrown by the task
+std::future<void> ThreadPool::submit(const std::function<void()>& task)
+{
+  auto packaged = std::make_shared<std::packaged_task<void()>>(task);
+  auto future = packaged->get_future();
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    tasks_.push([packaged]()
+                {
+                  (*packaged)();
+                });
+  }
+
+  ready_.notify_one();
+  return future;
+}
+
+
+
+// Splits [begin, end) into contiguous chunks of at least minChunk items,
+// runs fn(chunkBegin, chunkEnd) on each in parallel, and blocks until all
+// are done. The calling thread runs one of the chunks itself. Called from a
+// worker, the range runs serially so that workers never wait on each other.
+void ThreadPool::parallelFor(size_t begin,
+                             size_t end,
+                             const std::function<void(size_t, size_t)>& fn,
+                             size_t minChunk)
+{
+  if (begin >= end)
+    return;
+
+  const size_t count = end - begin;
+  const size_t maxChunks = (threads_.size() + 1) * 4;
+  const size_t nChunks = std::min(
+      maxChunks, std::max<size_t>(count / std::max<size_t>(minChunk, 1), 1));
+
+  if (nChunks == 1 || threads_.empty() || isWorkerThread())
+  {
+    fn(begin, end);
+    return;
+  }
+
+  // the tasks hold fn and whatever it refers to, so every one of them must
+  // finish before an exception leaves this frame
+  const size_t chunkSize = (count + nChunks - 1) / nChunks;
+  std::vector<std::future<void>> futures;
+  std::exception_ptr error;
+  try
+  {
+    for (size_t from = begin + chunkSize; from < end; from += chunkSize)
+    {
+      const size_t to = std::min(from + chunkSize, end);
+      futures.push_back(submit([&fn, from, to]()
+                               {
+                                 fn(from, to);
+                               }));
+    }
+
+    fn(begin, std::min(begin + chunkSize, end));
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+
+  for (auto& f : futures)
+  {
+    try
+    {
+      f.get();
+    }
+    catch (...)
+    {
+      if (!error)
+        error = std::current_exception();
+    }
+  }
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+
+
+size_t ThreadPool::getThreadCount() const
+{
+  return threads_.size();
+}
+
+
+
+bool ThreadPool::isWorkerThread()
+{
+  return isWorker_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// pinned first, if there is a WorkerPlacement, so that what the worker maps
+// later comes from its own node
+void ThreadPool::work(size_t index)
+{
+  isWorker_ = true;
+  WorkerPlacement::pin(index);
+
+  while (true)
+  {
+    std::function<void()> task;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [this]()
+                  {
+                    return stopping_ || !tasks_.empty();
+                  });
+
+      if (tasks_.empty())
+        return;  // stopping, and nothing is left to do
+
+      task = std::move(tasks_.front());
+      tasks_.pop();
+    }
+
+    task();
+  }
+}
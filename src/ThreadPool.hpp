@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <thread>
+#include <vector>
+#include <queue>
+#include <mutex>
+
+// Fixed-size pool of worker threads that run submitted tasks in FIFO order.
+// Workers are pinned according to the WorkerPlacement when they start.
+class ThreadPool
+{
+ public:
+  static ThreadPool& get()
+  {
+    static ThreadPool instance;
+    return instance;
+  }
+
+  ThreadPool(size_t nThreads = 0);
+  ~ThreadPool();
+
+  std::future<void> submit(const std::function<void()>&);
+  void parallelFor(size_t,
+                   size_t,
+                   const std::function<void(size_t, size_t)>&,
+                   size_t minChunk = 1);
+  size_t getThreadCount() const;
+  static bool isWorkerThread();
+
+ private:
+  ThreadPool(ThreadPool const&) = delete;
+  void operator=(ThreadPool const&) = delete;
+
+  void work(size_t);
+
+  std::vector<std::thread> threads_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  bool stopping_;
+
+  static thread_local bool isWorker_;
+};
+
+#endif
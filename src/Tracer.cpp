@@ -0,0 +1,184 @@
+
+#include "Tracer.hpp"
+#include <algorithm>
+
+const size_t Tracer::CAPACITY;
+std::atomic<bool> Tracer::enabled_(false);
+thread_local uint64_t Tracer::current_ = 0;
+
+Tracer::Span::Span(const char* name) : name_(name), active_(isEnabled())
+{
+  if (active_)
+    start_ = Clock::now();
+}
+
+
+
+Tracer::Span::~Span()
+{
+  if (active_)
+    Tracer::get().record(name_, start_, Clock::now());
+}
+
+
+
+Tracer::Context::Context()
+    : previous_(current_),
+      request_(current_ != 0 ? current_
+                             : Tracer::get().nextRequest_.fetch_add(
+                                   1, std::memory_order_relaxed))
+{
+  current_ = request_;
+}
+
+
+
+Tracer::Context::Context(uint64_t request)
+    : previous_(current_), request_(request)
+{
+  current_ = request_;
+}
+
+
+
+Tracer::Context::~Context()
+{
+  current_ = previous_;
+}
+
+
+
+uint64_t Tracer::Context::getRequest() const
+{
+  return request_;
+}
+
+
+
+void Tracer::setEnabled(bool enabled)
+{
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+
+
+uint64_t Tracer::getCurrentRequest()
+{
+  return current_;
+}
+
+
+
+// Every span still held, as complete ("X") events with microsecond times
+// and the request in their args:
+//   {"traceEvents": [{"name", "cat", "ph", "ts", "dur", "pid", "tid",
+//                     "args": {"request"}}, ...]}
+Json::Value Tracer::exportChromeTrace() const
+{
+  std::vector<std::pair<Entry, uint32_t>> all;
+  {
+    std::lock_guard<std::mutex> guard(buffersMutex_);
+    for (const auto& buffer : buffers_)
+    {
+      std::lock_guard<std::mutex> bufferGuard(buffer->mutex);
+      for (const auto& entry : buffer->entries)
+        all.push_back(std::make_pair(entry, buffer->thread));
+    }
+  }
+
+  std::sort(all.begin(), all.end(),
+            [](const std::pair<Entry, uint32_t>& a,
+               const std::pair<Entry, uint32_t>& b)
+            {
+              return a.first.start < b.first.start;
+            });
+
+  Json::Value events(Json::arrayValue);
+  for (const auto& span : all)
+  {
+    Json::Value event;
+    event["name"] = span.first.name;
+    event["cat"] = "onions";
+    event["ph"] = "X";
+    event["ts"] = static_cast<double>(span.first.start) / 1000;
+    event["dur"] = static_cast<double>(span.first.duration) / 1000;
+    event["pid"] = 1;
+    event["tid"] = span.second;
+    if (span.first.request != 0)
+      event["args"]["request"] = static_cast<Json::UInt64>(span.first.request);
+    events.append(event);
+  }
+
+  Json::Value trace;
+  trace["traceEvents"] = events;
+  trace["displayTimeUnit"] = "ms";
+  return trace;
+}
+
+
+
+void Tracer::clear()
+{
+  std::lock_guard<std::mutex> guard(buffersMutex_);
+  for (const auto& buffer : buffers_)
+  {
+    std::lock_guard<std::mutex> bufferGuard(buffer->mutex);
+    buffer->entries.clear();
+    buffer->next = 0;
+  }
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Tracer::Tracer() : epoch_(Clock::now()), nextRequest_(1)
+{
+}
+
+
+
+// once the thread's ring is full, the oldest span is overwritten
+void Tracer::record(const char* name, Clock::time_point start,
+                    Clock::time_point end)
+{
+  Entry entry;
+  entry.name = name;
+  entry.request = current_;
+  entry.start =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(start - epoch_)
+          .count();
+  entry.duration =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count();
+
+  Buffer& buffer = getLocalBuffer();
+  std::lock_guard<std::mutex> guard(buffer.mutex);
+  if (buffer.entries.size() < CAPACITY)
+    buffer.entries.push_back(entry);
+  else
+  {
+    buffer.entries[buffer.next] = entry;
+    buffer.next = (buffer.next + 1) % CAPACITY;
+  }
+}
+
+
+
+Tracer::Buffer& Tracer::getLocalBuffer()
+{
+  static thread_local std::shared_ptr<Buffer> local;
+  if (!local)
+  {
+    local = std::make_shared<Buffer>();
+    local->next = 0;
+
+    std::lock_guard<std::mutex> guard(buffersMutex_);
+    local->thread = static_cast<uint32_t>(buffers_.size());
+    buffers_.push_back(local);
+  }
+
+  return *local;
+}
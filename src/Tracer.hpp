@@ -0,0 +1,108 @@
+#ifndef TRACER_HPP
+#define TRACER_HPP
+
+#include <json/json.h>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+// Timed spans of a request's stages, such as the SOCKS handshake, the round
+// trip, parsing, proof generation and signature checks. A Span times its
+// own scope and is recorded against the request of its thread's current
+// Context. Each thread keeps its latest spans in a ring of its own, so
+// recording only takes an uncontended lock. Tracing is off by default, and
+// a disabled Span costs one relaxed load. exportChromeTrace() produces the
+// Chrome trace event format, which Perfetto and chrome://tracing load.
+class Tracer
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  static const size_t CAPACITY = 1 << 14;  // spans kept per thread
+
+  class Span
+  {
+   public:
+    explicit Span(const char*);  // the name must outlive the Tracer
+    ~Span();
+
+   private:
+    Span(const Span&) = delete;
+    void operator=(const Span&) = delete;
+
+    const char* name_;
+    bool active_;
+    Clock::time_point start_;
+  };
+
+  // While in scope, spans on this thread belong to the request. Without
+  // one, it continues the thread's current request or starts a new one.
+  // Passing a request's ID carries it over to another thread.
+  class Context
+  {
+   public:
+    Context();
+    explicit Context(uint64_t);
+    ~Context();
+    uint64_t getRequest() const;
+
+   private:
+    Context(const Context&) = delete;
+    void operator=(const Context&) = delete;
+
+    uint64_t previous_, request_;
+  };
+
+  static Tracer& get()
+  {
+    static Tracer instance;
+    return instance;
+  }
+
+  static void setEnabled(bool);
+  static bool isEnabled()
+  {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  static uint64_t getCurrentRequest();  // 0 outside of any Context
+  Json::Value exportChromeTrace() const;
+  void clear();
+
+ private:
+  struct Entry
+  {
+    const char* name;
+    uint64_t request;
+    int64_t start, duration;  // ns, start since epoch_
+  };
+
+  struct Buffer
+  {
+    std::mutex mutex;
+    uint32_t thread;  // numbered as threads first record a span
+    std::vector<Entry> entries;
+    size_t next;  // where the next entry goes once the ring is full
+  };
+
+  Tracer();
+  Tracer(Tracer const&) = delete;
+  void operator=(Tracer const&) = delete;
+
+  void record(const char*, Clock::time_point, Clock::time_point);
+  Buffer& getLocalBuffer();
+
+  const Clock::time_point epoch_;
+  std::atomic<uint64_t> nextRequest_;
+
+  mutable std::mutex buffersMutex_;
+  std::vector<std::shared_ptr<Buffer>> buffers_;  // by thread, kept on exit
+
+  static std::atomic<bool> enabled_;
+  static thread_local uint64_t current_;  // the thread's request
+};
+
+#endif
@@ -1,12 +1,13 @@
 
 #include "Utils.hpp"
 #include "Log.hpp"
+#include "crypto/SignaturePool.hpp"
+#include "crypto/KeyCache.hpp"
+#include "encoding/Codec.hpp"
 #include <botan/pem.h>
-#include <botan/base64.h>
-#include <botan/auto_rng.h>
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
-#include <sstream>
 
 
 bool Utils::parse(const poptContext& pc)
@@ -62,8 +63,8 @@ char* Utils::getAsHex(const uint8_t* data, int len)
   char* hexStr = new char[len * 2 + 3];
   hexStr[0] = '0';
   hexStr[1] = 'x';
-  for (int i = 0; i < len; i++)
-    sprintf(&hexStr[i * 2 + 2], "%02x", data[i]);
+  Codec::hexEncode(data, len, hexStr + 2);
+  hexStr[len * 2 + 2] = '\0';
   return hexStr;
 }
 
@@ -132,41 +133,35 @@ std::string Utils::trimString(const std::string& str)
 
 
 
-Botan::RSA_PublicKey* Utils::base64ToRSA(const std::string& base64)
+// returns the interned key, shared with every other Record that carries it
+std::shared_ptr<Botan::RSA_PublicKey> Utils::base64ToRSA(
+    const std::string& base64)
 {
-  // decode public key
-  unsigned long expectedSize = decode64Estimation(base64.length());
-  uint8_t* keyBuffer = new uint8_t[expectedSize];
-  size_t len = Botan::base64_decode(keyBuffer, base64, false);
-
-  // interpret and parse into public RSA key
-  std::istringstream iss(std::string(reinterpret_cast<char*>(keyBuffer), len));
-  Botan::DataSource_Stream keyStream(iss);
-  return dynamic_cast<Botan::RSA_PublicKey*>(Botan::X509::load_key(keyStream));
+  return KeyCache::get().loadBase64(base64.data(), base64.size());
 }
 
 
 
 Botan::RSA_PrivateKey* Utils::loadKey(const std::string& filename)
 {
-  static Botan::AutoSeeded_RNG rng;
+  auto& rng = SignaturePool::getRNG();
 
   try
   {
     // attempt reading key as standardized PKCS8 format
-    Log::get().notice("Opening HS key... ");
+    LOG_NOTICE("Opening HS key... ");
 
     auto pvtKey = Botan::PKCS8::load_key(filename, rng);
     auto rsaKey = dynamic_cast<Botan::RSA_PrivateKey*>(pvtKey);
     if (!rsaKey)
       Log::get().error("The loaded key is not a RSA key!");
 
-    Log::get().notice("Read PKCS8-formatted RSA key.");
+    LOG_NOTICE("Read PKCS8-formatted RSA key.");
     return rsaKey;
   }
   catch (const Botan::Decoding_Error&)
   {
-    Log::get().notice("Read OpenSSL-formatted RSA key.");
+    LOG_NOTICE("Read OpenSSL-formatted RSA key.");
     return Utils::loadOpenSSLRSA(filename, rng);
   }
   catch (const Botan::Stream_IO_Error& err)
@@ -215,11 +210,10 @@ Botan::RSA_PrivateKey* Utils::loadOpenSSLRSA(const std::string& filename,
 // an even number of [0-9a-f] characters, and target to be sufficiently large
 void Utils::hex2bin(const uint8_t* src, uint8_t* target)
 {  // https://stackoverflow.com/questions/17261798/
-  while (*src && src[1])
-  {
-    *(target++) = char2int(*src) * 16 + char2int(src[1]);
-    src += 2;
-  }
+  auto hex = reinterpret_cast<const char*>(src);
+  size_t length = std::strlen(hex) & ~size_t(1);  // an odd last digit is ignored
+  if (Codec::hexDecode(hex, length, target, length / 2) == Codec::INVALID)
+    Log::get().error("Invalid character");
 }
 
 
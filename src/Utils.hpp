@@ -5,6 +5,7 @@
 #include <botan/rsa.h>
 #include <popt.h>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 class Utils
@@ -24,7 +25,7 @@ class Utils
   static bool strBeginsWith(const std::string&, const std::string&);
   static std::string trimString(const std::string&);
 
-  static Botan::RSA_PublicKey* base64ToRSA(const std::string&);
+  static std::shared_ptr<Botan::RSA_PublicKey> base64ToRSA(const std::string&);
   static Botan::RSA_PrivateKey* loadKey(const std::string&);
   static Botan::RSA_PrivateKey* loadOpenSSLRSA(const std::string&,
                                                Botan::RandomNumberGenerator&);
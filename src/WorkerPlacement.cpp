@@ -0,0 +1,270 @@
+
+#include "WorkerPlacement.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include <cstdlib>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define MPOL_PREFERRED_MODE 1  // from linux/mempolicy.h
+#define MAX_CPUS 1024          // as in a cpu_set_t
+#define NODE_DIRECTORY "/sys/devices/system/node/"
+
+static WorkerPlacement::PlanPtr plan_ =
+    std::make_shared<WorkerPlacement::Plan>();
+static thread_local int node_ = -1;  // of the calling thread, once pinned
+
+
+// Replaces the placement, which then applies to workers as they start;
+// returns false, leaving the old one in place, if the string is malformed
+// or names a CPU that does not exist.
+bool WorkerPlacement::configure(const std::string& spec)
+{
+  auto plan = std::make_shared<Plan>();
+  if (!parse(spec, *plan))
+  {
+    Log::get().warn("Invalid worker placement \"" + spec + "\"");
+    return false;
+  }
+
+  std::atomic_store(&plan_, PlanPtr(plan));
+  if (!plan->empty())
+    LOG_NOTICE("Worker placement: " + describe(*plan));
+  return true;
+}
+
+
+
+WorkerPlacement::PlanPtr WorkerPlacement::getPlan()
+{
+  return std::atomic_load(&plan_);
+}
+
+
+
+// Pins the calling thread to the given worker's CPU and remembers its node.
+// Returns false if there is no placement or the CPU could not be used.
+bool WorkerPlacement::pin(size_t worker)
+{
+  const auto plan = getPlan();
+  if (plan->empty())
+    return false;
+
+  const Slot& slot = (*plan)[worker % plan->size()];
+
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(slot.cpu, &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+  {
+    Log::get().warn("Cannot pin worker " + std::to_string(worker) +
+                    " to CPU " + std::to_string(slot.cpu));
+    return false;
+  }
+
+  node_ = slot.node;
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+
+// the node that the calling thread's memory should come from, or -1 if the
+// thread was not pinned
+int WorkerPlacement::getNode()
+{
+  return node_;
+}
+
+
+
+// Asks the kernel to place the pages of the mapping on the node when they
+// are first touched, falling back to other nodes when that one is full.
+bool WorkerPlacement::bindMemory(void* memory, size_t length, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+  unsigned long mask[16] = {};
+  const size_t BITS = 8 * sizeof(unsigned long);
+  if (node < 0 || static_cast<size_t>(node) >= BITS * 16)
+    return false;
+
+  mask[node / BITS] = 1UL << (node % BITS);
+  return syscall(SYS_mbind, memory, length, MPOL_PREFERRED_MODE, mask,
+                 BITS * 16 + 1, 0) == 0;
+#else
+  return false;
+#endif
+}
+
+
+
+size_t WorkerPlacement::getNodeCount()
+{
+  size_t count = 0;
+  while (std::ifstream(NODE_DIRECTORY "node" + std::to_string(count) +
+                       "/cpulist"))
+    count++;
+
+  return std::max<size_t>(count, 1);
+}
+
+
+
+// the CPUs of the node, in order; every CPU is on node 0 without NUMA
+std::vector<int> WorkerPlacement::getNodeCpus(int node)
+{
+  std::vector<int> cpus;
+  std::string list;
+  std::ifstream file(NODE_DIRECTORY "node" + std::to_string(node) +
+                     "/cpulist");
+  if (file && std::getline(file, list) && parseCpus(list, cpus))
+    return cpus;
+
+  cpus.clear();
+  if (node == 0)
+    for (unsigned c = 0; c < std::max(std::thread::hardware_concurrency(), 1u);
+         c++)
+      cpus.push_back(static_cast<int>(c));
+  return cpus;
+}
+
+
+
+// or -1 if no node has the CPU
+int WorkerPlacement::getNodeOfCpu(int cpu)
+{
+  const size_t nodes = getNodeCount();
+  for (size_t n = 0; n < nodes; n++)
+    for (int c : getNodeCpus(static_cast<int>(n)))
+      if (c == cpu)
+        return static_cast<int>(n);
+
+  return -1;
+}
+
+
+
+// one "worker: cpu@node" entry per worker
+std::string WorkerPlacement::describe(const Plan& plan)
+{
+  std::string text;
+  for (size_t w = 0; w < plan.size(); w++)
+    text += (w > 0 ? ", " : "") + std::to_string(w) + ": " +
+            std::to_string(plan[w].cpu) + "@" + std::to_string(plan[w].node);
+  return text;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+bool WorkerPlacement::parse(const std::string& spec, Plan& plan)
+{
+  if (spec.empty())
+    return true;
+
+  if (spec == "auto")
+  {  // worker j on node j mod nodes, taking that node's CPUs in order
+    std::vector<std::vector<int>> cpus;
+    for (size_t n = 0; n < getNodeCount(); n++)
+      cpus.push_back(getNodeCpus(static_cast<int>(n)));
+
+    for (size_t round = 0;; round++)
+    {
+      bool any = false;
+      for (size_t n = 0; n < cpus.size(); n++)
+        if (round < cpus[n].size())
+        {
+          plan.push_back({cpus[n][round], static_cast<int>(n)});
+          any = true;
+        }
+
+      if (!any)
+        break;
+    }
+
+    return !plan.empty();
+  }
+
+  size_t start = 0;
+  while (start <= spec.size())
+  {
+    size_t end = spec.find(',', start);
+    if (end == std::string::npos)
+      end = spec.size();
+    const std::string entry = spec.substr(start, end - start);
+    start = end + 1;
+
+    const size_t at = entry.find('@');
+    std::vector<int> cpus;
+    int node = -1;
+    if (!parseCpus(entry.substr(0, at), cpus) ||
+        (at != std::string::npos && !parseNumber(entry.substr(at + 1), node)))
+      return false;
+
+    for (int cpu : cpus)
+    {
+      const int own = getNodeOfCpu(cpu);
+      if (own < 0)
+        return false;
+      plan.push_back({cpu, node < 0 ? own : node});
+    }
+  }
+
+  return true;
+}
+
+
+
+// a list such as "0-3,8,10-11", as in sysfs
+bool WorkerPlacement::parseCpus(const std::string& list, std::vector<int>& cpus)
+{
+  size_t start = 0;
+  while (start <= list.size())
+  {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos)
+      end = list.size();
+    const std::string range = list.substr(start, end - start);
+    start = end + 1;
+
+    const size_t dash = range.find('-');
+    int first, last;
+    if (!parseNumber(range.substr(0, dash), first))
+      return false;
+    last = first;
+    if (dash != std::string::npos && !parseNumber(range.substr(dash + 1), last))
+      return false;
+    if (last < first || last >= MAX_CPUS)
+      return false;
+
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+
+  return !cpus.empty();
+}
+
+
+
+bool WorkerPlacement::parseNumber(const std::string& text, int& number)
+{
+  if (text.empty() || text.size() > 6 ||
+      text.find_first_not_of("0123456789") != std::string::npos)
+    return false;
+
+  number = std::atoi(text.c_str());
+  return true;
+}
@@ -0,0 +1,47 @@
+#ifndef WORKER_PLACEMENT_HPP
+#define WORKER_PLACEMENT_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Pins ThreadPool workers to cores and tells each worker which NUMA node
+// its memory should come from, so that a worker's scrypt scratch, 128 MiB
+// at the Record parameters, is local to the core reading it at random. The
+// placement is configured as a string, one entry per worker, separated by
+// commas: a CPU number or a range of them, "a-b", giving one worker per
+// CPU, each of which may end with "@node" to take memory from another node
+// than the CPU's own. "auto" spreads workers over the NUMA nodes in turn,
+// one per CPU, and "" turns placement off, which is the default. Workers
+// past the end of the list wrap around to its start. The topology is read
+// from sysfs; elsewhere, or without NUMA, everything is on node 0.
+class WorkerPlacement
+{
+ public:
+  struct Slot
+  {
+    int cpu;
+    int node;  // for memory
+  };
+
+  typedef std::vector<Slot> Plan;
+  typedef std::shared_ptr<const Plan> PlanPtr;
+
+  static bool configure(const std::string&);
+  static PlanPtr getPlan();
+  static bool pin(size_t);
+  static int getNode();
+  static bool bindMemory(void*, size_t, int);
+
+  static size_t getNodeCount();
+  static std::vector<int> getNodeCpus(int);
+  static int getNodeOfCpu(int);
+  static std::string describe(const Plan&);
+
+ private:
+  static bool parse(const std::string&, Plan&);
+  static bool parseCpus(const std::string&, std::vector<int>&);
+  static bool parseNumber(const std::string&, int&);
+};
+
+#endif
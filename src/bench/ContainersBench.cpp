@@ -0,0 +1,128 @@
+
+#include "Fixtures.hpp"
+#include "../Common.hpp"
+#include "../containers/Cache.hpp"
+#include "../containers/MerkleTree.hpp"
+#include "../containers/ValidationCache.hpp"
+#include <benchmark/benchmark.h>
+
+// sizes of the Cache and of the Merkle tree, 10^3 to 10^6
+static void recordCounts(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->RangeMultiplier(10)->Range(1000, 1000000);
+}
+
+
+
+
+// one Record more than the Cache holds, taken out again untimed
+static void BM_CacheAdd(benchmark::State& state)
+{
+  const size_t count = Fixtures::fillCache(state.range(0));
+  const RecordPtr extra = Fixtures::getRecords(count + 1).back();
+
+  for (auto _ : state)
+  {
+    Cache::add(extra);
+    state.PauseTiming();
+    Cache::remove(extra->getName());
+    state.ResumeTiming();
+  }
+
+  state.counters["records"] = count;
+}
+BENCHMARK(BM_CacheAdd)->Apply(recordCounts);
+
+
+
+static void BM_CacheGet(benchmark::State& state)
+{
+  const size_t count = Fixtures::fillCache(state.range(0));
+
+  std::vector<std::string> names;
+  for (size_t n = 0; n < 4096; n++)
+    names.push_back(Fixtures::makeName(n * 7919 % count));
+
+  size_t n = 0;
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Cache::get(names[n++ % names.size()]));
+
+  state.counters["records"] = count;
+}
+BENCHMARK(BM_CacheGet)->Apply(recordCounts);
+
+
+
+static void BM_MerkleTreeBuild(benchmark::State& state)
+{
+  const auto records = Fixtures::getRecords(state.range(0));
+
+  for (auto _ : state)
+  {
+    MerkleTree tree(records);
+    benchmark::DoNotOptimize(tree.getRootHash());
+  }
+
+  state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_MerkleTreeBuild)->Apply(recordCounts)->Unit(benchmark::kMillisecond);
+
+
+
+static void BM_MerkleTreeGenerateSubtree(benchmark::State& state)
+{
+  const auto records = Fixtures::getRecords(state.range(0));
+  const MerkleTree tree(records);
+
+  size_t n = 0;
+  for (auto _ : state)
+  {
+    const std::string name = records[n++ * 7919 % records.size()]->getName();
+    benchmark::DoNotOptimize(tree.generateSubtree(name));
+  }
+}
+BENCHMARK(BM_MerkleTreeGenerateSubtree)->Apply(recordCounts);
+
+
+
+// the hash is memoized, so changing the contact clears it each time
+static void BM_RecordGetHash(benchmark::State& state)
+{
+  const RecordPtr record = Fixtures::getRecords(1).front();
+
+  for (auto _ : state)
+  {
+    record->setContact("");
+    benchmark::DoNotOptimize(record->getHash());
+  }
+}
+BENCHMARK(BM_RecordGetHash);
+
+
+
+static void BM_RecordAsJSON(benchmark::State& state)
+{
+  const RecordPtr record = Fixtures::getRecords(1).front();
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(record->asJSON());
+}
+BENCHMARK(BM_RecordAsJSON);
+
+
+
+// A mirror sends Records whose content was mostly validated before, so the
+// outcome is known to the ValidationCache here; BM_ScryptRecord gives the
+// cost of the first sighting.
+static void BM_CommonParseRecord(benchmark::State& state)
+{
+  const RecordPtr record = Fixtures::getRecords(1).front();
+  const std::string json = record->asJSON();
+  ValidationCache::get().insert(record->getContentHash(), {true, true});
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Common::parseRecord(json));
+
+  state.SetBytesProcessed(state.iterations() * json.size());
+}
+BENCHMARK(BM_CommonParseRecord);
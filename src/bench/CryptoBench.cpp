@@ -0,0 +1,134 @@
+
+#include "../Constants.hpp"
+#include "../crypto/ed25519.h"
+#include "../pow/Scrypt.hpp"
+#include <libscrypt/libscrypt.h>
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// one Record's proof-of-work hash at the production parameters
+static void BM_LibscryptScrypt(benchmark::State& state)
+{
+  uint8_t input[64] = {0}, salt[Const::RECORD_SCRYPT_SALT_LEN] = {0};
+  uint8_t output[Const::RECORD_SCRYPTED_LEN];
+
+  for (auto _ : state)
+  {
+    input[0]++;
+    libscrypt_scrypt(input, sizeof(input), salt, sizeof(salt),
+                     Const::RECORD_SCRYPT_N, 1, Const::RECORD_SCRYPT_P,
+                     output, sizeof(output));
+    benchmark::DoNotOptimize(output);
+  }
+}
+BENCHMARK(BM_LibscryptScrypt)->Unit(benchmark::kMillisecond);
+
+
+
+// the same through the library's own kernels, as Records are validated
+static void BM_ScryptRecord(benchmark::State& state)
+{
+  uint8_t input[64] = {0}, salt[Const::RECORD_SCRYPT_SALT_LEN] = {0};
+  uint8_t output[Const::RECORD_SCRYPTED_LEN];
+
+  for (auto _ : state)
+  {
+    input[0]++;
+    Scrypt::compute(input, sizeof(input), salt, sizeof(salt),
+                    Const::RECORD_SCRYPT_N, 1, Const::RECORD_SCRYPT_P, output,
+                    sizeof(output));
+    benchmark::DoNotOptimize(output);
+  }
+
+  state.SetLabel(Scrypt::getName(Scrypt::getKernel()));
+}
+BENCHMARK(BM_ScryptRecord)->Unit(benchmark::kMillisecond);
+
+
+
+// signatures by one key on distinct 48-byte messages, as on Merkle roots
+struct Signatures
+{
+  explicit Signatures(size_t count) : messages(count), signatures(count)
+  {
+    ed25519_secret_key secret = {1};
+    ed25519_publickey(secret, key);
+    for (size_t n = 0; n < count; n++)
+    {
+      messages[n].fill(static_cast<uint8_t>(n));
+      ed25519_sign(messages[n].data(), messages[n].size(), secret, key,
+                   signatures[n].data());
+    }
+  }
+
+  ed25519_public_key key;
+  std::vector<SHA384_HASH> messages;
+  std::vector<ED_SIGNATURE> signatures;
+};
+
+
+
+static void BM_Ed25519SignOpen(benchmark::State& state)
+{
+  const Signatures sigs(64);
+
+  size_t n = 0;
+  for (auto _ : state)
+  {
+    const size_t j = n++ % sigs.messages.size();
+    benchmark::DoNotOptimize(
+        ed25519_sign_open(sigs.messages[j].data(), sigs.messages[j].size(),
+                          sigs.key, sigs.signatures[j].data()));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Ed25519SignOpen);
+
+
+
+static void BM_Ed25519SignOpenPrecomputed(benchmark::State& state)
+{
+  const Signatures sigs(64);
+  static ed25519_precomputed_key table;
+  ed25519_precompute_public_key(sigs.key, &table);
+
+  size_t n = 0;
+  for (auto _ : state)
+  {
+    const size_t j = n++ % sigs.messages.size();
+    benchmark::DoNotOptimize(ed25519_sign_open_precomputed(
+        sigs.messages[j].data(), sigs.messages[j].size(), sigs.key, &table,
+        sigs.signatures[j].data()));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Ed25519SignOpenPrecomputed);
+
+
+
+static void BM_Ed25519SignOpenBatch(benchmark::State& state)
+{
+  const size_t count = state.range(0);
+  const Signatures sigs(count);
+
+  std::vector<const uint8_t*> messages, keys, signatures;
+  std::vector<size_t> lengths;
+  for (size_t n = 0; n < count; n++)
+  {
+    messages.push_back(sigs.messages[n].data());
+    lengths.push_back(sigs.messages[n].size());
+    keys.push_back(sigs.key);
+    signatures.push_back(sigs.signatures[n].data());
+  }
+
+  std::vector<int> valid(count);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        ed25519_sign_open_batch(messages.data(), lengths.data(), keys.data(),
+                                signatures.data(), count, valid.data()));
+
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_Ed25519SignOpenBatch)->RangeMultiplier(4)->Range(4, 256);
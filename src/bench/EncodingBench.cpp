@@ -0,0 +1,41 @@
+
+#include "../encoding/Codec.hpp"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// from a Record's 16-byte scrypt output up to a whole response
+static void encodedSizes(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->RangeMultiplier(16)->Range(16, 64 * 1024);
+}
+
+
+
+static void BM_Base64Encode(benchmark::State& state)
+{
+  const std::vector<uint8_t> bytes(state.range(0), 0xA5);
+  std::vector<char> text(Codec::base64Length(bytes.size()));
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        Codec::base64Encode(bytes.data(), bytes.size(), text.data()));
+
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_Base64Encode)->Apply(encodedSizes);
+
+
+
+static void BM_Base64Decode(benchmark::State& state)
+{
+  const std::vector<uint8_t> bytes(state.range(0), 0xA5);
+  const std::string text = Codec::base64Encode(bytes.data(), bytes.size());
+  std::vector<uint8_t> decoded(bytes.size());
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Codec::base64Decode(
+        text.data(), text.size(), decoded.data(), decoded.size()));
+
+  state.SetBytesProcessed(state.iterations() * bytes.size());
+}
+BENCHMARK(BM_Base64Decode)->Apply(encodedSizes);
@@ -0,0 +1,74 @@
+
+#include "Fixtures.hpp"
+#include "../Constants.hpp"
+#include "../containers/Cache.hpp"
+#include "../containers/StringArena.hpp"
+#include "../containers/records/CreateR.hpp"
+#include <botan/rsa.h>
+#include <botan/auto_rng.h>
+#include <cstdio>
+
+static const size_t ARENA_CHUNK_SIZE = 1024 * 1024;
+
+// names sort in the order of their numbers, as MerkleTree needs
+std::string Fixtures::makeName(size_t n)
+{
+  char name[32];
+  snprintf(name, sizeof(name), "name%08zu.tor", n);
+  return name;
+}
+
+
+
+// the first count Records, making more as needed
+std::vector<RecordPtr> Fixtures::getRecords(size_t count)
+{
+  static std::vector<RecordPtr> records;
+  static StringArenaPtr arena;
+
+  NameList subdomains;
+  subdomains.push_back(std::make_pair("www", "abcdefghijklmnop.onion"));
+
+  records.reserve(count);
+  while (records.size() < count)
+  {
+    if (records.size() % 1024 == 0)
+      arena = std::make_shared<StringArena>(ARENA_CHUNK_SIZE);
+
+    auto record = std::make_shared<CreateR>(
+        "", makeName(records.size()), subdomains, "AAAAAA==",
+        "AAAAAAAAAAAAAAAAAAAAAA==", "", getKey());
+    record->setArena(arena);
+    records.push_back(record);
+  }
+
+  return std::vector<RecordPtr>(records.begin(), records.begin() + count);
+}
+
+
+
+// grows the global Cache to at least count Records, returning how many
+size_t Fixtures::fillCache(size_t count)
+{
+  const size_t present = Cache::getRecordCount();
+  if (present < count)
+  {
+    const auto records = getRecords(count);
+    Cache::add(std::vector<RecordPtr>(records.begin() + present, records.end()));
+  }
+
+  return Cache::getRecordCount();
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Botan::RSA_PrivateKey* Fixtures::getKey()
+{
+  static Botan::AutoSeeded_RNG rng;
+  static Botan::RSA_PrivateKey key(rng, Const::RSA_LEN);
+  return &key;
+}
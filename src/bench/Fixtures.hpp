@@ -0,0 +1,22 @@
+#ifndef FIXTURES_HPP
+#define FIXTURES_HPP
+
+#include "../containers/records/Record.hpp"
+#include <vector>
+#include <string>
+
+// Inputs shared by the benchmarks. Records are made once, in name order and
+// all under one RSA key, and kept for the whole run, so that the larger
+// sizes of one benchmark reuse what the smaller ones already built.
+class Fixtures
+{
+ public:
+  static std::string makeName(size_t);
+  static std::vector<RecordPtr> getRecords(size_t);
+  static size_t fillCache(size_t);
+
+ private:
+  static Botan::RSA_PrivateKey* getKey();
+};
+
+#endif
@@ -0,0 +1,312 @@
+
+#include "MockSocks.hpp"
+#include "../tcp/AsyncServer.hpp"
+#include "../tcp/AsyncTorStream.hpp"
+#include "../tcp/AuthenticatedStream.hpp"
+#include "../tcp/StreamPool.hpp"
+#include "../crypto/ed25519.h"
+#include "../Utils.hpp"
+#include "../Log.hpp"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <thread>
+#include <deque>
+#include <popt.h>
+
+// Drives concurrent streams through MockSocks to an in-process AsyncServer
+// that echoes, and optionally signs, what it is sent, so that changes to the
+// stream, SOCKS5 and server code can be measured without Tor. Each stream
+// runs on a thread of its own, sending one request at a time, or up to
+// --depth at once in the pipelined and async modes. Every latency is kept,
+// and they are reported as percentiles alongside the overall rate.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Settings
+{
+  int streams = 16;
+  int requests = 1000;  // per stream
+  int latency = 0;      // ms each way
+  int size = 64;        // bytes of each request's value
+  int depth = 8;        // in flight per stream
+  int sign = 0;
+  std::string mode = "sync";
+};
+
+struct Results
+{
+  std::vector<double> latencies;  // in microseconds
+  size_t errors = 0;
+};
+
+static const char* REMOTE_HOST = "mock.tor";  // any name, MockSocks ignores it
+static const ushort REMOTE_PORT = 10053;
+static const std::string REQUEST_TYPE = "echo";  // the server returns the value
+
+static double elapsedMicros(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::micro>(Clock::now() - start)
+      .count();
+}
+
+
+
+static void record(Results& results,
+                   Clock::time_point start,
+                   const Json::Value& response)
+{
+  if (response.isMember("error"))
+    results.errors++;
+  else
+    results.latencies.push_back(elapsedMicros(start));
+}
+
+
+
+static TorStream* makeStream(const Settings& settings,
+                             ushort socksPort,
+                             const ED_KEY& publicKey)
+{
+  if (settings.sign)
+    return new AuthenticatedStream("127.0.0.1", socksPort, REMOTE_HOST,
+                                   REMOTE_PORT, publicKey);
+  return new TorStream("127.0.0.1", socksPort, REMOTE_HOST, REMOTE_PORT);
+}
+
+
+
+// one blocking stream, or one lease from the pool per request
+static void runBlocking(const Settings& settings,
+                        ushort socksPort,
+                        const ED_KEY& publicKey,
+                        const std::string& value,
+                        Results& results)
+{
+  std::unique_ptr<TorStream> stream;
+  if (settings.mode == "sync")
+    stream.reset(makeStream(settings, socksPort, publicKey));
+
+  for (int n = 0; n < settings.requests; n++)
+  {
+    auto start = Clock::now();
+    try
+    {
+      if (stream)
+        record(results, start, stream->sendReceive(REQUEST_TYPE, value));
+      else if (settings.sign)
+        record(results, start,
+               StreamPool::get()
+                   .acquire("127.0.0.1", socksPort, REMOTE_HOST, REMOTE_PORT,
+                            publicKey)
+                   ->sendReceive(REQUEST_TYPE, value));
+      else
+        record(results, start,
+               StreamPool::get()
+                   .acquire("127.0.0.1", socksPort, REMOTE_HOST, REMOTE_PORT)
+                   ->sendReceive(REQUEST_TYPE, value));
+    }
+    catch (const std::exception&)
+    {
+      results.errors++;
+    }
+  }
+}
+
+
+
+// Keeps up to depth requests outstanding, waiting on the oldest.
+template <typename Submit>
+static void runPipelined(const Settings& settings,
+                         const std::string& value,
+                         const Submit& submit,
+                         Results& results)
+{
+  std::deque<std::pair<Clock::time_point, std::future<Json::Value>>> inFlight;
+  int sent = 0;
+  while (sent < settings.requests || !inFlight.empty())
+  {
+    while (sent < settings.requests &&
+           inFlight.size() < static_cast<size_t>(settings.depth))
+    {
+      inFlight.emplace_back(Clock::now(), submit(REQUEST_TYPE, value));
+      sent++;
+    }
+
+    try
+    {
+      auto response = inFlight.front().second.get();
+      record(results, inFlight.front().first, response);
+    }
+    catch (const std::exception&)
+    {
+      results.errors++;
+    }
+    inFlight.pop_front();
+  }
+}
+
+
+
+static void runStream(const Settings& settings,
+                      ushort socksPort,
+                      const ED_KEY& publicKey,
+                      Results& results)
+{
+  const std::string value(settings.size, 'x');
+
+  try
+  {
+    if (settings.mode == "sync" || settings.mode == "pooled")
+      runBlocking(settings, socksPort, publicKey, value, results);
+    else if (settings.mode == "pipelined")
+    {
+      std::unique_ptr<TorStream> stream(
+          makeStream(settings, socksPort, publicKey));
+      stream->enableMultiplexing();
+      runPipelined(settings, value,
+                   [&](const std::string& type, const std::string& msg)
+                   {
+                     return stream->submit(type, msg);
+                   },
+                   results);
+    }
+    else
+    {
+      auto stream = AsyncTorStream::create(true);
+      if (settings.sign)
+        stream->setServerKey(publicKey);
+      stream->connect("127.0.0.1", socksPort, REMOTE_HOST, REMOTE_PORT).get();
+      runPipelined(settings, value,
+                   [&](const std::string& type, const std::string& msg)
+                   {
+                     return stream->sendReceive(type, msg);
+                   },
+                   results);
+      stream->close();
+    }
+  }
+  catch (const std::exception& ex)
+  {
+    Log::get().warn(std::string("Stream failed: ") + ex.what());
+    results.errors =
+        settings.requests - results.latencies.size();  // all unanswered
+  }
+}
+
+
+
+static double percentile(const std::vector<double>& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+
+  auto index = static_cast<size_t>(p * sorted.size());
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+
+
+static void report(const Settings& settings,
+                   std::vector<Results>& perStream,
+                   double seconds)
+{
+  std::vector<double> all;
+  size_t errors = 0;
+  for (auto& results : perStream)
+  {
+    all.insert(all.end(), results.latencies.begin(), results.latencies.end());
+    errors += results.errors;
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << std::fixed << std::setprecision(1);
+  std::cout << settings.mode << ", " << settings.streams << " streams, "
+            << settings.latency << " ms each way, " << settings.size
+            << " bytes" << (settings.sign ? ", signed" : "") << std::endl;
+  std::cout << "  " << all.size() << " responses, " << errors << " errors in "
+            << seconds << " s: " << all.size() / seconds << " requests/s"
+            << std::endl;
+  std::cout << "  latency (us): p50 " << percentile(all, 0.5) << ", p90 "
+            << percentile(all, 0.9) << ", p99 " << percentile(all, 0.99)
+            << ", p99.9 " << percentile(all, 0.999) << ", max "
+            << (all.empty() ? 0 : all.back()) << std::endl;
+}
+
+
+
+int main(int argc, const char** argv)
+{
+  Settings settings;
+  char* mode = nullptr;
+
+  struct poptOption po[] = {
+      {"streams", 'n', POPT_ARG_INT, &settings.streams, 0,
+       "Concurrent streams. Default: 16", "<count>"},
+      {"requests", 'r', POPT_ARG_INT, &settings.requests, 0,
+       "Requests per stream. Default: 1000", "<count>"},
+      {"latency", 'l', POPT_ARG_INT, &settings.latency, 0,
+       "Delay the proxy adds in each direction. Default: 0", "<ms>"},
+      {"size", 's', POPT_ARG_INT, &settings.size, 0,
+       "Bytes in each request. Default: 64", "<bytes>"},
+      {"depth", 'd', POPT_ARG_INT, &settings.depth, 0,
+       "Requests in flight per pipelined or async stream. Default: 8",
+       "<count>"},
+      {"signed", 'k', POPT_ARG_NONE, &settings.sign, 0,
+       "Sign every response and verify it, as AuthenticatedStream does.",
+       nullptr},
+      {"mode", 'm', POPT_ARG_STRING, &mode, 0,
+       "sync, pooled, pipelined or async. Default: sync", "<mode>"},
+      POPT_AUTOHELP{nullptr, 0, 0, nullptr, 0, nullptr, nullptr}};
+
+  poptContext pc = poptGetContext(nullptr, argc, argv, po, 0);
+  if (!Utils::parse(pc))
+    return EXIT_FAILURE;
+
+  if (mode)
+    settings.mode = mode;
+  const char* MODES[] = {"sync", "pooled", "pipelined", "async"};
+  if (std::find(std::begin(MODES), std::end(MODES), settings.mode) ==
+          std::end(MODES) ||
+      settings.streams < 1 || settings.requests < 1 || settings.depth < 1 ||
+      settings.latency < 0 || settings.size < 0)
+  {
+    std::cerr << "Invalid options, see --help." << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  Log::setLevel(Log::Level::Warn);
+
+  ED_KEY secretKey, publicKey;
+  ed25519_randombytes_unsafe(secretKey.data(), secretKey.size());
+  ed25519_publickey(secretKey.data(), publicKey.data());
+
+  auto server = AsyncServer::create(0, "127.0.0.1");
+  server->setHandler(REQUEST_TYPE, [](const Json::Value& value) { return value; });
+  if (settings.sign)
+    server->setSigningKey(secretKey);
+  server->start();
+
+  boost::asio::ip::tcp::endpoint target(
+      boost::asio::ip::address_v4::loopback(), server->getPort());
+  auto proxy = MockSocks::create(0, target);
+  proxy->setLatency(std::chrono::milliseconds(settings.latency));
+  proxy->start();
+
+  std::vector<Results> perStream(settings.streams);
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (int s = 0; s < settings.streams; s++)
+    threads.emplace_back(runStream, std::cref(settings), proxy->getPort(),
+                         std::cref(publicKey), std::ref(perStream[s]));
+  for (auto& thread : threads)
+    thread.join();
+  const double seconds = elapsedMicros(start) / 1e6;
+
+  report(settings, perStream, seconds);
+
+  proxy->stop();
+  server->stop();
+  return EXIT_SUCCESS;
+}
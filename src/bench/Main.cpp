@@ -0,0 +1,19 @@
+
+#include "../Log.hpp"
+#include <benchmark/benchmark.h>
+
+// Runs as Google Benchmark's own main does, such as with
+// --benchmark_format=json --benchmark_out=FILE for comparing releases, but
+// with notices off, since the paths being measured log them.
+int main(int argc, char** argv)
+{
+  Log::setLevel(Log::Level::Warn);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    return 1;
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,396 @@
+
+#include "MockSocks.hpp"
+#include "../tcp/IOExecutor.hpp"
+#include "../Log.hpp"
+#include <deque>
+
+using boost::asio::ip::tcp;
+typedef boost::system::error_code error_code;
+
+// One direction of a session. What is read from one socket is held until
+// the latency has passed since it arrived, then written to the other, one
+// write at a time so that nothing is reordered. The end of the input is
+// passed on once everything before it has been.
+class MockSocks::Pipe : public std::enable_shared_from_this<Pipe>
+{
+ public:
+  Pipe(boost::asio::io_service& ios,
+       tcp::socket& from,
+       tcp::socket& to,
+       boost::asio::io_service::strand& strand,
+       std::chrono::milliseconds latency,
+       const std::function<void()>& onError)
+      : from_(from),
+        to_(to),
+        strand_(strand),
+        timer_(ios),
+        latency_(latency),
+        onError_(onError),
+        writing_(false),
+        ended_(false)
+  {
+  }
+
+  void start()
+  {
+    readNext();
+  }
+
+  void cancel()
+  {
+    error_code ignored;
+    timer_.cancel(ignored);
+  }
+
+ private:
+  struct Chunk
+  {
+    std::chrono::steady_clock::time_point due;
+    std::string bytes;
+  };
+
+  void readNext()
+  {
+    auto self = shared_from_this();
+    from_.async_read_some(
+        boost::asio::buffer(buffer_, sizeof(buffer_)),
+        strand_.wrap([self](error_code ec, size_t n)
+                     {
+                       if (ec)
+                       {
+                         self->ended_ = true;
+                         self->writeNext();
+                         return;
+                       }
+
+                       self->queue_.push_back(
+                           {std::chrono::steady_clock::now() + self->latency_,
+                            std::string(self->buffer_, n)});
+                       self->writeNext();
+                       self->readNext();
+                     }));
+  }
+
+  void writeNext()
+  {
+    if (writing_)
+      return;
+
+    if (queue_.empty())
+    {
+      if (ended_)
+      {
+        error_code ignored;
+        to_.shutdown(tcp::socket::shutdown_send, ignored);
+      }
+      return;
+    }
+
+    writing_ = true;
+    auto self = shared_from_this();
+    timer_.expires_at(queue_.front().due);
+    timer_.async_wait(strand_.wrap([self](error_code ec)
+                                   {
+                                     if (ec)
+                                       return;
+
+                                     self->send();
+                                   }));
+  }
+
+  void send()
+  {
+    auto self = shared_from_this();
+    boost::asio::async_write(
+        to_, boost::asio::buffer(queue_.front().bytes),
+        strand_.wrap([self](error_code ec, size_t)
+                     {
+                       self->writing_ = false;
+                       if (ec)
+                       {
+                         self->onError_();
+                         return;
+                       }
+
+                       self->queue_.pop_front();
+                       self->writeNext();
+                     }));
+  }
+
+  tcp::socket &from_, &to_;
+  boost::asio::io_service::strand& strand_;
+  boost::asio::steady_timer timer_;
+  const std::chrono::milliseconds latency_;
+  const std::function<void()> onError_;
+  std::deque<Chunk> queue_;
+  char buffer_[16384];
+  bool writing_, ended_;
+};
+
+
+
+// A connection from a client: the SOCKS5 exchange, read in exactly the
+// sizes the protocol gives so that any early data stays in the socket,
+// then the two pipes to and from the target.
+class MockSocks::Session : public std::enable_shared_from_this<Session>
+{
+ public:
+  Session(boost::asio::io_service& ios,
+          const tcp::endpoint& target,
+          std::chrono::milliseconds latency)
+      : ios_(ios),
+        strand_(ios),
+        client_(ios),
+        upstream_(ios),
+        target_(target),
+        latency_(latency)
+  {
+  }
+
+  tcp::socket& getClient()
+  {
+    return client_;
+  }
+
+  void start()
+  {
+    auto self = shared_from_this();
+    read(2, [self]()
+         {
+           if (self->buffer_[0] != 0x05)
+             return self->close();
+
+           self->read(self->buffer_[1], [self]()
+                      {
+                        static const uint8_t NO_AUTH[] = {0x05, 0x00};
+                        self->write(NO_AUTH, sizeof(NO_AUTH));
+                        self->readRequest();
+                      });
+         });
+  }
+
+ private:
+  void readRequest()
+  {
+    // version, command, reserved and address type
+    auto self = shared_from_this();
+    read(4, [self]()
+         {
+           if (self->buffer_[0] != 0x05 || self->buffer_[1] != 0x01)
+             return self->close();
+
+           switch (self->buffer_[3])
+           {
+             case 0x01:
+               return self->read(4 + 2, [self]() { self->connect(); });
+             case 0x04:
+               return self->read(16 + 2, [self]() { self->connect(); });
+             case 0x03:
+               return self->read(1, [self]()
+                                 {
+                                   self->read(self->buffer_[0] + 2,
+                                              [self]() { self->connect(); });
+                                 });
+             default:
+               self->close();
+           }
+         });
+  }
+
+  // every address is taken to mean the target
+  void connect()
+  {
+    auto self = shared_from_this();
+    upstream_.async_connect(
+        target_, strand_.wrap([self](error_code ec)
+                              {
+                                // succeeded, bound to 0.0.0.0:0
+                                static const uint8_t OK[] = {
+                                    0x05, 0x00, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+                                static const uint8_t REFUSED[] = {
+                                    0x05, 0x05, 0x00, 0x01, 0, 0, 0, 0, 0, 0};
+                                if (ec)
+                                {
+                                  self->write(REFUSED, sizeof(REFUSED));
+                                  return;
+                                }
+
+                                error_code ignored;
+                                self->upstream_.set_option(
+                                    tcp::no_delay(true), ignored);
+                                self->write(OK, sizeof(OK));
+                                self->relay();
+                              }));
+  }
+
+  // after the reply, which is already queued on the client socket
+  void relay()
+  {
+    auto self = shared_from_this();
+    auto onError = [self]() { self->close(); };
+    auto toTarget = std::make_shared<Pipe>(ios_, client_, upstream_, strand_,
+                                           latency_, onError);
+    auto toClient = std::make_shared<Pipe>(ios_, upstream_, client_, strand_,
+                                           latency_, onError);
+    toTarget_ = toTarget;
+    toClient_ = toClient;
+    toTarget->start();
+    toClient->start();
+  }
+
+  void read(size_t n, const std::function<void()>& next)
+  {
+    auto self = shared_from_this();
+    boost::asio::async_read(client_, boost::asio::buffer(buffer_, n),
+                            strand_.wrap([self, next](error_code ec, size_t)
+                                         {
+                                           if (ec)
+                                             self->close();
+                                           else
+                                             next();
+                                         }));
+  }
+
+  // a reply is a few bytes on a fresh socket, so this write cannot stall
+  void write(const uint8_t* bytes, size_t n)
+  {
+    error_code ec;
+    boost::asio::write(client_, boost::asio::buffer(bytes, n), ec);
+    if (ec)
+      close();
+  }
+
+  void close()
+  {
+    error_code ignored;
+    client_.close(ignored);
+    upstream_.close(ignored);
+    for (auto& pipe : {toTarget_.lock(), toClient_.lock()})
+      if (pipe)
+        pipe->cancel();
+  }
+
+  boost::asio::io_service& ios_;
+  boost::asio::io_service::strand strand_;
+  tcp::socket client_, upstream_;
+  const tcp::endpoint target_;
+  const std::chrono::milliseconds latency_;
+  std::weak_ptr<Pipe> toTarget_, toClient_;  // which keep this alive
+  uint8_t buffer_[256 + 2];
+};
+
+
+
+std::shared_ptr<MockSocks> MockSocks::create(ushort port,
+                                             const tcp::endpoint& target)
+{
+  return std::shared_ptr<MockSocks>(new MockSocks(port, target));
+}
+
+
+
+// added to each direction of connections made from now on
+void MockSocks::setLatency(std::chrono::milliseconds latency)
+{
+  latency_ = latency.count();
+}
+
+
+
+std::chrono::milliseconds MockSocks::getLatency() const
+{
+  return std::chrono::milliseconds(latency_.load());
+}
+
+
+
+void MockSocks::start()
+{
+  if (running_.exchange(true))
+    Log::get().error("The proxy is already running!");
+
+  acceptor_.open(endpoint_.protocol());
+  acceptor_.set_option(tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint_);
+  acceptor_.listen(1024);
+  acceptNext();
+}
+
+
+
+// stops accepting; connections already relayed run until either side ends
+void MockSocks::stop()
+{
+  if (!running_.exchange(false))
+    return;
+
+  auto self = shared_from_this();
+  ios_.dispatch([self]()
+                {
+                  error_code ignored;
+                  self->acceptor_.close(ignored);
+                });
+}
+
+
+
+// the bound port, which is the one the OS chose if 0 was asked for
+ushort MockSocks::getPort() const
+{
+  error_code ec;
+  auto local = acceptor_.local_endpoint(ec);
+  return ec ? endpoint_.port() : local.port();
+}
+
+
+
+// connections accepted so far
+size_t MockSocks::getConnectionCount() const
+{
+  return connections_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+MockSocks::MockSocks(ushort port, const tcp::endpoint& target)
+    : ios_(IOExecutor::get().next()),
+      acceptor_(ios_),
+      endpoint_(boost::asio::ip::address_v4::loopback(), port),
+      target_(target),
+      latency_(0),
+      connections_(0),
+      running_(false)
+{
+}
+
+
+
+void MockSocks::acceptNext()
+{
+  auto self = shared_from_this();
+  auto session = std::make_shared<Session>(IOExecutor::get().next(), target_,
+                                           getLatency());
+  acceptor_.async_accept(session->getClient(), [self, session](error_code ec)
+                         {
+                           if (!self->running_)
+                             return;
+
+                           if (!ec)
+                           {
+                             error_code ignored;
+                             session->getClient().set_option(
+                                 tcp::no_delay(true), ignored);
+                             self->connections_++;
+                             session->start();
+                           }
+                           else if (ec != boost::asio::error::operation_aborted)
+                             Log::get().warn("Proxy accept failed: " +
+                                             ec.message());
+
+                           self->acceptNext();
+                         });
+}
@@ -0,0 +1,49 @@
+#ifndef MOCK_SOCKS_HPP
+#define MOCK_SOCKS_HPP
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+
+// An in-process stand-in for Tor's SOCKS port, speaking the part of SOCKS5
+// that Socks5::Socks5 uses: no authentication and CONNECT, including the
+// optimistic form in which the greeting, request and first data arrive
+// together. Whatever host is asked for, the connection goes to the one
+// target, such as a local AsyncServer. Each direction delays what it
+// carries by the latency, to stand in for a circuit, while keeping order.
+class MockSocks : public std::enable_shared_from_this<MockSocks>
+{
+ public:
+  static std::shared_ptr<MockSocks> create(
+      ushort,
+      const boost::asio::ip::tcp::endpoint&);
+
+  void setLatency(std::chrono::milliseconds);
+  std::chrono::milliseconds getLatency() const;
+
+  void start();
+  void stop();
+  ushort getPort() const;
+  size_t getConnectionCount() const;
+
+ private:
+  class Session;
+  class Pipe;
+
+  MockSocks(ushort, const boost::asio::ip::tcp::endpoint&);
+  MockSocks(const MockSocks&) = delete;
+  void operator=(const MockSocks&) = delete;
+
+  void acceptNext();
+
+  boost::asio::io_service& ios_;
+  boost::asio::ip::tcp::acceptor acceptor_;
+  const boost::asio::ip::tcp::endpoint endpoint_, target_;
+  std::atomic<int64_t> latency_;  // in ms
+  std::atomic<size_t> connections_;
+  std::atomic<bool> running_;
+};
+
+#endif
@@ -0,0 +1,103 @@
+
+#include "BloomFilter.hpp"
+#include <functional>
+#include <algorithm>
+#include <cmath>
+
+
+// sizes the filter for the expected number of items at the given error rate
+BloomFilter::BloomFilter(size_t expectedItems, double falsePositiveRate)
+    : itemCount_(0)
+{
+  // https://en.wikipedia.org/wiki/Bloom_filter#Optimal_number_of_hash_functions
+  const double ln2 = std::log(2.0);
+  const double n = std::max<size_t>(expectedItems, 1);
+  const double m = -n * std::log(falsePositiveRate) / (ln2 * ln2);
+
+  bitCount_ = std::max<size_t>(static_cast<size_t>(std::ceil(m)), 64);
+  hashCount_ =
+      std::max<uint32_t>(static_cast<uint32_t>(std::round(m / n * ln2)), 1);
+  bits_.resize((bitCount_ + 63) / 64, 0);
+}
+
+
+
+void BloomFilter::insert(const std::string& item)
+{
+  // Kirsch-Mitzenmacher: derive all probe positions from two hashes
+  const uint64_t h1 = std::hash<std::string>()(item);
+  const uint64_t h2 = mix(h1) | 1;
+
+  for (uint32_t j = 0; j < hashCount_; j++)
+  {
+    const uint64_t bit = (h1 + j * h2) % bitCount_;
+    bits_[bit / 64] |= uint64_t(1) << (bit % 64);
+  }
+
+  itemCount_++;
+}
+
+
+
+bool BloomFilter::mightContain(const std::string& item) const
+{
+  const uint64_t h1 = std::hash<std::string>()(item);
+  const uint64_t h2 = mix(h1) | 1;
+
+  for (uint32_t j = 0; j < hashCount_; j++)
+  {
+    const uint64_t bit = (h1 + j * h2) % bitCount_;
+    if ((bits_[bit / 64] & (uint64_t(1) << (bit % 64))) == 0)
+      return false;
+  }
+
+  return true;
+}
+
+
+
+size_t BloomFilter::getItemCount() const
+{
+  return itemCount_;
+}
+
+
+
+size_t BloomFilter::getBitCount() const
+{
+  return bitCount_;
+}
+
+
+
+// expected false-positive rate given the number of items actually inserted
+double BloomFilter::getFalsePositiveRate() const
+{
+  const double k = hashCount_;
+  return std::pow(1 - std::exp(-k * itemCount_ / bitCount_), k);
+}
+
+
+
+// bytes of the bit array
+size_t BloomFilter::getMemoryUsage() const
+{
+  return bits_.capacity() * sizeof(uint64_t);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// splitmix64 finalizer, decorrelates the second hash from the first
+uint64_t BloomFilter::mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
@@ -0,0 +1,29 @@
+#ifndef BLOOM_FILTER_HPP
+#define BLOOM_FILTER_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Compact probabilistic set of names. A negative answer from mightContain()
+// is definite, so absent names can be rejected before any expensive work.
+class BloomFilter
+{
+ public:
+  BloomFilter(size_t, double falsePositiveRate = 0.01);
+  void insert(const std::string&);
+  bool mightContain(const std::string&) const;
+  size_t getItemCount() const;
+  size_t getBitCount() const;
+  double getFalsePositiveRate() const;
+  size_t getMemoryUsage() const;
+
+ private:
+  static uint64_t mix(uint64_t);
+
+  std::vector<uint64_t> bits_;
+  size_t bitCount_, itemCount_;
+  uint32_t hashCount_;
+};
+
+#endif
@@ -1,65 +1,759 @@
 
 #include "Cache.hpp"
+#include "Partitioner.hpp"
+#include "../Common.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../MemoryStats.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
 
-std::vector<RecordPtr> Cache::records_;
+StringArenaPtr Cache::arena_ = std::make_shared<StringArena>();
+std::mutex Cache::writeMutex_;
+Cache::SnapshotPtr Cache::snapshot_ = std::make_shared<Cache::Snapshot>();
 
 
+// copies a shard per name of the Record, see add(std::vector)
 bool Cache::add(const RecordPtr& record)
-{  // todo: delete Records should cause deletion/replacement, etc
-  if (get(record->getName()))
-    return false;  // cannot add record, name is already taken
+{
+  return add(std::vector<RecordPtr>{record});
+}
+
+
+
+// bulk load: inserts all Records as one Batch and publishes a single Snapshot,
+// optionally reporting the indices of Records whose names were already taken
+bool Cache::add(const std::vector<RecordPtr>& records,
+                std::vector<size_t>* conflicts)
+{
+  std::lock_guard<std::mutex> guard(writeMutex_);
+
+  Batch batch(getSnapshot());
+  bool allSucceeded = batch.insert(records, conflicts);
+  std::atomic_store(&snapshot_, batch.commit());
+  return allSucceeded;
+}
+
+
+
+// swaps out the Record with the same primary name for the given Record
+bool Cache::replace(const RecordPtr& record)
+{
+  std::lock_guard<std::mutex> guard(writeMutex_);
+
+  Batch batch(getSnapshot());
+  if (!batch.replace(record))
+    return false;
+
+  std::atomic_store(&snapshot_, batch.commit());
+  return true;
+}
+
+
+
+// replaces each Record as one Batch, optionally reporting the indices of
+// those that had no Record to replace
+bool Cache::replace(const std::vector<RecordPtr>& records,
+                    std::vector<size_t>* absent)
+{
+  std::lock_guard<std::mutex> guard(writeMutex_);
+
+  Batch batch(getSnapshot());
+  size_t replaced = 0;
+  for (size_t j = 0; j < records.size(); j++)
+    if (batch.replace(records[j]))
+      replaced++;
+    else if (absent)
+      absent->push_back(j);
+
+  if (replaced > 0)
+    std::atomic_store(&snapshot_, batch.commit());
+  return replaced == records.size();
+}
+
+
+
+// removes the Record with the given primary name, along with its subdomains
+bool Cache::remove(const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(writeMutex_);
+
+  Batch batch(getSnapshot());
+  if (!batch.remove(name))
+    return false;
+
+  std::atomic_store(&snapshot_, batch.commit());
+  return true;
+}
+
+
+
+// removes each name's Record as one Batch, optionally reporting the indices
+// of names that were not primary names in the Cache
+bool Cache::remove(const std::vector<std::string>& names,
+                   std::vector<size_t>* absent)
+{
+  std::lock_guard<std::mutex> guard(writeMutex_);
+
+  Batch batch(getSnapshot());
+  size_t removed = 0;
+  for (size_t j = 0; j < names.size(); j++)
+    if (batch.remove(names[j]))
+      removed++;
+    else if (absent)
+      absent->push_back(j);
+
+  if (removed > 0)
+    std::atomic_store(&snapshot_, batch.commit());
+  return removed == names.size();
+}
+
+
+
+// Returns a shared read-only view of all Records, ordered by name. Pending
+// changes are folded into a compacted copy of the Snapshot, built without
+// the writer lock, which replaces the Snapshot so that later calls are free
+// unless a writer has published another meanwhile; it has the same Records,
+// so either way nothing is lost.
+Cache::SortedListPtr Cache::getSortedList()
+{
+  auto snapshot = getSnapshot();
+  if (snapshot->pending_->empty() && snapshot->removed_->empty())
+    return snapshot->sorted_;
+
+  auto compacted = std::make_shared<Snapshot>(*snapshot);
+  compacted->compact();
+  std::atomic_compare_exchange_strong(&snapshot_, &snapshot,
+                                      SnapshotPtr(compacted));
+  return compacted->sorted_;
+}
+
+
+
+RecordPtr Cache::get(const std::string& name)
+{
+  static Metrics::Counter& hits = Metrics::get().counter(
+      "onions_cache_lookups_total{result=\"hit\"}", "Cache::get calls.");
+  static Metrics::Counter& misses = Metrics::get().counter(
+      "onions_cache_lookups_total{result=\"miss\"}", "Cache::get calls.");
+  static Metrics::Histogram& latency = Metrics::get().histogram(
+      "onions_cache_get_seconds", "Time taken by Cache::get.",
+      {0.0000001, 0.00000025, 0.0000005, 0.000001, 0.0000025, 0.00001,
+       0.0001});
+
+  const auto start = std::chrono::steady_clock::now();
+  RecordPtr record = getSnapshot()->get(name);
+  latency.observeDuration(std::chrono::steady_clock::now() - start);
+  (record ? hits : misses).add();
+  return record;
+}
+
+
+
+size_t Cache::getRecordCount()
+{
+  return getSnapshot()->getRecordCount();
+}
+
+
+
+// the returned Snapshot never changes, later writes publish a new one
+Cache::SnapshotPtr Cache::getSnapshot()
+{
+  return std::atomic_load(&snapshot_);
+}
+
+
+
+// of the current Snapshot, though older ones that readers still hold may
+// keep more alive
+Cache::MemoryUsage Cache::getMemoryUsage()
+{
+  auto usage = getSnapshot()->getMemoryUsage();
+  usage.strings = arena_->getMemoryUsage();
+  return usage;
+}
+
 
-  records_.push_back(record);
+
+// Writes the Cache to a snapshot file in native byte order. The file holds
+// a header (magic, version, Record count), then for each Record in name order:
+// its SHA-384 hash (also its Merkle leaf hash), its encoding, and all of its
+// fully-qualified names so that the name index can be restored directly. The
+// encoding is the binary form, which loads without a JSON parser; files with
+// the JSON form, which Common::parseRecord also accepts, still load.
+bool Cache::save(const std::string& path)
+{
+  auto records = getSortedList();
+
+  // write to a temporary file first so that a crash cannot truncate the file
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+  if (!file.is_open())
+  {
+    Log::get().warn("Cannot open Cache snapshot " + tmpPath);
+    return false;
+  }
+
+  const uint32_t magic = FILE_MAGIC, version = FILE_VERSION;
+  const uint64_t count = records->size();
+  file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+  file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+  for (const auto& r : *records)
+  {
+    const SHA384_HASH hash = r->getHash();
+    const std::string encoding = r->asBinary();
+    const uint32_t encodingLen = encoding.size();
+    const auto names = getNames(r);
+    const uint8_t nameCount = names.size();
+
+    file.write(reinterpret_cast<const char*>(hash.data()), hash.size());
+    file.write(reinterpret_cast<const char*>(&encodingLen),
+               sizeof(encodingLen));
+    file.write(encoding.data(), encodingLen);
+    file.write(reinterpret_cast<const char*>(&nameCount), sizeof(nameCount));
+    for (const auto& name : names)
+    {
+      const uint16_t nameLen = name.size();
+      file.write(reinterpret_cast<const char*>(&nameLen), sizeof(nameLen));
+      file.write(name.data(), nameLen);
+    }
+  }
+
+  file.close();
+  if (file.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+  {
+    Log::get().warn("Failed to write Cache snapshot " + path);
+    return false;
+  }
+
+  LOG_NOTICE("Saved " + std::to_string(count) + " Records to " + path);
+  return true;
+}
+
+
+
+// Memory-maps a snapshot file and adds its Records to the Cache. Records whose
+// hash matches their stored hash are not put through scrypt or RSA again, and
+// their keys are not even decoded until something needs them.
+bool Cache::load(const std::string& path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    Log::get().warn("Cannot open Cache snapshot " + path);
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0)
+  {
+    close(fd);
+    Log::get().warn("Cache snapshot " + path + " is empty.");
+    return false;
+  }
+
+  const size_t size = info.st_size;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // the mapping remains valid
+  if (map == MAP_FAILED)
+  {
+    Log::get().warn("Cannot map Cache snapshot " + path);
+    return false;
+  }
+
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  std::vector<RecordPtr> records;
+  std::vector<std::vector<std::string>> names;
+  bool parsed = parseFile(static_cast<const uint8_t*>(map), size, records,
+                          names);
+  munmap(map, size);
+
+  if (!parsed)
+  {
+    Log::get().warn("Cache snapshot " + path + " is corrupt.");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(writeMutex_);
+  Batch batch(getSnapshot());
+  for (size_t j = 0; j < records.size(); j++)
+    batch.insert(records[j], names[j]);
+  std::atomic_store(&snapshot_, batch.commit());
+
+  LOG_NOTICE("Loaded " + std::to_string(records.size()) +
+             " Records from " + path);
   return true;
 }
 
 
 
-bool Cache::add(const std::vector<RecordPtr>& records)
-{  // todo: push all at once
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+size_t Cache::getShardIndex(const std::string& name)
+{
+  return std::hash<std::string>()(name) % SHARD_COUNT;
+}
+
+
+
+// returns the primary name and every fully-qualified subdomain of the Record
+std::vector<std::string> Cache::getNames(const RecordPtr& record)
+{
+  const StringRef& name = record->getNameRef();
+  const auto subdomains = record->getSubdomainRefs();
+
+  std::vector<std::string> names;
+  names.reserve(1 + subdomains.size());
+  names.push_back(name.str());
+  for (const auto& subdomain : subdomains)
+  {
+    std::string fullName;
+    fullName.reserve(subdomain.first.size() + 1 + name.size());
+    fullName.append(subdomain.first.data(), subdomain.first.size());
+    fullName += '.';
+    fullName.append(name.data(), name.size());
+    names.push_back(std::move(fullName));
+  }
+
+  return names;
+}
+
+
+
+// merges two ordered lists into a new ordered list, skipping removed Records
+Cache::SortedListPtr Cache::merge(const std::vector<RecordPtr>& a,
+                                  const std::vector<RecordPtr>& b,
+                                  const Snapshot::Tombstones& removed)
+{
+  auto merged = std::make_shared<std::vector<RecordPtr>>();
+  merged->reserve(a.size() + b.size());
+  std::merge(a.begin(), a.end(), b.begin(), b.end(),
+             std::back_inserter(*merged), isLessThan);
+
+  if (!removed.empty())
+    merged->erase(std::remove_if(merged->begin(), merged->end(),
+                                 [&removed](const RecordPtr& r)
+                                 {
+                                   return removed.count(r.get()) > 0;
+                                 }),
+                  merged->end());
+
+  return merged;
+}
+
+
+
+bool Cache::isLessThan(const RecordPtr& a, const RecordPtr& b)
+{
+  return a->getNameRef() < b->getNameRef();
+}
+
+
+
+// parses the layout written by save(), skipping Records that fail to parse
+// or whose stored names are not their own
+bool Cache::parseFile(const uint8_t* pos,
+                      size_t size,
+                      std::vector<RecordPtr>& records,
+                      std::vector<std::vector<std::string>>& names)
+{
+  const uint8_t* end = pos + size;
+
+  uint32_t magic, version;
+  uint64_t count;
+  if (!readBytes(pos, end, &magic, sizeof(magic)) || magic != FILE_MAGIC ||
+      !readBytes(pos, end, &version, sizeof(version)) ||
+      version != FILE_VERSION || !readBytes(pos, end, &count, sizeof(count)))
+    return false;
+
+  // each entry takes at least its hash, length and name count, so the file
+  // bounds how many it can hold whatever its count says
+  const size_t minEntry =
+      sizeof(SHA384_HASH) + sizeof(uint32_t) + sizeof(uint8_t);
+  const size_t capacity = std::min<uint64_t>(count, (end - pos) / minEntry);
+  records.reserve(capacity);
+  names.reserve(capacity);
+
+  for (uint64_t j = 0; j < count; j++)
+  {
+    SHA384_HASH hash;
+    uint32_t encodingLen;
+    if (!readBytes(pos, end, hash.data(), hash.size()) ||
+        !readBytes(pos, end, &encodingLen, sizeof(encodingLen)) ||
+        static_cast<size_t>(end - pos) < encodingLen)
+      return false;
+
+    std::string encoding(reinterpret_cast<const char*>(pos), encodingLen);
+    pos += encodingLen;
+
+    uint8_t nameCount;
+    if (!readBytes(pos, end, &nameCount, sizeof(nameCount)))
+      return false;
+
+    std::vector<std::string> recordNames;
+    for (uint8_t n = 0; n < nameCount; n++)
+    {
+      uint16_t nameLen;
+      if (!readBytes(pos, end, &nameLen, sizeof(nameLen)) ||
+          static_cast<size_t>(end - pos) < nameLen)
+        return false;
+
+      recordNames.push_back(
+          std::string(reinterpret_cast<const char*>(pos), nameLen));
+      pos += nameLen;
+    }
+
+    try
+    {
+      // the index must match what erase() and replace() will recompute
+      const RecordPtr record = Common::parseRecord(encoding, hash);
+      if (getNames(record) != recordNames)
+        Log::get().error("The stored names are not the Record's own.");
+
+      records.push_back(record);
+      names.push_back(recordNames);
+    }
+    catch (const std::exception& err)
+    {
+      Log::get().warn("Skipping invalid Record in snapshot: " +
+                      std::string(err.what()));
+    }
+  }
+
+  return pos == end;
+}
+
+
+
+bool Cache::readBytes(const uint8_t*& pos,
+                      const uint8_t* end,
+                      void* out,
+                      size_t len)
+{
+  if (static_cast<size_t>(end - pos) < len)
+    return false;
+
+  memcpy(out, pos, len);
+  pos += len;
+  return true;
+}
+
+
+
+// ************************** SUBCLASS METHODS **************************** //
+
+
+
+Cache::Snapshot::Snapshot()
+    : sorted_(std::make_shared<std::vector<RecordPtr>>()),
+      pending_(std::make_shared<std::vector<RecordPtr>>()),
+      removed_(std::make_shared<Tombstones>())
+{
+  for (auto& shard : shards_)
+    shard = std::make_shared<Shard>();
+}
+
+
+
+RecordPtr Cache::Snapshot::get(const std::string& name) const
+{
+  const auto& names = *shards_[getShardIndex(name)];
+  auto match = names.find(name);
+  return match == names.end() ? nullptr : match->second;
+}
+
+
+
+// only allocates if there are pending inserts or removals
+Cache::SortedListPtr Cache::Snapshot::getSortedList() const
+{
+  if (pending_->empty() && removed_->empty())
+    return sorted_;
+  return merge(*sorted_, *pending_, *removed_);
+}
+
+
+
+size_t Cache::Snapshot::getRecordCount() const
+{
+  return sorted_->size() + pending_->size() - removed_->size();
+}
+
+
+
+Cache::MemoryUsage Cache::Snapshot::getMemoryUsage() const
+{
+  const size_t NODE = MemoryStats::NODE_OVERHEAD;
+  MemoryUsage usage = {getRecordCount(), 0, 0, 0, 0};
+
+  for (const auto& list : {sorted_, pending_})
+  {
+    usage.index += list->capacity() * sizeof(RecordPtr);
+    for (const auto& record : *list)
+      if (removed_->count(record.get()) == 0)
+      {
+        usage.records += record->getMemoryUsage();
+        usage.keys += record->getKeyMemoryUsage();
+      }
+  }
+
+  for (const auto& shard : shards_)
+  {
+    usage.index += shard->bucket_count() * sizeof(void*) +
+                   shard->size() * (sizeof(Shard::value_type) + NODE);
+    for (const auto& entry : *shard)
+      usage.index += MemoryStats::getStringMemoryUsage(entry.first);
+  }
+
+  usage.index += removed_->bucket_count() * sizeof(void*) +
+                 removed_->size() * (sizeof(const Record*) + NODE);
+  return usage;
+}
+
+
+
+size_t Cache::MemoryUsage::getTotal() const
+{
+  return records + keys + strings + index;
+}
+
+
+
+size_t Cache::MemoryUsage::getPerRecord() const
+{
+  return recordCount > 0 ? getTotal() / recordCount : 0;
+}
+
+
+
+void Cache::Snapshot::compact()
+{
+  if (pending_->empty() && removed_->empty())
+    return;
+
+  sorted_ = merge(*sorted_, *pending_, *removed_);
+  pending_ = std::make_shared<std::vector<RecordPtr>>();
+  removed_ = std::make_shared<Tombstones>();
+}
+
+
+
+Cache::Batch::Batch(const SnapshotPtr& base) : base_(base)
+{
+}
+
+
+
+bool Cache::Batch::insert(const RecordPtr& record)
+{
+  return insert(record, getNames(record));
+}
+
+
+
+// the first Record to claim a name wins, including within the same batch
+bool Cache::Batch::insert(const std::vector<RecordPtr>& records,
+                          std::vector<size_t>* conflicts)
+{
+  // compute each Record's names once and size every shard up front,
+  // so that the index does not rehash repeatedly during a large load
+  std::vector<std::vector<std::string>> names;
+  names.reserve(records.size());
+  std::array<size_t, SHARD_COUNT> growth;
+  growth.fill(0);
+  for (const auto& r : records)
+  {
+    names.push_back(getNames(r));
+    for (const auto& name : names.back())
+      growth[getShardIndex(name)]++;
+  }
+
+  for (size_t j = 0; j < SHARD_COUNT; j++)
+    if (growth[j] > 0)
+    {
+      auto& shard = getWritableShard(j);
+      shard.reserve(shard.size() + growth[j]);
+    }
+
+  added_.reserve(added_.size() + records.size());
+
   bool allSucceeded = true;
-  for (auto r : records)
-    if (!add(r))
+  for (size_t j = 0; j < records.size(); j++)
+  {
+    if (!insert(records[j], names[j]))
+    {
       allSucceeded = false;
+      if (conflicts)
+        conflicts->push_back(j);
+    }
+  }
+
   return allSucceeded;
 }
 
 
 
-std::vector<RecordPtr> Cache::getSortedList()
+// checks that neither the primary name nor any subdomain is already claimed
+// Records of another node's partition are left out, which is not a conflict
+bool Cache::Batch::insert(const RecordPtr& record,
+                          const std::vector<std::string>& names)
 {
-  std::sort(records_.begin(), records_.end(),
-            [](const RecordPtr& a, const RecordPtr& b)
-            {
-              return a->getName().compare(b->getName());
-            });
-  return records_;
+  static Metrics::Counter& elsewhere = Metrics::get().counter(
+      "onions_partition_skipped_total",
+      "Records left out of the Cache as they belong to another partition.");
+
+  if (!Partitioner::isLocal(record->getName()))
+  {
+    elsewhere.add();
+    return true;
+  }
+
+  for (const auto& name : names)
+    if (!isAvailable(name))
+      return false;
+
+  record->setArena(arena_);
+  for (const auto& name : names)
+    getWritableShard(getShardIndex(name))[name] = record;
+
+  added_.push_back(record);
+  return true;
 }
 
 
 
-RecordPtr Cache::get(const std::string& name)
+// the new primary name must match and every other name must be unclaimed,
+// unless it already belongs to the Record being replaced
+bool Cache::Batch::replace(const RecordPtr& record)
 {
-  for (auto r : records_)
+  auto names = getNames(record);  // the primary name first
+  auto old = find(names.front());
+  if (!old || old->getNameRef() != record->getNameRef())
+    return false;
+
+  for (const auto& name : names)
   {
-    // check main name
-    if (r->getName() == name)
-      return r;
-
-    // check subdomain
-    NameList list = r->getSubdomains();
-    for (auto subdomain : list)
-      if (subdomain.first + "." + r->getName() == name)
-        return r;
+    auto owner = find(name);
+    if (owner && owner != old)
+      return false;
   }
 
-  return nullptr;
+  erase(old);
+  return insert(record, names);
 }
 
 
 
-size_t Cache::getRecordCount()
+bool Cache::Batch::remove(const std::string& name)
+{
+  auto old = find(name);
+  if (!old || old->getNameRef() != name)
+    return false;  // not a primary name
+
+  erase(old);
+  return true;
+}
+
+
+
+// untouched shards are shared with the base Snapshot rather than copied
+Cache::SnapshotPtr Cache::Batch::commit() const
+{
+  auto snapshot = std::make_shared<Snapshot>(*base_);
+  for (size_t j = 0; j < SHARD_COUNT; j++)
+    if (dirty_[j])
+      snapshot->shards_[j] = dirty_[j];
+
+  if (added_.empty() && removed_.empty())
+    return snapshot;
+
+  // Records removed from the merge buffer are dropped directly,
+  // Records removed from the sorted run are tombstoned until compaction
+  auto removed = std::make_shared<Snapshot::Tombstones>(*base_->removed_);
+  Snapshot::Tombstones removedHere;
+  for (const auto& r : removed_)
+    removedHere.insert(r.get());
+
+  std::vector<RecordPtr> pending;
+  for (const auto& r : *base_->pending_)
+    if (removedHere.erase(r.get()) == 0)
+      pending.push_back(r);
+  removed->insert(removedHere.begin(), removedHere.end());
+
+  // new Records enter the merge buffer, which is folded in once it grows;
+  // a tombstoned Record that is added back is simply revived in place
+  std::vector<RecordPtr> added;
+  for (const auto& r : added_)
+    if (removed->erase(r.get()) == 0)
+      added.push_back(r);
+  std::sort(added.begin(), added.end(), isLessThan);
+  snapshot->pending_ = merge(pending, added, Snapshot::Tombstones());
+  snapshot->removed_ = removed;
+  if (snapshot->pending_->size() + removed->size() > MERGE_THRESHOLD)
+    snapshot->compact();
+
+  return snapshot;
+}
+
+
+
+RecordPtr Cache::Batch::find(const std::string& name) const
+{
+  const auto& shard = getShard(getShardIndex(name));
+  auto match = shard.find(name);
+  return match == shard.end() ? nullptr : match->second;
+}
+
+
+
+// unindexes all names of the Record and schedules it for removal
+void Cache::Batch::erase(const RecordPtr& record)
+{
+  for (const auto& name : getNames(record))
+    getWritableShard(getShardIndex(name)).erase(name);
+
+  auto inBatch = std::find(added_.begin(), added_.end(), record);
+  if (inBatch != added_.end())
+    added_.erase(inBatch);  // added and removed by the same batch
+  else
+    removed_.push_back(record);
+}
+
+
+
+const Cache::Snapshot::Shard& Cache::Batch::getShard(size_t index) const
+{
+  return dirty_[index] ? *dirty_[index] : *base_->shards_[index];
+}
+
+
+
+// copies the shard from the base Snapshot on first write
+Cache::Snapshot::Shard& Cache::Batch::getWritableShard(size_t index)
+{
+  if (!dirty_[index])
+    dirty_[index] = std::make_shared<Snapshot::Shard>(*base_->shards_[index]);
+  return *dirty_[index];
+}
+
+
+
+bool Cache::Batch::isAvailable(const std::string& name) const
 {
-  return records_.size();
+  return getShard(getShardIndex(name)).count(name) == 0;
 }
@@ -1,21 +1,127 @@
-
 #ifndef CACHE_HPP
 #define CACHE_HPP
 
 #include "records/Record.hpp"
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <mutex>
 #include <vector>
 
 class Cache
 {
  public:
+  static const size_t SHARD_COUNT = 16;
+  static const size_t MERGE_THRESHOLD = 1024;  // max size of the merge buffer
+
+  typedef std::shared_ptr<const std::vector<RecordPtr>> SortedListPtr;
+
+  // estimated bytes, by what holds them
+  struct MemoryUsage
+  {
+    size_t recordCount;
+    size_t records;  // the Records and their own buffers
+    size_t keys;     // their Botan keys, counted once per Record
+    size_t strings;  // the arena that the Records' strings live in
+    size_t index;    // the name shards, sorted lists and tombstones
+    size_t getTotal() const;
+    size_t getPerRecord() const;
+  };
+
+  // an immutable view of the Cache, safe to hold and read from any thread
+  class Snapshot
+  {
+   public:
+    Snapshot();
+    RecordPtr get(const std::string&) const;
+    SortedListPtr getSortedList() const;
+    size_t getRecordCount() const;
+    MemoryUsage getMemoryUsage() const;  // but for the arena
+
+   private:
+    friend class Cache;
+
+    // fully-qualified name (primary names and subdomains) -> owning Record
+    typedef std::unordered_map<std::string, RecordPtr> Shard;
+    typedef std::shared_ptr<const Shard> ShardPtr;
+    typedef std::unordered_set<const Record*> Tombstones;
+
+    void compact();
+
+    std::array<ShardPtr, SHARD_COUNT> shards_;
+    SortedListPtr sorted_;   // all Records by name, except those in pending_
+    SortedListPtr pending_;  // small sorted merge buffer of recent inserts
+    std::shared_ptr<const Tombstones> removed_;  // deleted from sorted_
+  };
+
+  typedef std::shared_ptr<const Snapshot> SnapshotPtr;
+
+  // Each call publishes a new Snapshot, copying every shard it touches, so
+  // a single change costs about getRecordCount() / SHARD_COUNT; many changes
+  // should go through the overloads that take a vector, as one Batch.
   static bool add(const RecordPtr& record);
-  static bool add(const std::vector<RecordPtr>&);
-  static std::vector<RecordPtr> getSortedList();
+  static bool add(const std::vector<RecordPtr>&,
+                  std::vector<size_t>* conflicts = nullptr);
+  static bool replace(const RecordPtr&);
+  static bool replace(const std::vector<RecordPtr>&,
+                      std::vector<size_t>* absent = nullptr);
+  static bool remove(const std::string&);
+  static bool remove(const std::vector<std::string>&,
+                     std::vector<size_t>* absent = nullptr);
+  static SortedListPtr getSortedList();
   static RecordPtr get(const std::string&);
   static size_t getRecordCount();
+  static SnapshotPtr getSnapshot();
+  static MemoryUsage getMemoryUsage();
+
+  static bool save(const std::string&);
+  static bool load(const std::string&);
 
  private:
-  static std::vector<RecordPtr> records_;
+  static const uint32_t FILE_MAGIC = 0x43534e4f;  // "ONSC"
+  static const uint32_t FILE_VERSION = 2;  // hashes of the binary encoding
+
+  // accumulates inserts against a base Snapshot, copying only touched shards
+  class Batch
+  {
+   public:
+    Batch(const SnapshotPtr&);
+    bool insert(const RecordPtr&);
+    bool insert(const std::vector<RecordPtr>&, std::vector<size_t>*);
+    bool insert(const RecordPtr&, const std::vector<std::string>&);
+    bool replace(const RecordPtr&);
+    bool remove(const std::string&);
+    SnapshotPtr commit() const;
+
+   private:
+    typedef std::shared_ptr<Snapshot::Shard> WritableShard;
+
+    RecordPtr find(const std::string&) const;
+    void erase(const RecordPtr&);
+    const Snapshot::Shard& getShard(size_t) const;
+    Snapshot::Shard& getWritableShard(size_t);
+    bool isAvailable(const std::string&) const;
+
+    SnapshotPtr base_;
+    std::array<WritableShard, SHARD_COUNT> dirty_;
+    std::vector<RecordPtr> added_, removed_;
+  };
+
+  static size_t getShardIndex(const std::string&);
+  static std::vector<std::string> getNames(const RecordPtr&);
+  static SortedListPtr merge(const std::vector<RecordPtr>&,
+                             const std::vector<RecordPtr>&,
+                             const Snapshot::Tombstones&);
+  static bool isLessThan(const RecordPtr&, const RecordPtr&);
+  static bool parseFile(const uint8_t*,
+                        size_t,
+                        std::vector<RecordPtr>&,
+                        std::vector<std::vector<std::string>>&);
+  static bool readBytes(const uint8_t*&, const uint8_t*, void*, size_t);
+
+  static StringArenaPtr arena_;   // shared by all Records in the Cache
+  static std::mutex writeMutex_;  // serializes writers, never taken by readers
+  static SnapshotPtr snapshot_;   // only accessed through std::atomic_*
 };
 
 #endif
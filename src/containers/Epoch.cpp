@@ -0,0 +1,262 @@
+
+#include "Epoch.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../encoding/Codec.hpp"
+#include <algorithm>
+#include <chrono>
+
+const size_t Epoch::MAX_INCREMENTAL_CHANGES;
+const size_t Epoch::MAX_INCREMENTAL_REMOVALS;
+std::mutex Epoch::buildMutex_;
+std::mutex Epoch::publishMutex_;
+EpochPtr Epoch::current_;
+
+
+// The returned Epoch never changes, later builds publish a new one. Until
+// the first is published it is the empty Epoch 0.
+EpochPtr Epoch::getCurrent()
+{
+  static const EpochPtr EMPTY(new Epoch(
+      0, std::make_shared<Cache::Snapshot>(),
+      std::make_shared<MerkleTree>(std::vector<RecordPtr>()),
+      std::make_shared<std::vector<Json::Value>>()));
+
+  auto current = std::atomic_load(&current_);
+  return current ? current : EMPTY;
+}
+
+
+
+// Builds the Epoch that follows the given one for the Records of the given
+// Snapshot, without publishing it. The base stays untouched and may serve
+// readers throughout. If the root turns out the same, so do the signatures.
+EpochPtr Epoch::build(const EpochPtr& base,
+                      const Cache::SnapshotPtr& snapshot,
+                      ThreadPool* pool)
+{
+  static Metrics::Histogram& buildTime = Metrics::get().histogram(
+      "onions_epoch_build_seconds", "Time taken to build the next Epoch.");
+
+  const auto start = std::chrono::steady_clock::now();
+  auto tree = updateTree(base->tree_, *base->snapshot_->getSortedList(),
+                         *snapshot->getSortedList(), pool);
+
+  auto signatures = tree->getRootHash() == base->root_
+                        ? base->signatures_
+                        : std::make_shared<std::vector<Json::Value>>();
+  EpochPtr next(new Epoch(base->number_ + 1, snapshot, tree, signatures));
+  buildTime.observeDuration(std::chrono::steady_clock::now() - start);
+  return next;
+}
+
+
+
+// builds the next Epoch from the Cache on a thread of its own
+std::future<EpochPtr> Epoch::buildAsync(ThreadPool* pool)
+{
+  return std::async(std::launch::async,
+                    [pool]()
+                    {
+                      return build(getCurrent(), Cache::getSnapshot(), pool);
+                    });
+}
+
+
+
+// Makes the Epoch current unless a newer one already is, in which case the
+// Epoch was built from a stale base and false is returned. Readers that
+// still hold the old Epoch keep it alive until they are done with it. If
+// the root is unchanged, signatures that addSignature attached to the
+// current Epoch while this one was built are carried over, so what becomes
+// current is then a copy of the Epoch with them.
+bool Epoch::publish(const EpochPtr& epoch)
+{
+  static Metrics::Gauge& number = Metrics::get().gauge(
+      "onions_epoch_number", "Number of the Epoch being served.");
+
+  std::lock_guard<std::mutex> guard(publishMutex_);
+  const auto current = getCurrent();
+  if (epoch->number_ <= current->number_)
+    return false;
+
+  EpochPtr next = epoch;
+  if (epoch->root_ == current->root_ &&
+      epoch->signatures_ != current->signatures_)
+  {
+    auto signatures =
+        std::make_shared<std::vector<Json::Value>>(*current->signatures_);
+    for (const auto& signature : *epoch->signatures_)
+      if (std::find(signatures->begin(), signatures->end(), signature) ==
+          signatures->end())
+        signatures->push_back(signature);
+    next = EpochPtr(new Epoch(epoch->number_, epoch->snapshot_, epoch->tree_,
+                              signatures));
+  }
+
+  std::atomic_store(&current_, next);
+  number.set(static_cast<double>(epoch->number_));
+  LOG_NOTICE("Serving epoch " + std::to_string(epoch->number_) + " of " +
+             std::to_string(epoch->snapshot_->getRecordCount()) +
+             " Records, root " +
+             Codec::base64Encode(epoch->root_.data(), epoch->root_.size()));
+  return true;
+}
+
+
+
+// builds the next Epoch from the Cache and publishes it, one build at a time
+EpochPtr Epoch::rebuild(ThreadPool* pool)
+{
+  std::lock_guard<std::mutex> guard(buildMutex_);
+
+  const auto base = getCurrent();
+  const auto snapshot = Cache::getSnapshot();
+  if (snapshot == base->snapshot_)
+    return base;
+
+  const auto next = build(base, snapshot, pool);
+  return publish(next) ? getCurrent() : next;
+}
+
+
+
+// Attaches a Quorum signature to the current Epoch if it is of that Epoch's
+// root, publishing a copy that shares everything else. Signatures are not
+// checked here but by whoever received them.
+bool Epoch::addSignature(const SHA384_HASH& root, const Json::Value& signature)
+{
+  std::lock_guard<std::mutex> guard(publishMutex_);
+
+  const auto current = getCurrent();
+  if (current->root_ != root)
+    return false;
+
+  auto signatures =
+      std::make_shared<std::vector<Json::Value>>(*current->signatures_);
+  signatures->push_back(signature);
+  std::atomic_store(&current_,
+                    EpochPtr(new Epoch(current->number_, current->snapshot_,
+                                       current->tree_, signatures)));
+  return true;
+}
+
+
+
+uint64_t Epoch::getNumber() const
+{
+  return number_;
+}
+
+
+
+const Cache::SnapshotPtr& Epoch::getSnapshot() const
+{
+  return snapshot_;
+}
+
+
+
+const MerkleTree& Epoch::getTree() const
+{
+  return *tree_;
+}
+
+
+
+// for holding on to the tree, as a ProofCache entry might
+const Epoch::TreePtr& Epoch::getTreePtr() const
+{
+  return tree_;
+}
+
+
+
+const SHA384_HASH& Epoch::getRootHash() const
+{
+  return root_;
+}
+
+
+
+const std::vector<Json::Value>& Epoch::getSignatures() const
+{
+  return *signatures_;
+}
+
+
+
+RecordPtr Epoch::get(const std::string& name) const
+{
+  return snapshot_->get(name);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Epoch::Epoch(uint64_t number,
+             const Cache::SnapshotPtr& snapshot,
+             const TreePtr& tree,
+             const SignaturesPtr& signatures)
+    : number_(number),
+      snapshot_(snapshot),
+      tree_(tree),
+      root_(tree->getRootHash()),
+      signatures_(signatures)
+{
+}
+
+
+
+// Returns the tree for the new Records, given the tree for the old ones.
+// Both lists are in name order, and a Record in the Cache is never modified,
+// only replaced, so walking them together finds every change by comparing
+// pointers. A few changes are applied to a copy of the old tree, which only
+// rehashes the paths they touch; a removal shifts every later leaf, so more
+// than a few of those, or many changes of any kind, rebuild from scratch.
+Epoch::TreePtr Epoch::updateTree(const TreePtr& tree,
+                                 const std::vector<RecordPtr>& before,
+                                 const std::vector<RecordPtr>& after,
+                                 ThreadPool* pool)
+{
+  std::vector<RecordPtr> added, replaced;
+  std::vector<std::string> removed;
+  auto old = before.begin();
+  auto now = after.begin();
+  while (old != before.end() || now != after.end())
+  {
+    if (now == after.end() ||
+        (old != before.end() &&
+         (*old)->getNameRef() < (*now)->getNameRef()))
+      removed.push_back((*old++)->getName());
+    else if (old == before.end() ||
+             (*now)->getNameRef() < (*old)->getNameRef())
+      added.push_back(*now++);
+    else
+    {
+      if (*old != *now)
+        replaced.push_back(*now);
+      ++old;
+      ++now;
+    }
+
+    if (removed.size() > MAX_INCREMENTAL_REMOVALS ||
+        added.size() + replaced.size() + removed.size() >
+            MAX_INCREMENTAL_CHANGES)
+      return std::make_shared<MerkleTree>(after, pool);
+  }
+
+  if (added.empty() && replaced.empty() && removed.empty())
+    return tree;
+
+  auto updated = std::make_shared<MerkleTree>(*tree);
+  for (const auto& name : removed)
+    updated->remove(name);
+  updated->insert(added);
+  for (const auto& record : replaced)
+    updated->replace(record);
+  return updated;
+}
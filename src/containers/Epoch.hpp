@@ -0,0 +1,72 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include "Cache.hpp"
+#include "MerkleTree.hpp"
+#include <json/json.h>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Epoch;
+typedef std::shared_ptr<const Epoch> EpochPtr;
+
+// An immutable version of everything a mirror serves: a Cache Snapshot, the
+// MerkleTree of its Records, that tree's root and the Quorum's signatures of
+// the root. A request takes the current Epoch once and answers from it
+// alone, so it never sees a tree that disagrees with the Records or one that
+// is half built. The next Epoch is built to the side while the current one
+// keeps serving; it shares every unchanged Record and Cache shard, updates a
+// copy of the current tree in place when few Records changed, and becomes
+// current with a single atomic store. Readers never take a lock.
+class Epoch
+{
+ public:
+  typedef std::shared_ptr<const MerkleTree> TreePtr;
+  typedef std::shared_ptr<const std::vector<Json::Value>> SignaturesPtr;
+
+  // more changes than this, or any more removals, and the tree is rebuilt
+  static const size_t MAX_INCREMENTAL_CHANGES = 4096;
+  static const size_t MAX_INCREMENTAL_REMOVALS = 16;
+
+  static EpochPtr getCurrent();
+  static EpochPtr build(const EpochPtr&,
+                        const Cache::SnapshotPtr&,
+                        ThreadPool* pool = nullptr);
+  static std::future<EpochPtr> buildAsync(ThreadPool* pool = nullptr);
+  static bool publish(const EpochPtr&);
+  static EpochPtr rebuild(ThreadPool* pool = nullptr);
+  static bool addSignature(const SHA384_HASH&, const Json::Value&);
+
+  uint64_t getNumber() const;
+  const Cache::SnapshotPtr& getSnapshot() const;
+  const MerkleTree& getTree() const;
+  const TreePtr& getTreePtr() const;
+  const SHA384_HASH& getRootHash() const;
+  const std::vector<Json::Value>& getSignatures() const;
+  RecordPtr get(const std::string&) const;
+
+ private:
+  Epoch(uint64_t,
+        const Cache::SnapshotPtr&,
+        const TreePtr&,
+        const SignaturesPtr&);
+
+  static TreePtr updateTree(const TreePtr&,
+                            const std::vector<RecordPtr>&,
+                            const std::vector<RecordPtr>&,
+                            ThreadPool*);
+
+  uint64_t number_;
+  Cache::SnapshotPtr snapshot_;
+  TreePtr tree_;
+  SHA384_HASH root_;
+  SignaturesPtr signatures_;
+
+  static std::mutex buildMutex_;    // one rebuild at a time
+  static std::mutex publishMutex_;  // serializes publishers, not readers
+  static EpochPtr current_;         // only accessed through std::atomic_*
+};
+
+#endif
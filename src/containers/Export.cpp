@@ -0,0 +1,487 @@
+
+#include "Export.hpp"
+#include "../Common.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../crypto/Sha2.hpp"
+#include "../encoding/Codec.hpp"
+#include <algorithm>
+#include <iterator>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const uint32_t Export::MAGIC;
+const uint32_t Export::VERSION;
+const size_t Export::HEADER_LEN;
+const size_t Export::ENTRY_LEN;
+const size_t Export::CHUNK_SIZE;
+const size_t Export::MAX_RANGE;
+const size_t Export::MAX_CHUNKS;
+const std::string Export::REQUEST_TYPE = "getExport";
+std::mutex Export::publishMutex_;
+ExportPtr Export::current_;
+
+
+// Makes the Epoch's export current, writing it into the directory unless
+// the current export already has its root or an earlier run left one for
+// it there. The previous file is unlinked, but peers still streaming it
+// keep reading through its open descriptor. Returns nullptr, leaving the
+// current export in place, if the file cannot be written.
+ExportPtr Export::publish(const EpochPtr& epoch, const std::string& directory)
+{
+  static Metrics::Histogram& writeTime = Metrics::get().histogram(
+      "onions_export_write_seconds", "Time taken to write an export.");
+
+  std::lock_guard<std::mutex> guard(publishMutex_);
+  const ExportPtr previous = getCurrent();
+  const SHA384_HASH& root = epoch->getRootHash();
+  if (previous && previous->getRootHash() == root)
+    return previous;
+
+  const std::string path = directory + "/export-" +
+                           Codec::hexEncode(root.data(), root.size()) + ".bin";
+  ExportPtr fresh = open(path, root);
+  if (!fresh)
+  {
+    const auto start = std::chrono::steady_clock::now();
+    if (!write(*epoch, path) || !(fresh = open(path, root)))
+    {
+      Log::get().warn("Failed to write export " + path);
+      return nullptr;
+    }
+
+    writeTime.observeDuration(std::chrono::steady_clock::now() - start);
+  }
+
+  std::atomic_store(&current_, fresh);
+  if (previous && previous->getPath() != path)
+    std::remove(previous->getPath().c_str());
+
+  LOG_NOTICE("Exporting " + std::to_string(fresh->getRecordCount()) +
+             " Records in " + std::to_string(fresh->getSize()) + " bytes");
+  return fresh;
+}
+
+
+
+// the export that "getExport" requests are served from, or nullptr
+ExportPtr Export::getCurrent()
+{
+  return std::atomic_load(&current_);
+}
+
+
+
+// For a "getExport" request, describes the range of the current export to
+// send after the response and throws if the request cannot be served.
+Json::Value Export::answer(const std::string& text, Range& range)
+{
+  static Metrics::Counter& served = Metrics::get().counter(
+      "onions_export_requested_bytes_total",
+      "Bytes of exports requested by syncing peers.");
+
+  Json::Value request;
+  Json::Reader reader;
+  if (!reader.parse(text, request) || !request.isObject() ||
+      !request["offset"].isUInt64() ||
+      (request.isMember("length") && !request["length"].isUInt64()) ||
+      (request.isMember("root") && !request["root"].isString()))
+    Log::get().error("Malformed export request.");
+
+  const ExportPtr current = getCurrent();
+  if (!current)
+    Log::get().error("No export is available.");
+
+  const std::string root =
+      Codec::base64Encode(current->root_.data(), current->root_.size());
+  if (request.isMember("root") && request["root"].asString() != root)
+    Log::get().error("The export has moved on to another root.");
+
+  const uint64_t offset = request["offset"].asUInt64();
+  if (offset > current->size_)
+    Log::get().error("The offset is past the end of the export.");
+
+  uint64_t length = std::min<uint64_t>(current->size_ - offset, MAX_RANGE);
+  if (request.isMember("length"))
+    length = std::min<uint64_t>(length, request["length"].asUInt64());
+
+  range = {current, offset, length};
+  served.add(length);
+
+  Json::Value result;
+  result["root"] = root;
+  result["size"] = static_cast<Json::UInt64>(current->size_);
+  result["offset"] = static_cast<Json::UInt64>(offset);
+  result["length"] = static_cast<Json::UInt64>(length);
+  return result;
+}
+
+
+
+Export::~Export()
+{
+  close(fd_);
+}
+
+
+
+const std::string& Export::getPath() const
+{
+  return path_;
+}
+
+
+
+const SHA384_HASH& Export::getRootHash() const
+{
+  return root_;
+}
+
+
+
+uint64_t Export::getRecordCount() const
+{
+  return recordCount_;
+}
+
+
+
+uint64_t Export::getSize() const
+{
+  return size_;
+}
+
+
+
+// open for reading for as long as the Export lives
+int Export::getFileDescriptor() const
+{
+  return fd_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Export::Export(const std::string& path,
+               int fd,
+               uint64_t size,
+               const SHA384_HASH& root,
+               uint64_t recordCount)
+    : path_(path), fd_(fd), size_(size), root_(root), recordCount_(recordCount)
+{
+}
+
+
+
+// Lays the chunks out from the Records' encoded lengths first, so that the
+// table can go ahead of them, then encodes one chunk at a time into a
+// reused buffer and fills in the checksums at the end.
+bool Export::write(const Epoch& epoch, const std::string& path)
+{
+  struct Layout
+  {
+    uint32_t length, records;
+  };
+
+  const auto records = epoch.getSnapshot()->getSortedList();
+  std::vector<Layout> chunks;
+  for (const auto& r : *records)
+  {
+    const size_t length = 4 + r->getEncodedLength(r->isValid());
+    if (chunks.empty() || chunks.back().length + length > CHUNK_SIZE)
+      chunks.push_back({0, 0});
+    chunks.back().length += length;
+    chunks.back().records++;
+  }
+
+  // the partial file is removed on every way out but the rename, after the
+  // stream below has closed it
+  const std::string tmpPath = path + ".tmp";
+  struct TmpGuard
+  {
+    const std::string& path;
+    bool renamed;
+    ~TmpGuard()
+    {
+      if (!renamed)
+        std::remove(path.c_str());
+    }
+  } guard = {tmpPath, false};
+
+  std::ofstream file(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+  if (!file.is_open())
+    return false;
+
+  uint8_t header[HEADER_LEN];
+  putInteger(header, MAGIC, 4);
+  putInteger(header + 4, VERSION, 4);
+  std::memcpy(header + 8, epoch.getRootHash().data(), Const::SHA384_LEN);
+  putInteger(header + 56, records->size(), 8);
+  putInteger(header + 64, chunks.size(), 4);
+  file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+  std::vector<uint8_t> table(chunks.size() * ENTRY_LEN, 0);
+  file.write(reinterpret_cast<const char*>(table.data()), table.size());
+
+  std::vector<uint8_t> buffer;
+  uint64_t offset = HEADER_LEN + table.size();
+  size_t next = 0;
+  for (size_t c = 0; c < chunks.size(); c++)
+  {
+    buffer.resize(chunks[c].length);
+    uint8_t* pos = buffer.data();
+    for (uint32_t k = 0; k < chunks[c].records; k++)
+    {
+      const RecordPtr& r = (*records)[next++];
+      const size_t length = r->getEncodedLength(r->isValid());
+      putInteger(pos, length, 4);
+      if (r->encode(pos + 4, length, r->isValid()) != length)
+        return false;
+      pos += 4 + length;
+    }
+
+    uint8_t* entry = table.data() + c * ENTRY_LEN;
+    putInteger(entry, offset, 8);
+    putInteger(entry + 8, chunks[c].length, 4);
+    putInteger(entry + 12, chunks[c].records, 4);
+    Sha2::sha384(buffer.data(), buffer.size(), entry + 16);
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    offset += buffer.size();
+  }
+
+  file.seekp(HEADER_LEN);
+  file.write(reinterpret_cast<const char*>(table.data()), table.size());
+  file.close();
+  guard.renamed =
+      !file.fail() && std::rename(tmpPath.c_str(), path.c_str()) == 0;
+  return guard.renamed;
+}
+
+
+
+// the export at the path, or nullptr if there is none for the root
+ExportPtr Export::open(const std::string& path, const SHA384_HASH& root)
+{
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  uint8_t header[HEADER_LEN];
+  if (fstat(fd, &info) != 0 ||
+      pread(fd, header, HEADER_LEN, 0) != static_cast<ssize_t>(HEADER_LEN) ||
+      getInteger(header, 4) != MAGIC || getInteger(header + 4, 4) != VERSION ||
+      std::memcmp(header + 8, root.data(), root.size()) != 0)
+  {
+    close(fd);
+    return nullptr;
+  }
+
+  return ExportPtr(
+      new Export(path, fd, info.st_size, root, getInteger(header + 56, 8)));
+}
+
+
+
+void Export::putInteger(uint8_t* out, uint64_t value, size_t bytes)
+{
+  for (size_t j = 0; j < bytes; j++)
+    out[j] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - j)));
+}
+
+
+
+uint64_t Export::getInteger(const uint8_t* in, size_t bytes)
+{
+  uint64_t value = 0;
+  for (size_t j = 0; j < bytes; j++)
+    value = (value << 8) | in[j];
+  return value;
+}
+
+
+
+// ************************** SUBCLASS METHODS **************************** //
+
+
+
+Export::Reader::Reader()
+    : offset_(0), parsed_(false), recordCount_(0), next_(0)
+{
+  root_.fill(0);
+}
+
+
+
+// Appends the encodings of the chunks that the bytes complete. Returns
+// false if the header is invalid, in which case the Reader starts over, or
+// if a chunk fails its checksum, in which case the peer should be asked
+// again from getOffset(), the start of that chunk.
+bool Export::Reader::feed(const uint8_t* data,
+                          size_t len,
+                          std::vector<std::string>& encodings)
+{
+  while (!isDone())
+  {
+    if (!parsed_ && buffer_.size() == HEADER_LEN && !parseHeader())
+    {
+      buffer_.clear();
+      return false;
+    }
+
+    const size_t needed =
+        parsed_ ? chunks_[next_].length
+                : buffer_.size() < HEADER_LEN
+                      ? HEADER_LEN
+                      : HEADER_LEN + chunks_.size() * ENTRY_LEN;
+    if (buffer_.size() < needed)
+    {
+      if (len == 0)
+        return true;
+
+      const size_t take = std::min(len, needed - buffer_.size());
+      buffer_.append(reinterpret_cast<const char*>(data), take);
+      data += take;
+      len -= take;
+      continue;
+    }
+
+    if (!parsed_)
+    {  // the table, now that all of it is here
+      uint64_t offset = buffer_.size(), records = 0;
+      const uint8_t* entry =
+          reinterpret_cast<const uint8_t*>(buffer_.data()) + HEADER_LEN;
+      for (auto& chunk : chunks_)
+      {
+        chunk.offset = getInteger(entry, 8);
+        chunk.length = static_cast<uint32_t>(getInteger(entry + 8, 4));
+        chunk.records = static_cast<uint32_t>(getInteger(entry + 12, 4));
+        std::memcpy(chunk.hash.data(), entry + 16, chunk.hash.size());
+        entry += ENTRY_LEN;
+
+        // each Record takes at least its 4-byte length
+        if (chunk.offset != offset || chunk.length == 0 ||
+            chunk.length > CHUNK_SIZE + 4 + Common::MAX_RECORD_LENGTH ||
+            chunk.records > chunk.length / 4)
+        {
+          buffer_.clear();
+          return false;
+        }
+
+        offset += chunk.length;
+        records += chunk.records;
+      }
+
+      if (records != recordCount_)
+      {
+        buffer_.clear();
+        return false;
+      }
+
+      offset_ = buffer_.size();
+      buffer_.clear();
+      parsed_ = true;
+      continue;
+    }
+
+    if (!parseChunk(chunks_[next_], encodings))
+    {
+      buffer_.clear();
+      return false;
+    }
+
+    offset_ += buffer_.size();
+    buffer_.clear();
+    next_++;
+  }
+
+  return len == 0;  // nothing follows the last chunk
+}
+
+
+
+// where the next range should start, including a partly received chunk
+uint64_t Export::Reader::getOffset() const
+{
+  return offset_ + buffer_.size();
+}
+
+
+
+bool Export::Reader::isDone() const
+{
+  return parsed_ && next_ == chunks_.size();
+}
+
+
+
+const SHA384_HASH& Export::Reader::getRootHash() const
+{
+  return root_;
+}
+
+
+
+uint64_t Export::Reader::getRecordCount() const
+{
+  return recordCount_;
+}
+
+
+
+// checks the fixed part of the header, sizing the table that follows it
+bool Export::Reader::parseHeader()
+{
+  const uint8_t* header = reinterpret_cast<const uint8_t*>(buffer_.data());
+  const uint64_t chunks = getInteger(header + 64, 4);
+  if (getInteger(header, 4) != MAGIC || getInteger(header + 4, 4) != VERSION ||
+      chunks > MAX_CHUNKS)
+    return false;
+
+  std::memcpy(root_.data(), header + 8, root_.size());
+  recordCount_ = getInteger(header + 56, 8);
+  chunks_.resize(chunks);
+  return true;
+}
+
+
+
+// the chunk in buffer_, all or nothing
+bool Export::Reader::parseChunk(const Chunk& chunk,
+                                std::vector<std::string>& encodings) const
+{
+  SHA384_HASH hash;
+  const uint8_t* pos = reinterpret_cast<const uint8_t*>(buffer_.data());
+  Sha2::sha384(pos, buffer_.size(), hash.data());
+  if (hash != chunk.hash)
+    return false;
+
+  const uint8_t* end = pos + buffer_.size();
+  std::vector<std::string> parsed;
+  parsed.reserve(chunk.records);
+  while (end - pos >= 4)
+  {
+    const size_t length = getInteger(pos, 4);
+    pos += 4;
+    if (length > Common::MAX_RECORD_LENGTH ||
+        length > static_cast<size_t>(end - pos))
+      return false;
+
+    parsed.emplace_back(reinterpret_cast<const char*>(pos), length);
+    pos += length;
+  }
+
+  if (pos != end || parsed.size() != chunk.records)
+    return false;
+
+  std::move(parsed.begin(), parsed.end(), std::back_inserter(encodings));
+  return true;
+}
@@ -0,0 +1,116 @@
+#ifndef EXPORT_HPP
+#define EXPORT_HPP
+
+#include "Epoch.hpp"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class Export;
+typedef std::shared_ptr<const Export> ExportPtr;
+
+// An Epoch's Records as one ordered, chunked and checksummed file, written
+// once per root, which mirrors stream to syncing peers straight from the
+// page cache. All integers are big-endian. The file begins with a header
+//   magic, version (4 bytes each), root (48), Records (8), chunks (4)
+// and a table of one entry per chunk
+//   offset (8), length (4), Records (4), SHA-384 of the chunk (48)
+// followed by the chunks, each holding whole Records in name order as a
+// 4-byte length and the encoding from Record::asBinary. Peers ask for
+// ranges of it by offset, so a sync that breaks off resumes where it
+// stopped, and they check every chunk as it completes. The checksums only
+// guard the transfer; a peer trusts the Records once the MerkleTree it
+// builds from them has the root that the Quorum signed.
+//
+// The "getExport" request's value is the JSON text of
+//   {"root": base64, "offset": n, "length": n}
+// where the root, if present, must be the current export's, and the
+// length is capped at MAX_RANGE. The response's value is
+//   {"root": base64, "size": n, "offset": n, "length": n}
+// and the length bytes of the file from the offset follow the response
+// immediately, outside of any framing.
+class Export
+{
+ public:
+  static const uint32_t MAGIC = 0x58534e4f;  // "ONSX"
+  static const uint32_t VERSION = 1;
+  static const size_t HEADER_LEN = 68;
+  static const size_t ENTRY_LEN = 64;      // per chunk in the table
+  static const size_t CHUNK_SIZE = 1 << 20;  // bytes, unless a Record is larger
+  static const size_t MAX_RANGE = 16 << 20;  // bytes per request
+  static const size_t MAX_CHUNKS = 1 << 20;  // bounds a Reader's table
+  static const std::string REQUEST_TYPE;
+
+  // what a request for a range of the current export gets
+  struct Range
+  {
+    ExportPtr source;
+    uint64_t offset, length;
+  };
+
+  // Takes an export as it arrives, in order from any offset it asked for,
+  // and gives the encodings of the Records of every chunk that completes
+  // and matches its checksum.
+  class Reader
+  {
+   public:
+    Reader();
+    bool feed(const uint8_t*, size_t, std::vector<std::string>&);
+    uint64_t getOffset() const;
+    bool isDone() const;
+    const SHA384_HASH& getRootHash() const;
+    uint64_t getRecordCount() const;
+
+   private:
+    struct Chunk
+    {
+      uint64_t offset;
+      uint32_t length, records;
+      SHA384_HASH hash;
+    };
+
+    bool parseHeader();
+    bool parseChunk(const Chunk&, std::vector<std::string>&) const;
+
+    std::string buffer_;  // from offset_ on, never more than one chunk
+    uint64_t offset_;
+    bool parsed_;
+    SHA384_HASH root_;
+    uint64_t recordCount_;
+    std::vector<Chunk> chunks_;
+    size_t next_;  // the chunk buffer_ is filling
+  };
+
+  static ExportPtr publish(const EpochPtr&, const std::string&);
+  static ExportPtr getCurrent();
+  static Json::Value answer(const std::string&, Range&);
+
+  ~Export();
+  const std::string& getPath() const;
+  const SHA384_HASH& getRootHash() const;
+  uint64_t getRecordCount() const;
+  uint64_t getSize() const;
+  int getFileDescriptor() const;
+
+ private:
+  Export(const std::string&, int, uint64_t, const SHA384_HASH&, uint64_t);
+  Export(const Export&) = delete;
+  void operator=(const Export&) = delete;
+
+  static bool write(const Epoch&, const std::string&);
+  static ExportPtr open(const std::string&, const SHA384_HASH&);
+  static void putInteger(uint8_t*, uint64_t, size_t);
+  static uint64_t getInteger(const uint8_t*, size_t);
+
+  const std::string path_;
+  const int fd_;  // kept open, so that ranges still come after an unlink
+  const uint64_t size_;
+  const SHA384_HASH root_;
+  const uint64_t recordCount_;
+
+  static std::mutex publishMutex_;  // serializes publishers, not readers
+  static ExportPtr current_;        // only accessed through std::atomic_*
+};
+
+#endif
@@ -0,0 +1,272 @@
+
+#include "MerkleProof.hpp"
+#include "../crypto/Sha2.hpp"
+#include <cstring>
+
+
+// writes a single path proof, returning its size or 0 if it does not fit
+size_t MerkleProof::encode(const Path& path, uint8_t* out, size_t capacity)
+{
+  if (2 + getSize(path) > capacity)
+    return 0;
+
+  out[0] = VERSION;
+  out[1] = 0;
+  return writePath(path, out + 2) - out;
+}
+
+
+
+// writes a span proof; the right path's height is where it meets the left
+size_t MerkleProof::encode(const Path& left,
+                           const Path& right,
+                           uint8_t* out,
+                           size_t capacity)
+{
+  if (right.height > left.height ||
+      2 + getSize(left) + getSize(right) > capacity)
+    return 0;
+
+  out[0] = VERSION;
+  out[1] = SPAN;
+  return writePath(right, writePath(left, out + 2)) - out;
+}
+
+
+
+MerkleProof::MerkleProof() : span_(false)
+{
+  memset(&left_, 0, sizeof(left_));
+  memset(&right_, 0, sizeof(right_));
+}
+
+
+
+// the buffer must outlive this object, whose paths point into it
+bool MerkleProof::parse(const uint8_t* data, size_t length)
+{
+  const uint8_t* end = data + length;
+  if (length < 2 || data[0] != VERSION || (data[1] & ~SPAN) != 0)
+    return false;
+
+  span_ = data[1] & SPAN;
+  data += 2;
+
+  if (!readPath(data, end, left_))
+    return false;
+  if (span_ && (!readPath(data, end, right_) || right_.height > left_.height))
+    return false;
+
+  return data == end;
+}
+
+
+
+bool MerkleProof::isSpan() const
+{
+  return span_;
+}
+
+
+
+const MerkleProof::Path& MerkleProof::getLeft() const
+{
+  return left_;
+}
+
+
+
+const MerkleProof::Path& MerkleProof::getRight() const
+{
+  return right_;
+}
+
+
+
+// Hashes the left path up to the root. For a span, the right path must
+// rejoin it with the same hash where it stops, and the two leaves must be
+// neighbours (or the same leaf, at either end of the tree).
+bool MerkleProof::computeRoot(SHA384_HASH& root) const
+{
+  if (!span_)
+  {
+    climb(left_, 0, left_.height, root.data());
+    return true;
+  }
+
+  const size_t meet = right_.height;
+  SHA384_HASH fromLeft, fromRight;
+  climb(left_, 0, meet, fromLeft.data());
+  climb(right_, 0, meet, fromRight.data());
+  if (fromLeft != fromRight)
+    return false;
+
+  const uint32_t below = meet < 32 ? (uint32_t(1) << meet) - 1 : ~uint32_t(0);
+  const uint64_t leftIndex = left_.directions;
+  const uint64_t rightIndex =
+      (left_.directions & ~below) | (right_.directions & below);
+  if (rightIndex != leftIndex && rightIndex != leftIndex + 1)
+    return false;
+
+  // continue upwards from where the paths met
+  Path upper = left_;
+  upper.leaf = fromLeft.data();
+  climb(upper, meet, left_.height, root.data());
+  return true;
+}
+
+
+
+// Mirrors MerkleTree::doesContain: a path must lead to the Record itself,
+// while a span must bound its name, or, when both paths give one leaf, put
+// the name before the first leaf or after the last. Either way the hashes
+// must be coherent; the caller compares computeRoot() against a trusted root.
+bool MerkleProof::doesContain(const RecordPtr& record) const
+{
+  SHA384_HASH root;
+  if (!computeRoot(root))
+    return false;
+
+  const StringRef& name = record->getNameRef();
+  const StringRef leftName(left_.name, left_.nameLength);
+
+  if (!span_)
+  {
+    SHA384_HASH hash = record->getHash();
+    return leftName == name &&
+           memcmp(left_.leaf, hash.data(), Const::SHA384_LEN) == 0;
+  }
+
+  if (right_.height == 0)
+  {  // one leaf at either end of the tree, as for MerkleTree::verifySpan
+    if (name < leftName)
+      return left_.directions == 0;
+    const uint32_t used = left_.height < 32
+                              ? (uint32_t(1) << left_.height) - 1
+                              : ~uint32_t(0);
+    return leftName < name && (left_.directions | left_.selfPaired) == used;
+  }
+
+  const StringRef rightName(right_.name, right_.nameLength);
+  return leftName < name && name < rightName;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+size_t MerkleProof::getSize(const Path& path)
+{
+  size_t siblings = 0;
+  for (size_t level = 0; level < path.height; level++)
+    if (!(path.selfPaired & (uint32_t(1) << level)))
+      siblings++;
+
+  return 1 + path.nameLength + 1 + 8 + (1 + siblings) * Const::SHA384_LEN;
+}
+
+
+
+uint8_t* MerkleProof::writePath(const Path& path, uint8_t* out)
+{
+  *out++ = path.nameLength;
+  memcpy(out, path.name, path.nameLength);
+  out += path.nameLength;
+  *out++ = path.height;
+
+  for (uint32_t bits : {path.directions, path.selfPaired})
+    for (int shift = 24; shift >= 0; shift -= 8)
+      *out++ = static_cast<uint8_t>(bits >> shift);
+
+  memcpy(out, path.leaf, Const::SHA384_LEN);
+  out += Const::SHA384_LEN;
+
+  for (size_t level = 0; level < path.height; level++)
+  {
+    if (path.selfPaired & (uint32_t(1) << level))
+      continue;
+    memcpy(out, path.siblings[level], Const::SHA384_LEN);
+    out += Const::SHA384_LEN;
+  }
+
+  return out;
+}
+
+
+
+bool MerkleProof::readPath(const uint8_t*& data, const uint8_t* end, Path& path)
+{
+  if (end - data < 1 || end - data < 1 + data[0] + 1 + 8)
+    return false;
+
+  path.nameLength = *data++;
+  path.name = reinterpret_cast<const char*>(data);
+  data += path.nameLength;
+
+  path.height = *data++;
+  if (path.height > MAX_HEIGHT)
+    return false;
+
+  for (uint32_t* bits : {&path.directions, &path.selfPaired})
+  {
+    *bits = 0;
+    for (int n = 0; n < 4; n++)
+      *bits = (*bits << 8) | *data++;
+  }
+
+  // bits above the height would make equal proofs compare differently
+  const uint32_t used = path.height < 32 ? (uint32_t(1) << path.height) - 1
+                                         : ~uint32_t(0);
+  if ((path.directions | path.selfPaired) & ~used)
+    return false;
+  if (path.directions & path.selfPaired)
+    return false;  // only a left child can be missing its sibling
+
+  if (end - data < static_cast<ptrdiff_t>(Const::SHA384_LEN))
+    return false;
+  path.leaf = data;
+  data += Const::SHA384_LEN;
+
+  for (size_t level = 0; level < path.height; level++)
+  {
+    path.siblings[level] = nullptr;
+    if (path.selfPaired & (uint32_t(1) << level))
+      continue;
+
+    if (end - data < static_cast<ptrdiff_t>(Const::SHA384_LEN))
+      return false;
+    path.siblings[level] = data;
+    data += Const::SHA384_LEN;
+  }
+
+  return true;
+}
+
+
+
+// hashes from the node at level "from" (given as path.leaf) up to level "to"
+void MerkleProof::climb(const Path& path,
+                        size_t from,
+                        size_t to,
+                        uint8_t* out)
+{
+  uint8_t node[Const::SHA384_LEN];
+  memcpy(node, path.leaf, Const::SHA384_LEN);
+
+  for (size_t level = from; level < to; level++)
+  {
+    const uint32_t bit = uint32_t(1) << level;
+    const uint8_t* sibling =
+        path.selfPaired & bit ? node : path.siblings[level];
+
+    uint8_t pair[2 * Const::SHA384_LEN];
+    const bool right = (path.directions & bit) != 0;
+    memcpy(pair + (right ? Const::SHA384_LEN : 0), node, Const::SHA384_LEN);
+    memcpy(pair + (right ? 0 : Const::SHA384_LEN), sibling, Const::SHA384_LEN);
+    Sha2::sha384(pair, sizeof(pair), node);
+  }
+
+  memcpy(out, node, Const::SHA384_LEN);
+}
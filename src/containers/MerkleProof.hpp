@@ -0,0 +1,62 @@
+#ifndef MERKLE_PROOF_HPP
+#define MERKLE_PROOF_HPP
+
+#include "records/Record.hpp"
+#include "../Constants.hpp"
+
+// Binary counterpart to the JSON subtrees from MerkleTree::generateSubtree,
+// about a third of their size. Integers are big-endian. The layout is
+//   header: uint8 version, uint8 flags
+//   path:   uint8 name length, name, uint8 height,
+//           uint32 direction bits, uint32 self-paired bits,
+//           48-byte leaf hash, then a 48-byte sibling for each level from
+//           the leaf upwards, except those that are self-paired
+// A span (flag SPAN) is the left path followed by the right path. The right
+// path stops at the level where the two meet and shares the left path's
+// hashes above that. Encoding and parsing work in place on the caller's
+// buffer and never allocate.
+class MerkleProof
+{
+ public:
+  static const uint8_t VERSION = 1;
+  static const uint8_t SPAN = 0x01;
+  static const size_t MAX_HEIGHT = 32;  // direction bits per path
+  static const size_t MAX_NAME_LEN = 255;
+  static const size_t MAX_PATH_SIZE =
+      1 + MAX_NAME_LEN + 1 + 8 + (MAX_HEIGHT + 1) * Const::SHA384_LEN;
+  static const size_t MAX_SIZE = 2 + 2 * MAX_PATH_SIZE;
+
+  // a path from a leaf towards the root, pointing into someone else's memory
+  struct Path
+  {
+    const char* name;
+    uint8_t nameLength;
+    uint8_t height;        // levels below the root, at most MAX_HEIGHT
+    uint32_t directions;   // bit i: the node at level i is a right child
+    uint32_t selfPaired;   // bit i: the node at level i has no sibling
+    const uint8_t* leaf;   // Const::SHA384_LEN bytes
+    const uint8_t* siblings[MAX_HEIGHT];  // null where self-paired
+  };
+
+  static size_t encode(const Path&, uint8_t*, size_t);
+  static size_t encode(const Path&, const Path&, uint8_t*, size_t);
+
+  MerkleProof();
+  bool parse(const uint8_t*, size_t);
+  bool isSpan() const;
+  const Path& getLeft() const;  // the only path if this is not a span
+  const Path& getRight() const;
+  bool computeRoot(SHA384_HASH&) const;
+  bool doesContain(const RecordPtr&) const;
+
+ private:
+  static size_t getSize(const Path&);
+  static uint8_t* writePath(const Path&, uint8_t*);
+  static bool readPath(const uint8_t*&, const uint8_t*, Path&);
+  static void climb(const Path&, size_t, size_t, uint8_t*);
+
+  bool span_;
+  Path left_, right_;
+};
+
+#endif
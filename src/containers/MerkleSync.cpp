@@ -0,0 +1,408 @@
+
+#include "MerkleSync.hpp"
+#include "Cache.hpp"
+#include "../Common.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../encoding/Codec.hpp"
+#include <algorithm>
+
+const size_t MerkleSync::FANOUT;
+const size_t MerkleSync::LIST_THRESHOLD;
+const size_t MerkleSync::MAX_RANGES;
+const size_t MerkleSync::MAX_ROUNDS;
+const std::string MerkleSync::REQUEST_TYPE = "syncRanges";
+
+// The peer's side: for a "syncRanges" handler, answers the request's
+// value, comparing each range with the tree and throwing if it is malformed.
+Json::Value MerkleSync::answer(const MerkleTree& tree, const std::string& text)
+{
+  Json::Value request;
+  Json::Reader reader;
+  if (!reader.parse(text, request) || !request["ranges"].isArray() ||
+      request["ranges"].size() > MAX_RANGES)
+    Log::get().error("Malformed sync request.");
+
+  const SHA384_HASH root = tree.getRootHash();
+  Json::Value result;
+  result["root"] = MerkleTree::encode(root);
+  result["ranges"] = Json::Value(Json::arrayValue);
+
+  for (const auto& range : request["ranges"])
+  {
+    SHA384_HASH theirs;
+    if (!range.isArray() || range.size() != 4 || !range[0].isString() ||
+        !range[1].isString() || !range[2].isUInt64() ||
+        !MerkleTree::decodeHash(range[3], theirs))
+      Log::get().error("Malformed range in sync request.");
+
+    const std::string lo = range[0].asString(), hi = range[1].asString();
+    const size_t begin = tree.lowerBound(lo);
+    const size_t end = std::max(begin, upperIndex(tree, hi));
+    if (range[2].asUInt64() == end - begin &&
+        tree.getRangeDigest(begin, end) == theirs)
+      continue;
+
+    Json::Value entry;
+    entry["lo"] = lo;
+    entry["hi"] = hi;
+    if (end - begin <= LIST_THRESHOLD)
+    {
+      entry["items"] = Json::Value(Json::arrayValue);
+      for (size_t j = begin; j < end; j++)
+      {
+        Json::Value item(Json::arrayValue);
+        item.append(tree.names_[j]);
+        item.append(MerkleTree::encode(tree.levels_[0][j]));
+        entry["items"].append(item);
+      }
+    }
+    else
+    {  // in parts of about equal size, bounded by names in this tree
+      entry["splits"] = Json::Value(Json::arrayValue);
+      for (size_t k = 0; k < FANOUT; k++)
+      {
+        const size_t from = begin + (end - begin) * k / FANOUT;
+        const size_t to = begin + (end - begin) * (k + 1) / FANOUT;
+        entry["splits"].append(
+            describe(tree, k == 0 ? lo : tree.names_[from],
+                     k == FANOUT - 1 ? hi : tree.names_[to]));
+      }
+    }
+
+    result["ranges"].append(entry);
+  }
+
+  return result;
+}
+
+
+
+// Syncs the tree and the Cache with a peer whose root is trusted, such as
+// one with a quorum's signatures: reconciles the names, then removes the
+// extra Records whose absence is proven and fetches the rest, with batch
+// queries checked against the root. The Cache and the tree are both changed, and should have held
+// the same Records beforehand. If the result is not consistent, as after
+// a digest collision or a peer that moved on, the caller should fall back
+// to a full fetch.
+MerkleSync::Result MerkleSync::run(MerkleTree& tree,
+                                   const SHA384_HASH& root,
+                                   const Exchange& exchange)
+{
+  static Metrics::Counter& rounds = Metrics::get().counter(
+      "onions_sync_rounds_total", "syncRanges exchanges by MerkleSync::run.");
+  static Metrics::Counter& fetched = Metrics::get().counter(
+      "onions_sync_records_total", "Records fetched by MerkleSync::run.");
+
+  MerkleSync sync(tree);
+  while (!sync.isDone())
+  {
+    sync.processResponse(exchange(REQUEST_TYPE, sync.getRequest()));
+    rounds.add();
+  }
+
+  Result result = {sync.getRoundCount(), 0, 0, 0, false};
+  if (sync.getPeerRoot() != root)
+  {
+    Log::get().warn("The peer's root is not the trusted one, not syncing.");
+    return result;
+  }
+
+  // the peer's word is not enough to delete a Record: only names whose
+  // absence is proven against the root are removed
+  const std::vector<std::string>& extra = sync.getExtra();
+  size_t unproven = 0;
+  for (size_t first = 0; first < extra.size();
+       first += Common::MAX_BATCH_NAMES)
+  {
+    std::vector<std::string> gone;
+    for (const auto& lookup : lookUp(extra, first, root, exchange))
+      if (lookup.record)
+        unproven++;
+      else
+        gone.push_back(lookup.name);
+
+    std::vector<size_t> absent;  // ascending
+    Cache::remove(gone, &absent);
+    for (size_t j = 0, next = 0; j < gone.size(); j++)
+      if (next < absent.size() && absent[next] == j)
+        next++;
+      else if (tree.remove(gone[j]))
+        result.removed++;
+  }
+  if (unproven > 0)
+    Log::get().warn("The peer listed " + std::to_string(unproven) +
+                    " Records under the root as missing, keeping them.");
+
+  std::vector<std::string> wanted = sync.getChanged();
+  wanted.insert(wanted.end(), sync.getMissing().begin(),
+                sync.getMissing().end());
+  for (size_t first = 0; first < wanted.size();
+       first += Common::MAX_BATCH_NAMES)
+  {
+    const auto lookups = lookUp(wanted, first, root, exchange);
+
+    std::vector<RecordPtr> found, added;
+    for (const auto& lookup : lookups)
+      if (lookup.record)
+        found.push_back(lookup.record);
+    fetched.add(found.size());
+
+    // the Cache takes each kind of change as one Batch
+    std::vector<size_t> absent;  // ascending
+    Cache::replace(found, &absent);
+    for (size_t j = 0, next = 0; j < found.size(); j++)
+      if (next < absent.size() && absent[next] == j)
+      {
+        added.push_back(found[j]);
+        next++;
+      }
+      else
+      {
+        tree.replace(found[j]);
+        result.replaced++;
+      }
+
+    std::vector<size_t> conflicts;
+    Cache::add(added, &conflicts);
+    for (size_t j : conflicts)
+      added[j] = nullptr;
+    added.erase(std::remove(added.begin(), added.end(), nullptr), added.end());
+    result.added += tree.insert(added);
+  }
+
+  result.consistent = tree.getRootHash() == root;
+  LOG_NOTICE("Synced in " + std::to_string(result.rounds) + " rounds: " +
+             std::to_string(result.added) + " added, " +
+             std::to_string(result.replaced) + " replaced, " +
+             std::to_string(result.removed) + " removed.");
+  return result;
+}
+
+
+
+// starts with the whole of the tree as one range
+MerkleSync::MerkleSync(const MerkleTree& tree) : tree_(tree), rounds_(0)
+{
+  pending_.push_back({"", ""});
+  peerRoot_.fill(0);
+}
+
+
+
+bool MerkleSync::isDone() const
+{
+  return pending_.empty();
+}
+
+
+
+// the value of the next "syncRanges" request, of up to MAX_RANGES ranges
+std::string MerkleSync::getRequest()
+{
+  Json::Value request;
+  request["ranges"] = Json::Value(Json::arrayValue);
+  for (size_t n = 0; n < MAX_RANGES && !pending_.empty(); n++)
+  {
+    request["ranges"].append(
+        describe(tree_, pending_.front().lo, pending_.front().hi));
+    requested_.push_back(pending_.front());
+    pending_.pop_front();
+  }
+
+  Json::FastWriter writer;
+  return writer.write(request);
+}
+
+
+
+// Takes in the response to the last request: listed ranges are compared
+// name by name, and the parts of split ones that still differ are queued.
+void MerkleSync::processResponse(const Json::Value& response)
+{
+  if (!response.isObject() || !response["ranges"].isArray() ||
+      !MerkleTree::decodeHash(response["root"], peerRoot_))
+    Log::get().error("Malformed sync response.");
+
+  if (++rounds_ > MAX_ROUNDS)
+    Log::get().error("Sync did not finish within " +
+                     std::to_string(MAX_ROUNDS) + " rounds.");
+
+  std::vector<Range> requested;
+  requested.swap(requested_);
+  for (const auto& entry : response["ranges"])
+  {
+    if (!entry.isObject() || !entry["lo"].isString() || !entry["hi"].isString())
+      Log::get().error("Malformed range in sync response.");
+
+    // each entry answers a distinct range of the request
+    const Range range = {entry["lo"].asString(), entry["hi"].asString()};
+    const auto asked = std::find_if(
+        requested.begin(), requested.end(), [&range](const Range& r)
+        {
+          return r.lo == range.lo && r.hi == range.hi;
+        });
+    if (asked == requested.end())
+      Log::get().error("Sync response answers a range that was not asked.");
+    requested.erase(asked);
+
+    if (entry["items"].isArray())
+    {
+      compareItems(range, entry["items"]);
+      continue;
+    }
+
+    if (!entry["splits"].isArray() || entry["splits"].size() > FANOUT)
+      Log::get().error("Malformed range in sync response.");
+
+    for (const auto& split : entry["splits"])
+    {
+      if (!split.isArray() || split.size() != 4 || !split[0].isString() ||
+          !split[1].isString())
+        Log::get().error("Malformed split in sync response.");
+
+      const Range part = {split[0].asString(), split[1].asString()};
+      if (!isWithin(part, range))
+        Log::get().error("Sync response splits outside of the range.");
+      if (describe(tree_, part.lo, part.hi) != split)
+        pending_.push_back(part);
+    }
+  }
+}
+
+
+
+// names that the peer has and this tree does not
+const std::vector<std::string>& MerkleSync::getMissing() const
+{
+  return missing_;
+}
+
+
+
+// names that both have, but with different Records
+const std::vector<std::string>& MerkleSync::getChanged() const
+{
+  return changed_;
+}
+
+
+
+// names that this tree has and the peer does not
+const std::vector<std::string>& MerkleSync::getExtra() const
+{
+  return extra_;
+}
+
+
+
+// as of the last response
+const SHA384_HASH& MerkleSync::getPeerRoot() const
+{
+  return peerRoot_;
+}
+
+
+
+size_t MerkleSync::getRoundCount() const
+{
+  return rounds_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// [lo, hi, count, digest] of the tree's leaves in [lo, hi)
+Json::Value MerkleSync::describe(const MerkleTree& tree,
+                                 const std::string& lo,
+                                 const std::string& hi)
+{
+  const size_t begin = tree.lowerBound(lo);
+  const size_t end = std::max(begin, upperIndex(tree, hi));
+
+  Json::Value range(Json::arrayValue);
+  range.append(lo);
+  range.append(hi);
+  range.append(static_cast<Json::UInt64>(end - begin));
+  range.append(MerkleTree::encode(tree.getRangeDigest(begin, end)));
+  return range;
+}
+
+
+
+// whether the part is a nonempty range inside the whole, and smaller
+bool MerkleSync::isWithin(const Range& part, const Range& whole)
+{
+  if (part.lo < whole.lo || (!part.hi.empty() && part.hi <= part.lo))
+    return false;
+  if (!whole.hi.empty() && (part.hi.empty() || part.hi > whole.hi))
+    return false;
+  return part.lo != whole.lo || part.hi != whole.hi;
+}
+
+
+
+// the Lookups of up to MAX_BATCH_NAMES of the names, from the first on,
+// with a batch query whose answers are checked against the root
+std::vector<Common::Lookup> MerkleSync::lookUp(
+    const std::vector<std::string>& names,
+    size_t first,
+    const SHA384_HASH& root,
+    const Exchange& exchange)
+{
+  const std::vector<std::string> part(
+      names.begin() + first,
+      names.begin() + std::min(names.size(), first + Common::MAX_BATCH_NAMES));
+  return Common::checkBatchQuery(
+      exchange("batchQuery", Common::makeBatchQuery(part)), part, root);
+}
+
+
+
+// the end of a range, where an empty name means no upper bound
+size_t MerkleSync::upperIndex(const MerkleTree& tree, const std::string& hi)
+{
+  return hi.empty() ? tree.names_.size() : tree.lowerBound(hi);
+}
+
+
+
+// merges the peer's sorted leaves in the range with this tree's
+void MerkleSync::compareItems(const Range& range, const Json::Value& items)
+{
+  size_t local = tree_.lowerBound(range.lo);
+  const size_t end = std::max(local, upperIndex(tree_, range.hi));
+
+  std::string previous;
+  for (const auto& item : items)
+  {
+    SHA384_HASH hash;
+    if (!item.isArray() || item.size() != 2 || !item[0].isString() ||
+        !MerkleTree::decodeHash(item[1], hash))
+      Log::get().error("Malformed item in sync response.");
+
+    const std::string name = item[0].asString();
+    if ((!previous.empty() && name <= previous) || name < range.lo ||
+        (!range.hi.empty() && name >= range.hi))
+      Log::get().error("Sync response items are out of order.");
+    previous = name;
+
+    while (local < end && tree_.names_[local] < name)
+      extra_.push_back(tree_.names_[local++]);
+
+    if (local < end && tree_.names_[local] == name)
+    {
+      if (tree_.levels_[0][local] != hash)
+        changed_.push_back(name);
+      local++;
+    }
+    else
+      missing_.push_back(name);
+  }
+
+  while (local < end)
+    extra_.push_back(tree_.names_[local++]);
+}
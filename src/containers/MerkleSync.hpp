@@ -0,0 +1,95 @@
+#ifndef MERKLE_SYNC_HPP
+#define MERKLE_SYNC_HPP
+
+#include "MerkleTree.hpp"
+#include "../Common.hpp"
+#include <json/json.h>
+#include <functional>
+#include <deque>
+#include <string>
+#include <vector>
+
+// Brings a mirror's tree up to date with a peer's by exchanging digests of
+// ranges of names, descending only into ranges that differ, and then
+// fetching only the Records that are missing or changed. Leaves shift
+// whenever a name is added or removed, so the same Records rarely sit under
+// the same node in both trees; ranges are therefore bounded by names, and
+// their digests are the XOR of their leaf hashes, which any tree can
+// compute for any range. A differing range is split by the peer into
+// FANOUT parts, or listed in full once it holds LIST_THRESHOLD leaves or
+// fewer, so the rounds and the bytes sent grow with the difference times
+// the depth, not with the number of Records.
+//
+// The "syncRanges" request's value is the JSON text of
+//   {"ranges": [[lo, hi, count, digest], ...]}
+// for the names in [lo, hi), an empty hi meaning no upper bound, and the
+// requester's count and base64 digest of them. The response is
+//   {"root": base64, "ranges": [{"lo": lo, "hi": hi,
+//     "items": [[name, hash], ...]} or {..., "splits": [[lo, hi, count,
+//     digest], ...]}]}
+// with an entry only for each range that differs, and splits only inside
+// it. Records are then fetched, and extra ones proven absent, with batch
+// queries, whose proofs tie them to the root. XOR digests can be
+// made to collide on purpose, but a collision only makes a sync miss
+// Records, which the final comparison of the roots then reveals.
+class MerkleSync
+{
+ public:
+  static const size_t FANOUT = 16;
+  static const size_t LIST_THRESHOLD = 32;  // leaves
+  static const size_t MAX_RANGES = 256;     // per request
+  static const size_t MAX_ROUNDS = 1024;    // before giving up on a peer
+  static const std::string REQUEST_TYPE;
+
+  // sends a request of the type with the value, returning the response's
+  // value, e.g. through TorStream::sendReceive and its "value"
+  typedef std::function<Json::Value(const std::string&, const std::string&)>
+      Exchange;
+
+  struct Result
+  {
+    size_t rounds;            // syncRanges exchanges
+    size_t added, replaced, removed;
+    bool consistent;  // whether the local root now matches the peer's
+  };
+
+  static Json::Value answer(const MerkleTree&, const std::string&);
+  static Result run(MerkleTree&, const SHA384_HASH&, const Exchange&);
+
+  explicit MerkleSync(const MerkleTree&);
+  bool isDone() const;
+  std::string getRequest();
+  void processResponse(const Json::Value&);
+
+  const std::vector<std::string>& getMissing() const;
+  const std::vector<std::string>& getChanged() const;
+  const std::vector<std::string>& getExtra() const;
+  const SHA384_HASH& getPeerRoot() const;
+  size_t getRoundCount() const;
+
+ private:
+  struct Range
+  {
+    std::string lo, hi;
+  };
+
+  static Json::Value describe(const MerkleTree&,
+                              const std::string&,
+                              const std::string&);
+  static bool isWithin(const Range&, const Range&);
+  static std::vector<Common::Lookup> lookUp(const std::vector<std::string>&,
+                                            size_t,
+                                            const SHA384_HASH&,
+                                            const Exchange&);
+  static size_t upperIndex(const MerkleTree&, const std::string&);
+  void compareItems(const Range&, const Json::Value&);
+
+  const MerkleTree& tree_;
+  std::deque<Range> pending_;
+  std::vector<Range> requested_;  // by the last request
+  std::vector<std::string> missing_, changed_, extra_;
+  SHA384_HASH peerRoot_;
+  size_t rounds_;
+};
+
+#endif
@@ -1,51 +1,203 @@
 
 #include "MerkleTree.hpp"
 #include "../Log.hpp"
-#include <botan/sha2_64.h>
-#include <botan/base64.h>
-
-
-// records must be sorted by name
-MerkleTree::MerkleTree(const std::vector<RecordPtr>& records)
+#include "../Metrics.hpp"
+#include "../MemoryStats.hpp"
+#include "../Tracer.hpp"
+#include "../encoding/Codec.hpp"
+#include "../crypto/Sha2.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+static_assert(sizeof(SHA384_HASH) == Const::SHA384_LEN,
+              "a Merkle tree row must be a contiguous array of hashes");
+
+
+// Records must be sorted by name. If a ThreadPool is given, the leaves and
+// the wide lower rows are hashed in parallel; the root is the same either way.
+MerkleTree::MerkleTree(const std::vector<RecordPtr>& records, ThreadPool* pool)
+    : levels_(1), filter_(countNames(records)), prefixesValid_(0)
 {
-  Log::get().notice("Building Merkle tree of size " +
-                    std::to_string(records.size()));
+  static Metrics::Histogram& buildTime = Metrics::get().histogram(
+      "onions_merkle_build_seconds", "Time taken to build a MerkleTree.");
+  static Metrics::Gauge& leaves = Metrics::get().gauge(
+      "onions_merkle_leaves", "Records in the last MerkleTree built.");
+
+  LOG_NOTICE("Building Merkle tree of size " +
+             std::to_string(records.size()));
+  const auto start = std::chrono::steady_clock::now();
 
-  std::vector<NodePtr> row;
-  for (auto r : records)
+  names_.reserve(records.size());
+  for (const auto& r : records)
   {
-    LeafPtr leaf = std::make_shared<Leaf>(r, nullptr);
-    leaves_.push_back(leaf);
-    row.push_back(leaf);
+    names_.push_back(r->getNameRef().str());
+    addToFilter(*r);
   }
 
-  rootHash_ = buildTree(row);
-  Log::get().notice("Built tree. Root is " +
-                    Botan::base64_encode(rootHash_.data(), Const::SHA384_LEN));
+  // each leaf serializes and hashes its Record, the bulk of the work
+  levels_[0].resize(records.size());
+  auto hashLeaves = [&](size_t from, size_t to)
+  {
+    for (size_t j = from; j < to; j++)
+      levels_[0][j] = records[j]->getHash();
+  };
+
+  if (pool)
+    pool->parallelFor(0, records.size(), hashLeaves, 64);
+  else
+    hashLeaves(0, records.size());
+
+  buildTree(0, pool);
+  buildTime.observeDuration(std::chrono::steady_clock::now() - start);
+  leaves.set(static_cast<double>(records.size()));
+  LOG_NOTICE("Built tree. Root is " + encode(rootHash_));
+}
+
+
+
+// a deep copy, for changing a tree that readers may still be using
+MerkleTree::MerkleTree(const MerkleTree& other)
+    : names_(other.names_),
+      levels_(other.levels_),
+      rootHash_(other.rootHash_),
+      filter_(other.filter_),
+      index_(other.index_)
+{
+  std::lock_guard<std::mutex> guard(other.prefixMutex_);
+  prefixes_ = other.prefixes_;
+  prefixesValid_ = other.prefixesValid_;
 }
 
 
 
 Json::Value MerkleTree::generateSubtree(const std::string& domain) const
 {
-  if (leaves_.empty())
+  Tracer::Span span("merkle.generateSubtree");
+  if (names_.empty())
   {
     Json::Value empty;
     return empty;
   }
 
-  LeafPtr needle = std::make_shared<Leaf>(domain);
-  auto lowerBound =
-      std::lower_bound(leaves_.begin(), leaves_.end(), needle, isLessThan);
+  size_t index = lowerBound(domain);
 
-  Log::get().notice("Lower bound on domain at " +
-                    std::to_string(lowerBound - leaves_.begin()));
+  LOG_NOTICE("Lower bound on domain at " + std::to_string(index));
 
   Json::Value result;
-  if (lowerBound != leaves_.end() && !isLessThan(needle, *lowerBound))
-    result = generatePath(*lowerBound);  // found, so return single path
+  if (index < names_.size() && names_[index] == domain)
+    result = generatePath(index, levels_.size() - 1);  // found, single path
   else
-    result = generateSpan(needle, lowerBound);  // not found, so return span
+    result = generateSpan(index);  // not found, so return span
+
+  return result;
+}
+
+
+
+// Binary form of generateSubtree, written into the given buffer. Returns the
+// proof's size, or 0 if the tree is empty or the buffer is too small; a
+// buffer of MerkleProof::MAX_SIZE bytes always suffices.
+size_t MerkleTree::generateProof(const std::string& domain,
+                                 uint8_t* out,
+                                 size_t capacity) const
+{
+  if (names_.empty() || levels_.size() - 1 > MerkleProof::MAX_HEIGHT)
+    return 0;
+
+  size_t index = lowerBound(domain);
+  const size_t height = levels_.size() - 1;
+
+  MerkleProof::Path left;
+  if (index < names_.size() && names_[index] == domain)
+  {
+    makePath(index, height, left);
+    return MerkleProof::encode(left, out, capacity);
+  }
+
+  // same neighbours as generateSpan
+  size_t l = index > 0 ? index - 1 : 0;
+  size_t r = index < names_.size() ? index : names_.size() - 1;
+
+  size_t meet = 0;  // the level at which both leaves share an ancestor
+  while ((l >> meet) != (r >> meet))
+    meet++;
+
+  MerkleProof::Path right;
+  makePath(l, height, left);
+  makePath(r, meet, right);
+  return MerkleProof::encode(left, right, out, capacity);
+}
+
+
+
+// Proves several domains at once. The result lists the leaves that prove
+// each domain (its own leaf, or the two neighbours of a missing name) and
+// every sibling hash needed to climb from them to the root, omitting any
+// node that can be computed from the leaves themselves, so the shared upper
+// levels appear once instead of once per domain:
+//   {"size": leaf count, "leaves": [{"index", "name", "hash"}, ...],
+//    "nodes": [sibling hashes, bottom level first, left to right]}
+Json::Value MerkleTree::generateMultiProof(
+    const std::vector<std::string>& domains) const
+{
+  Tracer::Span span("merkle.generateMultiProof");
+  if (names_.empty())
+  {
+    Json::Value empty;
+    return empty;
+  }
+
+  std::vector<size_t> known;
+  for (const auto& domain : domains)
+  {
+    size_t index = lowerBound(domain);
+
+    if (index < names_.size() && names_[index] == domain)
+      known.push_back(index);
+    else
+    {  // same neighbours as generateSpan
+      known.push_back(index > 0 ? index - 1 : 0);
+      known.push_back(index < names_.size() ? index : names_.size() - 1);
+    }
+  }
+
+  std::sort(known.begin(), known.end());
+  known.erase(std::unique(known.begin(), known.end()), known.end());
+
+  Json::Value result;
+  result["size"] = static_cast<Json::UInt64>(names_.size());
+  result["leaves"] = Json::Value(Json::arrayValue);
+  result["nodes"] = Json::Value(Json::arrayValue);
+
+  for (size_t index : known)
+  {
+    Json::Value leafVal;
+    leafVal["index"] = static_cast<Json::UInt64>(index);
+    leafVal["name"] = names_[index];
+    leafVal["hash"] = encode(levels_[0][index]);
+    result["leaves"].append(leafVal);
+  }
+
+  // walk up level by level, in the same order that verifyMultiProof does
+  for (size_t level = 0; level + 1 < levels_.size(); level++)
+  {
+    const Level& row = levels_[level];
+    std::vector<size_t> parents;
+
+    for (size_t k = 0; k < known.size(); k++)
+    {
+      size_t j = known[k];
+      if (j % 2 == 0 && k + 1 < known.size() && known[k + 1] == j + 1)
+        k++;  // both children are known
+      else if ((j ^ 1) < row.size())
+        result["nodes"].append(encode(row[j ^ 1]));
+
+      parents.push_back(j / 2);
+    }
+
+    known.swap(parents);
+  }
 
   return result;
 }
@@ -56,7 +208,12 @@ Json::Value MerkleTree::generateSubtree(const std::string& domain) const
 bool MerkleTree::doesContain(const Json::Value& subtree,
                              const RecordPtr& record)
 {
-  if (subtree.isArray())
+  if (subtree.isObject() && subtree.isMember("leaves"))
+  {  // multi-proof, as from generateMultiProof
+    if (!verifyLeaves(subtree, record))
+      return false;
+  }
+  else if (subtree.isArray())
   {  // check main path
     if (!verifyPath(subtree, record))
       return false;
@@ -69,9 +226,8 @@ bool MerkleTree::doesContain(const Json::Value& subtree,
 
     if (subtree.isMember("left") || subtree.isMember("right"))
     {
-      // verify each path's validity, then check if the span covers the Record
-      if (!verifyPath(subtree["left"], record) ||
-          !verifyPath(subtree["right"], record) || !verifySpan(subtree, record))
+      // verify both paths and their junction, then check the span covers it
+      if (!verifySpan(subtree, record))
         return false;
     }
     else
@@ -83,16 +239,87 @@ bool MerkleTree::doesContain(const Json::Value& subtree,
 
 
 
-SHA384_HASH MerkleTree::extractRoot(const Json::Value& subtree)
+// whether a multi-proof, as from generateMultiProof, shows that no Record
+// by that name is in the tree; check it with verifyMultiProof first
+bool MerkleTree::doesExclude(const Json::Value& proof, const std::string& name)
 {
-  std::string base64Root;
+  const Json::Value* leaf = nullptr;
+  return proof.isObject() && proof["leaves"].isArray() &&
+         locateLeaf(proof, StringRef(name.data(), name.size()), leaf) &&
+         leaf == nullptr;
+}
+
 
-  // extract base64-encoded string
-  if (subtree.isArray())
-  {  // extract root from single path
-    base64Root = subtree[subtree.size() - 1]["hash"].asString();
+
+// Checks a whole multi-proof against the root in one pass up the tree:
+// each level's known nodes are paired with a known neighbour or with the
+// next hash from "nodes", leaving exactly one node, the root.
+bool MerkleTree::verifyMultiProof(const Json::Value& proof,
+                                  const SHA384_HASH& root)
+{
+  const Json::Value& leaves = proof["leaves"];
+  const Json::Value& nodes = proof["nodes"];
+  if (!proof["size"].isIntegral() || !leaves.isArray() || leaves.empty() ||
+      !nodes.isArray())
+    return false;
+
+  std::vector<std::pair<size_t, SHA384_HASH>> known;
+  size_t rowSize = proof["size"].asUInt64();
+  for (const auto& leafVal : leaves)
+  {
+    SHA384_HASH hash;
+    if (!leafVal["index"].isIntegral() || !decodeHash(leafVal["hash"], hash))
+      return false;
+
+    size_t index = leafVal["index"].asUInt64();
+    if (index >= rowSize || (!known.empty() && index <= known.back().first))
+      return false;  // out of range or out of order
+    known.push_back(std::make_pair(index, hash));
   }
-  else
+
+  Json::ArrayIndex next = 0;
+  while (rowSize > 1)
+  {
+    std::vector<std::pair<size_t, SHA384_HASH>> parents;
+
+    for (size_t k = 0; k < known.size(); k++)
+    {
+      size_t j = known[k].first;
+      const SHA384_HASH& node = known[k].second;
+      SHA384_HASH sibling = node;  // an odd node at the end is self-paired
+
+      if (j % 2 == 0 && k + 1 < known.size() && known[k + 1].first == j + 1)
+        sibling = known[++k].second;
+      else if ((j ^ 1) < rowSize)
+      {
+        if (next >= nodes.size() || !decodeHash(nodes[next++], sibling))
+          return false;
+      }
+
+      SHA384_HASH parent;
+      if (j % 2 == 0)
+        hashPair(node, sibling, parent);
+      else
+        hashPair(sibling, node, parent);
+      parents.push_back(std::make_pair(j / 2, parent));
+    }
+
+    known.swap(parents);
+    rowSize = (rowSize + 1) / 2;
+  }
+
+  return next == nodes.size() && known.size() == 1 && known[0].second == root;
+}
+
+
+
+// The last entry of a path holds the root's children, so the root is their
+// hash. A tree of one leaf has no entries above it, and the leaf is the root.
+SHA384_HASH MerkleTree::extractRoot(const Json::Value& subtree)
+{
+  const Json::Value* path = &subtree;
+
+  if (!subtree.isArray())
   {  // extract from a branch from the span
 
     // https://stackoverflow.com/questions/1596668
@@ -100,23 +327,54 @@ SHA384_HASH MerkleTree::extractRoot(const Json::Value& subtree)
       Log::get().warn("Malformed Merkle subtree, incomplete span.");
 
     if (subtree.isMember("left"))
-    {
-      Json::Value leftPath = subtree["left"];
-      base64Root = leftPath[leftPath.size() - 1]["hash"].asString();
-    }
+      path = &subtree["left"];  // the lower path is always complete
     else
       Log::get().warn("Subtree is missing both branches!");
   }
 
-  SHA384_HASH root;
-  if (Botan::base64_decode(root.data(), base64Root) != Const::SHA384_LEN)
+  SHA384_HASH root, left, right;
+  root.fill(0);
+
+  if (!path->isArray() || path->empty())
     Log::get().warn("Invalid root size for Merkle subtree.");
+  else if (path->size() == 1)
+  {
+    if (!decodeHash((*path)[0]["hash"], root))
+      Log::get().warn("Invalid root size for Merkle subtree.");
+  }
+  else
+  {
+    const Json::Value& top = (*path)[path->size() - 1];
+    if (decodeHash(top["left"], left) &&
+        (!top.isMember("right") || decodeHash(top["right"], right)))
+      root = concatenateHashes(left, top.isMember("right") ? right : left);
+    else
+      Log::get().warn("Invalid root size for Merkle subtree.");
+  }
 
   return root;
 }
 
 
 
+// decodes a base64 hash in place, without copying the string out of the JSON
+bool MerkleTree::decodeHash(const Json::Value& value, SHA384_HASH& hash)
+{
+  const char *begin, *end;
+  if (!value.isString() || !value.getString(&begin, &end))
+    return false;
+
+  // exactly the encoded length, so decoding cannot overrun the buffer
+  const size_t ENCODED_LEN = (Const::SHA384_LEN + 2) / 3 * 4;
+  if (static_cast<size_t>(end - begin) != ENCODED_LEN)
+    return false;
+
+  return Codec::base64Decode(begin, ENCODED_LEN, hash.data(), hash.size()) ==
+         Const::SHA384_LEN;
+}
+
+
+
 SHA384_HASH MerkleTree::getRootHash() const
 {
   return rootHash_;
@@ -124,78 +382,303 @@ SHA384_HASH MerkleTree::getRootHash() const
 
 
 
-// ************************** PRIVATE METHODS **************************** //
+// false means the name is definitely not registered, so callers can skip
+// the Cache lookup entirely; true means that it probably is
+bool MerkleTree::mightContain(const std::string& name) const
+{
+  return filter_.mightContain(name);
+}
 
 
 
-SHA384_HASH MerkleTree::buildTree(std::vector<NodePtr>& row)
+double MerkleTree::getFalsePositiveRate() const
 {
-  // build breadth-first, row by row
-  while (row.size() > 1)
+  return filter_.getFalsePositiveRate();
+}
+
+
+
+// Up to the given number of leaf names that start with the prefix, in
+// order, for operator tools; an empty prefix lists from the first name.
+std::vector<std::string> MerkleTree::getNamesWithPrefix(
+    const std::string& prefix,
+    size_t limit) const
+{
+  std::vector<std::string> names;
+  for (size_t j = lowerBound(prefix);
+       j < names_.size() && names.size() < limit &&
+       names_[j].compare(0, prefix.size(), prefix) == 0;
+       j++)
+    names.push_back(names_[j]);
+
+  return names;
+}
+
+
+
+MerkleTree::MemoryUsage MerkleTree::getMemoryUsage() const
+{
+  MemoryUsage usage = {levels_.capacity() * sizeof(Level), 0,
+                       filter_.getMemoryUsage()};
   {
-    std::vector<NodePtr> nextRow;
-    for (size_t j = 0; j < row.size(); j += 2)
-    {
-      // get left and right, or get left twice if row size is odd
-      NodePtr left = row[j + 0];
-      NodePtr right = j + 1 < row.size() ? row[j + 1] : left;
+    std::lock_guard<std::mutex> guard(prefixMutex_);
+    usage.hashes += prefixes_.capacity() * sizeof(SHA384_HASH);
+  }
+
+  for (const auto& level : levels_)
+    usage.hashes += level.capacity() * sizeof(SHA384_HASH);
+
+  usage.names = names_.capacity() * sizeof(std::string);
+  for (const auto& name : names_)
+    usage.names += MemoryStats::getStringMemoryUsage(name);
+  usage.names += index_.getMemoryUsage();
+  return usage;
+}
+
+
+
+size_t MerkleTree::MemoryUsage::getTotal() const
+{
+  return hashes + names + filter;
+}
+
+
+
+// adds a leaf for a Record whose name is not yet in the tree
+bool MerkleTree::insert(const RecordPtr& record)
+{
+  return insert(std::vector<RecordPtr>(1, record)) == 1;
+}
+
+
+
+// Adds leaves for a batch of Records at their sorted positions and returns
+// how many were added; names that are already in the tree are skipped. The
+// existing leaves are merged in one pass from the back, and only the nodes
+// covering the first new leaf and everything after it are recomputed, so a
+// few late arrivals near the end cost far less than a rebuild.
+size_t MerkleTree::insert(std::vector<RecordPtr> records)
+{
+  std::sort(records.begin(), records.end(),
+            [](const RecordPtr& a, const RecordPtr& b)
+            {
+              return a->getNameRef() < b->getNameRef();
+            });
+
+  // drop names that are already leaves or that repeat within the batch
+  size_t kept = 0;
+  for (size_t j = 0; j < records.size(); j++)
+  {
+    const StringRef& name = records[j]->getNameRef();
+    if (kept > 0 && records[kept - 1]->getNameRef() == name)
+      continue;
+    if (find(name.str()) != names_.size())
+      continue;
+    records[kept++] = records[j];
+  }
+  records.resize(kept);
 
-      SHA384_HASH hash = concatenateHashes(left, right);
-      NodePtr node = std::make_shared<Node>(nullptr, hash);
+  if (records.empty())
+    return 0;
 
-      nextRow.push_back(node);
-      node->setChildren(left, j + 1 < row.size() ? right : nullptr);
-      left->setParent(node);
-      right->setParent(node);
+  Level& leaves = levels_[0];
+  size_t old = names_.size(), next = records.size(), out = old + next;
+  names_.resize(out);
+  leaves.resize(out);
+
+  while (next > 0)
+  {
+    out--;
+    if (old > 0 && records[next - 1]->getNameRef() < names_[old - 1])
+    {  // shift an existing leaf right to make room
+      old--;
+      names_[out] = std::move(names_[old]);
+      leaves[out] = leaves[old];
+    }
+    else
+    {
+      next--;
+      names_[out] = records[next]->getNameRef().str();
+      leaves[out] = records[next]->getHash();
     }
+  }
+
+  // out is now the lowest index that changed
+  for (const auto& r : records)
+    addToFilter(*r);
+
+  buildTree(out);
+  return records.size();
+}
 
-    row = nextRow;
+
+
+// Swaps in a new version of a Record that already has a leaf. Only the hashes
+// on the path from that leaf to the root are recomputed: O(log n).
+bool MerkleTree::replace(const RecordPtr& record)
+{
+  size_t index = find(record->getNameRef().str());
+  if (index == names_.size())
+    return false;
+
+  levels_[0][index] = record->getHash();
+  invalidatePrefixes(index);
+  for (size_t level = 1; level < levels_.size(); level++)
+  {
+    index /= 2;
+    levels_[level][index] = hashChildren(level, index);
   }
 
-  return row[0]->getHash();
+  rootHash_ = levels_.back()[0];
+
+  // the filter cannot forget old subdomains, so they remain false positives
+  addToFilter(*record);
+
+  return true;
 }
 
 
 
-// returns a hash of the two nodes' values
-SHA384_HASH MerkleTree::concatenateHashes(const NodePtr& a, const NodePtr& b)
+// Removes a leaf. Every later leaf shifts left, so only the nodes above the
+// removed position and to its right are recomputed, from the stored hashes.
+bool MerkleTree::remove(const std::string& name)
 {
-  // hash their concatenation
-  Botan::SHA_384 sha384;
+  size_t index = find(name);
+  if (index == names_.size())
+    return false;
 
-  std::array<uint8_t, 2 * Const::SHA384_LEN> concat;
-  memcpy(concat.data(), a->getHash().data(), Const::SHA384_LEN);
-  memcpy(concat.data() + Const::SHA384_LEN, b->getHash().data(),
-         Const::SHA384_LEN);
+  names_.erase(names_.begin() + index);
+  levels_[0].erase(levels_[0].begin() + index);
+  buildTree(index);
+  return true;
+}
 
-  SHA384_HASH result;
-  auto hash = sha384.process(concat.data(), concat.size());
-  memcpy(result.data(), hash, hash.size());
 
-  Log::get().notice(std::to_string(hash.size()) + " | " +
-                    std::to_string(Const::SHA384_LEN));
 
+// ************************** PRIVATE METHODS **************************** //
+
+
+
+// Builds the rows above the leaves, breadth-first. Nodes that only cover
+// leaves before the given index are assumed to be up to date and are kept.
+// Nodes in a row only depend on the row below, so wide rows are split into
+// independent ranges for the pool; the narrow rows near the root are not.
+void MerkleTree::buildTree(size_t from, ThreadPool* pool)
+{
+  invalidatePrefixes(from);
+  index_.build(names_);  // the names may have shifted anywhere after from
+  size_t level = 0;
+  while (levels_[level].size() > 1)
+  {
+    if (levels_.size() == level + 1)
+      levels_.push_back(Level());
+
+    const size_t width = (levels_[level].size() + 1) / 2;
+    levels_[level + 1].resize(width);
+
+    from /= 2;
+    // a pair of children lies contiguously in the row, so the parents of
+    // whole pairs are hashed straight from it, several at once
+    auto hashRange = [this, level](size_t first, size_t last)
+    {
+      static const size_t BATCH = 64;
+      const Level& row = levels_[level];
+      Level& parents = levels_[level + 1];
+      const size_t paired = std::min(last, row.size() / 2);
+
+      const uint8_t* pairs[BATCH];
+      uint8_t* digests[BATCH];
+      for (size_t j = first; j < paired; j += BATCH)
+      {
+        const size_t n = std::min(BATCH, paired - j);
+        for (size_t k = 0; k < n; k++)
+        {
+          pairs[k] = row[2 * (j + k)].data();
+          digests[k] = parents[j + k].data();
+        }
+        Sha2::sha384Many(pairs, 2 * Const::SHA384_LEN, n, digests);
+      }
+
+      for (size_t j = std::max(first, paired); j < last; j++)
+        parents[j] = hashChildren(level + 1, j);
+    };
+
+    if (pool && width - from >= PARALLEL_THRESHOLD)
+      pool->parallelFor(from, width, hashRange, PARALLEL_THRESHOLD / 4);
+    else
+      hashRange(from, width);
+
+    level++;
+  }
+
+  levels_.resize(level + 1);  // the tree may have lost height
+  if (levels_[level].empty())
+    rootHash_.fill(0);
+  else
+    rootHash_ = levels_[level][0];
+}
+
+
+
+// computes node j of the given level from its children one level down,
+// using the left child twice if there is no right child
+SHA384_HASH MerkleTree::hashChildren(size_t level, size_t j) const
+{
+  const Level& row = levels_[level - 1];
+  const SHA384_HASH& left = row[2 * j];
+  const SHA384_HASH& right = 2 * j + 1 < row.size() ? row[2 * j + 1] : left;
+  return concatenateHashes(left, right);
+}
+
+
+
+// returns a hash of the two nodes' values
+SHA384_HASH MerkleTree::concatenateHashes(const SHA384_HASH& a,
+                                          const SHA384_HASH& b)
+{
+  SHA384_HASH result;
+  hashPair(a, b, result);
   return result;
 }
 
 
 
-Json::Value MerkleTree::generatePath(const LeafPtr& leaf) const
+// hashes the concatenation of a and b; result may be either of them
+void MerkleTree::hashPair(const SHA384_HASH& a,
+                          const SHA384_HASH& b,
+                          SHA384_HASH& result)
 {
-  Log::get().notice("Generating single path through Merkle tree.");
+  uint8_t pair[2 * Const::SHA384_LEN];
+  memcpy(pair, a.data(), Const::SHA384_LEN);
+  memcpy(pair + Const::SHA384_LEN, b.data(), Const::SHA384_LEN);
+  Sha2::sha384(pair, sizeof(pair), result.data());
+}
+
+
+
+std::string MerkleTree::encode(const SHA384_HASH& hash)
+{
+  return Codec::base64Encode(hash.data(), Const::SHA384_LEN);
+}
+
+
+
+// the leaf and the children of its first "height" ancestors
+Json::Value MerkleTree::generatePath(size_t index, size_t height) const
+{
+  LOG_NOTICE("Generating single path through Merkle tree.");
 
   Json::Value result;
 
   Json::Value leafVal;
-  leafVal["name"] = leaf->getName();
-  leafVal["hash"] = leaf->getBase64Hash();
+  leafVal["name"] = names_[index];
+  leafVal["hash"] = encode(levels_[0][index]);
   result.append(leafVal);
 
-  NodePtr node = leaf->getParent();
-  while (node)
+  for (size_t level = 1; level <= height; level++)
   {
-    result.append(node->asValue());
-    node = node->getParent();
+    index /= 2;
+    result.append(asValue(level, index));
   }
 
   return result;
@@ -203,19 +686,24 @@ Json::Value MerkleTree::generatePath(const LeafPtr& leaf) const
 
 
 
-Json::Value MerkleTree::generateSpan(
-    const LeafPtr& needle,
-    const std::vector<LeafPtr>::const_iterator& lowerBound) const
+// The leaves at lowerBound - 1 and lowerBound are the neighbours of a name
+// that is not in the tree, clamped to the leaves that exist. The two paths
+// converge at their lowest common ancestor, so the upper path stops there:
+// its last entry holds that ancestor's children, the same entry as at that
+// position in the lower path, and everything above it is shared.
+Json::Value MerkleTree::generateSpan(size_t lowerBound) const
 {
-  Log::get().notice("Generating span through Merkle tree.");
+  LOG_NOTICE("Generating span through Merkle tree.");
 
-  auto upperBound =
-      std::upper_bound(leaves_.begin(), leaves_.end(), needle, isLessThan);
+  size_t left = lowerBound > 0 ? lowerBound - 1 : 0;
+  size_t right = lowerBound < names_.size() ? lowerBound : names_.size() - 1;
 
-  Json::Value lowerPath = generatePath(*lowerBound);
-  Json::Value upperPath = generatePath(*upperBound);
+  size_t meet = 0;
+  while ((left >> meet) != (right >> meet))
+    meet++;
 
-  // todo: return "common" path where the two paths converge
+  Json::Value lowerPath = generatePath(left, levels_.size() - 1);
+  Json::Value upperPath = generatePath(right, meet);
 
   Json::Value result;
   result["left"] = lowerPath;
@@ -225,130 +713,311 @@ Json::Value MerkleTree::generateSpan(
 
 
 
-// checks the cryptographic validity of the paths to the Record
-bool MerkleTree::verifyPath(const Json::Value& path, const RecordPtr& record)
+// the hashes of the children of node j, as sent to clients
+Json::Value MerkleTree::asValue(size_t level, size_t j) const
 {
-  // check name
-  if (path[0]["name"] != record->getName())
-    return false;
-
-  // check record's hash against first hash
-  Leaf leaf(record, nullptr);
-  if (path[0]["hash"] != leaf.getBase64Hash())
-    return false;
+  const Level& row = levels_[level - 1];
+  Json::Value value;
 
-  for (size_t j = 1; j < path.size(); j++)
-  {
-    // todo:
-    // if previous hashes do not match either current match, return false
-    // concatenateHashes
-    // trouble is that I need the neighboring Record, yes? no
-  }
+  value["left"] = encode(row[2 * j]);
+  if (2 * j + 1 < row.size())
+    value["right"] = encode(row[2 * j + 1]);
 
-  return true;
+  return value;
 }
 
 
 
-// checks whether a span bounds the Record
-bool MerkleTree::verifySpan(const Json::Value& subtree, const RecordPtr& record)
+// describes the first "height" levels of the path up from the given leaf
+void MerkleTree::makePath(size_t index,
+                          size_t height,
+                          MerkleProof::Path& path) const
 {
-  return subtree["left"][0]["name"].asString() < record->getName() &&
-         record->getName() < subtree["right"][0]["name"].asString();
+  const std::string& name = names_[index];
+  path.name = name.data();
+  path.nameLength = static_cast<uint8_t>(name.size());
+  path.height = static_cast<uint8_t>(height);
+  path.directions = path.selfPaired = 0;
+  path.leaf = levels_[0][index].data();
+
+  for (size_t level = 0; level < height; level++)
+  {
+    const size_t sibling = index ^ 1;
+    path.siblings[level] = nullptr;
+
+    if (index & 1)
+      path.directions |= uint32_t(1) << level;
+    if (sibling < levels_[level].size())
+      path.siblings[level] = levels_[level][sibling].data();
+    else
+      path.selfPaired |= uint32_t(1) << level;
+
+    index /= 2;
+  }
 }
 
 
 
-bool MerkleTree::isLessThan(const LeafPtr& a, const LeafPtr& b)
+// returns the index of the leaf with the given name, or the leaf count
+size_t MerkleTree::find(const std::string& name) const
 {
-  return a->getName() < b->getName();
+  size_t index = lowerBound(name);
+  if (index < names_.size() && names_[index] == name)
+    return index;
+  return names_.size();
 }
 
 
 
-// ************************** SUBCLASS METHODS **************************** //
+// the index of the first leaf whose name is not before the given one
+size_t MerkleTree::lowerBound(const std::string& name) const
+{
+  return index_.lowerBound(names_, name);
+}
 
 
 
-MerkleTree::Node::Node()
-    : parent_(nullptr), leftChild_(nullptr), rightChild_(nullptr)
+// The XOR of the hashes of leaves [begin, end). Unlike a node, which is
+// only defined for the leaves under it, this covers any run of leaves, and
+// so can be compared with the same names in a tree of another shape.
+SHA384_HASH MerkleTree::getRangeDigest(size_t begin, size_t end) const
 {
-  hash_.fill(0);
+  const Level& leaves = levels_[0];
+  std::lock_guard<std::mutex> guard(prefixMutex_);
+  if (prefixes_.size() != leaves.size() + 1)
+  {
+    prefixes_.resize(leaves.size() + 1);
+    prefixes_[0].fill(0);
+  }
+
+  for (size_t j = prefixesValid_; j < leaves.size(); j++)
+    for (size_t b = 0; b < Const::SHA384_LEN; b++)
+      prefixes_[j + 1][b] = prefixes_[j][b] ^ leaves[j][b];
+  prefixesValid_ = leaves.size();
+
+  SHA384_HASH digest;
+  for (size_t b = 0; b < Const::SHA384_LEN; b++)
+    digest[b] = prefixes_[end][b] ^ prefixes_[begin][b];
+  return digest;
 }
 
 
 
-MerkleTree::Node::Node(const NodePtr& parent, const SHA384_HASH& hash)
-    : parent_(parent), leftChild_(nullptr), rightChild_(nullptr), hash_(hash)
+// the leaves from the index on have changed or moved
+void MerkleTree::invalidatePrefixes(size_t index)
 {
+  std::lock_guard<std::mutex> guard(prefixMutex_);
+  prefixesValid_ = std::min(prefixesValid_, index);
 }
 
 
 
-void MerkleTree::Node::setParent(const NodePtr& parent)
+// Checks the cryptographic validity of the path to the Record: the leaf must
+// be the Record, and every level must link up to the root from extractRoot.
+// Hashes are decoded into stack buffers and one hash context is reused.
+bool MerkleTree::verifyPath(const Json::Value& path, const RecordPtr& record)
 {
-  parent_ = parent;
+  if (!path.isArray() || path.empty())
+    return false;
+
+  // check name
+  if (getEntryName(path[0]) != record->getNameRef())
+    return false;
+
+  // check record's hash against first hash
+  SHA384_HASH leaf;
+  if (!decodeHash(path[0]["hash"], leaf) || leaf != record->getHash())
+    return false;
+
+  SHA384_HASH top;
+  uint64_t directions;
+  if (!climbPath(path, top, directions))
+    return false;
+
+  return top == extractRoot(path);
 }
 
 
 
-void MerkleTree::Node::setChildren(const NodePtr& left, const NodePtr& right)
+// Checks whether a span bounds the Record. The upper path stops where it
+// converges with the lower one, so its last entry must match the lower
+// path's at that position. The leaves
+// must also be neighbours: below the junction the lower path only climbs
+// from right children and the upper path only from left children. A name
+// before the first leaf or after the last has only one neighbour, which
+// both paths then give, and whose directions must put it at that end.
+bool MerkleTree::verifySpan(const Json::Value& subtree, const RecordPtr& record)
 {
-  leftChild_ = left;
-  rightChild_ = right;
+  const Json::Value& lower = subtree["left"];
+  const Json::Value& upper = subtree["right"];
+  if (!lower.isArray() || !upper.isArray() || upper.empty() ||
+      upper.size() > lower.size())
+    return false;
+
+  const Json::ArrayIndex meet = upper.size() - 1;
+  if (meet == 0 ? upper[0]["hash"] != lower[0]["hash"]
+                : upper[meet] != lower[meet])
+    return false;
+
+  SHA384_HASH top;
+  uint64_t lowerBits = 0, upperBits = 0;
+  if (!climbPath(lower, top, lowerBits) || !climbPath(upper, top, upperBits))
+    return false;
+
+  const StringRef& name = record->getNameRef();
+  if (meet == 0)
+  {  // one leaf at either end of the tree, as with locateLeaf
+    const StringRef leafName = getEntryName(lower[0]);
+    if (name < leafName)
+      return lowerBits == 0;
+    return leafName < name && isLastLeaf(lower, lowerBits);
+  }
+
+  const uint64_t junction = uint64_t(1) << (meet - 1);
+  if ((lowerBits & (2 * junction - 1)) != junction - 1 ||
+      upperBits != junction)
+    return false;
+
+  return getEntryName(lower[0]) < name && name < getEntryName(upper[0]);
 }
 
 
 
-MerkleTree::NodePtr MerkleTree::Node::getParent() const
+// Whether a whole path from climbPath starts at the tree's last leaf: each
+// node on it is the right child of its parent, or a left child alone.
+bool MerkleTree::isLastLeaf(const Json::Value& path, uint64_t directions)
 {
-  return parent_;
+  for (Json::ArrayIndex j = 1; j < path.size(); j++)
+    if (!(directions & (uint64_t(1) << (j - 1))) && path[j].isMember("right"))
+      return false;
+  return true;
 }
 
 
 
-SHA384_HASH MerkleTree::Node::getHash() const
+// Hashes up a path, checking that each node is one of the children listed
+// in the entry above it. Gives the hash of the node of the last entry, and
+// sets bit j - 1 of the directions if entry j was reached from its right.
+bool MerkleTree::climbPath(const Json::Value& path,
+                           SHA384_HASH& top,
+                           uint64_t& directions)
 {
-  return hash_;
+  directions = 0;
+  if (!path.isArray() || path.empty() || path.size() > 64 ||
+      !decodeHash(path[0]["hash"], top))
+    return false;
+
+  SHA384_HASH left, right;
+  for (Json::ArrayIndex j = 1; j < path.size(); j++)
+  {
+    const Json::Value& entry = path[j];
+    if (!decodeHash(entry["left"], left))
+      return false;
+
+    if (!entry.isMember("right"))
+      right = left;  // self-paired
+    else if (!decodeHash(entry["right"], right))
+      return false;
+
+    if (top != left)
+    {
+      if (top != right)
+        return false;
+      directions |= uint64_t(1) << (j - 1);
+    }
+
+    hashPair(left, right, top);
+  }
+
+  return true;
 }
 
 
 
-std::string MerkleTree::Node::getBase64Hash() const
+// The Record is covered if it is one of the leaves, or if two neighbouring
+// leaves bound its name, or if the first or last leaf does.
+bool MerkleTree::verifyLeaves(const Json::Value& proof, const RecordPtr& record)
 {
-  return Botan::base64_encode(hash_.data(), Const::SHA384_LEN);
+  const Json::Value* leaf = nullptr;
+  if (!locateLeaf(proof, record->getNameRef(), leaf))
+    return false;
+  return leaf == nullptr || (*leaf)["hash"] == encode(record->getHash());
 }
 
 
 
-Json::Value MerkleTree::Node::asValue() const
+// Finds the name among a multi-proof's leaves, setting leaf to it, or to
+// null if the leaves show that the name is absent: it falls between two
+// adjacent ones, or before the first or after the last of the tree. False
+// if the proof shows neither.
+bool MerkleTree::locateLeaf(const Json::Value& proof,
+                            const StringRef& name,
+                            const Json::Value*& leaf)
 {
-  Json::Value value;
+  const Json::Value& leaves = proof["leaves"];
+  const Json::Value* previous = nullptr;
+  leaf = nullptr;
 
-  if (leftChild_)
-    value["left"] = leftChild_->getBase64Hash();
-  if (rightChild_)
-    value["right"] = rightChild_->getBase64Hash();
+  for (const auto& leafVal : leaves)
+  {
+    const StringRef leafName = getEntryName(leafVal);
+    if (leafName == name)
+    {
+      leaf = &leafVal;
+      return true;
+    }
 
-  return value;
+    if (name < leafName)
+    {
+      if (previous == nullptr)
+        return leafVal["index"].asUInt64() == 0;
+      return (*previous)["index"].asUInt64() + 1 ==
+             leafVal["index"].asUInt64();
+    }
+
+    previous = &leafVal;
+  }
+
+  return previous != nullptr &&
+         (*previous)["index"].asUInt64() + 1 == proof["size"].asUInt64();
 }
 
 
 
-MerkleTree::Leaf::Leaf(const RecordPtr& record, const NodePtr& parent)
-    : Node(parent, record->getHash()), name_(record->getName())
+size_t MerkleTree::countNames(const std::vector<RecordPtr>& records)
 {
+  size_t count = 0;
+  for (const auto& r : records)
+    count += 1 + r->getSubdomainRefs().size();
+  return count;
 }
 
 
 
-MerkleTree::Leaf::Leaf(const std::string& name) : name_(name)
+// a view of the name of a path entry or a leaf, empty if it has none
+StringRef MerkleTree::getEntryName(const Json::Value& entry)
 {
+  const char *begin = nullptr, *end = nullptr;
+  const Json::Value& name = entry["name"];
+  if (!name.isString() || !name.getString(&begin, &end))
+    return StringRef();
+  return StringRef(begin, end - begin);
 }
 
 
 
-std::string MerkleTree::Leaf::getName() const
+// inserts the Record's names, building each full subdomain name in one buffer
+void MerkleTree::addToFilter(const Record& record)
 {
-  return name_;
+  const StringRef& name = record.getNameRef();
+  std::string fullName(name.data(), name.size());
+  filter_.insert(fullName);
+
+  for (const auto& subdomain : record.getSubdomainRefs())
+  {
+    fullName.assign(subdomain.first.data(), subdomain.first.size());
+    fullName += '.';
+    fullName.append(name.data(), name.size());
+    filter_.insert(fullName);
+  }
 }
@@ -1,73 +1,104 @@
-
 #ifndef MERKLE_TREE_HPP
 #define MERKLE_TREE_HPP
 
 #include "records/Record.hpp"
+#include "BloomFilter.hpp"
+#include "MerkleProof.hpp"
+#include "NameIndex.hpp"
 #include "../Constants.hpp"
+#include "../ThreadPool.hpp"
 #include <json/json.h>
 #include <vector>
 #include <memory>
 #include <string>
+#include <mutex>
 
 class MerkleTree
 {  // this tree is built and referenced from the leaves to the root
 
  public:
-  MerkleTree(const std::vector<RecordPtr>&);
+  // estimated bytes, by what holds them
+  struct MemoryUsage
+  {
+    size_t hashes;  // the rows of node hashes
+    size_t names;   // the sorted leaf names and their NameIndex
+    size_t filter;  // the Bloom filter of names
+    size_t getTotal() const;
+  };
+
+  MerkleTree(const std::vector<RecordPtr>&, ThreadPool* pool = nullptr);
+  MerkleTree(const MerkleTree&);
   Json::Value generateSubtree(const std::string&) const;
+  size_t generateProof(const std::string&, uint8_t*, size_t) const;
+  Json::Value generateMultiProof(const std::vector<std::string>&) const;
   static bool doesContain(const Json::Value&, const RecordPtr&);
+  static bool doesExclude(const Json::Value&, const std::string&);
+  static bool verifyMultiProof(const Json::Value&, const SHA384_HASH&);
   static SHA384_HASH extractRoot(const Json::Value&);
+  static bool decodeHash(const Json::Value&, SHA384_HASH&);
   SHA384_HASH getRootHash() const;
+  bool mightContain(const std::string&) const;
+  double getFalsePositiveRate() const;
+  std::vector<std::string> getNamesWithPrefix(const std::string&,
+                                              size_t limit = SIZE_MAX) const;
+  MemoryUsage getMemoryUsage() const;
 
- private:
-  class Node
-  {
-   public:
-    typedef std::shared_ptr<MerkleTree::Node> NodePtr;
-
-    Node();
-    Node(const NodePtr&, const SHA384_HASH&);
-    virtual ~Node() {}
-    void setParent(const NodePtr&);
-    void setChildren(const NodePtr&, const NodePtr&);
-    NodePtr getParent() const;
-    SHA384_HASH getHash() const;  // http://sphincs.cr.yp.to/
-    std::string getBase64Hash() const;
-    Json::Value asValue() const;
-
-   protected:
-    NodePtr parent_, leftChild_, rightChild_;
-    SHA384_HASH hash_;
-  };
-
-  typedef std::shared_ptr<MerkleTree::Node> NodePtr;
+  bool insert(const RecordPtr&);
+  size_t insert(std::vector<RecordPtr>);
+  bool replace(const RecordPtr&);
+  bool remove(const std::string&);
 
-  class Leaf : public Node
-  {
-   public:
-    Leaf(const RecordPtr&, const NodePtr&);
-    Leaf(const std::string&);
-    std::string getName() const;
-
-   private:
-    std::string name_;
-  };
-
-  typedef std::shared_ptr<MerkleTree::Leaf> LeafPtr;
-
-  SHA384_HASH buildTree(std::vector<NodePtr>&);
-  static SHA384_HASH concatenateHashes(const NodePtr&, const NodePtr&);
-  Json::Value generatePath(const LeafPtr&) const;
-  Json::Value generateSpan(const LeafPtr&,
-                           const std::vector<LeafPtr>::const_iterator&) const;
+ private:
+  friend class MerkleSync;
+
+  // The tree is stored as contiguous rows of hashes: levels_[0] holds the
+  // leaves and levels_.back() holds only the root. Node j of a level has the
+  // children 2j and 2j + 1 one level down, and an odd node out at the end of
+  // a row is hashed with itself.
+  typedef std::vector<SHA384_HASH> Level;
+
+  // rows at least this wide are split across the ThreadPool, if there is one
+  static const size_t PARALLEL_THRESHOLD = 4096;
+
+  void buildTree(size_t, ThreadPool* pool = nullptr);
+  SHA384_HASH hashChildren(size_t, size_t) const;
+  static SHA384_HASH concatenateHashes(const SHA384_HASH&, const SHA384_HASH&);
+  static void hashPair(const SHA384_HASH&, const SHA384_HASH&, SHA384_HASH&);
+  static std::string encode(const SHA384_HASH&);
+
+  Json::Value generatePath(size_t, size_t) const;
+  Json::Value generateSpan(size_t) const;
+  Json::Value asValue(size_t, size_t) const;
+  void makePath(size_t, size_t, MerkleProof::Path&) const;
+  size_t find(const std::string&) const;
+  size_t lowerBound(const std::string&) const;
+  SHA384_HASH getRangeDigest(size_t, size_t) const;
+  void invalidatePrefixes(size_t);
 
   static bool verifyPath(const Json::Value& value, const RecordPtr&);
   static bool verifySpan(const Json::Value& value, const RecordPtr&);
-
-  static bool isLessThan(const LeafPtr&, const LeafPtr&);
-
-  std::vector<LeafPtr> leaves_;
+  static bool climbPath(const Json::Value&, SHA384_HASH&, uint64_t&);
+  static bool isLastLeaf(const Json::Value&, uint64_t);
+  static bool verifyLeaves(const Json::Value&, const RecordPtr&);
+  static bool locateLeaf(const Json::Value&,
+                         const StringRef&,
+                         const Json::Value*&);
+  static StringRef getEntryName(const Json::Value&);
+  void addToFilter(const Record&);
+
+  static size_t countNames(const std::vector<RecordPtr>&);
+
+  std::vector<std::string> names_;  // leaf names, in sorted order
+  std::vector<Level> levels_;
   SHA384_HASH rootHash_;
+  BloomFilter filter_;  // every name and subdomain in the tree
+  NameIndex index_;     // of names_
+
+  // XORs of the first j leaf hashes, for getRangeDigest, of which the first
+  // prefixesValid_ + 1 are up to date; built only once a digest is needed
+  mutable std::mutex prefixMutex_;
+  mutable std::vector<SHA384_HASH> prefixes_;
+  mutable size_t prefixesValid_;
 };
 
 typedef std::shared_ptr<MerkleTree> MerkleTreePtr;
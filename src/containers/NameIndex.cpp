@@ -0,0 +1,138 @@
+
+#include "NameIndex.hpp"
+#include <algorithm>
+#include <limits>
+
+const size_t NameIndex::KEY_LEN;
+
+NameIndex::NameIndex() : keys_(1), ranks_(1)
+{
+}
+
+
+
+// names must be sorted
+void NameIndex::build(const std::vector<std::string>& names)
+{
+  commonPrefix_.clear();
+  if (!names.empty())
+  {  // sorted, so what the first and last share, all share
+    const std::string& first = names.front();
+    const std::string& last = names.back();
+    size_t len = 0;
+    while (len < first.size() && len < last.size() && first[len] == last[len])
+      len++;
+    commonPrefix_ = first.substr(0, len);
+  }
+
+  std::vector<uint64_t> sorted;
+  sorted.reserve(names.size());
+  for (const auto& name : names)
+    sorted.push_back(makeKey(name));
+
+  keys_.assign(names.size() + 1, 0);
+  ranks_.assign(names.size() + 1, 0);
+  size_t rank = 0;
+  layOut(sorted, rank, 1);
+}
+
+
+
+// the index of the first of the names that is not before the given one,
+// names.size() if there is none; names must be those the index was built of
+size_t NameIndex::lowerBound(const std::vector<std::string>& names,
+                             const std::string& name) const
+{
+  if (names.empty())
+    return 0;
+
+  const int order = name.compare(0, commonPrefix_.size(), commonPrefix_);
+  if (order != 0)
+    return order < 0 ? 0 : names.size();
+
+  const uint64_t key = makeKey(name);
+  const size_t slot = searchKey(key);
+  if (slot == 0)
+    return names.size();
+
+  // a lesser key is a lesser name, but equal keys need the strings compared
+  const size_t first = ranks_[slot];
+  if (keys_[slot] != key || names[first] >= name)
+    return first;
+
+  size_t end = names.size();
+  if (key != std::numeric_limits<uint64_t>::max())
+  {
+    const size_t next = searchKey(key + 1);
+    end = next == 0 ? names.size() : ranks_[next];
+  }
+
+  return std::lower_bound(names.begin() + first + 1, names.begin() + end,
+                          name) -
+         names.begin();
+}
+
+
+
+size_t NameIndex::getMemoryUsage() const
+{
+  return commonPrefix_.capacity() + keys_.capacity() * sizeof(uint64_t) +
+         ranks_.capacity() * sizeof(uint32_t);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// the KEY_LEN bytes after the common prefix, big-endian, zero-padded
+uint64_t NameIndex::makeKey(const std::string& name) const
+{
+  uint64_t key = 0;
+  for (size_t j = 0; j < KEY_LEN; j++)
+  {
+    const size_t pos = commonPrefix_.size() + j;
+    const uint8_t byte = pos < name.size() ? name[pos] : 0;
+    key = (key << 8) | byte;
+  }
+
+  return key;
+}
+
+
+
+// The slot of the first key in sorted order that is not less than the
+// given one, or 0 if there is none. The descent always runs to a leaf, one
+// step per level, and then undoes the right turns taken after the last left
+// turn, which is where the answer was passed.
+size_t NameIndex::searchKey(uint64_t key) const
+{
+  const size_t n = keys_.size() - 1;
+  size_t k = 1;
+  while (k <= n)
+  {
+    if (16 * k <= n)  // four levels down, where the search will be soon
+      __builtin_prefetch(&keys_[16 * k]);
+    k = 2 * k + (keys_[k] < key);
+  }
+
+  return k >> __builtin_ffsll(static_cast<long long>(~k));
+}
+
+
+
+// fills slot k and its subtrees with the sorted keys from rank onwards
+void NameIndex::layOut(const std::vector<uint64_t>& sorted,
+                       size_t& rank,
+                       size_t k)
+{
+  if (k >= keys_.size())
+    return;
+
+  layOut(sorted, rank, 2 * k);
+  keys_[k] = sorted[rank];
+  ranks_[k] = static_cast<uint32_t>(rank);
+  rank++;
+  layOut(sorted, rank, 2 * k + 1);
+}
@@ -0,0 +1,37 @@
+#ifndef NAME_INDEX_HPP
+#define NAME_INDEX_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Finds where a name falls in a sorted list of names without walking the
+// strings themselves. Every name shares a common prefix; the eight bytes
+// that follow it are packed big-endian into a key, so that comparing keys
+// orders the names as comparing the strings would, save for ties. The keys
+// are stored in Eytzinger order, root first and the children of k at 2k and
+// 2k + 1, so the first levels of every search share cache lines and the
+// next lines can be prefetched well before they are needed. Only names whose
+// keys tie with the one searched for are compared as strings. The index does
+// not own the names, and must be rebuilt whenever they change.
+class NameIndex
+{
+ public:
+  static const size_t KEY_LEN = sizeof(uint64_t);
+
+  NameIndex();
+  void build(const std::vector<std::string>&);
+  size_t lowerBound(const std::vector<std::string>&, const std::string&) const;
+  size_t getMemoryUsage() const;
+
+ private:
+  uint64_t makeKey(const std::string&) const;
+  size_t searchKey(uint64_t) const;
+  void layOut(const std::vector<uint64_t>&, size_t&, size_t);
+
+  std::string commonPrefix_;
+  std::vector<uint64_t> keys_;   // [0] unused, then in Eytzinger order
+  std::vector<uint32_t> ranks_;  // the sorted index of each key
+};
+
+#endif
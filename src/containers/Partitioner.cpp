@@ -0,0 +1,356 @@
+
+#include "Partitioner.hpp"
+#include "MerkleTree.hpp"
+#include "../Common.hpp"
+#include "../Log.hpp"
+#include "../encoding/Codec.hpp"
+#include "../crypto/Sha2.hpp"
+#include <algorithm>
+#include <mutex>
+
+const size_t Partitioner::DEFAULT_VIRTUAL_NODES;
+const size_t Partitioner::MAX_NODES;
+const size_t Partitioner::MAX_VIRTUAL_NODES;
+
+std::shared_ptr<const Partitioner::Local> Partitioner::local_;
+
+Partitioner::Partitioner(const std::vector<std::string>& nodes,
+                         size_t virtualNodes)
+    : nodes_(nodes), virtualNodes_(virtualNodes)
+{
+  if (nodes.empty() || nodes.size() > MAX_NODES)
+    Log::get().error("A partitioned cluster needs 1 to " +
+                     std::to_string(MAX_NODES) + " nodes!");
+  if (virtualNodes == 0 || virtualNodes > MAX_VIRTUAL_NODES)
+    Log::get().error("Invalid number of virtual nodes per node!");
+
+  for (const auto& node : nodes)
+    if (node.empty() || node.size() > UINT16_MAX)
+      Log::get().error("Invalid length of a node in a partitioned cluster!");
+
+  std::vector<std::string> sorted(nodes);
+  std::sort(sorted.begin(), sorted.end());
+  if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+    Log::get().error("The nodes of a partitioned cluster must be distinct!");
+
+  ring_.reserve(nodes.size() * virtualNodes);
+  for (size_t n = 0; n < nodes.size(); n++)
+    for (size_t v = 0; v < virtualNodes; v++)
+      ring_.push_back(
+          {hashPoint(nodes[n] + "#" + std::to_string(v)), uint32_t(n)});
+
+  // ties, however unlikely, go to the lower node on every machine
+  std::sort(ring_.begin(), ring_.end(),
+            [](const Point& a, const Point& b)
+            {
+              return a.hash < b.hash || (a.hash == b.hash && a.node < b.node);
+            });
+
+  digest_ = digestOf(nodes, virtualNodes);
+}
+
+
+
+// the index of the node that holds the name's Record
+size_t Partitioner::getPartition(const std::string& name) const
+{
+  const uint64_t key = hashPoint(Common::getOwnerName(name));
+  auto point = std::lower_bound(ring_.begin(), ring_.end(), key,
+                                [](const Point& p, uint64_t hash)
+                                {
+                                  return p.hash < hash;
+                                });
+
+  return point == ring_.end() ? ring_.front().node : point->node;
+}
+
+
+
+// the node that a lookup of the name should be routed to
+const std::string& Partitioner::getNode(const std::string& name) const
+{
+  return nodes_[getPartition(name)];
+}
+
+
+
+const std::vector<std::string>& Partitioner::getNodes() const
+{
+  return nodes_;
+}
+
+
+
+size_t Partitioner::getNodeCount() const
+{
+  return nodes_.size();
+}
+
+
+
+size_t Partitioner::getVirtualNodes() const
+{
+  return virtualNodes_;
+}
+
+
+
+// commits to the nodes, their order, and the virtual nodes of each
+const SHA384_HASH& Partitioner::getDigest() const
+{
+  return digest_;
+}
+
+
+
+// the Records of each partition, in the order they were given
+std::vector<std::vector<RecordPtr>> Partitioner::split(
+    const std::vector<RecordPtr>& records) const
+{
+  std::vector<std::vector<RecordPtr>> partitions(nodes_.size());
+  for (const auto& record : records)
+    partitions[getPartition(record->getName())].push_back(record);
+  return partitions;
+}
+
+
+
+// the global root, from every partition's root in node order
+SHA384_HASH Partitioner::combineRoots(
+    const std::vector<SHA384_HASH>& roots) const
+{
+  if (roots.size() != nodes_.size())
+    Log::get().error("Need the roots of all " + std::to_string(nodes_.size()) +
+                     " partitions, have " + std::to_string(roots.size()));
+
+  Sha2::Context context(true);
+  context.update(digest_.data(), digest_.size());
+  for (const auto& root : roots)
+    context.update(root.data(), root.size());
+
+  SHA384_HASH global;
+  context.final(global.data());
+  return global;
+}
+
+
+
+// Wraps a subtree from the partition's own MerkleTree so that it can be
+// checked against the global root:
+//   {"ring": asJSON(), "partition": index, "roots": [base64, ...],
+//    "subtree": the partition's subtree}
+Json::Value Partitioner::wrapSubtree(size_t partition,
+                                     const std::vector<SHA384_HASH>& roots,
+                                     const Json::Value& subtree) const
+{
+  if (partition >= nodes_.size() || roots.size() != nodes_.size())
+    Log::get().error("Cannot wrap a subtree without every partition root.");
+
+  Json::Value wrapped;
+  wrapped["ring"] = asJSON();
+  wrapped["partition"] = static_cast<Json::UInt>(partition);
+  wrapped["roots"] = Json::Value(Json::arrayValue);
+  for (const auto& root : roots)
+    wrapped["roots"].append(Codec::base64Encode(root.data(), root.size()));
+  wrapped["subtree"] = subtree;
+  return wrapped;
+}
+
+
+
+// Checks a wrapped subtree: the ring and the partition roots must combine to
+// the trusted global root, the name must belong to the partition, and the
+// subtree must lead up to the partition's root. Gives the subtree, which
+// then shows whether a Record is present, as from MerkleTree::doesContain.
+bool Partitioner::unwrapSubtree(const Json::Value& wrapped,
+                                const std::string& name,
+                                const SHA384_HASH& globalRoot,
+                                Json::Value& subtree)
+{
+  // clients check many names against the same ring, so keep the last one
+  static std::mutex mutex;
+  static PartitionerPtr last;
+
+  if (!wrapped.isObject() || !wrapped["roots"].isArray() ||
+      !wrapped["partition"].isUInt())
+    return false;
+
+  std::vector<std::string> nodes;
+  size_t virtualNodes;
+  if (!parseRing(wrapped["ring"], nodes, virtualNodes))
+    return false;
+
+  PartitionerPtr ring;
+  const SHA384_HASH digest = digestOf(nodes, virtualNodes);
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (last && last->getDigest() == digest)
+      ring = last;
+  }
+
+  if (!ring)
+  {
+    try
+    {
+      ring = std::make_shared<Partitioner>(nodes, virtualNodes);
+    }
+    catch (const std::exception&)
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    last = ring;
+  }
+
+  const Json::Value& roots = wrapped["roots"];
+  const size_t partition = wrapped["partition"].asUInt();
+  if (roots.size() != ring->getNodeCount() ||
+      ring->getPartition(name) != partition)
+    return false;
+
+  std::vector<SHA384_HASH> decoded(roots.size());
+  for (Json::ArrayIndex j = 0; j < roots.size(); j++)
+    if (!MerkleTree::decodeHash(roots[j], decoded[j]))
+      return false;
+
+  if (ring->combineRoots(decoded) != globalRoot ||
+      MerkleTree::extractRoot(wrapped["subtree"]) != decoded[partition])
+    return false;
+
+  subtree = wrapped["subtree"];
+  return true;
+}
+
+
+
+Json::Value Partitioner::asJSON() const
+{
+  Json::Value ring;
+  ring["virtual"] = static_cast<Json::UInt>(virtualNodes_);
+  ring["nodes"] = Json::Value(Json::arrayValue);
+  for (const auto& node : nodes_)
+    ring["nodes"].append(node);
+  return ring;
+}
+
+
+
+// the ring described by asJSON(), or nullptr if the description is invalid
+PartitionerPtr Partitioner::fromJSON(const Json::Value& ring)
+{
+  std::vector<std::string> nodes;
+  size_t virtualNodes;
+  if (!parseRing(ring, nodes, virtualNodes))
+    return nullptr;
+
+  try
+  {
+    return std::make_shared<Partitioner>(nodes, virtualNodes);
+  }
+  catch (const std::exception&)
+  {
+    return nullptr;
+  }
+}
+
+
+
+// Turns partitioned mode on for this process, which is then the given node
+// of the ring, or off again with a null ring.
+void Partitioner::configure(const PartitionerPtr& ring, size_t self)
+{
+  if (ring && self >= ring->getNodeCount())
+    Log::get().error("The local node is not one of the ring's nodes!");
+
+  std::shared_ptr<const Local> local;
+  if (ring)
+  {
+    local = std::make_shared<Local>(Local{ring, self});
+    LOG_NOTICE("Holding partition " + std::to_string(self) + " of " +
+               std::to_string(ring->getNodeCount()));
+  }
+
+  std::atomic_store(&local_, local);
+}
+
+
+
+// the ring this process serves a partition of, or nullptr if not partitioned
+PartitionerPtr Partitioner::getConfigured()
+{
+  const auto local = std::atomic_load(&local_);
+  return local ? local->ring : nullptr;
+}
+
+
+
+// whether this process holds the name's Record; always true unless partitioned
+bool Partitioner::isLocal(const std::string& name)
+{
+  const auto local = std::atomic_load(&local_);
+  return !local || local->ring->getPartition(name) == local->self;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// the first eight bytes of the string's SHA-384, big-endian
+uint64_t Partitioner::hashPoint(const std::string& str)
+{
+  uint8_t hash[Sha2::SHA384_LEN];
+  Sha2::sha384(reinterpret_cast<const uint8_t*>(str.data()), str.size(), hash);
+
+  uint64_t point = 0;
+  for (size_t j = 0; j < sizeof(point); j++)
+    point = (point << 8) | hash[j];
+  return point;
+}
+
+
+
+SHA384_HASH Partitioner::digestOf(const std::vector<std::string>& nodes,
+                                  size_t virtualNodes)
+{
+  Sha2::Context context(true);
+  uint8_t header[8];
+  for (size_t j = 0; j < sizeof(header); j++)
+    header[j] = static_cast<uint8_t>(uint64_t(virtualNodes) >> (56 - 8 * j));
+  context.update(header, sizeof(header));
+
+  for (const auto& node : nodes)
+  {  // each prefixed by its length, so that no two lists hash alike
+    const uint8_t length[2] = {uint8_t(node.size() >> 8), uint8_t(node.size())};
+    context.update(length, sizeof(length));
+    context.update(reinterpret_cast<const uint8_t*>(node.data()), node.size());
+  }
+
+  SHA384_HASH digest;
+  context.final(digest.data());
+  return digest;
+}
+
+
+
+bool Partitioner::parseRing(const Json::Value& ring,
+                            std::vector<std::string>& nodes,
+                            size_t& virtualNodes)
+{
+  if (!ring.isObject() || !ring["virtual"].isUInt() ||
+      !ring["nodes"].isArray() || ring["nodes"].empty() ||
+      ring["nodes"].size() > MAX_NODES)
+    return false;
+
+  for (const auto& node : ring["nodes"])
+  {
+    if (!node.isString())
+      return false;
+    nodes.push_back(node.asString());
+  }
+
+  virtualNodes = ring["virtual"].asUInt();
+  return true;
+}
@@ -0,0 +1,91 @@
+#ifndef PARTITIONER_HPP
+#define PARTITIONER_HPP
+
+#include "records/Record.hpp"
+#include "../Constants.hpp"
+#include <json/json.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Partitioner;
+typedef std::shared_ptr<const Partitioner> PartitionerPtr;
+
+// Spreads the Records of a cluster over its nodes by consistent hashing, so
+// that each node only holds and builds the MerkleTree of its own partition.
+// Every node is placed at VIRTUAL_NODES points on a ring of 64-bit hashes,
+// and a name belongs to the first point at or after the hash of its owning
+// name, so a Record's subdomains always go with it, and adding or removing
+// a node only moves the names next to its points. Nodes are identified by
+// strings, such as their keys, and are numbered in the order given.
+//
+// The global root is the SHA-384 of the ring's digest and then every
+// partition's root, in node order, which a coordinator computes once it has
+// them all. A partition proves a name by wrapping its own subtree with the
+// ring and the other roots; unwrapSubtree() checks that against the global
+// root and that the name belongs to that partition, and gives the inner
+// subtree for MerkleTree::doesContain.
+//
+// Partitioned mode is off until configure() is called. Then Cache only
+// keeps the Records of the local node's partition.
+class Partitioner
+{
+ public:
+  static const size_t DEFAULT_VIRTUAL_NODES = 64;
+  static const size_t MAX_NODES = 1024;
+  static const size_t MAX_VIRTUAL_NODES = 1024;
+
+  Partitioner(const std::vector<std::string>&,
+              size_t virtualNodes = DEFAULT_VIRTUAL_NODES);
+
+  size_t getPartition(const std::string&) const;
+  const std::string& getNode(const std::string&) const;
+  const std::vector<std::string>& getNodes() const;
+  size_t getNodeCount() const;
+  size_t getVirtualNodes() const;
+  const SHA384_HASH& getDigest() const;
+  std::vector<std::vector<RecordPtr>> split(const std::vector<RecordPtr>&) const;
+
+  SHA384_HASH combineRoots(const std::vector<SHA384_HASH>&) const;
+  Json::Value wrapSubtree(size_t,
+                          const std::vector<SHA384_HASH>&,
+                          const Json::Value&) const;
+  static bool unwrapSubtree(const Json::Value&,
+                            const std::string&,
+                            const SHA384_HASH&,
+                            Json::Value&);
+
+  Json::Value asJSON() const;
+  static PartitionerPtr fromJSON(const Json::Value&);
+
+  static void configure(const PartitionerPtr&, size_t);
+  static PartitionerPtr getConfigured();
+  static bool isLocal(const std::string&);
+
+ private:
+  struct Point
+  {
+    uint64_t hash;
+    uint32_t node;
+  };
+
+  struct Local
+  {
+    PartitionerPtr ring;
+    size_t self;
+  };
+
+  static uint64_t hashPoint(const std::string&);
+  static SHA384_HASH digestOf(const std::vector<std::string>&, size_t);
+  static bool parseRing(const Json::Value&, std::vector<std::string>&, size_t&);
+
+  std::vector<std::string> nodes_;
+  size_t virtualNodes_;
+  std::vector<Point> ring_;  // by hash
+  SHA384_HASH digest_;       // of the nodes and virtualNodes_
+
+  static std::shared_ptr<const Local> local_;  // only through std::atomic_*
+};
+
+#endif
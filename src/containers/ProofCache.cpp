@@ -0,0 +1,153 @@
+
+#include "ProofCache.hpp"
+#include "../MemoryStats.hpp"
+
+
+ProofCache::ProofCache(size_t maxEntries)
+    : maxEntries_(maxEntries), hits_(0), misses_(0)
+{
+  root_.fill(0);
+}
+
+
+
+// returns the serialized response, or nullptr if it isn't cached for the root
+ProofCache::ResponsePtr ProofCache::get(const SHA384_HASH& root,
+                                        const std::string& domain)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto slot = slots_.find(domain);
+  if (root != root_ || slot == slots_.end())
+  {
+    misses_++;
+    return nullptr;
+  }
+
+  // mark as most recently used
+  lru_.splice(lru_.begin(), lru_, slot->second.lruPosition);
+  hits_++;
+  return slot->second.response;
+}
+
+
+
+// the serialized result of tree.generateSubtree(domain), from the cache if
+// possible; generation happens outside of the lock
+ProofCache::ResponsePtr ProofCache::getSubtree(const MerkleTree& tree,
+                                               const std::string& domain)
+{
+  const SHA384_HASH root = tree.getRootHash();
+  auto response = get(root, domain);
+  if (response)
+    return response;
+
+  Json::FastWriter writer;
+  return put(root, domain, writer.write(tree.generateSubtree(domain)));
+}
+
+
+
+// stores a response for the domain, replacing any older one
+ProofCache::ResponsePtr ProofCache::put(const SHA384_HASH& root,
+                                        const std::string& domain,
+                                        const std::string& response)
+{
+  auto shared = std::make_shared<const std::string>(response);
+  if (maxEntries_ == 0)
+    return shared;
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  setRoot(root);
+
+  auto existing = slots_.find(domain);
+  if (existing != slots_.end())
+  {
+    existing->second.response = shared;
+    lru_.splice(lru_.begin(), lru_, existing->second.lruPosition);
+    return shared;
+  }
+
+  if (slots_.size() >= maxEntries_)
+  {  // evict the least recently used response
+    slots_.erase(lru_.back());
+    lru_.pop_back();
+  }
+
+  lru_.push_front(domain);
+  Slot slot;
+  slot.response = shared;
+  slot.lruPosition = lru_.begin();
+  slots_[domain] = slot;
+  return shared;
+}
+
+
+
+void ProofCache::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  slots_.clear();
+  lru_.clear();
+}
+
+
+
+size_t ProofCache::getEntryCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return slots_.size();
+}
+
+
+
+// estimated bytes of the responses and of the index and LRU list of them
+size_t ProofCache::getMemoryUsage() const
+{
+  const size_t NODE = MemoryStats::NODE_OVERHEAD;
+  std::lock_guard<std::mutex> guard(mutex_);
+  size_t bytes = slots_.bucket_count() * sizeof(void*);
+  for (const auto& entry : slots_)
+    bytes += sizeof(decltype(slots_)::value_type) + NODE +
+             MemoryStats::getStringMemoryUsage(entry.first) +
+             sizeof(std::string) + 2 * sizeof(void*) +  // the shared string
+             MemoryStats::getStringMemoryUsage(*entry.second.response);
+
+  for (const auto& key : lru_)
+    bytes += sizeof(key) + NODE + MemoryStats::getStringMemoryUsage(key);
+  return bytes;
+}
+
+
+
+size_t ProofCache::getHitCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+
+
+size_t ProofCache::getMissCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// responses for any other root are stale, so forget them all
+void ProofCache::setRoot(const SHA384_HASH& root)
+{
+  if (root == root_)
+    return;
+
+  slots_.clear();
+  lru_.clear();
+  root_ = root;
+}
@@ -0,0 +1,49 @@
+#ifndef PROOF_CACHE_HPP
+#define PROOF_CACHE_HPP
+
+#include "MerkleTree.hpp"
+#include "../Constants.hpp"
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <list>
+
+// Server-side cache of already-serialized subtree responses for the most
+// requested domains, keyed by (root, domain). A response is only good for
+// the root it was generated under, so a new root drops every entry.
+class ProofCache
+{
+ public:
+  typedef std::shared_ptr<const std::string> ResponsePtr;
+
+  ProofCache(size_t);
+  ResponsePtr get(const SHA384_HASH&, const std::string&);
+  ResponsePtr getSubtree(const MerkleTree&, const std::string&);
+  ResponsePtr put(const SHA384_HASH&, const std::string&, const std::string&);
+  void clear();
+
+  size_t getEntryCount() const;
+  size_t getHitCount() const;
+  size_t getMissCount() const;
+  size_t getMemoryUsage() const;
+
+ private:
+  struct Slot
+  {
+    ResponsePtr response;
+    std::list<std::string>::iterator lruPosition;
+  };
+
+  void setRoot(const SHA384_HASH&);
+
+  const size_t maxEntries_;
+
+  mutable std::mutex mutex_;
+  SHA384_HASH root_;  // the root that every cached response belongs to
+  std::unordered_map<std::string, Slot> slots_;
+  std::list<std::string> lru_;  // most recently used at the front
+  size_t hits_, misses_;
+};
+
+#endif
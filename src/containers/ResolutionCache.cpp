@@ -0,0 +1,354 @@
+
+#include "ResolutionCache.hpp"
+#include "../Common.hpp"
+#include "../Metrics.hpp"
+#include "../Log.hpp"
+#include <algorithm>
+#include <iterator>
+
+const size_t ResolutionCache::MAX_FOLLOWERS;
+const int ResolutionCache::CO_QUERY_SECONDS;
+
+
+ResolutionCache::ResolutionCache(const std::chrono::seconds& ttl,
+                                 size_t maxBytes)
+    : ttl_(ttl), maxBytes_(maxBytes), bytes_(0)
+{
+}
+
+
+
+// returns the cached resolution, or nullptr if it is missing or expired
+ResolutionCache::EntryPtr ResolutionCache::get(const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto slot = slots_.find(name);
+  if (slot == slots_.end())
+    return nullptr;
+
+  if (slot->second.expiration <= Clock::now())
+  {
+    remove(slot);
+    return nullptr;
+  }
+
+  // mark as most recently used
+  lru_.splice(lru_.begin(), lru_, slot->second.lruPosition);
+  return slot->second.entry;
+}
+
+
+
+void ResolutionCache::put(const std::string& name, const Entry& entry)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  insert(name, entry, estimateSize(name, entry));
+  evict();
+}
+
+
+
+// Caches every name of the Record under the proof it came with: the proof
+// shows that the Record is under the root, and the Record holds the
+// destinations of its subdomains, so they need no lookups of their own.
+void ResolutionCache::putRecord(const RecordPtr& record,
+                                const Json::Value& subtree,
+                                const SHA384_HASH& root)
+{
+  Json::FastWriter writer;
+  const size_t subtreeBytes = writer.write(subtree).size();
+
+  const std::string owner = record->getName();
+  std::vector<std::string> names{owner};
+  for (const auto& subdomain : record->getSubdomainRefs())
+    names.push_back(subdomain.first.str() + "." + owner);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (const auto& name : names)
+  {
+    Entry entry;
+    entry.destination = record->resolve(name.data(), name.size()).str();
+    entry.subtree = subtree;
+    entry.root = root;
+    insert(name, entry, estimateSize(name, entry.destination, subtreeBytes));
+  }
+
+  evict();
+}
+
+
+
+void ResolutionCache::erase(const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto slot = slots_.find(name);
+  if (slot != slots_.end())
+    remove(slot);
+}
+
+
+
+void ResolutionCache::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  slots_.clear();
+  lru_.clear();
+  bytes_ = 0;
+}
+
+
+
+// pinned names are never evicted to save memory, but they still expire
+void ResolutionCache::pin(const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  pinned_.insert(name);
+}
+
+
+
+void ResolutionCache::unpin(const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  pinned_.erase(name);
+  evict();
+}
+
+
+
+// Notes that the client is looking up the name. When a lookup follows one
+// of another Record within CO_QUERY_SECONDS, the second Record is remembered
+// as a follower of the first, for as long as the first stays cached.
+void ResolutionCache::noteQuery(const std::string& name)
+{
+  const std::string owner = Common::getOwnerName(name);
+  const auto now = Clock::now();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto slot = slots_.find(lastOwner_);
+  if (slot != slots_.end() && owner != lastOwner_ &&
+      now - lastQuery_ <= std::chrono::seconds(CO_QUERY_SECONDS))
+  {
+    auto& followers = slot->second.followers;
+    auto existing = std::find(followers.begin(), followers.end(), owner);
+    if (existing != followers.end())
+    {
+      followers.erase(existing);
+      bytes_ -= owner.size();
+      slot->second.bytes -= owner.size();
+    }
+
+    followers.insert(followers.begin(), owner);
+    bytes_ += owner.size();
+    slot->second.bytes += owner.size();
+    if (followers.size() > MAX_FOLLOWERS)
+    {
+      bytes_ -= followers.back().size();
+      slot->second.bytes -= followers.back().size();
+      followers.pop_back();
+    }
+  }
+
+  lastOwner_ = owner;
+  lastQuery_ = now;
+}
+
+
+
+// the Records that have followed the name's own and are not cached, most
+// recent first; these are worth a prefetch once the name is resolved
+std::vector<std::string> ResolutionCache::getPrefetchNames(
+    const std::string& name)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  std::vector<std::string> names;
+  auto slot = slots_.find(Common::getOwnerName(name));
+  if (slot == slots_.end())
+    return names;
+
+  for (const auto& follower : slot->second.followers)
+    if (!isFresh(follower))
+      names.push_back(follower);
+  return names;
+}
+
+
+
+// Looks up the names that are not cached in batch queries, checks each
+// response against the trusted root and caches the Records it proves. Names
+// without a Record are not cached, and a failed or invalid response is only
+// logged, as nothing depends on a prefetch. Returns the number of Records
+// that were cached.
+size_t ResolutionCache::prefetch(const std::vector<std::string>& names,
+                                 const SHA384_HASH& root,
+                                 const Fetcher& fetch)
+{
+  static Metrics::Counter& prefetched = Metrics::get().counter(
+      "onions_prefetched_records_total",
+      "Records cached by ResolutionCache::prefetch.");
+
+  std::vector<std::string> missing;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& name : names)
+      if (!isFresh(name) &&
+          std::find(missing.begin(), missing.end(), name) == missing.end())
+        missing.push_back(name);
+  }
+
+  size_t cached = 0;
+  for (size_t start = 0; start < missing.size();
+       start += Common::MAX_BATCH_NAMES)
+  {
+    const size_t end =
+        std::min(missing.size(), start + Common::MAX_BATCH_NAMES);
+    const std::vector<std::string> batch(missing.begin() + start,
+                                         missing.begin() + end);
+
+    try
+    {
+      const Json::Value response = fetch(Common::makeBatchQuery(batch));
+      std::vector<RecordPtr> records;
+      for (const auto& lookup : Common::checkBatchQuery(response, batch, root))
+        if (lookup.record &&
+            std::find(records.begin(), records.end(), lookup.record) ==
+                records.end())
+          records.push_back(lookup.record);
+
+      for (const auto& record : records)
+        putRecord(record, response["proof"], root);
+      cached += records.size();
+    }
+    catch (const std::exception& err)
+    {
+      Log::get().warn("Prefetch failed: " + std::string(err.what()));
+    }
+  }
+
+  prefetched.add(cached);
+  return cached;
+}
+
+
+
+// as prefetch, on a thread of its own; the cache must outlive the future
+std::future<size_t> ResolutionCache::prefetchAsync(
+    const std::vector<std::string>& names,
+    const SHA384_HASH& root,
+    const Fetcher& fetch)
+{
+  return std::async(std::launch::async,
+                    [this, names, root, fetch]()
+                    {
+                      return prefetch(names, root, fetch);
+                    });
+}
+
+
+
+size_t ResolutionCache::getEntryCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return slots_.size();
+}
+
+
+
+size_t ResolutionCache::getMemoryUsage() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return bytes_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// replaces any entry of the name, keeping the Records that followed it
+void ResolutionCache::insert(const std::string& name,
+                             const Entry& entry,
+                             size_t bytes)
+{
+  std::vector<std::string> followers;
+  auto existing = slots_.find(name);
+  if (existing != slots_.end())
+  {
+    followers.swap(existing->second.followers);
+    remove(existing);
+  }
+
+  lru_.push_front(name);
+
+  Slot slot;
+  slot.entry = std::make_shared<Entry>(entry);
+  slot.expiration = Clock::now() + ttl_;
+  slot.bytes = bytes;
+  slot.lruPosition = lru_.begin();
+  for (const auto& follower : followers)
+    slot.bytes += follower.size();
+  slot.followers.swap(followers);
+
+  bytes_ += slot.bytes;
+  slots_[name] = slot;
+}
+
+
+
+bool ResolutionCache::isFresh(const std::string& name) const
+{
+  auto slot = slots_.find(name);
+  return slot != slots_.end() && slot->second.expiration > Clock::now();
+}
+
+
+
+void ResolutionCache::remove(SlotMap::iterator slot)
+{
+  bytes_ -= slot->second.bytes;
+  lru_.erase(slot->second.lruPosition);
+  slots_.erase(slot);
+}
+
+
+
+// drops the least recently used unpinned entries until under the memory cap
+void ResolutionCache::evict()
+{
+  auto candidate = lru_.end();
+  while (bytes_ > maxBytes_ && candidate != lru_.begin())
+  {
+    --candidate;
+    if (pinned_.count(*candidate) > 0)
+      continue;
+
+    auto victim = slots_.find(*candidate);
+    candidate = std::next(candidate);  // remove() invalidates the position
+    remove(victim);
+  }
+}
+
+
+
+size_t ResolutionCache::estimateSize(const std::string& name,
+                                     const Entry& entry)
+{
+  Json::FastWriter writer;
+  return estimateSize(name, entry.destination,
+                      writer.write(entry.subtree).size());
+}
+
+
+
+size_t ResolutionCache::estimateSize(const std::string& name,
+                                     const std::string& destination,
+                                     size_t subtreeBytes)
+{
+  return sizeof(Slot) + sizeof(Entry) + 2 * name.size() +
+         destination.size() + subtreeBytes;
+}
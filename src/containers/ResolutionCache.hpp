@@ -0,0 +1,100 @@
+#ifndef RESOLUTION_CACHE_HPP
+#define RESOLUTION_CACHE_HPP
+
+#include "../Constants.hpp"
+#include "records/Record.hpp"
+#include <json/json.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <list>
+
+// Bounded client-side cache of recent resolutions. Entries expire after a
+// fixed TTL, and the least recently used unpinned entries are evicted once
+// the estimated memory use exceeds the cap. A Record and its proof answer
+// for every name the Record holds, so the whole Record is cached at once and
+// a later lookup of one of its subdomains needs no round trip. The cache also
+// remembers which Records tend to be looked up shortly after one another, so
+// that the client can fetch those in the background, in one batch query.
+class ResolutionCache
+{
+ public:
+  struct Entry
+  {
+    std::string destination;  // .onion address or .tor name
+    Json::Value subtree;      // Merkle proof from the server
+    SHA384_HASH root;         // root that the proof was checked against
+  };
+
+  typedef std::shared_ptr<const Entry> EntryPtr;
+  typedef std::chrono::steady_clock Clock;
+
+  // sends a "batchQuery" request and returns the response's value
+  typedef std::function<Json::Value(const std::string&)> Fetcher;
+
+  static const size_t MAX_FOLLOWERS = 8;  // remembered per Record
+  static const int CO_QUERY_SECONDS = 30;
+
+  ResolutionCache(const std::chrono::seconds&, size_t);
+  EntryPtr get(const std::string&);
+  void put(const std::string&, const Entry&);
+  void putRecord(const RecordPtr&, const Json::Value&, const SHA384_HASH&);
+  void erase(const std::string&);
+  void clear();
+
+  void pin(const std::string&);
+  void unpin(const std::string&);
+
+  void noteQuery(const std::string&);
+  std::vector<std::string> getPrefetchNames(const std::string&);
+  size_t prefetch(const std::vector<std::string>&,
+                  const SHA384_HASH&,
+                  const Fetcher&);
+  std::future<size_t> prefetchAsync(const std::vector<std::string>&,
+                                    const SHA384_HASH&,
+                                    const Fetcher&);
+
+  size_t getEntryCount() const;
+  size_t getMemoryUsage() const;
+
+ private:
+  struct Slot
+  {
+    EntryPtr entry;
+    Clock::time_point expiration;
+    size_t bytes;
+    std::list<std::string>::iterator lruPosition;
+    std::vector<std::string> followers;  // Records, most recent first
+  };
+
+  typedef std::unordered_map<std::string, Slot> SlotMap;
+
+  void insert(const std::string&, const Entry&, size_t);
+  bool isFresh(const std::string&) const;
+  void remove(SlotMap::iterator);
+  void evict();
+  static size_t estimateSize(const std::string&, const Entry&);
+  static size_t estimateSize(const std::string&,
+                             const std::string&,
+                             size_t);
+
+  const std::chrono::seconds ttl_;
+  const size_t maxBytes_;
+
+  mutable std::mutex mutex_;
+  SlotMap slots_;
+  std::list<std::string> lru_;  // most recently used at the front
+  std::unordered_set<std::string> pinned_;
+  size_t bytes_;
+
+  std::string lastOwner_;  // of the last name looked up
+  Clock::time_point lastQuery_;
+};
+
+#endif
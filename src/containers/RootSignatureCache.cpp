@@ -0,0 +1,150 @@
+#include "RootSignatureCache.hpp"
+#include "../encoding/Codec.hpp"
+#include "../Metrics.hpp"
+#include "../crypto/KeyCache.hpp"
+
+const size_t RootSignatureCache::MAX_KEYS;
+const size_t RootSignatureCache::MAX_VERIFIED;
+
+// decodes a base64 Quorum key, or returns false if it is malformed
+bool RootSignatureCache::decodeKey(const std::string& key64, ED_KEY& key)
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = decoded_.find(key64);
+    if (entry != decoded_.end())
+    {
+      key = entry->second;
+      return true;
+    }
+  }
+
+  if (Codec::base64Decode(key64, key.data(), key.size()) != key.size())
+    return false;
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (decoded_.size() >= MAX_KEYS)
+    decoded_.clear();  // there are only a few Quorum nodes, so rarely hit
+  decoded_[key64] = key;
+  return true;
+}
+
+
+
+// returns as ed25519_sign_open does, 0 if the signature on the root is valid
+int RootSignatureCache::verify(const SHA384_HASH& root,
+                               const ED_KEY& key,
+                               const ED_SIGNATURE& sig)
+{
+  const std::string triple = makeTriple(root, key, sig);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (verified_.count(triple) > 0)
+    {
+      hits_++;
+      return 0;
+    }
+
+    misses_++;
+  }
+
+  const Ed25519KeyPtr verifier = KeyCache::get().loadEd25519(key);
+  if (!verifier->isValid())
+    return -1;
+
+  static Metrics::Counter& verifications = Metrics::get().counter(
+      "onions_signature_verifications_total{algorithm=\"ed25519\"}",
+      "Signatures checked, by algorithm.");
+  verifications.add();
+
+  int status = verifier->verify(root.data(), root.size(), sig.data());
+  if (status == 0)
+    addVerified(root, key, sig);
+  return status;
+}
+
+
+
+// true if the signature was verified recently, counting it as a hit
+bool RootSignatureCache::isVerified(const SHA384_HASH& root,
+                                    const ED_KEY& key,
+                                    const ED_SIGNATURE& sig)
+{
+  const std::string triple = makeTriple(root, key, sig);
+  std::lock_guard<std::mutex> guard(mutex_);
+  bool known = verified_.count(triple) > 0;
+  known ? hits_++ : misses_++;
+  return known;
+}
+
+
+
+// records a signature that was verified elsewhere, such as in a batch
+void RootSignatureCache::addVerified(const SHA384_HASH& root,
+                                     const ED_KEY& key,
+                                     const ED_SIGNATURE& sig)
+{
+  std::string triple = makeTriple(root, key, sig);
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!verified_.insert(triple).second)
+    return;
+
+  verifiedOrder_.push_back(std::move(triple));
+  if (verifiedOrder_.size() > MAX_VERIFIED)
+  {
+    verified_.erase(verifiedOrder_.front());
+    verifiedOrder_.pop_front();
+  }
+}
+
+
+
+void RootSignatureCache::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  decoded_.clear();
+  verified_.clear();
+  verifiedOrder_.clear();
+  hits_ = misses_ = 0;
+}
+
+
+
+size_t RootSignatureCache::getHitCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+
+
+size_t RootSignatureCache::getMissCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+RootSignatureCache::RootSignatureCache() : hits_(0), misses_(0)
+{
+}
+
+
+
+// the key first, so that its bytes are a prefix of the triple
+std::string RootSignatureCache::makeTriple(const SHA384_HASH& root,
+                                           const ED_KEY& key,
+                                           const ED_SIGNATURE& sig)
+{
+  std::string triple;
+  triple.reserve(key.size() + root.size() + sig.size());
+  triple.append(reinterpret_cast<const char*>(key.data()), key.size());
+  triple.append(reinterpret_cast<const char*>(root.data()), root.size());
+  triple.append(reinterpret_cast<const char*>(sig.data()), sig.size());
+  return triple;
+}
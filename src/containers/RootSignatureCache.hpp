@@ -0,0 +1,53 @@
+#ifndef ROOT_SIGNATURE_CACHE_HPP
+#define ROOT_SIGNATURE_CACHE_HPP
+
+#include "../Constants.hpp"
+#include "../crypto/ed25519.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <string>
+#include <mutex>
+#include <deque>
+
+// Remembers the decoded Quorum keys, and the recently
+// verified (key, root, signature) triples, so that checking a root that was
+// already checked on another stream costs a hash table probe. Only valid
+// signatures are remembered, and the oldest are forgotten first.
+class RootSignatureCache
+{
+ public:
+  static const size_t MAX_KEYS = 256;
+  static const size_t MAX_VERIFIED = 1024;
+
+  static RootSignatureCache& get()
+  {
+    static RootSignatureCache instance;
+    return instance;
+  }
+
+  bool decodeKey(const std::string&, ED_KEY&);
+  int verify(const SHA384_HASH&, const ED_KEY&, const ED_SIGNATURE&);
+  bool isVerified(const SHA384_HASH&, const ED_KEY&, const ED_SIGNATURE&);
+  void addVerified(const SHA384_HASH&, const ED_KEY&, const ED_SIGNATURE&);
+  void clear();
+
+  size_t getHitCount() const;
+  size_t getMissCount() const;
+
+ private:
+  RootSignatureCache();
+  RootSignatureCache(RootSignatureCache const&) = delete;
+  void operator=(RootSignatureCache const&) = delete;
+
+  static std::string makeTriple(const SHA384_HASH&,
+                                const ED_KEY&,
+                                const ED_SIGNATURE&);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, ED_KEY> decoded_;  // by base64
+  std::unordered_set<std::string> verified_;
+  std::deque<std::string> verifiedOrder_;  // oldest at the front
+  size_t hits_, misses_;
+};
+
+#endif
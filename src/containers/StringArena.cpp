@@ -0,0 +1,134 @@
+
+#include "StringArena.hpp"
+#include <stdexcept>
+#include <algorithm>
+
+
+std::ostream& operator<<(std::ostream& os, const StringRef& ref)
+{
+  return os.write(ref.data(), ref.size());
+}
+
+
+
+StringArena::StringArena(size_t chunkSize)
+    : chunkSize_(chunkSize), used_(0), capacity_(0), total_(0)
+{
+}
+
+
+
+// copies the bytes into the arena
+StringRef StringArena::store(const char* data, size_t len)
+{
+  if (len > UINT32_MAX)
+    throw std::length_error("String too large for arena.");
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  char* dest = static_cast<char*>(allocateUnlocked(len, 1));
+  memcpy(dest, data, len);
+  return StringRef(dest, len);
+}
+
+
+
+StringRef StringArena::store(const std::string& str)
+{
+  return store(str.data(), str.size());
+}
+
+
+
+StringRef StringArena::store(const StringRef& str)
+{
+  return store(str.data(), str.size());
+}
+
+
+
+// stores the string only once no matter how many times it is interned,
+// suitable for values that repeat across Records, such as destinations
+StringRef StringArena::intern(const char* data, size_t len)
+{
+  if (len > UINT32_MAX)
+    throw std::length_error("String too large for arena.");
+
+  std::lock_guard<std::mutex> guard(mutex_);
+
+  auto existing = interned_.find(StringRef(data, len));
+  if (existing != interned_.end())
+    return *existing;
+
+  char* dest = static_cast<char*>(allocateUnlocked(len, 1));
+  memcpy(dest, data, len);
+  StringRef ref(dest, len);
+  interned_.insert(ref);
+  return ref;
+}
+
+
+
+StringRef StringArena::intern(const std::string& str)
+{
+  return intern(str.data(), str.size());
+}
+
+
+
+StringRef StringArena::intern(const StringRef& str)
+{
+  return intern(str.data(), str.size());
+}
+
+
+
+// returns uninitialized, suitably aligned memory owned by the arena
+void* StringArena::allocate(size_t len, size_t alignment)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return allocateUnlocked(len, alignment);
+}
+
+
+
+size_t StringArena::getMemoryUsage() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return total_ + interned_.size() * sizeof(StringRef) * 2;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+void* StringArena::allocateUnlocked(size_t len, size_t alignment)
+{
+  size_t offset = (used_ + alignment - 1) & ~(alignment - 1);
+  if (chunks_.empty() || offset + len > capacity_)
+  {  // start a new chunk, oversized if necessary
+    capacity_ = std::max(chunkSize_, len + alignment);
+    chunks_.push_back(std::unique_ptr<char[]>(new char[capacity_]));
+    total_ += capacity_;
+
+    // new[] memory is aligned for any fundamental type
+    offset = 0;
+  }
+
+  used_ = offset + len;
+  return chunks_.back().get() + offset;
+}
+
+
+
+size_t StringArena::RefHash::operator()(const StringRef& ref) const
+{  // 64-bit FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (uint32_t j = 0; j < ref.size(); j++)
+  {
+    hash ^= static_cast<uint8_t>(ref.data()[j]);
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<size_t>(hash);
+}
@@ -0,0 +1,102 @@
+#ifndef STRING_ARENA_HPP
+#define STRING_ARENA_HPP
+
+#include <unordered_set>
+#include <ostream>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+// non-owning view of bytes held by a StringArena
+class StringRef
+{
+ public:
+  StringRef() : data_(nullptr), size_(0) {}
+  StringRef(const char* data, uint32_t size) : data_(data), size_(size) {}
+
+  const char* data() const { return data_; }
+  uint32_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  std::string str() const { return std::string(data_, size_); }
+
+  // ordered as std::string::compare orders the same bytes
+  int compare(const char* data, size_t size) const
+  {
+    const int order = memcmp(data_, data, size_ < size ? size_ : size);
+    return order != 0 ? order : (size_ < size ? -1 : size_ > size ? 1 : 0);
+  }
+
+  int compare(const StringRef& other) const
+  {
+    return compare(other.data_, other.size_);
+  }
+
+  int compare(const std::string& other) const
+  {
+    return compare(other.data(), other.size());
+  }
+
+  bool operator==(const StringRef& other) const
+  {
+    return size_ == other.size_ && memcmp(data_, other.data_, size_) == 0;
+  }
+
+  bool operator==(const std::string& other) const
+  {
+    return size_ == other.size() && memcmp(data_, other.data(), size_) == 0;
+  }
+
+  bool operator!=(const StringRef& other) const { return !(*this == other); }
+  bool operator!=(const std::string& other) const { return !(*this == other); }
+  bool operator<(const StringRef& other) const { return compare(other) < 0; }
+  bool operator<(const std::string& other) const { return compare(other) < 0; }
+
+ private:
+  const char* data_;
+  uint32_t size_;
+};
+
+inline bool operator<(const std::string& a, const StringRef& b)
+{
+  return b.compare(a) > 0;
+}
+
+std::ostream& operator<<(std::ostream&, const StringRef&);
+
+// Append-only storage that packs many small strings into large contiguous
+// chunks. Nothing is freed until the arena itself is destroyed, and data, once
+// stored, never moves. Safe to append to from multiple threads.
+class StringArena
+{
+ public:
+  StringArena(size_t chunkSize = 64 * 1024);
+  StringRef store(const char*, size_t);
+  StringRef store(const std::string&);
+  StringRef store(const StringRef&);
+  StringRef intern(const char*, size_t);
+  StringRef intern(const std::string&);
+  StringRef intern(const StringRef&);
+  void* allocate(size_t, size_t);
+  size_t getMemoryUsage() const;
+
+ private:
+  struct RefHash
+  {
+    size_t operator()(const StringRef&) const;
+  };
+
+  void* allocateUnlocked(size_t, size_t);
+
+  const size_t chunkSize_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<char[]>> chunks_;
+  size_t used_, capacity_, total_;
+  std::unordered_set<StringRef, RefHash> interned_;
+};
+
+typedef std::shared_ptr<StringArena> StringArenaPtr;
+
+#endif
@@ -0,0 +1,153 @@
+
+#include "ValidationCache.hpp"
+#include "../Log.hpp"
+#include <fstream>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+
+bool ValidationCache::lookup(const SHA384_HASH& hash, Outcome& outcome) const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto entry = outcomes_.find(hash);
+  if (entry == outcomes_.end())
+    return false;
+
+  outcome.valid = (entry->second & VALID) != 0;
+  outcome.validSig = (entry->second & VALID_SIG) != 0;
+  return true;
+}
+
+
+
+void ValidationCache::insert(const SHA384_HASH& hash, const Outcome& outcome)
+{
+  uint8_t flags = (outcome.valid ? VALID : 0) |
+                  (outcome.validSig ? VALID_SIG : 0);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  outcomes_[hash] = flags;
+}
+
+
+
+void ValidationCache::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  outcomes_.clear();
+}
+
+
+
+size_t ValidationCache::getEntryCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return outcomes_.size();
+}
+
+
+
+// Writes the outcomes in native byte order: a header (magic, version, entry
+// count), then each entry's 48-byte hash and its flags byte.
+bool ValidationCache::save(const std::string& path) const
+{
+  std::vector<uint8_t> entries;
+  uint64_t count;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    count = outcomes_.size();
+    entries.reserve(count * (Const::SHA384_LEN + 1));
+    for (const auto& outcome : outcomes_)
+    {
+      entries.insert(entries.end(), outcome.first.begin(), outcome.first.end());
+      entries.push_back(outcome.second);
+    }
+  }
+
+  // write to a temporary file first so that a crash cannot truncate the file
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath, std::ofstream::binary | std::ofstream::trunc);
+  if (!file.is_open())
+  {
+    Log::get().warn("Cannot open validation cache " + tmpPath);
+    return false;
+  }
+
+  const uint32_t magic = FILE_MAGIC, version = FILE_VERSION;
+  file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+  file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  file.write(reinterpret_cast<const char*>(entries.data()), entries.size());
+
+  file.close();
+  if (file.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+  {
+    Log::get().warn("Failed to write validation cache " + path);
+    return false;
+  }
+
+  LOG_NOTICE("Saved " + std::to_string(count) +
+             " validation outcomes to " + path);
+  return true;
+}
+
+
+
+// adds the outcomes saved in the given file to those already known
+bool ValidationCache::load(const std::string& path)
+{
+  std::ifstream file(path, std::ifstream::binary);
+  if (!file.is_open())
+  {
+    Log::get().warn("Cannot open validation cache " + path);
+    return false;
+  }
+
+  uint32_t magic = 0, version = 0;
+  uint64_t count = 0;
+  file.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  file.read(reinterpret_cast<char*>(&version), sizeof(version));
+  file.read(reinterpret_cast<char*>(&count), sizeof(count));
+  if (!file || magic != FILE_MAGIC || version != FILE_VERSION)
+  {
+    Log::get().warn("Validation cache " + path + " is corrupt.");
+    return false;
+  }
+
+  std::vector<char> entries((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  const size_t entryLen = Const::SHA384_LEN + 1;
+  if (entries.size() != count * entryLen)
+  {
+    Log::get().warn("Validation cache " + path + " is corrupt.");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (size_t j = 0; j < entries.size(); j += entryLen)
+  {
+    SHA384_HASH hash;
+    memcpy(hash.data(), &entries[j], hash.size());
+    outcomes_[hash] = static_cast<uint8_t>(entries[j + hash.size()]);
+  }
+
+  LOG_NOTICE("Loaded " + std::to_string(count) +
+             " validation outcomes from " + path);
+  return true;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// the hash is already uniformly distributed, so any of its bytes will do
+size_t ValidationCache::Hasher::operator()(const SHA384_HASH& hash) const
+{
+  size_t value;
+  memcpy(&value, hash.data(), sizeof(value));
+  return value;
+}
@@ -0,0 +1,55 @@
+#ifndef VALIDATION_CACHE_HPP
+#define VALIDATION_CACHE_HPP
+
+#include "../Constants.hpp"
+#include <unordered_map>
+#include <string>
+#include <mutex>
+
+// Remembers the outcome of fully validating a Record, keyed by the hash of
+// its complete encoding (Record::getContentHash), which covers everything
+// scrypt and the RSA signature check look at. Content that has been seen
+// before, from another mirror or before a restart, can then skip both.
+class ValidationCache
+{
+ public:
+  struct Outcome
+  {
+    bool valid;     // the proof-of-work meets the difficulty
+    bool validSig;  // the RSA signature verifies
+  };
+
+  static ValidationCache& get()
+  {
+    static ValidationCache instance;
+    return instance;
+  }
+
+  bool lookup(const SHA384_HASH&, Outcome&) const;
+  void insert(const SHA384_HASH&, const Outcome&);
+  void clear();
+  size_t getEntryCount() const;
+
+  bool save(const std::string&) const;
+  bool load(const std::string&);
+
+ private:
+  static const uint32_t FILE_MAGIC = 0x56534e4f;  // "ONSV"
+  static const uint32_t FILE_VERSION = 1;
+
+  enum Flags : uint8_t
+  {
+    VALID = 1,
+    VALID_SIG = 2
+  };
+
+  struct Hasher
+  {
+    size_t operator()(const SHA384_HASH&) const;
+  };
+
+  mutable std::mutex mutex_;
+  std::unordered_map<SHA384_HASH, uint8_t, Hasher> outcomes_;
+};
+
+#endif
@@ -1,7 +1,9 @@
 
 #include "CreateR.hpp"
 #include "../../Common.hpp"
-#include <botan/base64.h>
+#include "../../encoding/Codec.hpp"
+#include "../../Log.hpp"
+#include <cstring>
 
 
 CreateR::CreateR(Botan::RSA_PrivateKey* key,
@@ -9,7 +11,7 @@ CreateR::CreateR(Botan::RSA_PrivateKey* key,
                  const std::string& contact)
     : Record(key)
 {
-  type_ = "Create";
+  type_ = Type::Create;
   setName(primaryName);
   setContact(contact);
 }
@@ -25,12 +27,77 @@ CreateR::CreateR(const std::string& contact,
                  Botan::RSA_PublicKey* pubKey)
     : Record(pubKey)
 {
-  type_ = "Create";
+  type_ = Type::Create;
   setContact(contact);
   setName(name);
   setSubdomains(subdomains);
+  decodeProof(StringRef(nonce.data(), nonce.size()),
+              StringRef(pow.data(), pow.size()),
+              StringRef(sig.data(), sig.size()));
+}
+
+
+
+// The same from views of the fields, as parsed out of a JSON document. The
+// strings are only copied once, into the Record's arena, and the key is only
+// decoded once it is needed.
+CreateR::CreateR(const StringRef& contact,
+                 const StringRef& name,
+                 const std::vector<SubdomainRef>& subdomains,
+                 const StringRef& nonce,
+                 const StringRef& pow,
+                 const StringRef& sig,
+                 const StringRef& publicKeyBER)
+    : Record(publicKeyBER)
+{
+  type_ = Type::Create;
+  setContact(contact);
+  setName(name);
+  setSubdomains(subdomains);
+  decodeProof(nonce, pow, sig);
+}
+
+
+
+// the same from raw bytes, as in the binary form; without the scrypt output
+// and signature, which may be null, those are left zeroed
+CreateR::CreateR(const StringRef& contact,
+                 const StringRef& name,
+                 const std::vector<SubdomainRef>& subdomains,
+                 const uint8_t* nonce,
+                 const uint8_t* pow,
+                 const uint8_t* sig,
+                 const StringRef& publicKeyBER)
+    : Record(publicKeyBER)
+{
+  type_ = Type::Create;
+  setContact(contact);
+  setName(name);
+  setSubdomains(subdomains);
+
+  memcpy(nonce_.data(), nonce, nonce_.size());
+  if (pow)
+    memcpy(scrypted_.data(), pow, scrypted_.size());
+  if (sig)
+    memcpy(signature_.data(), sig, signature_.size());
+}
 
-  Botan::base64_decode(nonce_.data(), nonce, false);
-  Botan::base64_decode(scrypted_.data(), pow, false);
-  Botan::base64_decode(signature_.data(), sig, false);
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// decodes the base64 nonce, scrypt output, and signature
+void CreateR::decodeProof(const StringRef& nonce,
+                          const StringRef& pow,
+                          const StringRef& sig)
+{
+  if (Codec::base64Decode(nonce.data(), nonce.size(), nonce_.data(),
+                          nonce_.size()) == Codec::INVALID ||
+      Codec::base64Decode(pow.data(), pow.size(), scrypted_.data(),
+                          scrypted_.size()) == Codec::INVALID ||
+      Codec::base64Decode(sig.data(), sig.size(), signature_.data(),
+                          signature_.size()) == Codec::INVALID)
+    Log::get().error("Record parsing: invalid or oversized base64!");
 }
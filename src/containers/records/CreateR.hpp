@@ -18,6 +18,23 @@ class CreateR : public Record
           const std::string&,
           const std::string&,
           Botan::RSA_PublicKey* pubKey);
+  CreateR(const StringRef&,
+          const StringRef&,
+          const std::vector<SubdomainRef>&,
+          const StringRef&,
+          const StringRef&,
+          const StringRef&,
+          const StringRef& publicKeyBER);
+  CreateR(const StringRef&,
+          const StringRef&,
+          const std::vector<SubdomainRef>&,
+          const uint8_t*,
+          const uint8_t*,
+          const uint8_t*,
+          const StringRef& publicKeyBER);
+
+ private:
+  void decodeProof(const StringRef&, const StringRef&, const StringRef&);
 };
 
 #endif
@@ -2,21 +2,76 @@
 #include "Record.hpp"
 #include "../Utils.hpp"
 #include "../../Log.hpp"
+#include "../../Metrics.hpp"
+#include "../../pow/NonceSearch.hpp"
+#include "../../pow/PowCalibration.hpp"
+#include "../../encoding/Codec.hpp"
+#include "../../crypto/Sha2.hpp"
+#include "../../crypto/KeyCache.hpp"
 #include <botan/pubkey.h>
 #include <botan/sha160.h>
-#include <botan/sha2_64.h>
-#include <botan/base64.h>
-#include <CyoEncode/CyoEncode.hpp>
-#include <libscrypt/libscrypt.h>
-#include <thread>
+#include <cstring>
+#include <cerrno>
 
+const size_t Record::ARENA_CHUNK_SIZE;
+std::mutex Record::keyMutex_;
 
+// whether the string, a std::string or a StringRef, ends with the bytes
+template <typename String>
+static bool endsWith(const String& str, const char* ending, size_t length)
+{
+  return str.size() >= length &&
+         memcmp(str.data() + str.size() - length, ending, length) == 0;
+}
+
+
+
+template <typename String>
+static bool endsWith(const String& str, const char* ending)
+{
+  return endsWith(str, ending, strlen(ending));
+}
+
+// The caller keeps ownership of the key, which must outlive the Record.
 Record::Record(Botan::RSA_PublicKey* pubKey)
-    : privateKey_(nullptr), publicKey_(pubKey), valid_(false), validSig_(false)
+    : type_(Type::Create),
+      arena_(std::make_shared<StringArena>(ARENA_CHUNK_SIZE)),
+      subdomains_(nullptr),
+      subdomainCount_(0),
+      privateKey_(nullptr),
+      publicKey_(std::shared_ptr<Botan::RSA_PublicKey>(), pubKey),
+      signatures_(std::make_shared<SignaturePool>(pubKey)),
+      keyState_(Loaded),
+      valid_(false),
+      validSig_(false),
+      hashState_(Stale)
+{
+  nonce_.fill(0);
+  scrypted_.fill(0);
+  signature_.fill(0);
+  storePublicKey(*arena_);
+}
+
+
+
+// Keeps the BER-encoded key without decoding it; loadKey() does that, and
+// throws then if the bytes are not an RSA key.
+Record::Record(const StringRef& publicKeyBER)
+    : type_(Type::Create),
+      arena_(std::make_shared<StringArena>(ARENA_CHUNK_SIZE)),
+      subdomains_(nullptr),
+      subdomainCount_(0),
+      privateKey_(nullptr),
+      publicKey_(nullptr),
+      keyState_(Deferred),
+      valid_(false),
+      validSig_(false),
+      hashState_(Stale)
 {
   nonce_.fill(0);
   scrypted_.fill(0);
   signature_.fill(0);
+  publicKeyBER_ = arena_->store(publicKeyBER);
 }
 
 
@@ -38,17 +93,30 @@ Record::Record(Botan::RSA_PrivateKey* key)
 
 Record::Record(const Record& other)
     : type_(other.type_),
+      arena_(other.arena_),
       name_(other.name_),
       contact_(other.contact_),
+      publicKeyBER_(other.publicKeyBER_),
       subdomains_(other.subdomains_),
+      subdomainCount_(other.subdomainCount_),
       privateKey_(other.privateKey_),
-      publicKey_(other.publicKey_),
+      publicKey_(nullptr),
+      keyState_(Deferred),
       nonce_(other.nonce_),
       scrypted_(other.scrypted_),
       signature_(other.signature_),
       valid_(other.valid_),
-      validSig_(other.validSig_)
+      validSig_(other.validSig_),
+      hashState_(other.hashState_ == Ready ? Ready : Stale),
+      hash_(other.hash_)
 {
+  if (other.isKeyLoaded())  // otherwise the copy loads the key on its own
+  {
+    onion_ = other.onion_;
+    publicKey_ = other.publicKey_;
+    signatures_ = other.signatures_;
+    keyState_.store(Loaded, std::memory_order_relaxed);
+  }
 }
 
 
@@ -60,22 +128,38 @@ Record::~Record()
 
 
 void Record::setName(const std::string& name)
+{
+  setName(StringRef(name.data(), name.size()));
+}
+
+
+
+void Record::setName(const StringRef& name)
 {
   // todo: check for valid name characters
 
-  if (name.length() < 5 || name.length() > 128)
-    Log::get().error("Name \"" + name + "\" has invalid length!");
+  if (name.size() < 5 || name.size() > 128)
+    Log::get().error("Name \"" + name.str() + "\" has invalid length!");
 
-  if (!Utils::strEndsWith(name, ".tor"))
-    Log::get().error("Name \"" + name + "\" must end with .tor!");
+  if (!endsWith(name, ".tor"))
+    Log::get().error("Name \"" + name.str() + "\" must end with .tor!");
 
-  name_ = name;
+  name_ = arena_->store(name);
   valid_ = false;
+  clearCentral();
+  clearHash();
 }
 
 
 
 std::string Record::getName() const
+{
+  return name_.str();
+}
+
+
+
+const StringRef& Record::getNameRef() const
 {
   return name_;
 }
@@ -84,50 +168,75 @@ std::string Record::getName() const
 
 void Record::setSubdomains(const NameList& subdomains)
 {
-  // todo: count/check number and length of names
-
-  if (subdomains.size() > 24)
-    Log::get().error("Cannot have more than 24 subdomains!");
+  checkSubdomains(subdomains.data(), subdomains.size());
+  storeSubdomains(subdomains.data(), subdomains.size(), *arena_);
+  valid_ = false;
+  clearCentral();
+  clearHash();
+}
 
-  for (auto pair : subdomains)
-  {
-    if (pair.first.length() == 0 || pair.first.length() > 128)
-      Log::get().error("Invalid length of subdomain!");
-    if (pair.second.length() == 0 || pair.second.length() > 128)
-      Log::get().error("Invalid length of destination!");
 
-    if (Utils::strEndsWith(pair.first, name_))
-      Log::get().error("Subdomain should not contain name");
-    if (!Utils::strEndsWith(pair.second, ".tor") &&
-        !Utils::strEndsWith(pair.second, ".onion"))
-      Log::get().error("Destination must go to .tor or .onion!");
-  }
 
-  subdomains_ = subdomains;
+// as above, from views of strings held elsewhere, such as a parse buffer
+void Record::setSubdomains(const std::vector<SubdomainRef>& subdomains)
+{
+  checkSubdomains(subdomains.data(), subdomains.size());
+  storeSubdomains(subdomains.data(), subdomains.size(), *arena_);
   valid_ = false;
+  clearCentral();
+  clearHash();
 }
 
 
 
 NameList Record::getSubdomains() const
 {
-  return subdomains_;
+  NameList list;
+  list.reserve(subdomainCount_);
+  for (uint8_t j = 0; j < subdomainCount_; j++)
+    list.push_back(std::make_pair(subdomains_[j].first.str(),
+                                  subdomains_[j].second.str()));
+  return list;
+}
+
+
+
+Record::SubdomainRange Record::getSubdomainRefs() const
+{
+  return SubdomainRange(subdomains_, subdomainCount_);
 }
 
 
 
 void Record::setContact(const std::string& contactInfo)
 {
-  if (!contactInfo.empty() && !Utils::isPowerOfTwo(contactInfo.length()))
+  setContact(StringRef(contactInfo.data(), contactInfo.size()));
+}
+
+
+
+void Record::setContact(const StringRef& contactInfo)
+{
+  if (!contactInfo.empty() && (!Utils::isPowerOfTwo(contactInfo.size()) ||
+                               contactInfo.size() > UINT16_MAX))
     Log::get().error("Invalid length of PGP key");
 
-  contact_ = contactInfo;
+  contact_ = arena_->intern(contactInfo);
   valid_ = false;
+  clearCentral();
+  clearHash();
 }
 
 
 
 std::string Record::getContact() const
+{
+  return contact_.str();
+}
+
+
+
+const StringRef& Record::getContactRef() const
 {
   return contact_;
 }
@@ -139,109 +248,247 @@ bool Record::setKey(Botan::RSA_PrivateKey* key)
   if (key == NULL)
     return false;
 
+  loadKey();  // so that the pool verifies with the Record's public key
   privateKey_ = key;
+  signatures_ = std::make_shared<SignaturePool>(publicKey_.get(), key);
   valid_ = false;  // need new nonce now
+  clearHash();
   return true;
 }
 
 
 
+// the returned bytes are owned by the Record's arena and must not be freed
 UInt8Array Record::getPublicKey() const
 {
-  // https://en.wikipedia.org/wiki/X.690#BER_encoding
-  auto bem = Botan::X509::BER_encode(*publicKey_);
-  uint8_t* val = new uint8_t[bem.size()];
-  memcpy(val, bem, bem.size());
+  auto bytes = reinterpret_cast<const uint8_t*>(publicKeyBER_.data());
+  return std::make_pair(const_cast<uint8_t*>(bytes), publicKeyBER_.size());
+}
+
+
+
+// Decodes the key, sets up its SignaturePool and derives the onion address,
+// unless that was done already. Validation calls this before checking the
+// signature; a Record restored from storage or from the ValidationCache may
+// never need its key at all.
+void Record::loadKey() const
+{
+  if (isKeyLoaded())
+    return;
 
-  return std::make_pair(val, bem.size());
+  std::lock_guard<std::mutex> guard(keyMutex_);
+  if (keyState_.load(std::memory_order_relaxed) == Loaded)
+    return;
+
+  auto ber = getPublicKey();
+  auto key = KeyCache::get().load(ber.first, ber.second);
+  if (!key)
+    Log::get().error("Record parsing: the key is not a RSA key!");
+
+  publicKey_ = key;
+  signatures_ = std::make_shared<SignaturePool>(key.get(), privateKey_);
+  storeOnion(*arena_);
+  keyState_.store(Loaded, std::memory_order_release);
 }
 
 
 
-std::string Record::getOnion() const
+bool Record::isKeyLoaded() const
 {
-  // https://gitweb.torproject.org/torspec.git/tree/tor-spec.txt :
-  // When we refer to "the hash of a public key", we mean the SHA-1 hash of the
-  // DER encoding of an ASN.1 RSA public key (as specified in PKCS.1).
+  return keyState_.load(std::memory_order_acquire) == Loaded;
+}
 
-  // get DER encoding of RSA key
-  auto x509Key = publicKey_->x509_subject_public_key();
-  char* derEncoded = new char[x509Key.size()];
-  memcpy(derEncoded, x509Key, x509Key.size());
 
-  // perform SHA-1
-  Botan::SHA_160 sha1;
-  auto hash = sha1.process(std::string(derEncoded, x509Key.size()));
-  delete[] derEncoded;
 
-  // perform base32 encoding
-  char onionB32[Const::SHA1_LEN * 4];
-  CyoEncode::Base32::Encode(onionB32, hash, Const::SHA1_LEN);
+// derived from the key once it is loaded, so no encoding or hashing here
+StringRef Record::getOnion() const
+{
+  loadKey();
+  return onion_;
+}
+
+
+
+// The destination of the name itself or of "label.name", or an empty ref
+// if the Record covers neither. The query is compared in place against the
+// name and then against each label, so nothing is allocated.
+StringRef Record::resolve(const char* source, size_t length) const
+{
+  const size_t nameLength = name_.size();
+  if (length == nameLength)
+    return memcmp(source, name_.data(), length) == 0 ? getOnion()
+                                                     : StringRef();
+
+  // otherwise there must be a nonempty label, a dot, then the name
+  if (length < nameLength + 2)
+    return StringRef();
 
-  // truncate, make lowercase, and return result
-  auto addr = std::string(onionB32, 16);
-  std::transform(addr.begin(), addr.end(), addr.begin(), ::tolower);
-  return addr + ".onion";
+  const size_t labelLength = length - nameLength - 1;
+  if (source[labelLength] != '.' ||
+      memcmp(source + labelLength + 1, name_.data(), nameLength) != 0)
+    return StringRef();
+
+  for (uint8_t j = 0; j < subdomainCount_; j++)
+  {
+    const StringRef& label = subdomains_[j].first;
+    if (label.size() == labelLength &&
+        memcmp(label.data(), source, labelLength) == 0)
+      return subdomains_[j].second;
+  }
+
+  return StringRef();
 }
 
 
 
+// The hash covers the encoding, including the proof once the Record is
+// valid. It is kept until something changes; concurrent first calls may all
+// compute it, but only one of them stores it.
 SHA384_HASH Record::getHash() const
 {
-  Botan::SHA_384 sha;
-  auto hash = sha.process(asJSON());
+  if (hashState_.load(std::memory_order_acquire) == Ready)
+    return hash_;
+
+  SHA384_HASH hashArray = hashEncoding(isValid());
+
+  uint8_t expected = Stale;
+  if (hashState_.compare_exchange_strong(expected, Computing))
+  {
+    hash_ = hashArray;
+    hashState_.store(Ready, std::memory_order_release);
+  }
 
-  SHA384_HASH hashArray;
-  memcpy(hashArray.data(), hash, hashArray.size());
   return hashArray;
 }
 
 
 
-void Record::makeValid(uint8_t nWorkers)
+// the hash of the complete encoding, proof included, whether or not the
+// Record is valid; it covers everything that validation depends on, and
+// equals getHash() once the Record is valid
+SHA384_HASH Record::getContentHash() const
+{
+  return isValid() ? getHash() : hashEncoding(true);
+}
+
+
+
+// Searches for a nonce with a valid PoW across the shared ThreadPool. Each
+// worker tries a batch of nonces at once on the backend, one copy of the
+// Record per nonce, and the first copy to become valid is adopted. With a
+// single worker, the lowest valid nonce is found whatever the backend.
+void Record::makeValid(uint8_t nWorkers, PowBackend& backend)
 {
   if (nWorkers == 0)
     Log::get().error("Not enough workers");
 
-  Log::get().notice("Making the Record valid... \n");
+  LOG_NOTICE("Making the Record valid with the " + backend.getName() +
+             " backend... \n");
 
-  bool found = false;
-  bool* foundSig = &found;
+  const size_t lanes = backend.getBatchSize(Const::RECORD_SCRYPT_N, 1);
+  std::vector<std::shared_ptr<Record>> copies;
+  for (size_t n = 0; n < nWorkers * lanes; n++)
+    copies.push_back(std::make_shared<Record>(*this));
 
-  std::vector<std::thread> workers;
-  for (uint8_t n = 0; n < nWorkers; n++)
-  {
-    workers.push_back(std::thread(
-        [n, nWorkers, foundSig, this]()
-        {
-          std::string name("worker " + std::to_string(n + 1));
-
-          Log::get().notice("Starting " + name);
+  static Metrics::Counter& attempts = Metrics::get().counter(
+      "onions_pow_attempts_total", "Nonces tried by Record::makeValid.");
+  static Metrics::Gauge& hashRate = Metrics::get().gauge(
+      "onions_pow_hash_rate", "Hashes per second of the last PoW search.");
 
-          auto record = std::make_shared<Record>(*this);
-          record->nonce_[nonce_.size() - 1] = n;
-          if (record->makeValid(0, nWorkers, foundSig) == WorkStatus::Success)
-          {
-            Log::get().notice("Success from " + name);
+  static Metrics::Gauge& eta = Metrics::get().gauge(
+      "onions_pow_eta_seconds",
+      "Expected seconds left in the running PoW search.");
 
-            // save successful answer
-            nonce_ = record->nonce_;
-            scrypted_ = record->scrypted_;
-            signature_ = record->signature_;
-            valid_ = true;
-          }
+  // a calibrated worker rate predicts the search before it has any of its own
+  const uint32_t difficulty = getDifficulty();
+  PowCalibration::Result calibration;
+  if (PowCalibration::getLast(backend, calibration))
+  {
+    const double rate =
+        calibration.getWorkerRate() * std::min<size_t>(nWorkers,
+                                                       calibration.workers);
+    const auto expected = PowCalibration::estimate(difficulty, 0, rate);
+    eta.set(expected.expectedSeconds);
+    LOG_NOTICE("Expecting to take " +
+               std::to_string(expected.expectedSeconds) + " s at " +
+               std::to_string(rate) + " H/s.");
+  }
 
-          Log::get().notice("Shutting down " + name);
-        }));
+  NonceSearch search(nWorkers);
+  search.setProgressCallback(
+      [difficulty](const NonceSearch::Progress& progress)
+      {
+        const double rate = progress.getHashRate();
+        const auto left =
+            PowCalibration::estimate(difficulty, progress.attempts, rate);
+        hashRate.set(rate);
+        eta.set(left.expectedSeconds);
+        LOG_NOTICE(std::to_string(progress.attempts) + " attempts, " +
+                   std::to_string(rate) + " H/s, about " +
+                   std::to_string(left.expectedSeconds) + " s to go, " +
+                   std::to_string(100 * left.chanceSoFar) +
+                   "% chance of having finished by now");
+      },
+      std::chrono::seconds(10));
+
+  auto result = search.run(
+      [&copies, lanes, &backend](size_t worker, const uint32_t* nonces,
+                                 size_t count, const std::atomic<bool>& cancel)
+      {
+        std::vector<Record*> batch(count);
+        for (size_t l = 0; l < count; l++)
+        {
+          Record& record = *copies[worker * lanes + l];
+          for (size_t j = 0; j < record.nonce_.size(); j++)
+            record.nonce_[j] = static_cast<uint8_t>(nonces[l] >> (8 * (3 - j)));
+          batch[l] = &record;
+        }
+
+        computeValidity(batch.data(), count, &cancel, backend);
+        attempts.add(count);
+        for (size_t l = 0; l < count; l++)
+          if (batch[l]->isValid())
+            return l;
+        return count;
+      },
+      lanes);
+
+  hashRate.set(search.getProgress().getHashRate());
+  eta.set(0);
+  if (!result.found)
+  {
+    Log::get().warn("No valid nonce found.");
+    return;
   }
 
-  std::for_each(workers.begin(), workers.end(), [](std::thread& t)
-                {
-                  t.join();
-                });
+  // save successful answer, already checked by the worker that found it
+  const Record& winner = *copies[result.worker * lanes + result.index];
+  nonce_ = winner.nonce_;
+  scrypted_ = winner.scrypted_;
+  signature_ = winner.signature_;
+  valid_ = winner.valid_;
+  validSig_ = winner.validSig_;
+  clearHash();
+
+  LOG_NOTICE("Found a valid nonce after " +
+             std::to_string(search.getProgress().attempts) +
+             " attempts.");
+}
 
-  bool tmp = false;
-  computeValidity(&tmp);  // todo: faster way than this?
+
+
+// marks the Record as valid if its hash, which covers the nonce, PoW, and
+// signature, matches one computed when the Record was last fully validated
+bool Record::restoreValidity(const SHA384_HASH& knownHash)
+{
+  valid_ = validSig_ = true;
+  clearHash();
+  if (getHash() == knownHash)
+    return true;
+
+  valid_ = validSig_ = false;
+  clearHash();
+  return false;
 }
 
 
@@ -260,9 +507,136 @@ bool Record::hasValidSignature() const
 
 
 
+// moves the Record's strings and key encoding into a shared arena, such as the
+// Cache's, so that they are stored contiguously with those of other Records
+void Record::setArena(const StringArenaPtr& arena)
+{
+  if (arena == arena_)
+    return;
+
+  // the old arena, which holds the strings being copied, lives until the end
+  name_ = arena->store(name_);
+  contact_ = arena->intern(contact_);
+  storeSubdomains(subdomains_, subdomainCount_, *arena);
+  publicKeyBER_ = arena->store(publicKeyBER_.data(), publicKeyBER_.size());
+  if (isKeyLoaded())
+    onion_ = arena->store(onion_.data(), onion_.size());
+  arena_ = arena;
+}
+
+
+
+// the object as allocated by make_shared, and the PoW buffer if it is kept
+size_t Record::getMemoryUsage() const
+{
+  return sizeof(*this) + 2 * sizeof(void*) + central_.capacity();
+}
+
+
+
+size_t Record::getArenaUsage() const
+{
+  size_t bytes = name_.size() + contact_.size() + publicKeyBER_.size() +
+                 onion_.size() + subdomainCount_ * sizeof(SubdomainRef);
+  for (uint8_t j = 0; j < subdomainCount_; j++)
+    bytes += subdomains_[j].first.size() + subdomains_[j].second.size();
+  return bytes;
+}
+
+
+
+// the key numbers in their BigInts, with the objects around them; a
+// private key is also the public one
+size_t Record::getKeyMemoryUsage() const
+{
+  size_t bytes = 0;
+  if (isKeyLoaded() && publicKey_ && publicKey_.get() != privateKey_)
+    bytes += sizeof(Botan::RSA_PublicKey) + publicKey_->get_n().bytes() +
+             publicKey_->get_e().bytes();
+
+  if (privateKey_)
+    bytes += sizeof(Botan::RSA_PrivateKey) + privateKey_->get_n().bytes() +
+             privateKey_->get_e().bytes() + privateKey_->get_d().bytes() +
+             privateKey_->get_p().bytes() + privateKey_->get_q().bytes() +
+             privateKey_->get_d1().bytes() + privateKey_->get_d2().bytes() +
+             privateKey_->get_c().bytes();
+
+  return bytes;
+}
+
+
+
+size_t Record::getEncodedLength(bool withProof) const
+{
+  size_t length = 3 + name_.size() + 2 + contact_.size() + 1;
+  for (uint8_t j = 0; j < subdomainCount_; j++)
+    length += 2 + subdomains_[j].first.size() + subdomains_[j].second.size();
+
+  length += 2 + publicKeyBER_.size() + nonce_.size();
+  if (withProof)
+    length += scrypted_.size() + signature_.size();
+
+  return length;
+}
+
+
+
+// writes the canonical encoding, returning its length or 0 if it won't fit
+size_t Record::encode(uint8_t* out, size_t capacity, bool withProof) const
+{
+  const size_t length = getEncodedLength(withProof);
+  if (length > capacity)
+    return 0;
+
+  auto putBytes = [&out](const void* data, size_t size)
+  {
+    memcpy(out, data, size);
+    out += size;
+  };
+
+  auto putString = [&out, &putBytes](const StringRef& str, bool wide)
+  {
+    if (wide)
+      *out++ = static_cast<uint8_t>(str.size() >> 8);
+    *out++ = static_cast<uint8_t>(str.size());
+    putBytes(str.data(), str.size());
+  };
+
+  *out++ = ENCODING_VERSION;
+  *out++ = static_cast<uint8_t>(type_);
+  putString(name_, false);
+  putString(contact_, true);
+
+  *out++ = subdomainCount_;
+  for (uint8_t j = 0; j < subdomainCount_; j++)
+  {
+    putString(subdomains_[j].first, false);
+    putString(subdomains_[j].second, false);
+  }
+
+  putString(publicKeyBER_, true);
+  putBytes(nonce_.data(), nonce_.size());
+
+  if (withProof)
+  {
+    putBytes(scrypted_.data(), scrypted_.size());
+    putBytes(signature_.data(), signature_.size());
+  }
+
+  return length;
+}
+
+
+
 std::string Record::getType() const
 {
-  return type_;
+  switch (type_)
+  {
+    case Type::Create:
+      return "Create";
+  }
+
+  return "";
 }
 
 
@@ -278,26 +652,28 @@ Json::Value Record::asJSONObj() const
 {
   Json::Value obj;
 
-  obj["type"] = type_;
-  obj["name"] = name_;
+  obj["type"] = getType();
+  obj["name"] = Json::Value(name_.data(), name_.data() + name_.size());
   if (!contact_.empty())
-    obj["contact"] = contact_;
+    obj["contact"] =
+        Json::Value(contact_.data(), contact_.data() + contact_.size());
 
   // add subdomains
-  for (auto sub : subdomains_)
-    obj["subd"][sub.first] = sub.second;
+  for (const auto& sub : getSubdomainRefs())
+    obj["subd"][sub.first.str()] =
+        Json::Value(sub.second.data(), sub.second.data() + sub.second.size());
 
   // extract and save public key
   auto key = getPublicKey();
-  obj["pubHSKey"] = Botan::base64_encode(key.first, key.second);
+  obj["pubHSKey"] = Codec::base64Encode(key.first, key.second);
 
   // if the domain is valid, add nonce_, scrypted_, and signature_
   if (isValid())
   {
-    obj["nonce"] = Botan::base64_encode(nonce_.data(), nonce_.size());
-    obj["pow"] = Botan::base64_encode(scrypted_.data(), scrypted_.size());
+    obj["nonce"] = Codec::base64Encode(nonce_.data(), nonce_.size());
+    obj["pow"] = Codec::base64Encode(scrypted_.data(), scrypted_.size());
     obj["recordSig"] =
-        Botan::base64_encode(signature_.data(), signature_.size());
+        Codec::base64Encode(signature_.data(), signature_.size());
   }
 
   return obj;
@@ -314,6 +690,18 @@ std::string Record::asJSON() const
 
 
 
+// the canonical encoding, an alternative to asJSON() that needs neither
+// base64 nor a JSON writer; like asJSON(), the proof is only included
+// once the Record is valid
+std::string Record::asBinary() const
+{
+  std::string binary(getEncodedLength(isValid()), '\0');
+  encode(reinterpret_cast<uint8_t*>(&binary[0]), binary.size(), isValid());
+  return binary;
+}
+
+
+
 std::ostream& operator<<(std::ostream& os, const Record& dt)
 {
   os << "Domain Registration: (currently "
@@ -321,7 +709,7 @@ std::ostream& operator<<(std::ostream& os, const Record& dt)
 
   os << "   Domain Information: " << std::endl;
   os << "      " << dt.name_ << " -> " << dt.getOnion() << std::endl;
-  for (auto subd : dt.subdomains_)
+  for (const auto& subd : dt.getSubdomainRefs())
     os << "      " << subd.first << "." << dt.name_ << " -> " << subd.second
        << std::endl;
 
@@ -331,24 +719,25 @@ std::ostream& operator<<(std::ostream& os, const Record& dt)
 
   os << "   Nonce: ";
   if (dt.isValid())
-    os << Botan::base64_encode(dt.nonce_.data(), dt.nonce_.size()) << std::endl;
+    os << Codec::base64Encode(dt.nonce_.data(), dt.nonce_.size()) << std::endl;
   else
     os << "<regeneration required>" << std::endl;
 
   os << "      Proof of Work: ";
   if (dt.isValid())
-    os << Botan::base64_encode(dt.scrypted_.data(), dt.scrypted_.size())
+    os << Codec::base64Encode(dt.scrypted_.data(), dt.scrypted_.size())
        << std::endl;
   else
     os << "<regeneration required>" << std::endl;
 
   os << "      Signature: ";
   if (dt.isValid())
-    os << Botan::base64_encode(dt.signature_.data(), dt.signature_.size() / 4)
+    os << Codec::base64Encode(dt.signature_.data(), dt.signature_.size() / 4)
        << " ..." << std::endl;
   else
     os << "<regeneration required>" << std::endl;
 
+  dt.loadKey();
   auto pem = Botan::X509::PEM_encode(*dt.publicKey_);
   pem.pop_back();  // delete trailing /n
   Utils::stringReplace(pem, "\n", "\n\t");
@@ -363,102 +752,82 @@ std::ostream& operator<<(std::ostream& os, const Record& dt)
 
 
 
-Record::WorkStatus Record::makeValid(uint8_t depth, uint8_t inc, bool* abortSig)
+// with a cancellation flag, gives up as soon as it is seen to be set
+void Record::computeValidity(const std::atomic<bool>* cancel)
 {
-  if (isValid())
-    return WorkStatus::Aborted;
-
-  if (depth > nonce_.size())
-    return WorkStatus::NotFound;
-
-  // base case
-  if (depth == nonce_.size())
-  {
-    computeValidity(abortSig);  // abortSig stops check
-
-    if (isValid())
-    {                    // stop processing if found valid
-      *abortSig = true;  // alert other workers
-      return WorkStatus::Success;
-    }
-
-    return *abortSig ? WorkStatus::Aborted : WorkStatus::NotFound;
-  }
-
-  WorkStatus ret = makeValid(depth + 1, inc, abortSig);
-  if (ret == WorkStatus::Success || ret == WorkStatus::Aborted)
-    return ret;
-
-  while (nonce_[depth] < UINT8_MAX)
-  {
-    nonce_[depth] += inc;
-    ret = makeValid(depth + 1, inc, abortSig);
-    if (ret == WorkStatus::Success || ret == WorkStatus::Aborted)
-      return ret;
-  }
-
-  nonce_[depth] = 0;
-  return WorkStatus::NotFound;
+  Record* self = this;
+  computeValidity(&self, 1, cancel);
 }
 
 
 
-void Record::computeValidity(bool* abortSig)
+// the same over several Records at once, in one call to the backend; the
+// Records may be unrelated
+void Record::computeValidity(Record* const* records,
+                             size_t count,
+                             const std::atomic<bool>* cancel,
+                             PowBackend& backend)
 {
-  UInt8Array buffer = computeCentral();
-
-  if (*abortSig)
+  std::vector<UInt8Array> buffers(count);
+  for (size_t n = 0; n < count; n++)
   {
-    delete[] buffer.first;
-    return;
+    records[n]->clearHash();  // the PoW, signature, and validity may change
+    buffers[n] = records[n]->computeCentral();
   }
 
-  // updated scrypted_, append scrypted_ to buffer, check for errors
-  if (updateAppendScrypt(buffer) < 0)
+  // updated scrypted_, append scrypted_ to buffers, check for errors
+  bool proceed = !(cancel && *cancel);
+  if (proceed && updateAppendScrypt(records, buffers.data(), count, cancel,
+                                     backend) < 0)
   {
-    Log::get().warn("Error with scrypt call!");
-    delete[] buffer.first;
-    return;
+    if (errno != ECANCELED)
+      Log::get().warn("Error with scrypt call!");
+    proceed = false;
   }
 
-  if (*abortSig)  // stop if another worker has won
-  {
-    delete[] buffer.first;
-    return;
-  }
+  if (proceed && !(cancel && *cancel))  // stop if another worker has won
+    for (size_t n = 0; n < count; n++)
+    {
+      records[n]->updateAppendSignature(buffers[n]);  // update signature_
+      records[n]->updateValidity(buffers[n]);  // update valid_ from buffer
+    }
 
-  updateAppendSignature(buffer);  // update signature_, append to buffer
-  updateValidity(buffer);         // update valid_ based on entire buffer
-  delete[] buffer.first;          // cleanup
+  for (size_t n = 0; n < count; n++)
+    if (records[n]->valid_)  // no more attempts, so free the buffer
+      std::vector<uint8_t>().swap(records[n]->central_);
 }
 
 
 
-// allocates a buffer big enough to append
-// scrypted_ and signature_ without buffer overflow
-UInt8Array Record::computeCentral()
+SHA384_HASH Record::hashEncoding(bool withProof) const
 {
-  std::string str(type_ + name_);
-  for (auto pair : subdomains_)
-    str += pair.first + pair.second;
-  str += contact_;
+  static thread_local std::vector<uint8_t> buffer;
+  buffer.resize(getEncodedLength(withProof));
+  encode(buffer.data(), buffer.size(), withProof);
 
-  int index = 0;
-  auto pubKey = getPublicKey();
-  const size_t centralLen = str.length() + nonce_.size() + pubKey.second;
-  uint8_t* central =
-      new uint8_t[centralLen + scrypted_.size() + signature_.size()];
+  SHA384_HASH hashArray;
+  Sha2::sha384(buffer.data(), buffer.size(), hashArray.data());
+  return hashArray;
+}
 
-  memcpy(central + index, str.c_str(), str.size());  // copy string into array
-  index += str.size();
 
-  memcpy(central + index, nonce_.data(), nonce_.size());
-  index += nonce_.size();
 
-  memcpy(central + index, pubKey.first, pubKey.second);
+// Returns the encoding without the proof, in a buffer with room to append
+// scrypted_ and signature_. The buffer is owned by the Record and kept
+// between attempts, which then only patch the nonce that ends the encoding.
+UInt8Array Record::computeCentral()
+{
+  const size_t proofLen = scrypted_.size() + signature_.size();
+  if (central_.empty())
+  {
+    const size_t length = getEncodedLength(false);
+    central_.resize(length + proofLen);
+    encode(central_.data(), length, false);
+  }
 
-  // std::cout << Botan::base64_encode(central, centralLen) << std::endl;
-  return std::make_pair(central, centralLen);
+  const size_t centralLen = central_.size() - proofLen;
+  memcpy(&central_[centralLen - nonce_.size()], nonce_.data(), nonce_.size());
+  return std::make_pair(central_.data(), centralLen);
 }
 
 
@@ -466,22 +835,17 @@ UInt8Array Record::computeCentral()
 // signs buffer, saving to signature_, appends signature to buffer
 void Record::updateAppendSignature(UInt8Array& buffer)
 {
-  static Botan::AutoSeeded_RNG rng;
-
-  if (privateKey_)
+  loadKey();
+  if (signatures_->canSign())
   {  // if we have a key, sign it
-    // https://stackoverflow.com/questions/14263346/
-    // http://botan.randombit.net/manual/pubkey.html#signatures
-    Botan::PK_Signer signer(*privateKey_, "EMSA-PKCS1-v1_5(SHA-384)");
-    auto sig = signer.sign_message(buffer.first, buffer.second, rng);
-    memcpy(signature_.data(), sig, sig.size());
+    signatures_->sign(buffer.first, buffer.second, signature_.data(),
+                      signature_.size());
     validSig_ = true;
   }
   else
   {  // we are validating a public Record, so confirm the signature
-    Botan::PK_Verifier verifier(*publicKey_, "EMSA-PKCS1-v1_5(SHA-384)");
-    validSig_ = verifier.verify_message(buffer.first, buffer.second,
-                                        signature_.data(), signature_.size());
+    validSig_ = signatures_->verify(buffer.first, buffer.second,
+                                    signature_.data(), signature_.size());
   }
 
   // append into buffer
@@ -491,28 +855,141 @@ void Record::updateAppendSignature(UInt8Array& buffer)
 
 
 
-// performs scrypt on buffer, appends result to buffer, returns scrypt status
-int Record::updateAppendScrypt(UInt8Array& buffer)
+// copies the subdomain table and its strings into the arena
+template <typename Pair>
+void Record::storeSubdomains(const Pair* subdomains,
+                             size_t count,
+                             StringArena& arena)
+{
+  void* memory =
+      arena.allocate(count * sizeof(SubdomainRef), alignof(SubdomainRef));
+  auto table = static_cast<SubdomainRef*>(memory);
+
+  // labels such as "www" and shared destinations are interned
+  for (size_t j = 0; j < count; j++)
+    new (&table[j]) SubdomainRef(arena.intern(subdomains[j].first),
+                                 arena.intern(subdomains[j].second));
+
+  subdomains_ = table;
+  subdomainCount_ = count;
+}
+
+
+
+template <typename Pair>
+void Record::checkSubdomains(const Pair* subdomains, size_t count) const
 {
-  // allocate and prepare static salt
-  static uint8_t* const SALT = new uint8_t[Const::RECORD_SCRYPT_SALT_LEN];
-  static bool saltReady = false;
-  if (!saltReady)
+  // todo: count/check number and length of names
+
+  if (count > 24)
+    Log::get().error("Cannot have more than 24 subdomains!");
+
+  for (size_t j = 0; j < count; j++)
   {
+    const auto& label = subdomains[j].first;
+    const auto& destination = subdomains[j].second;
+    if (label.size() == 0 || label.size() > 128)
+      Log::get().error("Invalid length of subdomain!");
+    if (destination.size() == 0 || destination.size() > 128)
+      Log::get().error("Invalid length of destination!");
+
+    if (endsWith(label, name_.data(), name_.size()))
+      Log::get().error("Subdomain should not contain name");
+    if (!endsWith(destination, ".tor") && !endsWith(destination, ".onion"))
+      Log::get().error("Destination must go to .tor or .onion!");
+  }
+}
+
+
+
+// stores the key's BER encoding and its onion address, both fixed per key
+void Record::storePublicKey(StringArena& arena)
+{
+  // https://en.wikipedia.org/wiki/X.690#BER_encoding
+  auto ber = Botan::X509::BER_encode(*publicKey_);
+  publicKeyBER_ = arena.store(reinterpret_cast<const char*>(ber.begin()),
+                              ber.size());
+  storeOnion(arena);
+}
+
+
+
+void Record::storeOnion(StringArena& arena) const
+{
+  // https://gitweb.torproject.org/torspec.git/tree/tor-spec.txt :
+  // When we refer to "the hash of a public key", we mean the SHA-1 hash of the
+  // DER encoding of an ASN.1 RSA public key (as specified in PKCS.1).
+
+  // perform SHA-1 on the DER encoding of the RSA key
+  auto x509Key = publicKey_->x509_subject_public_key();
+  Botan::SHA_160 sha1;
+  auto hash = sha1.process(x509Key);
+
+  // the address is the lowercase base32 of the first 80 bits, then the TLD
+  char onion[16 + 6];
+  Codec::base32Encode(hash, 10, onion, true);
+  std::memcpy(onion + 16, ".onion", 6);
+  onion_ = arena.store(onion, sizeof(onion));
+}
+
+
+
+void Record::clearHash()
+{
+  hashState_.store(Stale, std::memory_order_release);
+}
+
+
+
+// the encoded name, contact, or subdomains changed, so re-encode next time
+void Record::clearCentral()
+{
+  central_.clear();
+}
+
+
+
+// performs scrypt on each Record's buffer, appends the results to the
+// buffers, returns scrypt status; scrypt stops early if cancel becomes set
+int Record::updateAppendScrypt(Record* const* records,
+                               UInt8Array* buffers,
+                               size_t count,
+                               const std::atomic<bool>* cancel,
+                               PowBackend& backend)
+{
+  // prepare static salt, once even with several threads validating
+  static const uint8_t* const SALT = []()
+  {
+    auto salt = new uint8_t[Const::RECORD_SCRYPT_SALT_LEN];
     std::string piHex("243F6A8885A308D313198A2E03707344");  // pi in hex
-    Utils::hex2bin(reinterpret_cast<const uint8_t*>(piHex.c_str()), SALT);
-    saltReady = true;
+    Utils::hex2bin(reinterpret_cast<const uint8_t*>(piHex.c_str()), salt);
+    return salt;
+  }();
+
+  std::vector<const uint8_t*> pass(count);
+  std::vector<size_t> passLen(count);
+  std::vector<uint8_t*> out(count);
+  for (size_t n = 0; n < count; n++)
+  {
+    pass[n] = buffers[n].first;
+    passLen[n] = buffers[n].second;
+    out[n] = records[n]->scrypted_.data();
   }
 
   // compute scrypt
-  auto r = libscrypt_scrypt(buffer.first, buffer.second, SALT,
-                            Const::RECORD_SCRYPT_SALT_LEN,
-                            Const::RECORD_SCRYPT_N, 1, Const::RECORD_SCRYPT_P,
-                            scrypted_.data(), scrypted_.size());
-
-  // append scrypt output to buffer
-  memcpy(buffer.first + buffer.second, scrypted_.data(), scrypted_.size());
-  buffer.second += scrypted_.size();
+  auto r = backend.compute(pass.data(), passLen.data(), SALT,
+                           Const::RECORD_SCRYPT_SALT_LEN,
+                           Const::RECORD_SCRYPT_N, 1, Const::RECORD_SCRYPT_P,
+                           out.data(), Const::RECORD_SCRYPTED_LEN, count,
+                           cancel);
+
+  // append scrypt output to buffers
+  for (size_t n = 0; n < count; n++)
+  {
+    memcpy(buffers[n].first + buffers[n].second, out[n],
+           Const::RECORD_SCRYPTED_LEN);
+    buffers[n].second += Const::RECORD_SCRYPTED_LEN;
+  }
 
   return r;
 }
@@ -523,8 +1000,8 @@ int Record::updateAppendScrypt(UInt8Array& buffer)
 void Record::updateValidity(const UInt8Array& buffer)
 {
   // hash entire buffer and convert hash to number
-  Botan::SHA_384 sha384;
-  auto hash = sha384.process(buffer.first, buffer.second);
+  uint8_t hash[Sha2::SHA384_LEN];
+  Sha2::sha384(buffer.first, buffer.second, hash);
   auto num = Utils::arrayToUInt32(hash, 0);
 
   // compare number against threshold
@@ -533,7 +1010,7 @@ void Record::updateValidity(const UInt8Array& buffer)
     valid_ = true;
   else
   {
-    Log::get().notice(Botan::base64_encode(nonce_.data(), nonce_.size()) +
-                      " -> not valid");
+    LOG_NOTICE(Codec::base64Encode(nonce_.data(), nonce_.size()) +
+               " -> not valid");
   }
 }
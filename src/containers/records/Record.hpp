@@ -3,11 +3,17 @@
 #define RECORD_HPP
 
 #include "../../Constants.hpp"
+#include "../StringArena.hpp"
+#include "../../crypto/SignaturePool.hpp"
+#include "../../pow/PowBackend.hpp"
 #include <botan/botan.h>
 #include <botan/rsa.h>
 #include <json/json.h>
 #include <memory>
+#include <vector>
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 #include <string>
 
 typedef std::pair<uint8_t*, size_t> UInt8Array;
@@ -16,60 +22,167 @@ typedef std::vector<std::pair<std::string, std::string> > NameList;
 class Record
 {
  public:
-  enum WorkStatus
+  enum class Type : uint8_t
   {
-    Success,
-    NotFound,
-    Aborted
+    Create
+  };
+
+  // Views of the Record's strings, valid for as long as the Record is. They
+  // avoid the copies that getName(), getContact() and getSubdomains() make,
+  // and are what lookups and comparisons should use.
+  typedef std::pair<StringRef, StringRef> SubdomainRef;
+
+  class SubdomainRange
+  {
+   public:
+    SubdomainRange(const SubdomainRef* first, size_t size)
+        : first_(first), size_(size)
+    {
+    }
+
+    const SubdomainRef* begin() const { return first_; }
+    const SubdomainRef* end() const { return first_ + size_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+   private:
+    const SubdomainRef* first_;
+    size_t size_;
   };
 
   Record(Botan::RSA_PublicKey*);
   Record(Botan::RSA_PrivateKey*);
+  Record(const StringRef&);
   Record(const Record&);
   virtual ~Record();
 
   void setName(const std::string&);
+  void setName(const StringRef&);
   std::string getName() const;
+  const StringRef& getNameRef() const;
 
   void setSubdomains(const NameList&);
+  void setSubdomains(const std::vector<SubdomainRef>&);
   NameList getSubdomains() const;
+  SubdomainRange getSubdomainRefs() const;
 
   void setContact(const std::string&);
+  void setContact(const StringRef&);
   std::string getContact() const;
+  const StringRef& getContactRef() const;
 
   bool setKey(Botan::RSA_PrivateKey*);
   UInt8Array getPublicKey() const;
-  std::string getOnion() const;
+  void loadKey() const;
+  bool isKeyLoaded() const;
+  StringRef getOnion() const;
+  StringRef resolve(const char*, size_t) const;
   SHA384_HASH getHash() const;
-
-  void makeValid(uint8_t);
-  void computeValidity(bool*);  // updates valid_, with flag to abort work
+  SHA384_HASH getContentHash() const;
+
+  void makeValid(uint8_t, PowBackend& = PowBackend::getDefault());
+  void computeValidity(const std::atomic<bool>* cancel = nullptr);
+  static void computeValidity(Record* const*,
+                              size_t,
+                              const std::atomic<bool>*,
+                              PowBackend& = PowBackend::getDefault());
+  bool restoreValidity(const SHA384_HASH&);
   bool isValid() const;
   bool hasValidSignature() const;
 
+  void setArena(const StringArenaPtr&);
+
+  // estimated bytes: of the Record and its own buffers, of its strings in
+  // the arena, which may be shared, and of its Botan key objects, which
+  // copies of the Record share
+  size_t getMemoryUsage() const;
+  size_t getArenaUsage() const;
+  size_t getKeyMemoryUsage() const;
+
+  // Canonical binary form of the Record, which the PoW, signature, and hash
+  // are computed over. Lengths are big-endian: uint8 version, uint8 type,
+  // uint8 name length, name, uint16 contact length, contact, uint8 subdomain
+  // count and for each a uint8 length and label then a uint8 length and
+  // destination, uint16 key length, BER-encoded public key, nonce, and with
+  // the proof, the scrypt output and then the signature. It is also the
+  // binary wire form, from asBinary(), accepted by Common::parseRecord.
+  static const uint8_t ENCODING_VERSION = 1;
+  size_t getEncodedLength(bool) const;
+  size_t encode(uint8_t*, size_t, bool) const;
+
   std::string getType() const;
   virtual uint32_t getDifficulty() const;
   virtual Json::Value asJSONObj() const;
   std::string asJSON() const;
+  std::string asBinary() const;
   friend std::ostream& operator<<(std::ostream&, const Record&);
 
  protected:
-  WorkStatus makeValid(uint8_t, uint8_t, bool*);
   virtual UInt8Array computeCentral();
+  SHA384_HASH hashEncoding(bool) const;
   void updateAppendSignature(UInt8Array& buffer);
-  int updateAppendScrypt(UInt8Array& buffer);
+  static int updateAppendScrypt(Record* const*,
+                                UInt8Array*,
+                                size_t,
+                                const std::atomic<bool>*,
+                                PowBackend&);
   void updateValidity(const UInt8Array& buffer);
 
-  std::string type_, name_, contact_;
-  NameList subdomains_;
+  static const size_t ARENA_CHUNK_SIZE = 1024;  // for a standalone Record
+
+  template <typename Pair>
+  void storeSubdomains(const Pair*, size_t, StringArena&);
+  template <typename Pair>
+  void checkSubdomains(const Pair*, size_t) const;
+  void storePublicKey(StringArena&);
+  void storeOnion(StringArena&) const;
+  void clearHash();
+  void clearCentral();
+
+  Type type_;
+
+  // the name, contact, subdomain table, and the BER-encoded public key and
+  // onion address derived from it once all live contiguously in the arena,
+  // which may be shared with other Records
+  StringArenaPtr arena_;
+  StringRef name_, contact_, publicKeyBER_;
+  mutable StringRef onion_;
+  const SubdomainRef* subdomains_;
+  uint8_t subdomainCount_;
+
+  // A Record parsed from its encoding keeps only the key's BER bytes until
+  // the key is needed, for a signature or the onion address; loadKey() then
+  // sets these once, under keyMutex_, and marks the key Loaded.
+  enum KeyState : uint8_t
+  {
+    Deferred,
+    Loaded
+  };
 
   Botan::RSA_PrivateKey* privateKey_;
-  Botan::RSA_PublicKey* publicKey_;
+  mutable std::shared_ptr<Botan::RSA_PublicKey> publicKey_;  // as interned
+  mutable SignaturePoolPtr signatures_;  // shared by copies with the same key
+  mutable std::atomic<uint8_t> keyState_;
+  static std::mutex keyMutex_;
 
   std::array<uint8_t, Const::RECORD_NONCE_LEN> nonce_;
   std::array<uint8_t, Const::RECORD_SCRYPTED_LEN> scrypted_;
   std::array<uint8_t, Const::SIGNATURE_LEN> signature_;
   bool valid_, validSig_;
+
+  // the encoding without the proof, reused by repeated PoW attempts
+  std::vector<uint8_t> central_;
+
+  // getHash() is memoized, and cleared whenever the encoding may change
+  enum HashState : uint8_t
+  {
+    Stale,
+    Computing,
+    Ready
+  };
+
+  mutable std::atomic<uint8_t> hashState_;
+  mutable SHA384_HASH hash_;
 };
 
 typedef std::shared_ptr<Record> RecordPtr;
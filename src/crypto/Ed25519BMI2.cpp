@@ -0,0 +1,33 @@
+// Ed25519 with the 64-bit field arithmetic compiled for BMI2 and ADX, whose
+// MULX and ADCX/ADOX leave the flags alone and so let the 128-bit products
+// and carries interleave. The headers with inline C++ come first, so that
+// only this copy of Ed25519-donna is built for those instructions.
+
+#include "Ed25519Kernels.hpp"
+
+#ifdef ED25519_HAVE_BMI2
+
+#include "Sha2.hpp"
+#include <botan/botan.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __clang__
+#pragma clang attribute push(__attribute__((target("bmi2,adx"))), \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("bmi2,adx")
+#endif
+
+#define ED25519_SUFFIX _bmi2
+#define ED25519_FUNCTIONS Ed25519Kernels::BMI2
+#include "ed25519-donna-api.h"
+
+#ifdef __clang__
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef ED25519_KERNELS_HPP
+#define ED25519_KERNELS_HPP
+
+#include "ed25519.h"
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define ED25519_HAVE_BMI2
+#endif
+
+// The Ed25519-donna code is built once per kernel, each a complete copy
+// under its own suffix, and the functions of ed25519.h forward to the copy
+// picked the first time one of them is called.
+class Ed25519Kernels
+{
+ public:
+  enum class Kernel : uint8_t
+  {
+    Portable,  // whatever the build target allows
+    BMI2       // the 64-bit arithmetic with MULX and ADX
+  };
+
+  struct Functions
+  {
+    void (*publickey)(const ed25519_secret_key, ed25519_public_key);
+    void (*sign)(const unsigned char*,
+                 size_t,
+                 const ed25519_secret_key,
+                 const ed25519_public_key,
+                 ed25519_signature);
+    int (*signOpen)(const unsigned char*,
+                    size_t,
+                    const ed25519_public_key,
+                    const ed25519_signature);
+    int (*unpackPublicKey)(const ed25519_public_key, ed25519_unpacked_key*);
+    int (*signOpenUnpacked)(const unsigned char*,
+                            size_t,
+                            const ed25519_public_key,
+                            const ed25519_unpacked_key*,
+                            const ed25519_signature);
+    int (*precomputePublicKey)(const ed25519_public_key,
+                               ed25519_precomputed_key*);
+    int (*signOpenPrecomputed)(const unsigned char*,
+                               size_t,
+                               const ed25519_public_key,
+                               const ed25519_precomputed_key*,
+                               const ed25519_signature);
+    int (*signOpenBatch)(const unsigned char**,
+                         size_t*,
+                         const unsigned char**,
+                         const unsigned char**,
+                         size_t,
+                         int*);
+    void (*randombytesUnsafe)(void*, size_t);
+    void (*scalarmultBasepoint)(curved25519_key, const curved25519_key);
+  };
+
+  static Kernel getKernel();
+  static bool setKernel(Kernel);
+  static bool isSupported(Kernel);
+  static const char* getName(Kernel);
+  static const Functions& getFunctions();
+
+  static const Functions PORTABLE;
+#ifdef ED25519_HAVE_BMI2
+  static const Functions BMI2;
+#endif
+
+ private:
+  static Kernel detectKernel();
+};
+
+#endif
@@ -0,0 +1,37 @@
+
+#include "Ed25519Key.hpp"
+
+Ed25519Key::Ed25519Key(const ED_KEY& bytes)
+    : bytes_(bytes),
+      valid_(ed25519_precompute_public_key(bytes_.data(), &table_) == 0)
+{
+}
+
+
+
+// false if the key is not a point on the curve, so that nothing verifies
+bool Ed25519Key::isValid() const
+{
+  return valid_;
+}
+
+
+
+const ED_KEY& Ed25519Key::getBytes() const
+{
+  return bytes_;
+}
+
+
+
+// returns as ed25519_sign_open does, 0 if the signature on the message holds
+int Ed25519Key::verify(const uint8_t* message,
+                       size_t length,
+                       const uint8_t* signature) const
+{
+  if (!valid_)
+    return -1;
+
+  return ed25519_sign_open_precomputed(message, length, bytes_.data(), &table_,
+                                       signature);
+}
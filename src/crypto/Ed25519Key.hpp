@@ -0,0 +1,29 @@
+#ifndef ED25519_KEY_HPP
+#define ED25519_KEY_HPP
+
+#include "ed25519.h"
+#include "../Constants.hpp"
+#include <memory>
+
+// An Ed25519 public key that is decompressed and has the table of its
+// point's multiples built once, for the Quorum and mirror keys that check
+// signature after signature. It never changes after construction, so one
+// is shared by every stream and thread that verifies against the key.
+class Ed25519Key
+{
+ public:
+  explicit Ed25519Key(const ED_KEY&);
+
+  bool isValid() const;
+  const ED_KEY& getBytes() const;
+  int verify(const uint8_t*, size_t, const uint8_t*) const;
+
+ private:
+  ED_KEY bytes_;
+  ed25519_precomputed_key table_;
+  bool valid_;
+};
+
+typedef std::shared_ptr<const Ed25519Key> Ed25519KeyPtr;
+
+#endif
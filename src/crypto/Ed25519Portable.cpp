@@ -0,0 +1,6 @@
+// Ed25519 as the build target allows: 64-bit limbs where the compiler has a
+// 128-bit type, with the x86-64 assembly table lookups where it applies
+
+#define ED25519_SUFFIX _portable
+#define ED25519_FUNCTIONS Ed25519Kernels::PORTABLE
+#include "ed25519-donna-api.h"
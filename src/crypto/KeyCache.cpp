@@ -0,0 +1,203 @@
+#include "KeyCache.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../encoding/Codec.hpp"
+#include <botan/x509_key.h>
+#include <botan/sha2_32.h>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+const size_t KeyCache::MAX_DER_LEN;
+const size_t KeyCache::MIN_RSA_SWEEP;
+const size_t KeyCache::MAX_ED25519_KEYS;
+const size_t KeyCache::TOR_KEY_LEN;
+const size_t KeyCache::TOR_MODULUS_OFFSET;
+const size_t KeyCache::TOR_MODULUS_LEN;
+
+// returns the shared key for the DER encoding, or null if it is not RSA
+RSAKeyPtr KeyCache::load(const uint8_t* der, size_t length)
+{
+  uint8_t digest[32];
+  Botan::SHA_256 sha256;
+  sha256.update(der, length);
+  sha256.final(digest);
+  const std::string id(reinterpret_cast<const char*>(digest), sizeof(digest));
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = keys_.find(id);
+    if (entry != keys_.end())
+    {
+      if (RSAKeyPtr key = entry->second.lock())
+      {
+        hits_++;
+        return key;
+      }
+    }
+  }
+
+  // parse outside the lock, straight from the caller's bytes
+  RSAKeyPtr key(decodeKey(der, length));
+  if (!key)
+    return nullptr;
+
+  // if another thread parsed the same key meanwhile, keep the first
+  std::lock_guard<std::mutex> guard(mutex_);
+  misses_++;
+  auto& slot = keys_[id];
+  if (RSAKeyPtr first = slot.lock())
+    return first;
+  slot = key;
+
+  if (keys_.size() >= sweepAt_)
+  {  // forget the keys that no Record holds any more
+    for (auto entry = keys_.begin(); entry != keys_.end();)
+      entry = entry->second.expired() ? keys_.erase(entry) : std::next(entry);
+    sweepAt_ = std::max(MIN_RSA_SWEEP, 2 * keys_.size());
+  }
+
+  return key;
+}
+
+
+
+// decodes into a stack buffer, then loads as above
+RSAKeyPtr KeyCache::loadBase64(const char* base64, size_t length)
+{
+  uint8_t der[MAX_DER_LEN];
+  size_t derLength = Codec::base64Decode(base64, length, der, sizeof(der));
+  if (derLength == Codec::INVALID)
+    Log::get().error("RSA key is malformed or too long!");
+
+  return load(der, derLength);
+}
+
+
+
+// returns the shared Ed25519 key, building its table the first time
+Ed25519KeyPtr KeyCache::loadEd25519(const ED_KEY& bytes)
+{
+  const std::string id(bytes.begin(), bytes.end());
+
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto entry = edKeys_.find(id);
+    if (entry != edKeys_.end())
+    {
+      hits_++;
+      return entry->second;
+    }
+  }
+
+  auto key = std::make_shared<const Ed25519Key>(bytes);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  misses_++;
+  if (edKeys_.size() >= MAX_ED25519_KEYS)
+    edKeys_.clear();  // only a few Quorum nodes and mirrors, so rarely hit
+  auto& slot = edKeys_[id];
+  if (!slot)
+    slot = key;
+  return slot;
+}
+
+
+
+size_t KeyCache::getEntryCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return keys_.size() + edKeys_.size();
+}
+
+
+
+size_t KeyCache::getHitCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+
+
+size_t KeyCache::getMissCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+KeyCache::KeyCache() : sweepAt_(MIN_RSA_SWEEP), hits_(0), misses_(0)
+{
+}
+
+
+
+// Decodes a SubjectPublicKeyInfo holding a 1024-bit RSA key with e = 65537,
+// the shape of Tor's hidden service keys, without going through Botan's BER
+// decoder: every byte but the modulus is fixed, so the encoding is checked
+// against a template. The modulus must be odd and use all 1024 bits, as a
+// DER integer has no spare leading zeros. Returns null for anything else.
+Botan::RSA_PublicKey* KeyCache::decodeTorKey(const uint8_t* der, size_t length)
+{
+  static const uint8_t HEADER[TOR_MODULUS_OFFSET] = {
+      0x30, 0x81, 0x9f,              // SEQUENCE, 159 bytes
+      0x30, 0x0d,                    // SEQUENCE, the algorithm
+      0x06, 0x09, 0x2a, 0x86, 0x48,  // OID 1.2.840.113549.1.1.1, rsaEncryption
+      0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01,
+      0x05, 0x00,                    // NULL parameters
+      0x03, 0x81, 0x8d, 0x00,        // BIT STRING, 141 bytes, no unused bits
+      0x30, 0x81, 0x89,              // SEQUENCE, RSAPublicKey
+      0x02, 0x81, 0x81, 0x00};       // INTEGER, 129 bytes, then the modulus
+  static const uint8_t TRAILER[] = {0x02, 0x03, 0x01, 0x00, 0x01};  // 65537
+
+  static_assert(TOR_MODULUS_OFFSET + TOR_MODULUS_LEN + sizeof(TRAILER) ==
+                    TOR_KEY_LEN,
+                "the template must cover the whole encoding");
+
+  if (length != TOR_KEY_LEN || memcmp(der, HEADER, sizeof(HEADER)) != 0 ||
+      memcmp(der + TOR_MODULUS_OFFSET + TOR_MODULUS_LEN, TRAILER,
+             sizeof(TRAILER)) != 0)
+    return nullptr;
+
+  const uint8_t* modulus = der + TOR_MODULUS_OFFSET;
+  if ((modulus[0] & 0x80) == 0 || (modulus[TOR_MODULUS_LEN - 1] & 1) == 0)
+    return nullptr;
+
+  return new Botan::RSA_PublicKey(Botan::BigInt(modulus, TOR_MODULUS_LEN),
+                                  Botan::BigInt(65537));
+}
+
+
+
+// a new key from the DER encoding, or null if it is not an RSA key
+Botan::RSA_PublicKey* KeyCache::decodeKey(const uint8_t* der, size_t length)
+{
+  static Metrics::Counter& fast = Metrics::get().counter(
+      "onions_rsa_key_decodes_total{path=\"fixed\"}",
+      "RSA public keys decoded, by decoder.");
+  static Metrics::Counter& generic = Metrics::get().counter(
+      "onions_rsa_key_decodes_total{path=\"generic\"}",
+      "RSA public keys decoded, by decoder.");
+
+  if (auto key = decodeTorKey(der, length))
+  {
+    fast.add();
+    return key;
+  }
+
+  generic.add();
+  Botan::DataSource_Memory source(der, length);
+  std::unique_ptr<Botan::Public_Key> parsed(Botan::X509::load_key(source));
+  auto rsaKey = dynamic_cast<Botan::RSA_PublicKey*>(parsed.get());
+  if (!rsaKey)
+    return nullptr;
+
+  parsed.release();
+  return rsaKey;
+}
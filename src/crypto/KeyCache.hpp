@@ -0,0 +1,64 @@
+#ifndef KEY_CACHE_HPP
+#define KEY_CACHE_HPP
+
+#include "Ed25519Key.hpp"
+#include <botan/rsa.h>
+#include <unordered_map>
+#include <memory>
+#include <string>
+#include <mutex>
+
+// Interns parsed RSA public keys by the SHA-256 digest of their DER
+// encoding, so that Records carrying the same hidden service key share one
+// key object and the key is only parsed once while any Record holds it. The
+// table only refers to the keys weakly: a key goes with the last Record that
+// holds it, such as one that failed validation, and its entry is swept out
+// once the table has doubled since the last sweep.
+// Ed25519 keys are interned too, with their precomputed tables; they are
+// shared, so forgetting them when there are too many frees no one's key.
+// Hidden service keys are nearly always 1024-bit RSA with an exponent of
+// 65537, whose DER encoding has a single fixed layout; those are decoded
+// straight from the bytes, and anything else goes through Botan's parser.
+typedef std::shared_ptr<Botan::RSA_PublicKey> RSAKeyPtr;
+
+class KeyCache
+{
+ public:
+  static const size_t MAX_DER_LEN = 2048;
+  static const size_t MIN_RSA_SWEEP = 1024;  // entries before the first sweep
+  static const size_t MAX_ED25519_KEYS = 256;
+  static const size_t TOR_KEY_LEN = 162;       // DER bytes
+  static const size_t TOR_MODULUS_OFFSET = 29;
+  static const size_t TOR_MODULUS_LEN = 128;
+
+  static KeyCache& get()
+  {
+    static KeyCache instance;
+    return instance;
+  }
+
+  RSAKeyPtr load(const uint8_t*, size_t);
+  RSAKeyPtr loadBase64(const char*, size_t);
+  Ed25519KeyPtr loadEd25519(const ED_KEY&);
+
+  size_t getEntryCount() const;
+  size_t getHitCount() const;
+  size_t getMissCount() const;
+
+ private:
+  KeyCache();
+  KeyCache(KeyCache const&) = delete;
+  void operator=(KeyCache const&) = delete;
+
+  static Botan::RSA_PublicKey* decodeTorKey(const uint8_t*, size_t);
+  static Botan::RSA_PublicKey* decodeKey(const uint8_t*, size_t);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::weak_ptr<Botan::RSA_PublicKey>>
+      keys_;  // by DER digest
+  size_t sweepAt_;  // keys_ entries
+  std::unordered_map<std::string, Ed25519KeyPtr> edKeys_;  // by key bytes
+  size_t hits_, misses_;
+};
+
+#endif
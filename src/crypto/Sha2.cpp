@@ -0,0 +1,305 @@
+
+#include "Sha2.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#ifdef SHA2_HAVE_ARMV8
+#include <sys/auxv.h>
+#define SHA2_HWCAP_SHA512 (1 << 21)
+#endif
+
+const size_t Sha2::SHA384_LEN;
+const size_t Sha2::SHA512_LEN;
+const size_t Sha2::LANES;
+static std::atomic<uint8_t> kernel_(0xFF);  // 0xFF until detected
+
+Sha2::Context::Context(bool sha384) : sha384_(sha384)
+{
+  reset();
+}
+
+
+
+void Sha2::Context::update(const uint8_t* in, size_t len)
+{
+  const size_t BLOCK = Sha2Kernels::BLOCK_LEN;
+  length_ += len;
+
+  if (buffered_ > 0)
+  {
+    const size_t n = std::min(len, BLOCK - buffered_);
+    memcpy(buffer_ + buffered_, in, n);
+    buffered_ += n;
+    in += n;
+    len -= n;
+    if (buffered_ < BLOCK)
+      return;
+
+    getCompress(getKernel())(state_, buffer_, 1);
+    buffered_ = 0;
+  }
+
+  if (len >= BLOCK)
+  {
+    getCompress(getKernel())(state_, in, len / BLOCK);
+    in += len - len % BLOCK;
+    len %= BLOCK;
+  }
+
+  memcpy(buffer_, in, len);
+  buffered_ = len;
+}
+
+
+
+void Sha2::Context::final(uint8_t* digest)
+{
+  uint8_t blocks[2 * Sha2Kernels::BLOCK_LEN];
+  const size_t count = pad(buffer_, buffered_, length_, blocks);
+  getCompress(getKernel())(state_, blocks, count);
+  store(state_, sha384_ ? SHA384_LEN / 8 : SHA512_LEN / 8, digest);
+  reset();
+}
+
+
+
+void Sha2::Context::reset()
+{
+  initialize(state_, sha384_);
+  buffered_ = 0;
+  length_ = 0;
+}
+
+
+
+void Sha2::sha384(const uint8_t* in, size_t len, uint8_t* digest)
+{
+  hash(in, len, true, digest);
+}
+
+
+
+void Sha2::sha512(const uint8_t* in, size_t len, uint8_t* digest)
+{
+  hash(in, len, false, digest);
+}
+
+
+
+// SHA-384 of n messages that are all len bytes long, into their digests
+void Sha2::sha384Many(const uint8_t* const* messages,
+                      size_t len,
+                      size_t n,
+                      uint8_t* const* digests)
+{
+  size_t done = 0;
+
+#ifdef SHA2_HAVE_X86
+  const size_t BLOCK = Sha2Kernels::BLOCK_LEN;
+  if (n > 1 && getKernel() == Kernel::AVX2)
+  {
+    uint64_t states[LANES][8];
+    uint64_t* stateRefs[LANES];
+    const uint8_t* inputs[LANES];
+    uint8_t tails[LANES][2 * Sha2Kernels::BLOCK_LEN];
+    const uint8_t* tailRefs[LANES];
+    for (size_t l = 0; l < LANES; l++)
+    {
+      stateRefs[l] = states[l];
+      tailRefs[l] = tails[l];
+    }
+
+    // a short last group repeats its last message in the spare lanes
+    for (; n - done > 1; done += std::min(LANES, n - done))
+    {
+      const size_t group = std::min(LANES, n - done);
+      size_t tailBlocks = 0;
+      for (size_t l = 0; l < LANES; l++)
+      {
+        inputs[l] = messages[done + std::min(l, group - 1)];
+        initialize(states[l], true);
+        tailBlocks = pad(inputs[l] + len - len % BLOCK, len % BLOCK, len,
+                         tails[l]);
+      }
+
+      Sha2Kernels::compress4AVX2(stateRefs, inputs, len / BLOCK);
+      Sha2Kernels::compress4AVX2(stateRefs, tailRefs, tailBlocks);
+      for (size_t l = 0; l < group; l++)
+        store(states[l], SHA384_LEN / 8, digests[done + l]);
+    }
+  }
+#endif
+
+  for (; done < n; done++)
+    sha384(messages[done], len, digests[done]);
+}
+
+
+
+Sha2::Kernel Sha2::getKernel()
+{
+  uint8_t kernel = kernel_.load(std::memory_order_relaxed);
+  if (kernel == 0xFF)
+  {
+    kernel = static_cast<uint8_t>(detectKernel());
+    kernel_.store(kernel, std::memory_order_relaxed);
+  }
+
+  return static_cast<Kernel>(kernel);
+}
+
+
+
+// forces a kernel, returns false if this CPU cannot run it
+bool Sha2::setKernel(Kernel kernel)
+{
+  if (!isSupported(kernel))
+    return false;
+
+  kernel_.store(static_cast<uint8_t>(kernel), std::memory_order_relaxed);
+  return true;
+}
+
+
+
+bool Sha2::isSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef SHA2_HAVE_X86
+    case Kernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+
+#ifdef SHA2_HAVE_ARMV8
+    case Kernel::ARMv8:
+      return (getauxval(AT_HWCAP) & SHA2_HWCAP_SHA512) != 0;
+#endif
+
+    default:
+      return false;
+  }
+}
+
+
+
+const char* Sha2::getName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::AVX2:
+      return "AVX2";
+    case Kernel::ARMv8:
+      return "ARMv8";
+  }
+
+  return "unknown";
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+void Sha2::initialize(uint64_t* state, bool sha384)
+{
+  static const uint64_t SHA384_IV[8] = {
+      0xcbbb9d5dc1059ed8, 0x629a292a367cd507, 0x9159015a3070dd17,
+      0x152fecd8f70e5939, 0x67332667ffc00b31, 0x8eb44a8768581511,
+      0xdb0c2e0d64f98fa7, 0x47b5481dbefa4fa4};
+  static const uint64_t SHA512_IV[8] = {
+      0x6a09e667f3bcc908, 0xbb67ae8584caa73b, 0x3c6ef372fe94f82b,
+      0xa54ff53a5f1d36f1, 0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+      0x1f83d9abfb41bd6b, 0x5be0cd19137e2179};
+
+  memcpy(state, sha384 ? SHA384_IV : SHA512_IV, sizeof(SHA384_IV));
+}
+
+
+
+// Writes what is left of a message after its whole blocks, followed by the
+// padding and the bit length of all of it, into one or two blocks, and
+// returns how many.
+size_t Sha2::pad(const uint8_t* tail,
+                 size_t tailLen,
+                 uint64_t total,
+                 uint8_t* blocks)
+{
+  const size_t BLOCK = Sha2Kernels::BLOCK_LEN;
+  const size_t count = tailLen + 17 > BLOCK ? 2 : 1;
+
+  memcpy(blocks, tail, tailLen);
+  blocks[tailLen] = 0x80;
+  memset(blocks + tailLen + 1, 0, count * BLOCK - tailLen - 1);
+
+  uint8_t* length = blocks + count * BLOCK - 16;
+  length[7] = static_cast<uint8_t>(total >> 61);  // high word of the bits
+  const uint64_t bits = total << 3;
+  for (int j = 0; j < 8; j++)
+    length[15 - j] = static_cast<uint8_t>(bits >> (8 * j));
+  return count;
+}
+
+
+
+// the first "words" words of the state, big-endian
+void Sha2::store(const uint64_t* state, size_t words, uint8_t* digest)
+{
+  for (size_t w = 0; w < words; w++)
+    for (int j = 0; j < 8; j++)
+      digest[8 * w + j] = static_cast<uint8_t>(state[w] >> (56 - 8 * j));
+}
+
+
+
+void Sha2::hash(const uint8_t* in, size_t len, bool sha384, uint8_t* digest)
+{
+  const size_t BLOCK = Sha2Kernels::BLOCK_LEN;
+  const Sha2Kernels::Compress compress = getCompress(getKernel());
+
+  uint64_t state[8];
+  initialize(state, sha384);
+  compress(state, in, len / BLOCK);
+
+  uint8_t blocks[2 * Sha2Kernels::BLOCK_LEN];
+  const size_t count = pad(in + len - len % BLOCK, len % BLOCK, len, blocks);
+  compress(state, blocks, count);
+  store(state, sha384 ? SHA384_LEN / 8 : SHA512_LEN / 8, digest);
+}
+
+
+
+Sha2::Kernel Sha2::detectKernel()
+{
+  static const Kernel PREFERENCE[] = {Kernel::ARMv8, Kernel::AVX2};
+
+  for (auto kernel : PREFERENCE)
+    if (isSupported(kernel))
+      return kernel;
+
+  return Kernel::Scalar;
+}
+
+
+
+// the single-message compression for the kernel; x86 has none of its own
+Sha2Kernels::Compress Sha2::getCompress(Kernel kernel)
+{
+  switch (kernel)
+  {
+#ifdef SHA2_HAVE_ARMV8
+    case Kernel::ARMv8:
+      return Sha2Kernels::compressARMv8;
+#endif
+
+    default:
+      return Sha2Kernels::compressScalar;
+  }
+}
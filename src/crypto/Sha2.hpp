@@ -0,0 +1,67 @@
+#ifndef SHA2_HPP
+#define SHA2_HPP
+
+#include "Sha2Kernels.hpp"
+#include <cstdint>
+#include <cstddef>
+
+// SHA-384 and SHA-512 for the Merkle tree, Records and Ed25519, without a
+// Botan object per hash. Single messages use the ARMv8.2 SHA512
+// instructions where there are some. Many messages of the same length,
+// such as the pairs of a tree level, go four at a time through AVX2 where
+// that is supported. The kernel is picked the first time one is needed,
+// and every kernel gives the same digests.
+class Sha2
+{
+ public:
+  enum class Kernel : uint8_t
+  {
+    Scalar,
+    AVX2,
+    ARMv8
+  };
+
+  static const size_t SHA384_LEN = 48;
+  static const size_t SHA512_LEN = 64;
+  static const size_t LANES = 4;  // messages per multi-buffer pass
+
+  // an incremental hash, for input that is not in one piece
+  class Context
+  {
+   public:
+    explicit Context(bool sha384 = false);
+    void update(const uint8_t*, size_t);
+    void final(uint8_t*);  // then starts over
+
+   private:
+    void reset();
+
+    bool sha384_;
+    uint64_t state_[8];
+    uint8_t buffer_[Sha2Kernels::BLOCK_LEN];
+    size_t buffered_;
+    uint64_t length_;  // bytes so far
+  };
+
+  static void sha384(const uint8_t*, size_t, uint8_t*);
+  static void sha512(const uint8_t*, size_t, uint8_t*);
+  static void sha384Many(const uint8_t* const*,
+                         size_t,
+                         size_t,
+                         uint8_t* const*);
+
+  static Kernel getKernel();
+  static bool setKernel(Kernel);
+  static bool isSupported(Kernel);
+  static const char* getName(Kernel);
+
+ private:
+  static void initialize(uint64_t*, bool);
+  static size_t pad(const uint8_t*, size_t, uint64_t, uint8_t*);
+  static void store(const uint64_t*, size_t, uint8_t*);
+  static void hash(const uint8_t*, size_t, bool, uint8_t*);
+  static Kernel detectKernel();
+  static Sha2Kernels::Compress getCompress(Kernel);
+};
+
+#endif
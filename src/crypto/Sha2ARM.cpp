@@ -0,0 +1,98 @@
+// SHA-512 with the ARMv8.2 SHA512 instructions, two rounds at a time, after
+// the round structure of the AArch64 crypto-extension code in Mbed TLS.
+
+#include "Sha2Kernels.hpp"
+
+#ifdef SHA2_HAVE_ARMV8
+
+#include <arm_neon.h>
+
+#ifdef __clang__
+#define SHA512_FUNCTION __attribute__((target("sha3")))
+#else
+#define SHA512_FUNCTION __attribute__((target("+sha3")))
+#endif
+
+// Two rounds on the four state pairs, as named from where "ab" stands;
+// the next two rounds pass them rotated by one pair.
+#define SHA512_ROUNDS(s, t, ab, cd, ef, gh)                                 \
+  do                                                                        \
+  {                                                                         \
+    uint64x2_t sum = vaddq_u64(s, vld1q_u64(&K[t]));                        \
+    sum = vaddq_u64(vextq_u64(sum, sum, 1), gh);                            \
+    uint64x2_t mid =                                                        \
+        vsha512hq_u64(sum, vextq_u64(ef, gh, 1), vextq_u64(cd, ef, 1));     \
+    gh = vsha512h2q_u64(mid, cd, ab);                                       \
+    cd = vaddq_u64(cd, mid);                                                \
+  } while (false)
+
+// the message schedule for the next two words into s0
+#define SHA512_SCHEDULE(s0, s1, s4, s5, s7) \
+  s0 = vsha512su1q_u64(vsha512su0q_u64(s0, s1), s7, vextq_u64(s4, s5, 1))
+
+static inline uint64x2_t load(const uint8_t* p)
+{
+  return vreinterpretq_u64_u8(vrev64q_u8(vld1q_u8(p)));
+}
+
+
+
+SHA512_FUNCTION void Sha2Kernels::compressARMv8(uint64_t* state,
+                                                const uint8_t* blocks,
+                                                size_t count)
+{
+  uint64x2_t ab = vld1q_u64(&state[0]);
+  uint64x2_t cd = vld1q_u64(&state[2]);
+  uint64x2_t ef = vld1q_u64(&state[4]);
+  uint64x2_t gh = vld1q_u64(&state[6]);
+
+  for (size_t n = 0; n < count; n++, blocks += BLOCK_LEN)
+  {
+    const uint64x2_t abStart = ab, cdStart = cd, efStart = ef, ghStart = gh;
+
+    uint64x2_t s0 = load(blocks), s1 = load(blocks + 16);
+    uint64x2_t s2 = load(blocks + 32), s3 = load(blocks + 48);
+    uint64x2_t s4 = load(blocks + 64), s5 = load(blocks + 80);
+    uint64x2_t s6 = load(blocks + 96), s7 = load(blocks + 112);
+
+    for (int t = 0; t < 80; t += 16)
+    {
+      if (t > 0)
+        SHA512_SCHEDULE(s0, s1, s4, s5, s7);
+      SHA512_ROUNDS(s0, t, ab, cd, ef, gh);
+      if (t > 0)
+        SHA512_SCHEDULE(s1, s2, s5, s6, s0);
+      SHA512_ROUNDS(s1, t + 2, gh, ab, cd, ef);
+      if (t > 0)
+        SHA512_SCHEDULE(s2, s3, s6, s7, s1);
+      SHA512_ROUNDS(s2, t + 4, ef, gh, ab, cd);
+      if (t > 0)
+        SHA512_SCHEDULE(s3, s4, s7, s0, s2);
+      SHA512_ROUNDS(s3, t + 6, cd, ef, gh, ab);
+      if (t > 0)
+        SHA512_SCHEDULE(s4, s5, s0, s1, s3);
+      SHA512_ROUNDS(s4, t + 8, ab, cd, ef, gh);
+      if (t > 0)
+        SHA512_SCHEDULE(s5, s6, s1, s2, s4);
+      SHA512_ROUNDS(s5, t + 10, gh, ab, cd, ef);
+      if (t > 0)
+        SHA512_SCHEDULE(s6, s7, s2, s3, s5);
+      SHA512_ROUNDS(s6, t + 12, ef, gh, ab, cd);
+      if (t > 0)
+        SHA512_SCHEDULE(s7, s0, s3, s4, s6);
+      SHA512_ROUNDS(s7, t + 14, cd, ef, gh, ab);
+    }
+
+    ab = vaddq_u64(ab, abStart);
+    cd = vaddq_u64(cd, cdStart);
+    ef = vaddq_u64(ef, efStart);
+    gh = vaddq_u64(gh, ghStart);
+  }
+
+  vst1q_u64(&state[0], ab);
+  vst1q_u64(&state[2], cd);
+  vst1q_u64(&state[4], ef);
+  vst1q_u64(&state[6], gh);
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SHA2_KERNELS_HPP
+#define SHA2_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA2_HAVE_X86
+#endif
+
+#if defined(__aarch64__) && defined(__GNUC__)
+#define SHA2_HAVE_ARMV8
+#endif
+
+// SHA-512 compression functions (FIPS 180-4, section 6.4) for Sha2 to pick
+// from; SHA-384 differs only in its initial state and truncation. Each
+// runs the state over whole 128-byte blocks. The multi-buffer kernels run
+// several independent states side by side, one per SIMD lane, each over
+// its own blocks but the same number of them.
+class Sha2Kernels
+{
+ public:
+  static const size_t BLOCK_LEN = 128;
+
+  typedef void (*Compress)(uint64_t*, const uint8_t*, size_t);
+
+  static const uint64_t K[80];
+
+  static void compressScalar(uint64_t*, const uint8_t*, size_t);
+
+#ifdef SHA2_HAVE_X86
+  static void compress4AVX2(uint64_t* const*, const uint8_t* const*, size_t);
+#endif
+
+#ifdef SHA2_HAVE_ARMV8
+  static void compressARMv8(uint64_t*, const uint8_t*, size_t);
+#endif
+};
+
+#endif
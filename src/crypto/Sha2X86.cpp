@@ -0,0 +1,164 @@
+// AVX2 multi-buffer SHA-512: four independent messages, one per 64-bit lane
+// of each register. Every round does the same work for all of them, so a
+// level of Merkle tree nodes hashes about three times faster than one at a
+// time, there being no single-message SHA-512 instructions on x86 to beat.
+
+#include "Sha2Kernels.hpp"
+
+#ifdef SHA2_HAVE_X86
+
+#include <immintrin.h>
+
+#define AVX2_INLINE __attribute__((target("avx2"), always_inline)) inline
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+
+static AVX2_INLINE __m256i rotate(__m256i x, int n)
+{
+  return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+
+
+static AVX2_INLINE __m256i add(__m256i a, __m256i b)
+{
+  return _mm256_add_epi64(a, b);
+}
+
+
+
+// Words t to t + 3 of each lane's block, transposed so that register j
+// holds word t + j of all four lanes, in host order.
+static AVX2_INLINE void loadWords(const uint8_t* const* blocks,
+                                  size_t offset,
+                                  __m256i* W)
+{
+  const __m256i BSWAP = _mm256_setr_epi8(
+      7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2,
+      1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+
+  __m256i r0 = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(blocks[0] + offset));
+  __m256i r1 = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(blocks[1] + offset));
+  __m256i r2 = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(blocks[2] + offset));
+  __m256i r3 = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(blocks[3] + offset));
+
+  __m256i lo01 = _mm256_unpacklo_epi64(r0, r1);  // 0.0 1.0 0.2 1.2
+  __m256i hi01 = _mm256_unpackhi_epi64(r0, r1);  // 0.1 1.1 0.3 1.3
+  __m256i lo23 = _mm256_unpacklo_epi64(r2, r3);
+  __m256i hi23 = _mm256_unpackhi_epi64(r2, r3);
+
+  W[0] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(lo01, lo23, 0x20),
+                             BSWAP);
+  W[1] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(hi01, hi23, 0x20),
+                             BSWAP);
+  W[2] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(lo01, lo23, 0x31),
+                             BSWAP);
+  W[3] = _mm256_shuffle_epi8(_mm256_permute2x128_si256(hi01, hi23, 0x31),
+                             BSWAP);
+}
+
+
+
+static AVX2_INLINE void round(__m256i a,
+                              __m256i b,
+                              __m256i c,
+                              __m256i& d,
+                              __m256i e,
+                              __m256i f,
+                              __m256i g,
+                              __m256i& h,
+                              __m256i kw)
+{
+  const __m256i S1 =
+      _mm256_xor_si256(_mm256_xor_si256(rotate(e, 14), rotate(e, 18)),
+                       rotate(e, 41));
+  const __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f),
+                                      _mm256_andnot_si256(e, g));
+  const __m256i t1 = add(add(h, S1), add(ch, kw));
+  const __m256i S0 =
+      _mm256_xor_si256(_mm256_xor_si256(rotate(a, 28), rotate(a, 34)),
+                       rotate(a, 39));
+  const __m256i maj = _mm256_or_si256(_mm256_and_si256(a, b),
+                                      _mm256_and_si256(c, _mm256_or_si256(a, b)));
+
+  d = add(d, t1);
+  h = add(t1, add(S0, maj));
+}
+
+
+
+AVX2_FUNCTION void Sha2Kernels::compress4AVX2(uint64_t* const* states,
+                                              const uint8_t* const* blocks,
+                                              size_t count)
+{
+  __m256i S[8];
+  for (int j = 0; j < 8; j++)
+    S[j] = _mm256_setr_epi64x(states[0][j], states[1][j], states[2][j],
+                              states[3][j]);
+
+  const uint8_t* lanes[4] = {blocks[0], blocks[1], blocks[2], blocks[3]};
+  __m256i W[16];
+  for (size_t n = 0; n < count; n++)
+  {
+    __m256i a = S[0], b = S[1], c = S[2], d = S[3];
+    __m256i e = S[4], f = S[5], g = S[6], h = S[7];
+
+    for (int t = 0; t < 80; t += 8)
+    {
+      if (t < 16)
+      {
+        loadWords(lanes, 8 * t, W + t);
+        loadWords(lanes, 8 * t + 32, W + t + 4);
+      }
+      else
+        for (int j = t; j < t + 8; j++)
+        {
+          const __m256i w15 = W[(j - 15) & 15], w2 = W[(j - 2) & 15];
+          const __m256i s0 =
+              _mm256_xor_si256(_mm256_xor_si256(rotate(w15, 1), rotate(w15, 8)),
+                               _mm256_srli_epi64(w15, 7));
+          const __m256i s1 =
+              _mm256_xor_si256(_mm256_xor_si256(rotate(w2, 19), rotate(w2, 61)),
+                               _mm256_srli_epi64(w2, 6));
+          W[j & 15] = add(add(W[j & 15], s0), add(W[(j - 7) & 15], s1));
+        }
+
+      // the variables rotate through the eight rounds instead of moving
+      const __m256i* w = W + (t & 15);
+      const uint64_t* k = K + t;
+      round(a, b, c, d, e, f, g, h, add(w[0], _mm256_set1_epi64x(k[0])));
+      round(h, a, b, c, d, e, f, g, add(w[1], _mm256_set1_epi64x(k[1])));
+      round(g, h, a, b, c, d, e, f, add(w[2], _mm256_set1_epi64x(k[2])));
+      round(f, g, h, a, b, c, d, e, add(w[3], _mm256_set1_epi64x(k[3])));
+      round(e, f, g, h, a, b, c, d, add(w[4], _mm256_set1_epi64x(k[4])));
+      round(d, e, f, g, h, a, b, c, add(w[5], _mm256_set1_epi64x(k[5])));
+      round(c, d, e, f, g, h, a, b, add(w[6], _mm256_set1_epi64x(k[6])));
+      round(b, c, d, e, f, g, h, a, add(w[7], _mm256_set1_epi64x(k[7])));
+    }
+
+    S[0] = add(S[0], a);
+    S[1] = add(S[1], b);
+    S[2] = add(S[2], c);
+    S[3] = add(S[3], d);
+    S[4] = add(S[4], e);
+    S[5] = add(S[5], f);
+    S[6] = add(S[6], g);
+    S[7] = add(S[7], h);
+
+    for (int l = 0; l < 4; l++)
+      lanes[l] += BLOCK_LEN;
+  }
+
+  for (int j = 0; j < 8; j++)
+  {
+    alignas(32) uint64_t words[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(words), S[j]);
+    for (int l = 0; l < 4; l++)
+      states[l][j] = words[l];
+  }
+}
+
+#endif
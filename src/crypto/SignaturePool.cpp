@@ -0,0 +1,101 @@
+
+#include "SignaturePool.hpp"
+#include "../Metrics.hpp"
+#include <botan/auto_rng.h>
+#include <algorithm>
+#include <cstring>
+
+const std::string SignaturePool::EMSA = "EMSA-PKCS1-v1_5(SHA-384)";
+
+SignaturePool::SignaturePool(Botan::RSA_PublicKey* publicKey,
+                             Botan::RSA_PrivateKey* privateKey)
+    : publicKey_(publicKey), privateKey_(privateKey)
+{
+}
+
+
+
+bool SignaturePool::canSign() const
+{
+  return privateKey_ != nullptr;
+}
+
+
+
+// signs the message into sig, returning the length of the signature
+size_t SignaturePool::sign(const uint8_t* msg,
+                           size_t msgLen,
+                           uint8_t* sig,
+                           size_t sigLen)
+{
+  // https://stackoverflow.com/questions/14263346/
+  // http://botan.randombit.net/manual/pubkey.html#signatures
+  auto signer = signers_.acquire();
+  if (!signer)
+    signer.reset(new Botan::PK_Signer(*privateKey_, EMSA));
+
+  auto signature = signer->sign_message(msg, msgLen, getRNG());
+  signers_.release(std::move(signer));
+
+  const size_t len = std::min(sigLen, signature.size());
+  memcpy(sig, signature.begin(), len);
+  return len;
+}
+
+
+
+bool SignaturePool::verify(const uint8_t* msg,
+                           size_t msgLen,
+                           const uint8_t* sig,
+                           size_t sigLen)
+{
+  static Metrics::Counter& verifications = Metrics::get().counter(
+      "onions_signature_verifications_total{algorithm=\"rsa\"}",
+      "Signatures checked, by algorithm.");
+  verifications.add();
+
+  auto verifier = verifiers_.acquire();
+  if (!verifier)
+    verifier.reset(new Botan::PK_Verifier(*publicKey_, EMSA));
+
+  bool valid = verifier->verify_message(msg, msgLen, sig, sigLen);
+  verifiers_.release(std::move(verifier));
+  return valid;
+}
+
+
+
+// each thread seeds and keeps its own generator, as they are not thread-safe
+Botan::RandomNumberGenerator& SignaturePool::getRNG()
+{
+  static thread_local Botan::AutoSeeded_RNG rng;
+  return rng;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// takes an idle object, or returns null if the caller has to construct one
+template <typename T>
+std::unique_ptr<T> SignaturePool::Pool<T>::acquire()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (idle.empty())
+    return nullptr;
+
+  auto object = std::move(idle.back());
+  idle.pop_back();
+  return object;
+}
+
+
+
+template <typename T>
+void SignaturePool::Pool<T>::release(std::unique_ptr<T> object)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  idle.push_back(std::move(object));
+}
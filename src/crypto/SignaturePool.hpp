@@ -0,0 +1,48 @@
+#ifndef SIGNATURE_POOL_HPP
+#define SIGNATURE_POOL_HPP
+
+#include <botan/pubkey.h>
+#include <botan/rsa.h>
+#include <memory>
+#include <vector>
+#include <string>
+#include <mutex>
+
+// Signs and verifies with one RSA key, keeping the Botan signer and verifier
+// objects it constructs for reuse. They are expensive to set up, as each
+// precomputes with the key, but not thread-safe, so each is leased out to
+// one thread at a time and returned afterwards. Copies of a Record share
+// their key's pool, which then holds one of each per concurrent thread.
+class SignaturePool
+{
+ public:
+  SignaturePool(Botan::RSA_PublicKey*, Botan::RSA_PrivateKey* = nullptr);
+
+  bool canSign() const;
+  size_t sign(const uint8_t*, size_t, uint8_t*, size_t);
+  bool verify(const uint8_t*, size_t, const uint8_t*, size_t);
+
+  static Botan::RandomNumberGenerator& getRNG();
+
+ private:
+  template <typename T>
+  struct Pool
+  {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<T>> idle;
+
+    std::unique_ptr<T> acquire();
+    void release(std::unique_ptr<T>);
+  };
+
+  static const std::string EMSA;
+
+  Botan::RSA_PublicKey* publicKey_;
+  Botan::RSA_PrivateKey* privateKey_;
+  Pool<Botan::PK_Signer> signers_;
+  Pool<Botan::PK_Verifier> verifiers_;
+};
+
+typedef std::shared_ptr<SignaturePool> SignaturePoolPtr;
+
+#endif
@@ -0,0 +1,327 @@
+/*
+  Public domain by Andrew M. <liquidsun@gmail.com>
+
+  Ed25519 reference implementation using Ed25519-donna
+
+  Included once per kernel, with ED25519_SUFFIX naming its functions and
+  ED25519_FUNCTIONS naming the table of them. The field arithmetic follows
+  whatever the including file has selected.
+*/
+
+
+/* define ED25519_SUFFIX to have it appended to the end of each public function
+ */
+#if !defined(ED25519_SUFFIX)
+#define ED25519_SUFFIX
+#endif
+
+#define ED25519_FN3(fn, suffix) fn##suffix
+#define ED25519_FN2(fn, suffix) ED25519_FN3(fn, suffix)
+#define ED25519_FN(fn) ED25519_FN2(fn, ED25519_SUFFIX)
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#pragma clang diagnostic ignored "-Wcast-align"
+#pragma clang diagnostic ignored "-Wimplicit-fallthrough"
+#pragma clang diagnostic ignored "-Wmissing-prototypes"
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wmissing-variable-declarations"
+#elif __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#endif
+
+#include "ed25519-donna.h"
+#include "ed25519.h"
+#include "Ed25519Kernels.hpp"
+#include "ed25519-randombytes.h"
+#include "ed25519-hash.h"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#elif __GNUC__
+#pragma GCC diagnostic push
+#endif
+
+/*
+  Generates a (extsk[0..31]) and aExt (extsk[32..63])
+*/
+
+DONNA_INLINE static void ed25519_extsk(hash_512bits extsk,
+                                       const ed25519_secret_key sk)
+{
+  ed25519_hash(extsk, sk, 32);
+  extsk[0] &= 248;
+  extsk[31] &= 127;
+  extsk[31] |= 64;
+}
+
+static void ed25519_hram(hash_512bits hram,
+                         const ed25519_signature RS,
+                         const ed25519_public_key pk,
+                         const unsigned char* m,
+                         size_t mlen)
+{
+  ed25519_hash_context ctx;
+  ed25519_hash_init(&ctx);
+  ed25519_hash_update(&ctx, RS, 32);
+  ed25519_hash_update(&ctx, pk, 32);
+  ed25519_hash_update(&ctx, m, mlen);
+  ed25519_hash_final(&ctx, hram);
+}
+
+void ED25519_FN(ed25519_publickey)(const ed25519_secret_key sk,
+                                   ed25519_public_key pk)
+{
+  bignum256modm a;
+  ge25519 ALIGN(16) A;
+  hash_512bits extsk;
+
+  /* A = aB */
+  ed25519_extsk(extsk, sk);
+  expand256_modm(a, extsk, 32);
+  ge25519_scalarmult_base_niels(&A, ge25519_niels_base_multiples, a);
+  ge25519_pack(pk, &A);
+}
+
+
+void ED25519_FN(ed25519_sign)(const unsigned char* m,
+                              size_t mlen,
+                              const ed25519_secret_key sk,
+                              const ed25519_public_key pk,
+                              ed25519_signature RS)
+{
+  ed25519_hash_context ctx;
+  bignum256modm r, S, a;
+  ge25519 ALIGN(16) R;
+  hash_512bits extsk, hashr, hram;
+
+  ed25519_extsk(extsk, sk);
+
+  /* r = H(aExt[32..64], m) */
+  ed25519_hash_init(&ctx);
+  ed25519_hash_update(&ctx, extsk + 32, 32);
+  ed25519_hash_update(&ctx, m, mlen);
+  ed25519_hash_final(&ctx, hashr);
+  expand256_modm(r, hashr, 64);
+
+  /* R = rB */
+  ge25519_scalarmult_base_niels(&R, ge25519_niels_base_multiples, r);
+  ge25519_pack(RS, &R);
+
+  /* S = H(R,A,m).. */
+  ed25519_hram(hram, RS, pk, m, mlen);
+  expand256_modm(S, hram, 64);
+
+  /* S = H(R,A,m)a */
+  expand256_modm(a, extsk, 32);
+  mul256_modm(S, S, a);
+
+  /* S = (r + H(R,A,m)a) */
+  add256_modm(S, S, r);
+
+  /* S = (r + H(R,A,m)a) mod L */
+  contract256_modm(RS + 32, S);
+}
+
+int ED25519_FN(ed25519_sign_open)(const unsigned char* m,
+                                  size_t mlen,
+                                  const ed25519_public_key pk,
+                                  const ed25519_signature RS)
+{
+  ge25519 ALIGN(16) R, A;
+  hash_512bits hash;
+  bignum256modm hram, S;
+  unsigned char checkR[32];
+
+  if ((RS[63] & 224) || !ge25519_unpack_negative_vartime(&A, pk))
+    return -1;
+
+  /* hram = H(R,A,m) */
+  ed25519_hram(hash, RS, pk, m, mlen);
+  expand256_modm(hram, hash, 64);
+
+  /* S */
+  expand256_modm(S, RS + 32, 32);
+
+  /* SB - H(R,A,m)A */
+  ge25519_double_scalarmult_vartime(&R, &A, hram, S);
+  ge25519_pack(checkR, &R);
+
+  /* check that R = SB - H(R,A,m)A */
+  return ed25519_verify(RS, checkR, 32) ? 0 : -1;
+}
+
+static_assert(sizeof(ge25519) <= sizeof(ed25519_unpacked_key),
+              "ed25519_unpacked_key cannot hold a ge25519");
+
+/*
+  Decompresses a public key once, so that ed25519_sign_open_unpacked can
+  skip that step on every verification with it; -1 if not a valid point
+*/
+int ED25519_FN(ed25519_unpack_public_key)(const ed25519_public_key pk,
+                                          ed25519_unpacked_key* unpacked)
+{
+  ge25519 ALIGN(16) A;
+  if (!ge25519_unpack_negative_vartime(&A, pk))
+    return -1;
+
+  memcpy(unpacked, &A, sizeof(A));
+  return 0;
+}
+
+int ED25519_FN(ed25519_sign_open_unpacked)(const unsigned char* m,
+                                           size_t mlen,
+                                           const ed25519_public_key pk,
+                                           const ed25519_unpacked_key* unpacked,
+                                           const ed25519_signature RS)
+{
+  ge25519 ALIGN(16) R, A;
+  hash_512bits hash;
+  bignum256modm hram, S;
+  unsigned char checkR[32];
+
+  if (RS[63] & 224)
+    return -1;
+  memcpy(&A, unpacked, sizeof(A));
+
+  /* hram = H(R,A,m) */
+  ed25519_hram(hash, RS, pk, m, mlen);
+  expand256_modm(hram, hash, 64);
+
+  /* S */
+  expand256_modm(S, RS + 32, 32);
+
+  /* SB - H(R,A,m)A */
+  ge25519_double_scalarmult_vartime(&R, &A, hram, S);
+  ge25519_pack(checkR, &R);
+
+  /* check that R = SB - H(R,A,m)A */
+  return ed25519_verify(RS, checkR, 32) ? 0 : -1;
+}
+
+static_assert(sizeof(ge25519_pniels) * S2_TABLE_SIZE <=
+                  sizeof(ed25519_precomputed_key),
+              "ed25519_precomputed_key cannot hold the multiples of a point");
+
+/*
+  Decompresses a public key and builds the odd multiples of its point for
+  the same 7-bit sliding window as the basepoint's, so that
+  ed25519_sign_open_precomputed skips both steps and needs fewer point
+  additions; -1 if not a valid point
+*/
+int ED25519_FN(ed25519_precompute_public_key)(const ed25519_public_key pk,
+                                              ed25519_precomputed_key* key)
+{
+  ge25519 ALIGN(16) A;
+  ge25519_pniels multiples[S2_TABLE_SIZE];
+  if (!ge25519_unpack_negative_vartime(&A, pk))
+    return -1;
+
+  ge25519_precompute_multiples(multiples, &A, S2_TABLE_SIZE);
+  memcpy(key, multiples, sizeof(multiples));
+  return 0;
+}
+
+int ED25519_FN(ed25519_sign_open_precomputed)(
+    const unsigned char* m,
+    size_t mlen,
+    const ed25519_public_key pk,
+    const ed25519_precomputed_key* key,
+    const ed25519_signature RS)
+{
+  ge25519 ALIGN(16) R;
+  ge25519_pniels multiples[S2_TABLE_SIZE];
+  hash_512bits hash;
+  bignum256modm hram, S;
+  unsigned char checkR[32];
+
+  if (RS[63] & 224)
+    return -1;
+  memcpy(multiples, key, sizeof(multiples));
+
+  /* hram = H(R,A,m) */
+  ed25519_hram(hash, RS, pk, m, mlen);
+  expand256_modm(hram, hash, 64);
+
+  /* S */
+  expand256_modm(S, RS + 32, 32);
+
+  /* SB - H(R,A,m)A */
+  ge25519_double_scalarmult_vartime_multiples(&R, multiples, S2_SWINDOWSIZE,
+                                              hram, S);
+  ge25519_pack(checkR, &R);
+
+  /* check that R = SB - H(R,A,m)A */
+  return ed25519_verify(RS, checkR, 32) ? 0 : -1;
+}
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wold-style-cast"
+#pragma clang diagnostic ignored "-Wcast-align"
+#pragma clang diagnostic ignored "-Wimplicit-fallthrough"
+#pragma clang diagnostic ignored "-Wmissing-prototypes"
+#pragma clang diagnostic ignored "-Wsign-conversion"
+#pragma clang diagnostic ignored "-Wmissing-variable-declarations"
+#elif __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Wsign-compare"
+#endif
+
+#include "ed25519-donna-batchverify.h"
+
+#ifdef __clang__
+#pragma clang diagnostic pop
+#elif __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+/*
+  Fast Curve25519 basepoint scalar multiplication
+*/
+
+void ED25519_FN(curved25519_scalarmult_basepoint)(curved25519_key pk,
+                                                  const curved25519_key e)
+{
+  curved25519_key ec;
+  bignum256modm s;
+  bignum25519 ALIGN(16) yplusz, zminusy;
+  ge25519 ALIGN(16) p;
+  size_t i;
+
+  /* clamp */
+  for (i = 0; i < 32; i++)
+    ec[i] = e[i];
+  ec[0] &= 248;
+  ec[31] &= 127;
+  ec[31] |= 64;
+
+  expand_raw256_modm(s, ec);
+
+  /* scalar * basepoint */
+  ge25519_scalarmult_base_niels(&p, ge25519_niels_base_multiples, s);
+
+  /* u = (y + z) / (z - y) */
+  curve25519_add(yplusz, p.y, p.z);
+  curve25519_sub(zminusy, p.z, p.y);
+  curve25519_recip(zminusy, zminusy);
+  curve25519_mul(yplusz, yplusz, zminusy);
+  curve25519_contract(pk, yplusz);
+}
+
+
+const Ed25519Kernels::Functions ED25519_FUNCTIONS = {
+    ED25519_FN(ed25519_publickey),
+    ED25519_FN(ed25519_sign),
+    ED25519_FN(ed25519_sign_open),
+    ED25519_FN(ed25519_unpack_public_key),
+    ED25519_FN(ed25519_sign_open_unpacked),
+    ED25519_FN(ed25519_precompute_public_key),
+    ED25519_FN(ed25519_sign_open_precomputed),
+    ED25519_FN(ed25519_sign_open_batch),
+    ED25519_FN(ed25519_randombytes_unsafe),
+    ED25519_FN(curved25519_scalarmult_basepoint)};
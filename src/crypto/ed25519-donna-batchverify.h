@@ -215,7 +215,7 @@ static void ge25519_multi_scalarmult_vartime(ge25519* r,
 }
 
 /* not actually used for anything other than testing */
-unsigned char batch_point_buffer[3][32];
+static unsigned char batch_point_buffer[3][32];
 
 static int ge25519_is_neutral_vartime(const ge25519* p)
 {
@@ -264,25 +264,35 @@ static int ge25519_unpack_negative_vartime(ge25519* r,
 #define S2_SWINDOWSIZE 7
 #define S2_TABLE_SIZE (1 << (S2_SWINDOWSIZE - 2))
 
-/* computes [s1]p1 + [s2]basepoint */
-static void ge25519_double_scalarmult_vartime(ge25519* r,
-                                              const ge25519* p1,
-                                              const bignum256modm s1,
-                                              const bignum256modm s2)
+/* the odd multiples p1, 3p1, 5p1.. of a point, as a sliding window uses */
+static void ge25519_precompute_multiples(ge25519_pniels* pre1,
+                                         const ge25519* p1,
+                                         int32_t count)
 {
-  signed char slide1[256], slide2[256];
-  ge25519_pniels pre1[S1_TABLE_SIZE];
   ge25519 d1;
-  ge25519_p1p1 t;
   int32_t i;
 
-  contract256_slidingwindow_modm(slide1, s1, S1_SWINDOWSIZE);
-  contract256_slidingwindow_modm(slide2, s2, S2_SWINDOWSIZE);
-
   ge25519_double(&d1, p1);
   ge25519_full_to_pniels(pre1, p1);
-  for (i = 0; i < S1_TABLE_SIZE - 1; i++)
+  for (i = 0; i < count - 1; i++)
     ge25519_pnielsadd(&pre1[i + 1], &d1, &pre1[i]);
+}
+
+/* computes [s1]p1 + [s2]basepoint, with the multiples of p1 for a window of
+ * window1 bits */
+static void ge25519_double_scalarmult_vartime_multiples(
+    ge25519* r,
+    const ge25519_pniels* pre1,
+    int window1,
+    const bignum256modm s1,
+    const bignum256modm s2)
+{
+  signed char slide1[256], slide2[256];
+  ge25519_p1p1 t;
+  int32_t i;
+
+  contract256_slidingwindow_modm(slide1, s1, window1);
+  contract256_slidingwindow_modm(slide2, s2, S2_SWINDOWSIZE);
 
   /* set neutral */
   memset(r, 0, sizeof(ge25519));
@@ -316,6 +326,17 @@ static void ge25519_double_scalarmult_vartime(ge25519* r,
   }
 }
 
+/* computes [s1]p1 + [s2]basepoint */
+static void ge25519_double_scalarmult_vartime(ge25519* r,
+                                              const ge25519* p1,
+                                              const bignum256modm s1,
+                                              const bignum256modm s2)
+{
+  ge25519_pniels pre1[S1_TABLE_SIZE];
+  ge25519_precompute_multiples(pre1, p1, S1_TABLE_SIZE);
+  ge25519_double_scalarmult_vartime_multiples(r, pre1, S1_SWINDOWSIZE, s1, s2);
+}
+
 
 
 #if !defined(HAVE_GE25519_SCALARMULT_BASE_CHOOSE_NIELS)
@@ -3,6 +3,6 @@
 
 void ED25519_FN(ed25519_randombytes_unsafe)(void* p, size_t len)
 {
-  static Botan::AutoSeeded_RNG rng;
+  static thread_local Botan::AutoSeeded_RNG rng;  // not thread-safe
   rng.randomize((unsigned char*)p, len);
 }
@@ -1,205 +1,187 @@
-/*
-  Public domain by Andrew M. <liquidsun@gmail.com>
 
-  Ed25519 reference implementation using Ed25519-donna
-*/
+#include "ed25519.h"
+#include "Ed25519Kernels.hpp"
+#include <atomic>
 
+static std::atomic<uint8_t> kernel_(0xFF);  // 0xFF until detected
 
-/* define ED25519_SUFFIX to have it appended to the end of each public function
- */
-#if !defined(ED25519_SUFFIX)
-#define ED25519_SUFFIX
-#endif
+void ed25519_publickey(const ed25519_secret_key sk, ed25519_public_key pk)
+{
+  Ed25519Kernels::getFunctions().publickey(sk, pk);
+}
 
-#define ED25519_FN3(fn, suffix) fn##suffix
-#define ED25519_FN2(fn, suffix) ED25519_FN3(fn, suffix)
-#define ED25519_FN(fn) ED25519_FN2(fn, ED25519_SUFFIX)
-
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wold-style-cast"
-#pragma clang diagnostic ignored "-Wcast-align"
-#pragma clang diagnostic ignored "-Wimplicit-fallthrough"
-#pragma clang diagnostic ignored "-Wmissing-prototypes"
-#pragma clang diagnostic ignored "-Wsign-conversion"
-#pragma clang diagnostic ignored "-Wmissing-variable-declarations"
-#elif __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wpedantic"
-#pragma GCC diagnostic ignored "-Wsign-compare"
-#endif
 
-#include "ed25519-donna.h"
-#include "ed25519.h"
-#include "ed25519-randombytes.h"
-#include "ed25519-hash.h"
 
-#ifdef __clang__
-#pragma clang diagnostic pop
-#elif __GNUC__
-#pragma GCC diagnostic push
-#endif
+int ed25519_sign_open(const unsigned char* m,
+                      size_t mlen,
+                      const ed25519_public_key pk,
+                      const ed25519_signature RS)
+{
+  return Ed25519Kernels::getFunctions().signOpen(m, mlen, pk, RS);
+}
+
 
-/*
-  Generates a (extsk[0..31]) and aExt (extsk[32..63])
-*/
 
-DONNA_INLINE static void ed25519_extsk(hash_512bits extsk,
-                                       const ed25519_secret_key sk)
+void ed25519_sign(const unsigned char* m,
+                  size_t mlen,
+                  const ed25519_secret_key sk,
+                  const ed25519_public_key pk,
+                  ed25519_signature RS)
 {
-  ed25519_hash(extsk, sk, 32);
-  extsk[0] &= 248;
-  extsk[31] &= 127;
-  extsk[31] |= 64;
+  Ed25519Kernels::getFunctions().sign(m, mlen, sk, pk, RS);
 }
 
-static void ed25519_hram(hash_512bits hram,
-                         const ed25519_signature RS,
-                         const ed25519_public_key pk,
-                         const unsigned char* m,
-                         size_t mlen)
+
+
+int ed25519_unpack_public_key(const ed25519_public_key pk,
+                              ed25519_unpacked_key* unpacked)
 {
-  ed25519_hash_context ctx;
-  ed25519_hash_init(&ctx);
-  ed25519_hash_update(&ctx, RS, 32);
-  ed25519_hash_update(&ctx, pk, 32);
-  ed25519_hash_update(&ctx, m, mlen);
-  ed25519_hash_final(&ctx, hram);
+  return Ed25519Kernels::getFunctions().unpackPublicKey(pk, unpacked);
 }
 
-void ED25519_FN(ed25519_publickey)(const ed25519_secret_key sk,
-                                   ed25519_public_key pk)
+
+
+int ed25519_sign_open_unpacked(const unsigned char* m,
+                               size_t mlen,
+                               const ed25519_public_key pk,
+                               const ed25519_unpacked_key* unpacked,
+                               const ed25519_signature RS)
 {
-  bignum256modm a;
-  ge25519 ALIGN(16) A;
-  hash_512bits extsk;
+  return Ed25519Kernels::getFunctions().signOpenUnpacked(m, mlen, pk, unpacked,
+                                                         RS);
+}
+
 
-  /* A = aB */
-  ed25519_extsk(extsk, sk);
-  expand256_modm(a, extsk, 32);
-  ge25519_scalarmult_base_niels(&A, ge25519_niels_base_multiples, a);
-  ge25519_pack(pk, &A);
+
+int ed25519_precompute_public_key(const ed25519_public_key pk,
+                                  ed25519_precomputed_key* key)
+{
+  return Ed25519Kernels::getFunctions().precomputePublicKey(pk, key);
 }
 
 
-void ED25519_FN(ed25519_sign)(const unsigned char* m,
-                              size_t mlen,
-                              const ed25519_secret_key sk,
-                              const ed25519_public_key pk,
-                              ed25519_signature RS)
+
+int ed25519_sign_open_precomputed(const unsigned char* m,
+                                  size_t mlen,
+                                  const ed25519_public_key pk,
+                                  const ed25519_precomputed_key* key,
+                                  const ed25519_signature RS)
 {
-  ed25519_hash_context ctx;
-  bignum256modm r, S, a;
-  ge25519 ALIGN(16) R;
-  hash_512bits extsk, hashr, hram;
+  return Ed25519Kernels::getFunctions().signOpenPrecomputed(m, mlen, pk, key,
+                                                            RS);
+}
+
 
-  ed25519_extsk(extsk, sk);
 
-  /* r = H(aExt[32..64], m) */
-  ed25519_hash_init(&ctx);
-  ed25519_hash_update(&ctx, extsk + 32, 32);
-  ed25519_hash_update(&ctx, m, mlen);
-  ed25519_hash_final(&ctx, hashr);
-  expand256_modm(r, hashr, 64);
+int ed25519_sign_open_batch(const unsigned char** m,
+                            size_t* mlen,
+                            const unsigned char** pk,
+                            const unsigned char** RS,
+                            size_t num,
+                            int* valid)
+{
+  return Ed25519Kernels::getFunctions().signOpenBatch(m, mlen, pk, RS, num,
+                                                      valid);
+}
 
-  /* R = rB */
-  ge25519_scalarmult_base_niels(&R, ge25519_niels_base_multiples, r);
-  ge25519_pack(RS, &R);
 
-  /* S = H(R,A,m).. */
-  ed25519_hram(hram, RS, pk, m, mlen);
-  expand256_modm(S, hram, 64);
 
-  /* S = H(R,A,m)a */
-  expand256_modm(a, extsk, 32);
-  mul256_modm(S, S, a);
+void ed25519_randombytes_unsafe(void* out, size_t count)
+{
+  Ed25519Kernels::getFunctions().randombytesUnsafe(out, count);
+}
+
 
-  /* S = (r + H(R,A,m)a) */
-  add256_modm(S, S, r);
 
-  /* S = (r + H(R,A,m)a) mod L */
-  contract256_modm(RS + 32, S);
+void curved25519_scalarmult_basepoint(curved25519_key pk,
+                                      const curved25519_key e)
+{
+  Ed25519Kernels::getFunctions().scalarmultBasepoint(pk, e);
 }
 
-int ED25519_FN(ed25519_sign_open)(const unsigned char* m,
-                                  size_t mlen,
-                                  const ed25519_public_key pk,
-                                  const ed25519_signature RS)
+
+
+Ed25519Kernels::Kernel Ed25519Kernels::getKernel()
+{
+  uint8_t kernel = kernel_.load(std::memory_order_relaxed);
+  if (kernel == 0xFF)
+  {
+    kernel = static_cast<uint8_t>(detectKernel());
+    kernel_.store(kernel, std::memory_order_relaxed);
+  }
+
+  return static_cast<Kernel>(kernel);
+}
+
+
+
+// forces a kernel, returns false if this CPU cannot run it
+bool Ed25519Kernels::setKernel(Kernel kernel)
 {
-  ge25519 ALIGN(16) R, A;
-  hash_512bits hash;
-  bignum256modm hram, S;
-  unsigned char checkR[32];
-
-  if ((RS[63] & 224) || !ge25519_unpack_negative_vartime(&A, pk))
-    return -1;
-
-  /* hram = H(R,A,m) */
-  ed25519_hram(hash, RS, pk, m, mlen);
-  expand256_modm(hram, hash, 64);
-
-  /* S */
-  expand256_modm(S, RS + 32, 32);
-
-  /* SB - H(R,A,m)A */
-  ge25519_double_scalarmult_vartime(&R, &A, hram, S);
-  ge25519_pack(checkR, &R);
-
-  /* check that R = SB - H(R,A,m)A */
-  return ed25519_verify(RS, checkR, 32) ? 0 : -1;
-}
-
-#ifdef __clang__
-#pragma clang diagnostic push
-#pragma clang diagnostic ignored "-Wold-style-cast"
-#pragma clang diagnostic ignored "-Wcast-align"
-#pragma clang diagnostic ignored "-Wimplicit-fallthrough"
-#pragma clang diagnostic ignored "-Wmissing-prototypes"
-#pragma clang diagnostic ignored "-Wsign-conversion"
-#pragma clang diagnostic ignored "-Wmissing-variable-declarations"
-#elif __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wpedantic"
-#pragma GCC diagnostic ignored "-Wsign-compare"
+  if (!isSupported(kernel))
+    return false;
+
+  kernel_.store(static_cast<uint8_t>(kernel), std::memory_order_relaxed);
+  return true;
+}
+
+
+
+bool Ed25519Kernels::isSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Portable:
+      return true;
+
+#ifdef ED25519_HAVE_BMI2
+    case Kernel::BMI2:
+      return __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("adx");
 #endif
 
-#include "ed25519-donna-batchverify.h"
+    default:
+      return false;
+  }
+}
+
 
-#ifdef __clang__
-#pragma clang diagnostic pop
-#elif __GNUC__
-#pragma GCC diagnostic pop
+
+const char* Ed25519Kernels::getName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Portable:
+      return "portable";
+    case Kernel::BMI2:
+      return "BMI2";
+  }
+
+  return "unknown";
+}
+
+
+
+const Ed25519Kernels::Functions& Ed25519Kernels::getFunctions()
+{
+  switch (getKernel())
+  {
+#ifdef ED25519_HAVE_BMI2
+    case Kernel::BMI2:
+      return BMI2;
 #endif
 
-/*
-  Fast Curve25519 basepoint scalar multiplication
-*/
-
-void ED25519_FN(curved25519_scalarmult_basepoint)(curved25519_key pk,
-                                                  const curved25519_key e)
-{
-  curved25519_key ec;
-  bignum256modm s;
-  bignum25519 ALIGN(16) yplusz, zminusy;
-  ge25519 ALIGN(16) p;
-  size_t i;
-
-  /* clamp */
-  for (i = 0; i < 32; i++)
-    ec[i] = e[i];
-  ec[0] &= 248;
-  ec[31] &= 127;
-  ec[31] |= 64;
-
-  expand_raw256_modm(s, ec);
-
-  /* scalar * basepoint */
-  ge25519_scalarmult_base_niels(&p, ge25519_niels_base_multiples, s);
-
-  /* u = (y + z) / (z - y) */
-  curve25519_add(yplusz, p.y, p.z);
-  curve25519_sub(zminusy, p.z, p.y);
-  curve25519_recip(zminusy, zminusy);
-  curve25519_mul(yplusz, yplusz, zminusy);
-  curve25519_contract(pk, yplusz);
+    default:
+      return PORTABLE;
+  }
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Ed25519Kernels::Kernel Ed25519Kernels::detectKernel()
+{
+  return isSupported(Kernel::BMI2) ? Kernel::BMI2 : Kernel::Portable;
 }
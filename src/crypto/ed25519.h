@@ -13,6 +13,20 @@ typedef unsigned char ed25519_secret_key[32];
 
 typedef unsigned char curved25519_key[32];
 
+/* a decompressed public key, as ed25519_unpack_public_key leaves it */
+typedef struct
+{
+  unsigned long long opaque[20];
+} ed25519_unpacked_key;
+
+/* a decompressed public key with a table of multiples of its point, as
+   ed25519_precompute_public_key leaves it, for keys that check many
+   signatures */
+typedef struct
+{
+  unsigned long long opaque[640];
+} ed25519_precomputed_key;
+
 void ed25519_publickey(const ed25519_secret_key sk, ed25519_public_key pk);
 int ed25519_sign_open(const unsigned char* m,
                       size_t mlen,
@@ -24,6 +38,22 @@ void ed25519_sign(const unsigned char* m,
                   const ed25519_public_key pk,
                   ed25519_signature RS);
 
+int ed25519_unpack_public_key(const ed25519_public_key pk,
+                              ed25519_unpacked_key* unpacked);
+int ed25519_sign_open_unpacked(const unsigned char* m,
+                               size_t mlen,
+                               const ed25519_public_key pk,
+                               const ed25519_unpacked_key* unpacked,
+                               const ed25519_signature RS);
+
+int ed25519_precompute_public_key(const ed25519_public_key pk,
+                                  ed25519_precomputed_key* key);
+int ed25519_sign_open_precomputed(const unsigned char* m,
+                                  size_t mlen,
+                                  const ed25519_public_key pk,
+                                  const ed25519_precomputed_key* key,
+                                  const ed25519_signature RS);
+
 int ed25519_sign_open_batch(const unsigned char** m,
                             size_t* mlen,
                             const unsigned char** pk,
@@ -0,0 +1,369 @@
+#include "Codec.hpp"
+#include "CodecKernels.hpp"
+#include <algorithm>
+#include <atomic>
+
+const size_t Codec::INVALID;
+static std::atomic<uint8_t> kernel_(0xFF);  // 0xFF until detected
+
+static const char BASE64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char BASE32[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+static const char BASE32_LOWER[] = "abcdefghijklmnopqrstuvwxyz234567";
+static const char HEX[] = "0123456789abcdef";
+
+// character values for decoding, 0xFF for those outside the alphabet
+struct DecodeTable
+{
+  uint8_t base64[256], hex[256];
+
+  DecodeTable()
+  {
+    for (int c = 0; c < 256; c++)
+      base64[c] = hex[c] = 0xFF;
+    for (uint8_t v = 0; v < 64; v++)
+      base64[static_cast<uint8_t>(BASE64[v])] = v;
+    for (uint8_t v = 0; v < 16; v++)
+      hex[static_cast<uint8_t>(HEX[v])] = v;
+    for (uint8_t v = 10; v < 16; v++)
+      hex['A' + v - 10] = v;
+  }
+};
+
+static const DecodeTable TABLE;
+
+
+
+// writes base64Length(length) characters, returns that count
+size_t Codec::base64Encode(const uint8_t* in, size_t length, char* out)
+{
+  size_t i = getBase64Encode(getKernel())(in, length, out);
+  char* o = out + i / 3 * 4;
+
+  for (; i + 3 <= length; i += 3, o += 4)
+  {
+    uint32_t triple = uint32_t(in[i]) << 16 | uint32_t(in[i + 1]) << 8 |
+                      in[i + 2];
+    o[0] = BASE64[triple >> 18];
+    o[1] = BASE64[(triple >> 12) & 0x3F];
+    o[2] = BASE64[(triple >> 6) & 0x3F];
+    o[3] = BASE64[triple & 0x3F];
+  }
+
+  if (i < length)
+  {
+    bool two = i + 1 < length;
+    uint32_t triple = uint32_t(in[i]) << 16 | (two ? uint32_t(in[i + 1]) << 8 : 0);
+    o[0] = BASE64[triple >> 18];
+    o[1] = BASE64[(triple >> 12) & 0x3F];
+    o[2] = two ? BASE64[(triple >> 6) & 0x3F] : '=';
+    o[3] = '=';
+    o += 4;
+  }
+
+  return o - out;
+}
+
+
+
+std::string Codec::base64Encode(const uint8_t* in, size_t length)
+{
+  std::string encoded(base64Length(length), '\0');
+  base64Encode(in, length, &encoded[0]);
+  return encoded;
+}
+
+
+
+// Decodes into at most capacity bytes and returns how many were written, or
+// INVALID if a character is outside the alphabet, padding is misplaced, or
+// the result would not fit. Trailing padding may be left out.
+size_t Codec::base64Decode(const char* in,
+                           size_t length,
+                           uint8_t* out,
+                           size_t capacity)
+{
+  size_t padding = 0;
+  if (length >= 4 && length % 4 == 0)
+    padding = (in[length - 1] == '=') + (in[length - 2] == '=');
+
+  const size_t tail = padding > 0 ? 4 : length % 4;  // chars in last group
+  if (tail == 1 || (padding == 1 && in[length - 2] == '='))
+    return INVALID;
+
+  const size_t whole = length - tail;
+  const size_t tailBytes = tail == 0 ? 0 : tail - padding - 1;
+  const size_t bytes = whole / 4 * 3 + tailBytes;
+  if (bytes > capacity)
+    return INVALID;
+
+  size_t i = getBase64Decode(getKernel())(in, whole, out, capacity);
+  uint8_t* o = out + i / 4 * 3;
+
+  const uint8_t* values = TABLE.base64;
+  for (; i < whole; i += 4, o += 3)
+  {
+    uint8_t a = values[static_cast<uint8_t>(in[i])];
+    uint8_t b = values[static_cast<uint8_t>(in[i + 1])];
+    uint8_t c = values[static_cast<uint8_t>(in[i + 2])];
+    uint8_t d = values[static_cast<uint8_t>(in[i + 3])];
+    if ((a | b | c | d) & 0x80)
+      return INVALID;
+
+    uint32_t triple = uint32_t(a) << 18 | uint32_t(b) << 12 | c << 6 | d;
+    o[0] = static_cast<uint8_t>(triple >> 16);
+    o[1] = static_cast<uint8_t>(triple >> 8);
+    o[2] = static_cast<uint8_t>(triple);
+  }
+
+  if (tailBytes > 0)
+  {
+    uint32_t triple = 0;
+    for (size_t j = 0; j <= tailBytes; j++)
+    {
+      uint8_t value = values[static_cast<uint8_t>(in[whole + j])];
+      if (value & 0x80)
+        return INVALID;
+      triple |= uint32_t(value) << (18 - 6 * j);
+    }
+
+    o[0] = static_cast<uint8_t>(triple >> 16);
+    if (tailBytes == 2)
+      o[1] = static_cast<uint8_t>(triple >> 8);
+  }
+
+  return bytes;
+}
+
+
+
+size_t Codec::base64Decode(const std::string& in,
+                           uint8_t* out,
+                           size_t capacity)
+{
+  return base64Decode(in.data(), in.size(), out, capacity);
+}
+
+
+
+// RFC 4648 base32 with padding, writes base32Length(length) characters
+size_t Codec::base32Encode(const uint8_t* in,
+                           size_t length,
+                           char* out,
+                           bool lower)
+{
+  const char* alphabet = lower ? BASE32_LOWER : BASE32;
+  char* o = out;
+
+  for (size_t i = 0; i < length; i += 5)
+  {
+    const size_t n = std::min<size_t>(5, length - i);
+    uint64_t group = 0;
+    for (size_t j = 0; j < 5; j++)
+      group = group << 8 | (j < n ? in[i + j] : 0);
+
+    const size_t chars = (n * 8 + 4) / 5;
+    for (size_t j = 0; j < 8; j++)
+      *o++ = j < chars ? alphabet[(group >> (35 - 5 * j)) & 0x1F] : '=';
+  }
+
+  return o - out;
+}
+
+
+
+// lowercase, writes 2 * length characters
+size_t Codec::hexEncode(const uint8_t* in, size_t length, char* out)
+{
+  size_t i = getHexEncode(getKernel())(in, length, out);
+  for (; i < length; i++)
+  {
+    out[2 * i] = HEX[in[i] >> 4];
+    out[2 * i + 1] = HEX[in[i] & 0x0F];
+  }
+
+  return 2 * length;
+}
+
+
+
+std::string Codec::hexEncode(const uint8_t* in, size_t length)
+{
+  std::string encoded(2 * length, '\0');
+  hexEncode(in, length, &encoded[0]);
+  return encoded;
+}
+
+
+
+// either case; returns the bytes written, or INVALID as base64Decode does
+size_t Codec::hexDecode(const char* in,
+                        size_t length,
+                        uint8_t* out,
+                        size_t capacity)
+{
+  if (length % 2 != 0 || length / 2 > capacity)
+    return INVALID;
+
+  const uint8_t* values = TABLE.hex;
+  for (size_t i = 0; i < length; i += 2)
+  {
+    uint8_t high = values[static_cast<uint8_t>(in[i])];
+    uint8_t low = values[static_cast<uint8_t>(in[i + 1])];
+    if ((high | low) & 0x80)
+      return INVALID;
+    out[i / 2] = static_cast<uint8_t>(high << 4 | low);
+  }
+
+  return length / 2;
+}
+
+
+
+Codec::Kernel Codec::getKernel()
+{
+  uint8_t kernel = kernel_.load(std::memory_order_relaxed);
+  if (kernel == 0xFF)
+  {
+    kernel = static_cast<uint8_t>(detectKernel());
+    kernel_.store(kernel, std::memory_order_relaxed);
+  }
+
+  return static_cast<Kernel>(kernel);
+}
+
+
+
+// forces a kernel, returns false if this CPU cannot run it
+bool Codec::setKernel(Kernel kernel)
+{
+  if (!isSupported(kernel))
+    return false;
+
+  kernel_.store(static_cast<uint8_t>(kernel), std::memory_order_relaxed);
+  return true;
+}
+
+
+
+bool Codec::isSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef CODEC_HAVE_X86
+    case Kernel::SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    case Kernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+
+    default:
+      return false;
+  }
+}
+
+
+
+const char* Codec::getName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::SSSE3:
+      return "SSSE3";
+    case Kernel::AVX2:
+      return "AVX2";
+  }
+
+  return "unknown";
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Codec::Kernel Codec::detectKernel()
+{
+  static const Kernel PREFERENCE[] = {Kernel::AVX2, Kernel::SSSE3};
+
+  for (auto kernel : PREFERENCE)
+    if (isSupported(kernel))
+      return kernel;
+
+  return Kernel::Scalar;
+}
+
+
+
+// the scalar code does all of the work when there is no kernel
+static size_t encodeNothing(const uint8_t*, size_t, char*)
+{
+  return 0;
+}
+
+
+
+static size_t decodeNothing(const char*, size_t, uint8_t*, size_t)
+{
+  return 0;
+}
+
+
+
+CodecKernels::Base64Encode Codec::getBase64Encode(Kernel kernel)
+{
+  switch (kernel)
+  {
+#ifdef CODEC_HAVE_X86
+    case Kernel::SSSE3:
+      return CodecKernels::base64EncodeSSSE3;
+    case Kernel::AVX2:
+      return CodecKernels::base64EncodeAVX2;
+#endif
+
+    default:
+      return encodeNothing;
+  }
+}
+
+
+
+CodecKernels::Base64Decode Codec::getBase64Decode(Kernel kernel)
+{
+  switch (kernel)
+  {
+#ifdef CODEC_HAVE_X86
+    case Kernel::SSSE3:
+      return CodecKernels::base64DecodeSSSE3;
+    case Kernel::AVX2:
+      return CodecKernels::base64DecodeAVX2;
+#endif
+
+    default:
+      return decodeNothing;
+  }
+}
+
+
+
+CodecKernels::HexEncode Codec::getHexEncode(Kernel kernel)
+{
+  switch (kernel)
+  {
+#ifdef CODEC_HAVE_X86
+    case Kernel::SSSE3:
+      return CodecKernels::hexEncodeSSSE3;
+    case Kernel::AVX2:
+      return CodecKernels::hexEncodeAVX2;
+#endif
+
+    default:
+      return encodeNothing;
+  }
+}
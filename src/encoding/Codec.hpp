@@ -0,0 +1,51 @@
+#ifndef CODEC_HPP
+#define CODEC_HPP
+
+#include "CodecKernels.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// Base64 (RFC 4648, padded, without line breaks), base32, and hex, encoded
+// and decoded into the caller's buffers. The bulk of base64 and hex runs in
+// the fastest SIMD kernel that the CPU supports, picked on first use, and
+// the scalar code finishes the tail. Decoding checks every character and
+// the output size before anything is written past the caller's capacity.
+class Codec
+{
+ public:
+  enum class Kernel : uint8_t
+  {
+    Scalar,
+    SSSE3,
+    AVX2
+  };
+
+  static const size_t INVALID = SIZE_MAX;
+
+  static size_t base64Length(size_t bytes) { return (bytes + 2) / 3 * 4; }
+  static size_t base64Encode(const uint8_t*, size_t, char*);
+  static std::string base64Encode(const uint8_t*, size_t);
+  static size_t base64Decode(const char*, size_t, uint8_t*, size_t);
+  static size_t base64Decode(const std::string&, uint8_t*, size_t);
+
+  static size_t base32Length(size_t bytes) { return (bytes + 4) / 5 * 8; }
+  static size_t base32Encode(const uint8_t*, size_t, char*, bool lower = false);
+
+  static size_t hexEncode(const uint8_t*, size_t, char*);
+  static std::string hexEncode(const uint8_t*, size_t);
+  static size_t hexDecode(const char*, size_t, uint8_t*, size_t);
+
+  static Kernel getKernel();
+  static bool setKernel(Kernel);
+  static bool isSupported(Kernel);
+  static const char* getName(Kernel);
+
+ private:
+  static Kernel detectKernel();
+  static CodecKernels::Base64Encode getBase64Encode(Kernel);
+  static CodecKernels::Base64Decode getBase64Decode(Kernel);
+  static CodecKernels::HexEncode getHexEncode(Kernel);
+};
+
+#endif
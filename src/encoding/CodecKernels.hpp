@@ -0,0 +1,33 @@
+#ifndef CODEC_KERNELS_HPP
+#define CODEC_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CODEC_HAVE_X86
+#endif
+
+// SIMD bulk loops for Codec. Each converts as many whole blocks as it can
+// and returns how much of the input it consumed, leaving the rest to the
+// scalar code. The base64 decoders stop in front of the first block with a
+// character outside the alphabet, so that the scalar code reports it, and
+// never write beyond the given output capacity.
+class CodecKernels
+{
+ public:
+  typedef size_t (*Base64Encode)(const uint8_t*, size_t, char*);
+  typedef size_t (*Base64Decode)(const char*, size_t, uint8_t*, size_t);
+  typedef size_t (*HexEncode)(const uint8_t*, size_t, char*);
+
+#ifdef CODEC_HAVE_X86
+  static size_t base64EncodeSSSE3(const uint8_t*, size_t, char*);
+  static size_t base64EncodeAVX2(const uint8_t*, size_t, char*);
+  static size_t base64DecodeSSSE3(const char*, size_t, uint8_t*, size_t);
+  static size_t base64DecodeAVX2(const char*, size_t, uint8_t*, size_t);
+  static size_t hexEncodeSSSE3(const uint8_t*, size_t, char*);
+  static size_t hexEncodeAVX2(const uint8_t*, size_t, char*);
+#endif
+};
+
+#endif
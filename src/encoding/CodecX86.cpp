@@ -0,0 +1,349 @@
+// SSSE3 and AVX2 base64 after the pshufb methods of Wojciech Mula and Daniel
+// Lemire (https://arxiv.org/abs/1704.00605), and nibble lookups for hex.
+// Each 128-bit lane takes 12 bytes to 16 characters or back again; AVX2
+// handles two such lanes at once and leaves the remainder to SSSE3.
+
+#include "CodecKernels.hpp"
+
+#ifdef CODEC_HAVE_X86
+
+#include <immintrin.h>
+
+#define SSSE3_INLINE __attribute__((target("ssse3"), always_inline)) inline
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#define SSSE3_FUNCTION __attribute__((target("ssse3")))
+
+// the six-bit values of the 12 bytes in src, one per byte, in order
+static SSSE3_INLINE __m128i unpack6(__m128i src)
+{
+  src = _mm_shuffle_epi8(
+      src, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m128i ac = _mm_mulhi_epu16(_mm_and_si128(src, _mm_set1_epi32(0x0FC0FC00)),
+                               _mm_set1_epi32(0x04000040));
+  __m128i bd = _mm_mullo_epi16(_mm_and_si128(src, _mm_set1_epi32(0x003F03F0)),
+                               _mm_set1_epi32(0x01000010));
+  return _mm_or_si128(ac, bd);
+}
+
+
+
+// the base64 characters for six-bit values, by the offset of their range
+static SSSE3_INLINE __m128i toBase64(__m128i values)
+{
+  const __m128i OFFSETS =
+      _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+  __m128i range = _mm_subs_epu8(values, _mm_set1_epi8(51));
+  __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), values);
+  range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+  return _mm_add_epi8(values, _mm_shuffle_epi8(OFFSETS, range));
+}
+
+
+
+// six-bit values for 16 characters, false if any is outside the alphabet
+static SSSE3_INLINE bool fromBase64(__m128i chars, __m128i& values)
+{
+  const __m128i LOW = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                    0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B,
+                                    0x1B, 0x1A);
+  const __m128i HIGH = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04,
+                                     0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                     0x10, 0x10);
+  const __m128i ROLL =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i NIBBLE = _mm_set1_epi8(0x0F);
+
+  __m128i high = _mm_and_si128(_mm_srli_epi32(chars, 4), NIBBLE);
+  __m128i low = _mm_and_si128(chars, NIBBLE);
+  __m128i classes = _mm_and_si128(_mm_shuffle_epi8(LOW, low),
+                                  _mm_shuffle_epi8(HIGH, high));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(classes, _mm_setzero_si128())) !=
+      0xFFFF)
+    return false;
+
+  __m128i slash = _mm_cmpeq_epi8(chars, _mm_set1_epi8('/'));
+  __m128i roll = _mm_shuffle_epi8(ROLL, _mm_add_epi8(slash, high));
+  values = _mm_add_epi8(chars, roll);
+  return true;
+}
+
+
+
+// packs 16 six-bit values into the low 12 bytes
+static SSSE3_INLINE __m128i pack6(__m128i values)
+{
+  __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+  __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+  return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                               14, 13, 12, -1, -1, -1, -1));
+}
+
+
+
+// the characters for the high and the low nibbles of each byte
+static SSSE3_INLINE void toHex(__m128i src, __m128i& high, __m128i& low)
+{
+  const __m128i DIGITS = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                       '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+  const __m128i NIBBLE = _mm_set1_epi8(0x0F);
+
+  high = _mm_shuffle_epi8(DIGITS,
+                          _mm_and_si128(_mm_srli_epi16(src, 4), NIBBLE));
+  low = _mm_shuffle_epi8(DIGITS, _mm_and_si128(src, NIBBLE));
+}
+
+
+
+// each step reads 16 bytes but only encodes 12 of them
+static SSSE3_INLINE size_t encodeSSSE3(const uint8_t* in,
+                                       size_t length,
+                                       char* out,
+                                       size_t i)
+{
+  for (; i + 16 <= length; i += 12, out += 16)
+  {
+    __m128i src = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     toBase64(unpack6(src)));
+  }
+
+  return i;
+}
+
+
+
+// each step writes 16 bytes but only 12 of them are decoded
+static SSSE3_INLINE size_t decodeSSSE3(const char* in,
+                                       size_t length,
+                                       uint8_t* out,
+                                       size_t capacity,
+                                       size_t i)
+{
+  for (; i + 16 <= length && i / 4 * 3 + 16 <= capacity; i += 16)
+  {
+    __m128i values;
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    if (!fromBase64(chars, values))
+      break;
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 4 * 3),
+                     pack6(values));
+  }
+
+  return i;
+}
+
+
+
+static SSSE3_INLINE size_t hexSSSE3(const uint8_t* in,
+                                    size_t length,
+                                    char* out,
+                                    size_t i)
+{
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i high, low;
+    toHex(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), high, low);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i),
+                     _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i + 16),
+                     _mm_unpackhi_epi8(high, low));
+  }
+
+  return i;
+}
+
+
+
+SSSE3_FUNCTION size_t CodecKernels::base64EncodeSSSE3(const uint8_t* in,
+                                                      size_t length,
+                                                      char* out)
+{
+  return encodeSSSE3(in, length, out, 0);
+}
+
+
+
+SSSE3_FUNCTION size_t CodecKernels::base64DecodeSSSE3(const char* in,
+                                                      size_t length,
+                                                      uint8_t* out,
+                                                      size_t capacity)
+{
+  return decodeSSSE3(in, length, out, capacity, 0);
+}
+
+
+
+SSSE3_FUNCTION size_t CodecKernels::hexEncodeSSSE3(const uint8_t* in,
+                                                   size_t length,
+                                                   char* out)
+{
+  return hexSSSE3(in, length, out, 0);
+}
+
+
+
+// The AVX2 versions repeat the SSSE3 steps on both lanes, which is what
+// the 256-bit shuffles do, with the lanes' bytes loaded or stored 12 apart.
+
+#define AVX2_INLINE __attribute__((target("avx2"), always_inline)) inline
+
+static AVX2_INLINE __m256i unpack6(__m256i src)
+{
+  src = _mm256_shuffle_epi8(
+      src, _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+                            1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+  __m256i ac = _mm256_mulhi_epu16(
+      _mm256_and_si256(src, _mm256_set1_epi32(0x0FC0FC00)),
+      _mm256_set1_epi32(0x04000040));
+  __m256i bd = _mm256_mullo_epi16(
+      _mm256_and_si256(src, _mm256_set1_epi32(0x003F03F0)),
+      _mm256_set1_epi32(0x01000010));
+  return _mm256_or_si256(ac, bd);
+}
+
+
+
+static AVX2_INLINE __m256i toBase64(__m256i values)
+{
+  const __m256i OFFSETS = _mm256_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+  __m256i range = _mm256_subs_epu8(values, _mm256_set1_epi8(51));
+  __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), values);
+  range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+  return _mm256_add_epi8(values, _mm256_shuffle_epi8(OFFSETS, range));
+}
+
+
+
+static AVX2_INLINE bool fromBase64(__m256i chars, __m256i& values)
+{
+  const __m256i LOW = _mm256_setr_epi8(
+      0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A,
+      0x1B, 0x1B, 0x1B, 0x1A, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m256i HIGH = _mm256_setr_epi8(
+      0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m256i ROLL = _mm256_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4,
+      -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i NIBBLE = _mm256_set1_epi8(0x0F);
+
+  __m256i high = _mm256_and_si256(_mm256_srli_epi32(chars, 4), NIBBLE);
+  __m256i low = _mm256_and_si256(chars, NIBBLE);
+  __m256i classes = _mm256_and_si256(_mm256_shuffle_epi8(LOW, low),
+                                     _mm256_shuffle_epi8(HIGH, high));
+  if (_mm256_movemask_epi8(
+          _mm256_cmpeq_epi8(classes, _mm256_setzero_si256())) != -1)
+    return false;
+
+  __m256i slash = _mm256_cmpeq_epi8(chars, _mm256_set1_epi8('/'));
+  __m256i roll = _mm256_shuffle_epi8(ROLL, _mm256_add_epi8(slash, high));
+  values = _mm256_add_epi8(chars, roll);
+  return true;
+}
+
+
+
+static AVX2_INLINE __m256i pack6(__m256i values)
+{
+  __m256i pairs =
+      _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+  __m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+  return _mm256_shuffle_epi8(
+      words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                              -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                              -1, -1, -1, -1));
+}
+
+
+
+// reads 28 bytes per step; encodes 12 from each half
+AVX2_FUNCTION size_t CodecKernels::base64EncodeAVX2(const uint8_t* in,
+                                                    size_t length,
+                                                    char* out)
+{
+  size_t i = 0;
+  for (; i + 28 <= length; i += 24, out += 32)
+  {
+    __m256i src = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))),
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)), 1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                        toBase64(unpack6(src)));
+  }
+
+  return encodeSSSE3(in, length, out, i);
+}
+
+
+
+// writes 28 bytes per step; decodes 12 into each half
+AVX2_FUNCTION size_t CodecKernels::base64DecodeAVX2(const char* in,
+                                                    size_t length,
+                                                    uint8_t* out,
+                                                    size_t capacity)
+{
+  size_t i = 0;
+  for (; i + 32 <= length && i / 4 * 3 + 28 <= capacity; i += 32)
+  {
+    __m256i values;
+    __m256i chars =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    if (!fromBase64(chars, values))
+      break;
+
+    __m256i packed = pack6(values);
+    uint8_t* o = out + i / 4 * 3;
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                     _mm256_castsi256_si128(packed));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o + 12),
+                     _mm256_extracti128_si256(packed, 1));
+  }
+
+  return decodeSSSE3(in, length, out, capacity, i);
+}
+
+
+
+// 32 bytes per step; the unpacks work within lanes, so the halves of the
+// two results are recombined in order
+AVX2_FUNCTION size_t CodecKernels::hexEncodeAVX2(const uint8_t* in,
+                                                 size_t length,
+                                                 char* out)
+{
+  const __m256i DIGITS = _mm256_setr_epi8(
+      '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd',
+      'e', 'f', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b',
+      'c', 'd', 'e', 'f');
+  const __m256i NIBBLE = _mm256_set1_epi8(0x0F);
+
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i src = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    __m256i high = _mm256_shuffle_epi8(
+        DIGITS, _mm256_and_si256(_mm256_srli_epi16(src, 4), NIBBLE));
+    __m256i low = _mm256_shuffle_epi8(DIGITS, _mm256_and_si256(src, NIBBLE));
+    __m256i first = _mm256_unpacklo_epi8(high, low);
+    __m256i second = _mm256_unpackhi_epi8(high, low);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i),
+                        _mm256_permute2x128_si256(first, second, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * i + 32),
+                        _mm256_permute2x128_si256(first, second, 0x31));
+  }
+
+  return hexSSSE3(in, length, out, i);
+}
+
+#endif
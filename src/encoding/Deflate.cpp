@@ -0,0 +1,152 @@
+#include "Deflate.hpp"
+#include <zlib.h>
+#include <algorithm>
+
+// the most common strings last, where deflate reaches them most cheaply
+const char Deflate::DICTIONARY[] =
+    "\"consensusHash\":\"\"root\":\"\"leaves\":[\"proof\":[\"error\","
+    "\"Domain not found.\"\"framing\":\"length\"\"compression\":\"deflate\""
+    "\"type\":\"Create\",\"recordVersion\":\".tor\",\"subd\":{\"www.\""
+    "\"contact\":\"\"name\":\"\"IDAQAB\"\"pubHSKey\":\"MIGJAoGBA"
+    "\"nonce\":\"\"pow\":\"\"recordSig\":\"\"signature\":\"\"id\":"
+    "{\"type\":\"success\",\"value\":\"";
+
+// the calling thread's zlib streams, set up on first use
+class Deflate::Streams
+{
+ public:
+  Streams() : deflating_(false), inflating_(false) {}
+
+  ~Streams()
+  {
+    if (deflating_)
+      deflateEnd(&deflater_);
+    if (inflating_)
+      inflateEnd(&inflater_);
+  }
+
+  z_stream* getDeflater()
+  {
+    if (!deflating_)
+    {
+      deflater_ = z_stream();
+      if (deflateInit2(&deflater_, Deflate::LEVEL, Z_DEFLATED, -15, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK)
+        return nullptr;
+      deflating_ = true;
+    }
+    else if (deflateReset(&deflater_) != Z_OK)
+      return nullptr;
+
+    const auto& dict = Deflate::getDictionary();
+    if (deflateSetDictionary(&deflater_,
+                             reinterpret_cast<const Bytef*>(dict.data()),
+                             static_cast<uInt>(dict.size())) != Z_OK)
+      return nullptr;
+    return &deflater_;
+  }
+
+  z_stream* getInflater()
+  {
+    if (!inflating_)
+    {
+      inflater_ = z_stream();
+      if (inflateInit2(&inflater_, -15) != Z_OK)
+        return nullptr;
+      inflating_ = true;
+    }
+    else if (inflateReset(&inflater_) != Z_OK)
+      return nullptr;
+
+    const auto& dict = Deflate::getDictionary();
+    if (inflateSetDictionary(&inflater_,
+                             reinterpret_cast<const Bytef*>(dict.data()),
+                             static_cast<uInt>(dict.size())) != Z_OK)
+      return nullptr;
+    return &inflater_;
+  }
+
+ private:
+  z_stream deflater_, inflater_;
+  bool deflating_, inflating_;
+};
+
+const int Deflate::LEVEL;
+
+
+// replaces out with the compressed form of the input
+bool Deflate::compress(const char* in, size_t len, std::string& out)
+{
+  z_stream* stream = getStreams().getDeflater();
+  if (!stream)
+    return false;
+
+  out.resize(deflateBound(stream, static_cast<uLong>(len)));
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+  stream->avail_in = static_cast<uInt>(len);
+  stream->next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream->avail_out = static_cast<uInt>(out.size());
+
+  if (::deflate(stream, Z_FINISH) != Z_STREAM_END)
+    return false;
+
+  out.resize(stream->total_out);
+  return true;
+}
+
+
+
+// replaces out with the inflated input, of at most maxLen bytes
+bool Deflate::decompress(const char* in,
+                         size_t len,
+                         std::vector<char>& out,
+                         size_t maxLen)
+{
+  z_stream* stream = getStreams().getInflater();
+  if (!stream)
+    return false;
+
+  stream->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+  stream->avail_in = static_cast<uInt>(len);
+  out.resize(std::min(std::max(len * 4, size_t(4096)), maxLen));
+
+  while (true)
+  {
+    stream->next_out = reinterpret_cast<Bytef*>(&out[stream->total_out]);
+    stream->avail_out = static_cast<uInt>(out.size() - stream->total_out);
+
+    int status = ::inflate(stream, Z_FINISH);
+    if (status == Z_STREAM_END)
+      break;
+
+    // anything but a full output buffer means corrupt or truncated input
+    if ((status != Z_BUF_ERROR && status != Z_OK) || stream->avail_out != 0 ||
+        out.size() == maxLen)
+      return false;
+
+    out.resize(std::min(out.size() * 2, maxLen));
+  }
+
+  out.resize(stream->total_out);
+  return true;
+}
+
+
+
+const std::string& Deflate::getDictionary()
+{
+  static const std::string dictionary(DICTIONARY, sizeof(DICTIONARY) - 1);
+  return dictionary;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Deflate::Streams& Deflate::getStreams()
+{
+  static thread_local Streams streams;
+  return streams;
+}
@@ -0,0 +1,33 @@
+#ifndef DEFLATE_HPP
+#define DEFLATE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Raw deflate (RFC 1951) primed with a preset dictionary of the JSON that
+// TorStream carries: the protocol envelope, Record members, and the
+// base64 prefixes of DER-encoded 1024-bit RSA keys. The dictionary lets
+// even a single Record compress well. Each thread keeps its zlib streams
+// and resets them between messages, so nothing is allocated per call once
+// they exist. Inflation stops with an error past the given limit.
+class Deflate
+{
+ public:
+  static const int LEVEL = 6;
+
+  static bool compress(const char*, size_t, std::string&);
+  static bool decompress(const char*, size_t, std::vector<char>&, size_t);
+
+  static const std::string& getDictionary();
+
+ private:
+  class Streams;
+
+  static Streams& getStreams();
+
+  static const char DICTIONARY[];
+};
+
+#endif
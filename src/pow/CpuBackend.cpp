@@ -0,0 +1,49 @@
+#include "CpuBackend.hpp"
+#include "Scrypt.hpp"
+#include <algorithm>
+
+std::string CpuBackend::getName() const
+{
+  return "cpu";
+}
+
+
+
+bool CpuBackend::isAvailable()
+{
+  return true;
+}
+
+
+
+// as many lanes as the lane budget allows
+size_t CpuBackend::getBatchSize(uint64_t N, uint32_t r)
+{
+  return Scrypt::getLaneCount(N, r);
+}
+
+
+
+// larger batches are split into calls of at most Scrypt::MAX_LANES lanes
+int CpuBackend::compute(const uint8_t* const* pass,
+                        const size_t* passLen,
+                        const uint8_t* salt,
+                        size_t saltLen,
+                        uint64_t N,
+                        uint32_t r,
+                        uint32_t p,
+                        uint8_t* const* out,
+                        size_t outLen,
+                        size_t count,
+                        const std::atomic<bool>* cancel)
+{
+  for (size_t first = 0; first < count; first += Scrypt::MAX_LANES)
+  {
+    size_t lanes = std::min(Scrypt::MAX_LANES, count - first);
+    if (Scrypt::computeLanes(pass + first, passLen + first, salt, saltLen, N,
+                             r, p, out + first, outLen, lanes, cancel) < 0)
+      return -1;
+  }
+
+  return 0;
+}
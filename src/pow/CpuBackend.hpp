@@ -0,0 +1,37 @@
+#ifndef CPU_BACKEND_HPP
+#define CPU_BACKEND_HPP
+
+#include "PowBackend.hpp"
+
+// scrypt on the calling thread, through the vectorized multi-lane kernels
+class CpuBackend : public PowBackend
+{
+ public:
+  static CpuBackend& get()
+  {
+    static CpuBackend instance;
+    return instance;
+  }
+
+  std::string getName() const override;
+  bool isAvailable() override;
+  size_t getBatchSize(uint64_t, uint32_t) override;
+  int compute(const uint8_t* const*,
+              const size_t*,
+              const uint8_t*,
+              size_t,
+              uint64_t,
+              uint32_t,
+              uint32_t,
+              uint8_t* const*,
+              size_t,
+              size_t,
+              const std::atomic<bool>* cancel = nullptr) override;
+
+ private:
+  CpuBackend() {}
+  CpuBackend(CpuBackend const&) = delete;
+  void operator=(CpuBackend const&) = delete;
+};
+
+#endif
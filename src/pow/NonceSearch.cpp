@@ -0,0 +1,232 @@
+
+#include "NonceSearch.hpp"
+#include <algorithm>
+
+
+double NonceSearch::Progress::getHashRate() const
+{
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  return seconds > 0 ? attempts / seconds : 0;
+}
+
+
+
+NonceSearch::NonceSearch(size_t nWorkers, ThreadPool& pool)
+    : nWorkers_(std::max<size_t>(nWorkers, 1)),
+      pool_(pool),
+      cancelled_(false),
+      attempts_(0),
+      progressInterval_(0)
+{
+  const uint64_t SPACE = uint64_t(1) << 32;
+  for (size_t n = 0; n < nWorkers_; n++)
+  {
+    ranges_.push_back(std::unique_ptr<Range>(new Range()));
+    ranges_[n]->begin = SPACE * n / nWorkers_;
+    ranges_[n]->end = SPACE * (n + 1) / nWorkers_;
+  }
+
+  result_.found = false;
+  result_.nonce = 0;
+  result_.worker = 0;
+  result_.index = 0;
+}
+
+
+
+// the callback runs on the calling thread of run(), between its attempts
+void NonceSearch::setProgressCallback(
+    const ProgressCallback& callback,
+    const std::chrono::milliseconds& interval)
+{
+  progressCallback_ = callback;
+  progressInterval_ = interval;
+}
+
+
+
+// blocks until a worker succeeds, the space runs out, or cancel() is called
+NonceSearch::Result NonceSearch::run(const Attempt& attempt)
+{
+  return run([&attempt](size_t worker, const uint32_t* nonces, size_t,
+                        const std::atomic<bool>& cancel) -> size_t
+             {
+               return attempt(worker, nonces[0], cancel) ? 0 : 1;
+             },
+             1);
+}
+
+
+
+// as above, handing each worker up to batchSize nonces at a time
+NonceSearch::Result NonceSearch::run(const BatchAttempt& attempt,
+                                     size_t batchSize)
+{
+  start_ = lastReport_ = Clock::now();
+  batchSize = std::max<size_t>(batchSize, 1);
+
+  std::vector<std::future<void>> futures;
+  for (size_t n = 1; n < nWorkers_; n++)
+    futures.push_back(pool_.submit([this, n, &attempt, batchSize]()
+                                   {
+                                     work(n, attempt, batchSize);
+                                   }));
+
+  try
+  {
+    work(0, attempt, batchSize);
+  }
+  catch (...)
+  {  // the other workers still refer to this object, so let them finish
+    for (auto& f : futures)
+      f.wait();
+    throw;
+  }
+
+  for (auto& f : futures)
+    f.wait();
+  for (auto& f : futures)
+    f.get();  // rethrows the first failure of another worker
+
+  std::lock_guard<std::mutex> guard(resultMutex_);
+  return result_;
+}
+
+
+
+// safe to call from any thread, including from inside an attempt
+void NonceSearch::cancel()
+{
+  cancelled_ = true;
+}
+
+
+
+NonceSearch::Progress NonceSearch::getProgress() const
+{
+  Progress progress;
+  progress.attempts = attempts_;
+  progress.elapsed = Clock::now() - start_;
+  return progress;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+void NonceSearch::work(size_t worker,
+                       const BatchAttempt& attempt,
+                       size_t batchSize)
+{
+  std::vector<uint32_t> nonces(batchSize);
+  size_t count;
+  while (!cancelled_ && (count = next(worker, nonces.data(), batchSize)) > 0)
+  {
+    size_t index = count;
+    try
+    {
+      index = attempt(worker, nonces.data(), count, cancelled_);
+    }
+    catch (...)
+    {
+      cancel();  // an error anywhere ends the whole search
+      throw;
+    }
+
+    attempts_ += count;
+
+    if (index < count)
+    {
+      std::lock_guard<std::mutex> guard(resultMutex_);
+      if (!result_.found)
+      {  // the first success wins, and stops everyone else
+        result_.found = true;
+        result_.nonce = nonces[index];
+        result_.worker = worker;
+        result_.index = index;
+        cancelled_ = true;
+      }
+    }
+
+    if (worker == 0)
+      report();
+  }
+}
+
+
+
+// takes up to max nonces from the worker's own range, stealing if it is
+// empty, and returns how many it took
+size_t NonceSearch::next(size_t worker, uint32_t* nonces, size_t max)
+{
+  do
+  {
+    Range& range = *ranges_[worker];
+    std::lock_guard<std::mutex> guard(range.mutex);
+    size_t count = 0;
+    while (count < max && range.begin < range.end)
+      nonces[count++] = static_cast<uint32_t>(range.begin++);
+
+    if (count > 0)
+      return count;
+  } while (steal(worker));
+
+  return 0;
+}
+
+
+
+// moves the upper half of the largest remaining range to the given worker
+bool NonceSearch::steal(size_t thief)
+{
+  size_t victim = thief;
+  uint64_t largest = 0;
+  for (size_t n = 0; n < nWorkers_; n++)
+  {
+    std::lock_guard<std::mutex> guard(ranges_[n]->mutex);
+    uint64_t remaining = ranges_[n]->end - ranges_[n]->begin;
+    if (n != thief && remaining > largest)
+    {
+      victim = n;
+      largest = remaining;
+    }
+  }
+
+  if (victim == thief)
+    return false;  // nothing left anywhere
+
+  // lock in index order, so two thieves can never deadlock
+  Range& a = *ranges_[std::min(thief, victim)];
+  Range& b = *ranges_[std::max(thief, victim)];
+  std::lock(a.mutex, b.mutex);
+  std::lock_guard<std::mutex> guardA(a.mutex, std::adopt_lock);
+  std::lock_guard<std::mutex> guardB(b.mutex, std::adopt_lock);
+
+  Range& from = *ranges_[victim];
+  Range& to = *ranges_[thief];
+  if (from.begin >= from.end)
+    return true;  // it ran out meanwhile, so look again
+
+  uint64_t middle = from.begin + (from.end - from.begin) / 2;
+  to.begin = middle;
+  to.end = from.end;
+  from.end = middle;
+  return true;
+}
+
+
+
+void NonceSearch::report()
+{
+  if (!progressCallback_)
+    return;
+
+  auto now = Clock::now();
+  if (now - lastReport_ < progressInterval_)
+    return;
+
+  lastReport_ = now;
+  progressCallback_(getProgress());
+}
@@ -0,0 +1,85 @@
+#ifndef NONCE_SEARCH_HPP
+#define NONCE_SEARCH_HPP
+
+#include "../ThreadPool.hpp"
+#include <functional>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <mutex>
+
+// Searches the 32-bit nonce space for a proof-of-work. Each worker starts
+// with an equal share of the space and, when done with it, steals the upper
+// half of whichever share has the most left. Workers run on a persistent
+// ThreadPool, with the calling thread as worker 0, and stop as soon as any
+// of them succeeds or the search is cancelled.
+class NonceSearch
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Progress
+  {
+    uint64_t attempts;
+    Clock::duration elapsed;
+    double getHashRate() const;  // attempts per second
+  };
+
+  struct Result
+  {
+    bool found;
+    uint32_t nonce;
+    size_t worker;  // the index of the worker that found it
+    size_t index;   // and its position in that worker's batch
+  };
+
+  // tries a nonce on the given worker, returning true on success; it should
+  // give up early, returning false, once the cancellation flag is set
+  typedef std::function<bool(size_t, uint32_t, const std::atomic<bool>&)>
+      Attempt;
+  // the same over a batch of up to the given count of nonces, returning
+  // the index of one that succeeded, or the count if none did
+  typedef std::function<size_t(size_t,
+                               const uint32_t*,
+                               size_t,
+                               const std::atomic<bool>&)> BatchAttempt;
+  typedef std::function<void(const Progress&)> ProgressCallback;
+
+  NonceSearch(size_t, ThreadPool& pool = ThreadPool::get());
+  void setProgressCallback(const ProgressCallback&,
+                           const std::chrono::milliseconds&);
+  Result run(const Attempt&);
+  Result run(const BatchAttempt&, size_t);
+  void cancel();
+  Progress getProgress() const;
+
+ private:
+  struct Range
+  {
+    std::mutex mutex;
+    uint64_t begin, end;  // remaining nonces, [begin, end)
+  };
+
+  void work(size_t, const BatchAttempt&, size_t);
+  size_t next(size_t, uint32_t*, size_t);
+  bool steal(size_t);
+  void report();
+
+  const size_t nWorkers_;
+  ThreadPool& pool_;
+  std::vector<std::unique_ptr<Range>> ranges_;
+
+  std::atomic<bool> cancelled_;
+  std::atomic<uint64_t> attempts_;
+  Clock::time_point start_;
+
+  std::mutex resultMutex_;
+  Result result_;
+
+  ProgressCallback progressCallback_;
+  std::chrono::milliseconds progressInterval_;
+  Clock::time_point lastReport_;
+};
+
+#endif
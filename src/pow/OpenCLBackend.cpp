@@ -0,0 +1,470 @@
+#include "OpenCLBackend.hpp"
+#include "Scrypt.hpp"
+#include "../Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <vector>
+
+const size_t OpenCLBackend::MAX_BATCH;
+const uint64_t OpenCLBackend::SLICE;
+
+// SMix over 32-bit words, after crypto_scrypt-nosse.c, built once per r.
+// Each work-item keeps its block in private memory and its V contiguously
+// in V, and runs iterations [first, last) of either ROMix loop.
+static const char* KERNEL_SOURCE = R"CL(
+#define W (32 * SCRYPT_R)
+
+void salsa20_8(uint* B)
+{
+  uint x[16];
+  for (int i = 0; i < 16; i++)
+    x[i] = B[i];
+
+  for (int i = 0; i < 8; i += 2)
+  {
+    x[4] ^= rotate(x[0] + x[12], 7U);
+    x[8] ^= rotate(x[4] + x[0], 9U);
+    x[12] ^= rotate(x[8] + x[4], 13U);
+    x[0] ^= rotate(x[12] + x[8], 18U);
+
+    x[9] ^= rotate(x[5] + x[1], 7U);
+    x[13] ^= rotate(x[9] + x[5], 9U);
+    x[1] ^= rotate(x[13] + x[9], 13U);
+    x[5] ^= rotate(x[1] + x[13], 18U);
+
+    x[14] ^= rotate(x[10] + x[6], 7U);
+    x[2] ^= rotate(x[14] + x[10], 9U);
+    x[6] ^= rotate(x[2] + x[14], 13U);
+    x[10] ^= rotate(x[6] + x[2], 18U);
+
+    x[3] ^= rotate(x[15] + x[11], 7U);
+    x[7] ^= rotate(x[3] + x[15], 9U);
+    x[11] ^= rotate(x[7] + x[3], 13U);
+    x[15] ^= rotate(x[11] + x[7], 18U);
+
+    x[1] ^= rotate(x[0] + x[3], 7U);
+    x[2] ^= rotate(x[1] + x[0], 9U);
+    x[3] ^= rotate(x[2] + x[1], 13U);
+    x[0] ^= rotate(x[3] + x[2], 18U);
+
+    x[6] ^= rotate(x[5] + x[4], 7U);
+    x[7] ^= rotate(x[6] + x[5], 9U);
+    x[4] ^= rotate(x[7] + x[6], 13U);
+    x[5] ^= rotate(x[4] + x[7], 18U);
+
+    x[11] ^= rotate(x[10] + x[9], 7U);
+    x[8] ^= rotate(x[11] + x[10], 9U);
+    x[9] ^= rotate(x[8] + x[11], 13U);
+    x[10] ^= rotate(x[9] + x[8], 18U);
+
+    x[12] ^= rotate(x[15] + x[14], 7U);
+    x[13] ^= rotate(x[12] + x[15], 9U);
+    x[14] ^= rotate(x[13] + x[12], 13U);
+    x[15] ^= rotate(x[14] + x[13], 18U);
+  }
+
+  for (int i = 0; i < 16; i++)
+    B[i] += x[i];
+}
+
+void blockmix_salsa8(uint* B, uint* Y)
+{
+  uint X[16];
+  for (int k = 0; k < 16; k++)
+    X[k] = B[(2 * SCRYPT_R - 1) * 16 + k];
+
+  for (int i = 0; i < 2 * SCRYPT_R; i++)
+  {
+    for (int k = 0; k < 16; k++)
+      X[k] ^= B[i * 16 + k];
+    salsa20_8(X);
+    for (int k = 0; k < 16; k++)
+      Y[i * 16 + k] = X[k];
+  }
+
+  for (int i = 0; i < SCRYPT_R; i++)
+    for (int k = 0; k < 16; k++)
+    {
+      B[i * 16 + k] = Y[2 * i * 16 + k];
+      B[(SCRYPT_R + i) * 16 + k] = Y[(2 * i + 1) * 16 + k];
+    }
+}
+
+__kernel void smix(__global uint* X,
+                   __global uint* V,
+                   const ulong N,
+                   const ulong first,
+                   const ulong last,
+                   const uint fill)
+{
+  const ulong item = get_global_id(0);
+  __global uint* x = X + item * W;
+  __global uint* v = V + item * W * N;
+
+  uint B[W], Y[W];
+  for (int k = 0; k < W; k++)
+    B[k] = x[k];
+
+  for (ulong i = first; i < last; i++)
+  {
+    if (fill)
+      for (int k = 0; k < W; k++)
+        v[i * W + k] = B[k];
+    else
+    {
+      const int tail = (2 * SCRYPT_R - 1) * 16;
+      ulong j = (B[tail] | ((ulong)B[tail + 1] << 32)) & (N - 1);
+      for (int k = 0; k < W; k++)
+        B[k] ^= v[j * W + k];
+    }
+
+    blockmix_salsa8(B, Y);
+  }
+
+  for (int k = 0; k < W; k++)
+    x[k] = B[k];
+}
+)CL";
+
+
+
+std::string OpenCLBackend::getName() const
+{
+  return "opencl";
+}
+
+
+
+// true if an OpenCL device was found and set up
+bool OpenCLBackend::isAvailable()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return initialize();
+}
+
+
+
+// as many inputs as fit into device memory at once, up to MAX_BATCH
+size_t OpenCLBackend::getBatchSize(uint64_t N, uint32_t r)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!initialize())
+    return 1;
+
+  return std::max<size_t>(std::min(getItemLimit(N, r), MAX_BATCH), 1);
+}
+
+
+
+int OpenCLBackend::compute(const uint8_t* const* pass,
+                           const size_t* passLen,
+                           const uint8_t* salt,
+                           size_t saltLen,
+                           uint64_t N,
+                           uint32_t r,
+                           uint32_t p,
+                           uint8_t* const* out,
+                           size_t outLen,
+                           size_t count,
+                           const std::atomic<bool>* cancel)
+{
+  int error = Scrypt::checkParameters(N, r, p, outLen, 1);
+  if (error != 0)
+  {
+    errno = error;
+    return -1;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!initialize())
+  {
+    errno = ENODEV;
+    return -1;
+  }
+
+  cl_kernel kernel = getKernel(r);
+  const size_t limit = getItemLimit(N, r);
+  if (!kernel || limit == 0)
+  {
+    errno = kernel ? ENOMEM : EIO;
+    return -1;
+  }
+
+  // each of the p blocks of every input runs SMix as its own work-item
+  const size_t blockLen = 128 * r, words = 32 * r, items = count * p;
+  std::vector<uint8_t> B(items * blockLen);
+  for (size_t n = 0; n < count; n++)
+    Scrypt::pbkdf2(pass[n], passLen[n], salt, saltLen, &B[n * p * blockLen],
+                   p * blockLen);
+
+  std::vector<uint32_t> X(items * words);
+  for (size_t k = 0; k < X.size(); k++)
+    X[k] = uint32_t(B[4 * k]) | (uint32_t(B[4 * k + 1]) << 8) |
+           (uint32_t(B[4 * k + 2]) << 16) | (uint32_t(B[4 * k + 3]) << 24);
+
+  // the device may not hold every V at once, so go through in groups
+  for (size_t first = 0; first < items; first += limit)
+  {
+    const size_t group = std::min(limit, items - first);
+    if (!reserve(group * words * sizeof(uint32_t), group * blockLen * N))
+    {
+      errno = ENOMEM;
+      return -1;
+    }
+
+    cl_int status = clEnqueueWriteBuffer(
+        queue_, X_, CL_TRUE, 0, group * words * sizeof(uint32_t),
+        &X[first * words], 0, nullptr, nullptr);
+    if (!check(status, "clEnqueueWriteBuffer"))
+    {
+      errno = EIO;
+      return -1;
+    }
+
+    if (!runSMix(kernel, group, N, cancel))
+      return -1;
+
+    status = clEnqueueReadBuffer(queue_, X_, CL_TRUE, 0,
+                                 group * words * sizeof(uint32_t),
+                                 &X[first * words], 0, nullptr, nullptr);
+    if (!check(status, "clEnqueueReadBuffer"))
+    {
+      errno = EIO;
+      return -1;
+    }
+  }
+
+  for (size_t k = 0; k < X.size(); k++)
+    for (size_t j = 0; j < 4; j++)
+      B[4 * k + j] = static_cast<uint8_t>(X[k] >> (8 * j));
+
+  for (size_t n = 0; n < count; n++)
+    Scrypt::pbkdf2(pass[n], passLen[n], &B[n * p * blockLen], p * blockLen,
+                   out[n], outLen);
+
+  return 0;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+OpenCLBackend::OpenCLBackend()
+    : initialized_(false),
+      available_(false),
+      device_(nullptr),
+      context_(nullptr),
+      queue_(nullptr),
+      globalMemory_(0),
+      maxAllocation_(0),
+      X_(nullptr),
+      V_(nullptr),
+      xSize_(0),
+      vSize_(0)
+{
+}
+
+
+
+OpenCLBackend::~OpenCLBackend()
+{
+  for (auto& kernel : kernels_)
+  {
+    clReleaseKernel(kernel.second.second);
+    clReleaseProgram(kernel.second.first);
+  }
+
+  if (X_)
+    clReleaseMemObject(X_);
+  if (V_)
+    clReleaseMemObject(V_);
+  if (queue_)
+    clReleaseCommandQueue(queue_);
+  if (context_)
+    clReleaseContext(context_);
+}
+
+
+
+// picks the first GPU of any platform, or else any device; only tried once
+bool OpenCLBackend::initialize()
+{
+  if (initialized_)
+    return available_;
+  initialized_ = true;
+
+  cl_uint nPlatforms = 0;
+  if (clGetPlatformIDs(0, nullptr, &nPlatforms) != CL_SUCCESS ||
+      nPlatforms == 0)
+    return false;
+
+  std::vector<cl_platform_id> platforms(nPlatforms);
+  clGetPlatformIDs(nPlatforms, platforms.data(), nullptr);
+
+  const cl_device_type TYPES[] = {CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_ALL};
+  bool found = false;
+  for (auto type : TYPES)
+    for (auto platform : platforms)
+      if (!found &&
+          clGetDeviceIDs(platform, type, 1, &device_, nullptr) == CL_SUCCESS)
+        found = true;
+
+  if (!found)
+    return false;
+
+  cl_int status;
+  context_ = clCreateContext(nullptr, 1, &device_, nullptr, nullptr, &status);
+  if (!check(status, "clCreateContext"))
+    return false;
+
+  queue_ = clCreateCommandQueue(context_, device_, 0, &status);
+  if (!check(status, "clCreateCommandQueue"))
+    return false;
+
+  clGetDeviceInfo(device_, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong),
+                  &globalMemory_, nullptr);
+  clGetDeviceInfo(device_, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong),
+                  &maxAllocation_, nullptr);
+
+  char name[256] = {0};
+  clGetDeviceInfo(device_, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+  LOG_NOTICE("Using OpenCL device " + std::string(name) +
+             " for proof-of-work.");
+
+  available_ = true;
+  return true;
+}
+
+
+
+// builds the kernel for the given r the first time it is needed
+cl_kernel OpenCLBackend::getKernel(uint32_t r)
+{
+  auto existing = kernels_.find(r);
+  if (existing != kernels_.end())
+    return existing->second.second;
+
+  cl_int status;
+  cl_program program =
+      clCreateProgramWithSource(context_, 1, &KERNEL_SOURCE, nullptr, &status);
+  if (!check(status, "clCreateProgramWithSource"))
+    return nullptr;
+
+  auto options = "-D SCRYPT_R=" + std::to_string(r);
+  if (clBuildProgram(program, 1, &device_, options.c_str(), nullptr,
+                     nullptr) != CL_SUCCESS)
+  {
+    size_t logLen = 0;
+    clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, 0, nullptr,
+                          &logLen);
+    std::string buildLog(logLen, '\0');
+    clGetProgramBuildInfo(program, device_, CL_PROGRAM_BUILD_LOG, logLen,
+                          &buildLog[0], nullptr);
+    Log::get().warn("Failed to build the OpenCL scrypt kernel: " + buildLog);
+    clReleaseProgram(program);
+    return nullptr;
+  }
+
+  cl_kernel kernel = clCreateKernel(program, "smix", &status);
+  if (!check(status, "clCreateKernel"))
+  {
+    clReleaseProgram(program);
+    return nullptr;
+  }
+
+  kernels_[r] = std::make_pair(program, kernel);
+  return kernel;
+}
+
+
+
+// how many work-items' V fit in one allocation and 3/4 of device memory
+size_t OpenCLBackend::getItemLimit(uint64_t N, uint32_t r) const
+{
+  const cl_ulong itemMemory = 128 * cl_ulong(r) * N;
+  return static_cast<size_t>(
+      std::min(maxAllocation_ / itemMemory, globalMemory_ / 4 * 3 / itemMemory));
+}
+
+
+
+// grows the device buffers to at least the given sizes
+bool OpenCLBackend::reserve(size_t xSize, size_t vSize)
+{
+  cl_int status = CL_SUCCESS;
+  if (xSize > xSize_)
+  {
+    if (X_)
+      clReleaseMemObject(X_);
+    X_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, xSize, nullptr, &status);
+    xSize_ = status == CL_SUCCESS ? xSize : 0;
+    if (!check(status, "clCreateBuffer"))
+      return false;
+  }
+
+  if (vSize > vSize_)
+  {
+    if (V_)
+      clReleaseMemObject(V_);
+    V_ = clCreateBuffer(context_, CL_MEM_READ_WRITE, vSize, nullptr, &status);
+    vSize_ = status == CL_SUCCESS ? vSize : 0;
+    if (!check(status, "clCreateBuffer"))
+      return false;
+  }
+
+  return true;
+}
+
+
+
+// runs both ROMix loops over the items in X, a slice at a time
+bool OpenCLBackend::runSMix(cl_kernel kernel,
+                            size_t items,
+                            uint64_t N,
+                            const std::atomic<bool>* cancel)
+{
+  const cl_ulong n = N;
+  for (cl_uint fill : {1u, 0u})
+    for (uint64_t first = 0; first < N; first += SLICE)
+    {
+      if (cancel && *cancel)
+      {
+        errno = ECANCELED;
+        return false;
+      }
+
+      const cl_ulong from = first, to = std::min(N, first + SLICE);
+      clSetKernelArg(kernel, 0, sizeof(cl_mem), &X_);
+      clSetKernelArg(kernel, 1, sizeof(cl_mem), &V_);
+      clSetKernelArg(kernel, 2, sizeof(cl_ulong), &n);
+      clSetKernelArg(kernel, 3, sizeof(cl_ulong), &from);
+      clSetKernelArg(kernel, 4, sizeof(cl_ulong), &to);
+      clSetKernelArg(kernel, 5, sizeof(cl_uint), &fill);
+
+      cl_int status = clEnqueueNDRangeKernel(queue_, kernel, 1, nullptr, &items,
+                                             nullptr, 0, nullptr, nullptr);
+      if (status == CL_SUCCESS)
+        status = clFinish(queue_);
+      if (!check(status, "clEnqueueNDRangeKernel"))
+      {
+        errno = EIO;
+        return false;
+      }
+    }
+
+  return true;
+}
+
+
+
+bool OpenCLBackend::check(cl_int status, const std::string& call)
+{
+  if (status == CL_SUCCESS)
+    return true;
+
+  Log::get().warn("OpenCL error " + std::to_string(status) + " from " + call +
+                  ".");
+  return false;
+}
@@ -0,0 +1,69 @@
+#ifndef OPENCL_BACKEND_HPP
+#define OPENCL_BACKEND_HPP
+
+#include "PowBackend.hpp"
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+#include <map>
+#include <mutex>
+
+// scrypt on an OpenCL device, preferably a GPU. The host computes PBKDF2,
+// and the device runs SMix with one work-item per input and its V in device
+// memory. ROMix is enqueued in slices, so that cancellation is noticed
+// between them and no single kernel runs long enough to trip a watchdog.
+// Only one batch uses the device at a time.
+class OpenCLBackend : public PowBackend
+{
+ public:
+  static OpenCLBackend& get()
+  {
+    static OpenCLBackend instance;
+    return instance;
+  }
+
+  std::string getName() const override;
+  bool isAvailable() override;
+  size_t getBatchSize(uint64_t, uint32_t) override;
+  int compute(const uint8_t* const*,
+              const size_t*,
+              const uint8_t*,
+              size_t,
+              uint64_t,
+              uint32_t,
+              uint32_t,
+              uint8_t* const*,
+              size_t,
+              size_t,
+              const std::atomic<bool>* cancel = nullptr) override;
+
+  static const size_t MAX_BATCH = 64;
+  static const uint64_t SLICE = 1 << 14;  // ROMix iterations per enqueue
+
+ private:
+  OpenCLBackend();
+  ~OpenCLBackend();
+  OpenCLBackend(OpenCLBackend const&) = delete;
+  void operator=(OpenCLBackend const&) = delete;
+
+  bool initialize();
+  cl_kernel getKernel(uint32_t);
+  size_t getItemLimit(uint64_t, uint32_t) const;
+  bool reserve(size_t, size_t);
+  bool runSMix(cl_kernel, size_t, uint64_t, const std::atomic<bool>*);
+  static bool check(cl_int, const std::string&);
+
+  std::mutex mutex_;
+  bool initialized_, available_;
+  cl_device_id device_;
+  cl_context context_;
+  cl_command_queue queue_;
+  cl_ulong globalMemory_, maxAllocation_;
+  std::map<uint32_t, std::pair<cl_program, cl_kernel>> kernels_;  // by r
+  cl_mem X_, V_;
+  size_t xSize_, vSize_;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#include "PowBackend.hpp"
+#include "CpuBackend.hpp"
+#ifdef ONIONS_OPENCL
+#include "OpenCLBackend.hpp"
+#endif
+
+static std::atomic<PowBackend*> default_(nullptr);  // null until chosen
+
+
+
+// all compiled-in backends, whether or not their hardware is present
+std::vector<PowBackend*> PowBackend::getBackends()
+{
+  std::vector<PowBackend*> backends;
+  backends.push_back(&CpuBackend::get());
+#ifdef ONIONS_OPENCL
+  backends.push_back(&OpenCLBackend::get());
+#endif
+  return backends;
+}
+
+
+
+// returns the named backend if it can be used on this machine, else null
+PowBackend* PowBackend::find(const std::string& name)
+{
+  for (auto backend : getBackends())
+    if (backend->getName() == name)
+      return backend->isAvailable() ? backend : nullptr;
+
+  return nullptr;
+}
+
+
+
+// the CPU, unless another backend has been chosen with setDefault
+PowBackend& PowBackend::getDefault()
+{
+  PowBackend* backend = default_;
+  return backend ? *backend : CpuBackend::get();
+}
+
+
+
+bool PowBackend::setDefault(const std::string& name)
+{
+  PowBackend* backend = find(name);
+  if (backend)
+    default_ = backend;
+  return backend != nullptr;
+}
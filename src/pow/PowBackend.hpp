@@ -0,0 +1,45 @@
+#ifndef POW_BACKEND_HPP
+#define POW_BACKEND_HPP
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Computes the scrypt outputs that the proof-of-work consists of, for a
+// batch of independent inputs at once. Every backend must produce exactly
+// the output of Scrypt::compute, so that a nonce found with one verifies
+// with any other. Backends are singletons, and are looked up by name.
+class PowBackend
+{
+ public:
+  virtual ~PowBackend() {}
+
+  virtual std::string getName() const = 0;
+  virtual bool isAvailable() = 0;
+
+  // how many inputs one call should be given for the best throughput
+  virtual size_t getBatchSize(uint64_t, uint32_t) = 0;
+
+  // the arguments of Scrypt::computeLanes, but for any number of inputs;
+  // returns 0 on success or -1 with errno set, ECANCELED if cancelled
+  virtual int compute(const uint8_t* const*,
+                      const size_t*,
+                      const uint8_t*,
+                      size_t,
+                      uint64_t,
+                      uint32_t,
+                      uint32_t,
+                      uint8_t* const*,
+                      size_t,
+                      size_t,
+                      const std::atomic<bool>* cancel = nullptr) = 0;
+
+  static std::vector<PowBackend*> getBackends();
+  static PowBackend* find(const std::string&);
+  static PowBackend& getDefault();
+  static bool setDefault(const std::string&);
+};
+
+#endif
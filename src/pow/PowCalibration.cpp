@@ -0,0 +1,248 @@
+
+#include "PowCalibration.hpp"
+#include "CpuBackend.hpp"
+#include "NonceSearch.hpp"
+#include "../Constants.hpp"
+#include "../Log.hpp"
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <map>
+
+const int PowCalibration::DEFAULT_TRIAL_TIME;
+static std::mutex resultsMutex_;
+static std::map<std::string, PowCalibration::Result> results_;  // by backend
+
+PowCalibration::Options::Options()
+    : N(Const::RECORD_SCRYPT_N),
+      r(1),
+      p(Const::RECORD_SCRYPT_P),
+      maxWorkers(ThreadPool::get().getThreadCount() + 1),
+      memoryBudget(0),
+      trialTime(DEFAULT_TRIAL_TIME)
+{
+  long pages = sysconf(_SC_PHYS_PAGES), pageSize = sysconf(_SC_PAGESIZE);
+  if (pages > 0 && pageSize > 0)
+    memoryBudget = static_cast<size_t>(pages) * pageSize / 2;
+  else
+    memoryBudget = Scrypt::DEFAULT_LANE_BUDGET;
+}
+
+
+
+double PowCalibration::Result::getWorkerRate() const
+{
+  return workers > 0 ? hashRate / workers : 0;
+}
+
+
+
+std::string PowCalibration::Result::describe() const
+{
+  std::string kernelName =
+      backend == CpuBackend::get().getName()
+          ? std::string(Scrypt::getName(kernel)) + " kernel, "
+          : "";
+  return std::to_string(hashRate) + " H/s with the " + backend +
+         " backend, " + kernelName + std::to_string(lanes) + " lanes and " +
+         std::to_string(workers) + " workers";
+}
+
+
+
+// Times the configurations described above and remembers the best, for
+// getLast() and Record::makeValid, but leaves the scrypt settings as they
+// were; apply() puts the result into effect. This takes a trial time for
+// each configuration, and so some tens of seconds.
+PowCalibration::Result PowCalibration::run(PowBackend& backend,
+                                           const Options& options)
+{
+  if (!backend.isAvailable())
+    Log::get().error("The " + backend.getName() + " backend is unavailable.");
+
+  const uint64_t perLane = 128 * uint64_t(options.r) * options.N;
+  const size_t maxWorkers = std::max<size_t>(options.maxWorkers, 1);
+  auto fits = [&](size_t lanes, size_t workers)
+  {  // the first trial always runs, whatever the budget
+    return (lanes == 1 && workers == 1) ||
+           perLane * lanes * workers <= options.memoryBudget;
+  };
+
+  Result best;
+  best.backend = backend.getName();
+  best.kernel = Scrypt::getKernel();
+  best.lanes = backend.getBatchSize(options.N, options.r);
+  best.workers = 1;
+  best.hashRate = 0;
+
+  const bool cpu = &backend == &CpuBackend::get();
+  const Scrypt::Kernel original = Scrypt::getKernel();
+  if (cpu)
+  {
+    const Scrypt::Kernel KERNELS[] = {Scrypt::Kernel::Scalar,
+                                      Scrypt::Kernel::SSE2,
+                                      Scrypt::Kernel::AVX2,
+                                      Scrypt::Kernel::NEON};
+    for (auto kernel : KERNELS)
+    {
+      if (!Scrypt::setKernel(kernel))
+        continue;  // not on this CPU
+
+      for (size_t lanes = 1; lanes <= Scrypt::MAX_LANES && fits(lanes, 1);
+           lanes *= 2)
+      {
+        double rate = measure(backend, options, lanes, 1);
+        LOG_NOTICE(std::string(Scrypt::getName(kernel)) + " kernel, " +
+                   std::to_string(lanes) + " lanes: " +
+                   std::to_string(rate) + " H/s");
+        if (rate > best.hashRate)
+        {
+          best.kernel = kernel;
+          best.lanes = lanes;
+          best.hashRate = rate;
+        }
+      }
+    }
+
+    Scrypt::setKernel(best.kernel);  // for the worker trials
+  }
+  else
+    best.hashRate = measure(backend, options, best.lanes, 1);
+
+  try
+  {
+    for (size_t workers = 2; workers <= maxWorkers; workers *= 2)
+    {
+      // with many workers, fewer lanes each may be all that fits
+      size_t lanes = best.lanes;
+      while (cpu && lanes > 1 && !fits(lanes, workers))
+        lanes /= 2;
+      if (cpu && !fits(lanes, workers))
+        break;
+
+      double rate = measure(backend, options, lanes, workers);
+      LOG_NOTICE(std::to_string(workers) + " workers, " +
+                 std::to_string(lanes) + " lanes: " + std::to_string(rate) +
+                 " H/s");
+      if (rate < best.hashRate * 1.05)
+        break;  // the memory bus or the cores are saturated
+
+      best.lanes = lanes;
+      best.workers = workers;
+      best.hashRate = rate;
+    }
+  }
+  catch (...)
+  {
+    Scrypt::setKernel(original);
+    throw;
+  }
+
+  Scrypt::setKernel(original);
+  LOG_NOTICE("Calibrated: " + best.describe());
+  std::lock_guard<std::mutex> guard(resultsMutex_);
+  results_[best.backend] = best;
+  return best;
+}
+
+
+
+// Picks the calibrated kernel, and a lane budget that gives the calibrated
+// lane width for the record parameters. The worker count is for the
+// caller to pass to Record::makeValid.
+void PowCalibration::apply(const Result& result)
+{
+  if (result.backend != CpuBackend::get().getName())
+    return;
+
+  Scrypt::setKernel(result.kernel);
+  Scrypt::setLaneBudget(result.lanes * 128 *  // r is 1 for Records
+                        uint64_t(Const::RECORD_SCRYPT_N));
+}
+
+
+
+// the last calibration of the backend, if it has been calibrated
+bool PowCalibration::getLast(const PowBackend& backend, Result& result)
+{
+  std::lock_guard<std::mutex> guard(resultsMutex_);
+  auto last = results_.find(backend.getName());
+  if (last == results_.end())
+    return false;
+
+  result = last->second;
+  return true;
+}
+
+
+
+// Each attempt succeeds with a chance of 2^-difficulty, independently of
+// the others, so the expected time left is the same however long the
+// search has already run.
+PowCalibration::Estimate PowCalibration::estimate(uint32_t difficulty,
+                                                  uint64_t attempts,
+                                                  double hashRate)
+{
+  const double p = std::ldexp(1.0, -static_cast<int>(difficulty));
+  Estimate estimate;
+  estimate.expectedSeconds = hashRate > 0
+                                 ? 1 / (p * hashRate)
+                                 : std::numeric_limits<double>::infinity();
+  estimate.chanceSoFar = -std::expm1(attempts * std::log1p(-p));
+  return estimate;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// Attempts per second over one trial. Batches in progress when the trial
+// time runs out are finished, and counted, rather than cancelled.
+double PowCalibration::measure(PowBackend& backend,
+                               const Options& options,
+                               size_t lanes,
+                               size_t workers)
+{
+  static const uint8_t SALT[Const::RECORD_SCRYPT_SALT_LEN] = {0};
+  const size_t PASS_LEN = 512;  // about a Record's central encoding
+
+  std::vector<std::vector<uint8_t>> pass(workers * lanes,
+                                         std::vector<uint8_t>(PASS_LEN, 0));
+  std::vector<std::vector<uint8_t>> out(
+      workers * lanes, std::vector<uint8_t>(Const::RECORD_SCRYPTED_LEN));
+
+  NonceSearch search(workers);
+  const auto deadline = NonceSearch::Clock::now() + options.trialTime;
+  search.run(
+      [&](size_t worker, const uint32_t* nonces, size_t count,
+          const std::atomic<bool>&) -> size_t
+      {
+        std::vector<const uint8_t*> in(count);
+        std::vector<size_t> inLen(count, PASS_LEN);
+        std::vector<uint8_t*> outs(count);
+        for (size_t l = 0; l < count; l++)
+        {
+          auto& bytes = pass[worker * lanes + l];
+          memcpy(bytes.data(), &nonces[l], sizeof(nonces[l]));
+          in[l] = bytes.data();
+          outs[l] = out[worker * lanes + l].data();
+        }
+
+        if (backend.compute(in.data(), inLen.data(), SALT, sizeof(SALT),
+                            options.N, options.r, options.p, outs.data(),
+                            Const::RECORD_SCRYPTED_LEN, count) < 0)
+          Log::get().error("Scrypt failed during calibration.");
+
+        if (worker == 0 && NonceSearch::Clock::now() >= deadline)
+          search.cancel();
+        return count;
+      },
+      lanes);
+
+  return search.getProgress().getHashRate();
+}
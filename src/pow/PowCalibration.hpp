@@ -0,0 +1,63 @@
+#ifndef POW_CALIBRATION_HPP
+#define POW_CALIBRATION_HPP
+
+#include "PowBackend.hpp"
+#include "Scrypt.hpp"
+#include <chrono>
+
+// Measures how fast this machine computes the proof-of-work, so that the
+// worker count and lane width can be chosen for it, and so that a search
+// can say how long it should take. On the CPU backend every supported
+// scrypt kernel is timed at every lane width that fits, on one worker; the
+// best of those is then timed on more and more workers until that stops
+// paying. Other backends are only timed over worker counts. Each trial runs
+// the real scrypt parameters through NonceSearch, as Record::makeValid
+// does, until the trial time has passed, and trials whose scratch memory
+// would exceed the memory budget are skipped.
+class PowCalibration
+{
+ public:
+  static const int DEFAULT_TRIAL_TIME = 2000;  // ms per configuration
+
+  struct Options
+  {
+    Options();
+
+    uint64_t N;
+    uint32_t r, p;
+    size_t maxWorkers;     // default: the ThreadPool's threads and the caller
+    size_t memoryBudget;   // bytes; default: half the physical memory
+    std::chrono::milliseconds trialTime;
+  };
+
+  struct Result
+  {
+    std::string backend;
+    Scrypt::Kernel kernel;  // only meaningful for the CPU backend
+    size_t lanes, workers;
+    double hashRate;  // attempts per second with all of those workers
+
+    double getWorkerRate() const;
+    std::string describe() const;
+  };
+
+  // how long an unfinished search should still take, and how likely it
+  // was to have finished by now
+  struct Estimate
+  {
+    double expectedSeconds;
+    double chanceSoFar;
+  };
+
+  static Result run(PowBackend& = PowBackend::getDefault(),
+                    const Options& = Options());
+  static void apply(const Result&);
+  static bool getLast(const PowBackend&, Result&);
+
+  static Estimate estimate(uint32_t, uint64_t, double);
+
+ private:
+  static double measure(PowBackend&, const Options&, size_t, size_t);
+};
+
+#endif
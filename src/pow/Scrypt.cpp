@@ -0,0 +1,440 @@
+
+#include "Scrypt.hpp"
+#include "ScryptKernels.hpp"
+#include "../Metrics.hpp"
+#include <botan/sha2_32.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__arm__) && defined(SCRYPT_HAVE_NEON)
+#include <sys/auxv.h>
+#define SCRYPT_HWCAP_NEON (1 << 12)
+#endif
+
+const size_t Scrypt::MAX_LANES;
+const size_t Scrypt::DEFAULT_LANE_BUDGET;
+const size_t Scrypt::HmacKey::BLOCK;
+static std::atomic<uint8_t> kernel_(0xFF);  // 0xFF until detected
+static std::atomic<size_t> laneBudget_(Scrypt::DEFAULT_LANE_BUDGET);
+
+
+
+// behaves like libscrypt_scrypt: returns 0 on success, -1 with errno set.
+// Working memory comes from the calling thread's ScryptScratch. With a
+// cancellation flag, the kernels poll it inside ROMix and give up with
+// ECANCELED soon after it is set.
+int Scrypt::compute(const uint8_t* pass,
+                    size_t passLen,
+                    const uint8_t* salt,
+                    size_t saltLen,
+                    uint64_t N,
+                    uint32_t r,
+                    uint32_t p,
+                    uint8_t* out,
+                    size_t outLen,
+                    const std::atomic<bool>* cancel)
+{
+  return compute(pass, passLen, salt, saltLen, N, r, p, out, outLen,
+                 ScryptScratch::local(), cancel);
+}
+
+
+
+int Scrypt::compute(const uint8_t* pass,
+                    size_t passLen,
+                    const uint8_t* salt,
+                    size_t saltLen,
+                    uint64_t N,
+                    uint32_t r,
+                    uint32_t p,
+                    uint8_t* out,
+                    size_t outLen,
+                    ScryptScratch& scratch,
+                    const std::atomic<bool>* cancel)
+{
+  int error = checkParameters(N, r, p, outLen, 1);
+  if (error == 0 && !scratch.reserve(N, r, p))
+    error = ENOMEM;
+
+  if (error != 0)
+  {
+    errno = error;
+    return -1;
+  }
+
+  static Metrics::Counter& hashes = Metrics::get().counter(
+      "onions_scrypt_hashes_total", "Scrypt hashes computed, counting lanes.");
+  hashes.add();
+
+  ScryptKernels::SMix smix = getSMix(getKernel());
+  uint8_t* B = scratch.getB();
+
+  HmacKey key;
+  prepareKey(pass, passLen, key);
+  pbkdf2(key, salt, saltLen, B, 128 * r * p);
+  for (uint32_t i = 0; i < p; i++)
+    if (!smix(&B[128 * r * i], r, N, scratch.getV(), scratch.getXY(), cancel))
+    {
+      errno = ECANCELED;
+      return -1;
+    }
+  pbkdf2(key, B, 128 * r * p, out, outLen);
+
+  return 0;
+}
+
+
+
+// Computes scrypt over several inputs with the same salt and parameters,
+// such as one Record under different nonces, interleaving them in SIMD
+// registers. Lanes run together in groups of 8 or 4, padded if need be,
+// since fewer than three gain nothing over the single-lane kernel.
+// Each lane needs its own V, so memory grows with the lanes.
+int Scrypt::computeLanes(const uint8_t* const* pass,
+                         const size_t* passLen,
+                         const uint8_t* salt,
+                         size_t saltLen,
+                         uint64_t N,
+                         uint32_t r,
+                         uint32_t p,
+                         uint8_t* const* out,
+                         size_t outLen,
+                         size_t lanes,
+                         const std::atomic<bool>* cancel,
+                         ScryptScratch& scratch)
+{
+  int error = lanes == 0 || lanes > MAX_LANES
+                  ? EINVAL
+                  : checkParameters(N, r, p, outLen, lanes);
+  if (error == 0 && !scratch.reserve(N, r, p, lanes))
+    error = ENOMEM;
+
+  if (error != 0)
+  {
+    errno = error;
+    return -1;
+  }
+
+  static Metrics::Counter& hashes = Metrics::get().counter(
+      "onions_scrypt_hashes_total", "Scrypt hashes computed, counting lanes.");
+  hashes.add(lanes);
+
+  HmacKey keys[MAX_LANES];
+  for (size_t l = 0; l < lanes; l++)
+  {
+    prepareKey(pass[l], passLen[l], keys[l]);
+    pbkdf2(keys[l], salt, saltLen, scratch.getB(l), 128 * r * p);
+  }
+
+  for (uint32_t i = 0; i < p; i++)
+    for (size_t first = 0; first < lanes;)
+    {
+      size_t count = lanes - first, width = getLaneWidth(count);
+      if (width == 1)
+      {
+        if (!getSMix(getKernel())(scratch.getB(first) + 128 * r * i, r, N,
+                                  scratch.getV(first), scratch.getXY(),
+                                  cancel))
+        {
+          errno = ECANCELED;
+          return -1;
+        }
+
+        first++;
+        continue;
+      }
+
+      // spare lanes repeat the group's first one, although they work
+      // in step with it on the same memory, so they read and write the
+      // same values at the same time
+      uint8_t* B[MAX_LANES];
+      uint32_t* V[MAX_LANES];
+      for (size_t l = 0; l < width; l++)
+      {
+        size_t lane = first + (l < count ? l : 0);
+        B[l] = scratch.getB(lane) + 128 * r * i;
+        V[l] = scratch.getV(lane);
+      }
+
+      if (!getSMixLanes(width)(B, r, N, V, scratch.getXY(), cancel))
+      {
+        errno = ECANCELED;
+        return -1;
+      }
+
+      first += std::min(count, width);
+    }
+
+  for (size_t l = 0; l < lanes; l++)
+    pbkdf2(keys[l], scratch.getB(l), 128 * r * p, out[l], outLen);
+
+  return 0;
+}
+
+
+
+// the number of lanes whose memory fits in the lane budget, at least one
+size_t Scrypt::getLaneCount(uint64_t N, uint32_t r)
+{
+  uint64_t perLane = 128 * uint64_t(r) * N;
+  uint64_t fits = perLane > 0 ? getLaneBudget() / perLane : MAX_LANES;
+  if (fits > MAX_LANES)
+    return MAX_LANES;
+
+  return fits > 0 ? static_cast<size_t>(fits) : 1;
+}
+
+
+
+size_t Scrypt::getLaneBudget()
+{
+  return laneBudget_.load(std::memory_order_relaxed);
+}
+
+
+
+// bounds the V memory of each multi-lane call, and so of each PoW worker
+void Scrypt::setLaneBudget(size_t bytes)
+{
+  laneBudget_.store(bytes, std::memory_order_relaxed);
+}
+
+
+
+Scrypt::Kernel Scrypt::getKernel()
+{
+  uint8_t kernel = kernel_.load(std::memory_order_relaxed);
+  if (kernel == 0xFF)
+  {
+    kernel = static_cast<uint8_t>(detectKernel());
+    kernel_.store(kernel, std::memory_order_relaxed);
+  }
+
+  return static_cast<Kernel>(kernel);
+}
+
+
+
+// forces a kernel, returns false if this CPU cannot run it
+bool Scrypt::setKernel(Kernel kernel)
+{
+  if (!isSupported(kernel))
+    return false;
+
+  kernel_.store(static_cast<uint8_t>(kernel), std::memory_order_relaxed);
+  return true;
+}
+
+
+
+bool Scrypt::isSupported(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return true;
+
+#ifdef SCRYPT_HAVE_X86
+    case Kernel::SSE2:
+      return __builtin_cpu_supports("sse2");
+    case Kernel::AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+
+#ifdef SCRYPT_HAVE_NEON
+    case Kernel::NEON:
+#ifdef __arm__
+      return (getauxval(AT_HWCAP) & SCRYPT_HWCAP_NEON) != 0;
+#else
+      return true;  // NEON is mandatory on AArch64
+#endif
+#endif
+
+    default:
+      return false;
+  }
+}
+
+
+
+const char* Scrypt::getName(Kernel kernel)
+{
+  switch (kernel)
+  {
+    case Kernel::Scalar:
+      return "scalar";
+    case Kernel::SSE2:
+      return "SSE2";
+    case Kernel::AVX2:
+      return "AVX2";
+    case Kernel::NEON:
+      return "NEON";
+  }
+
+  return "unknown";
+}
+
+
+
+// returns an errno value, in the order that libscrypt checks them
+int Scrypt::checkParameters(uint64_t N,
+                            uint32_t r,
+                            uint32_t p,
+                            size_t outLen,
+                            size_t lanes)
+{
+  if (uint64_t(outLen) > ((uint64_t(1) << 32) - 1) * 32 ||
+      uint64_t(r) * uint64_t(p) >= (1 << 30))
+    return EFBIG;
+
+  if (r == 0 || p == 0 || (N & (N - 1)) != 0 || N < 2)
+    return EINVAL;
+
+  if (r > SIZE_MAX / 128 / p || r > SIZE_MAX / 256 || N > SIZE_MAX / 128 / r ||
+      128 * r * N > SIZE_MAX / lanes - 128 * r * p - 256 * r - 64)
+    return ENOMEM;
+
+  return 0;
+}
+
+
+
+// PBKDF2-HMAC-SHA256 with a single iteration, as scrypt uses it. Botan's
+// PBKDF2 refuses HMAC keys over 512 bytes, which Record buffers can exceed.
+void Scrypt::pbkdf2(const uint8_t* pass,
+                    size_t passLen,
+                    const uint8_t* salt,
+                    size_t saltLen,
+                    uint8_t* out,
+                    size_t outLen)
+{
+  HmacKey key;
+  prepareKey(pass, passLen, key);
+  pbkdf2(key, salt, saltLen, out, outLen);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+Scrypt::Kernel Scrypt::detectKernel()
+{
+  static const Kernel PREFERENCE[] = {Kernel::AVX2, Kernel::SSE2,
+                                      Kernel::NEON};
+
+  for (auto kernel : PREFERENCE)
+    if (isSupported(kernel))
+      return kernel;
+
+  return Kernel::Scalar;
+}
+
+
+
+ScryptKernels::SMix Scrypt::getSMix(Kernel kernel)
+{
+  switch (kernel)
+  {
+#ifdef SCRYPT_HAVE_X86
+    case Kernel::SSE2:
+      return ScryptKernels::smixSSE2;
+    case Kernel::AVX2:
+      return ScryptKernels::smixAVX2;
+#endif
+
+#ifdef SCRYPT_HAVE_NEON
+    case Kernel::NEON:
+      return ScryptKernels::smixNEON;
+#endif
+
+    default:
+      return ScryptKernels::smixScalar;
+  }
+}
+
+
+
+// the group size for the given number of remaining lanes; eight lanes only
+// pay off when they fit one AVX2 register
+size_t Scrypt::getLaneWidth(size_t lanes)
+{
+  if (lanes > 4 && getKernel() == Kernel::AVX2)
+    return 8;
+  if (lanes > 2)
+    return 4;
+  return 1;
+}
+
+
+
+ScryptKernels::SMixLanes Scrypt::getSMixLanes(size_t width)
+{
+#ifdef SCRYPT_HAVE_X86
+  if (width == 8)
+    return ScryptKernels::smixLanes8AVX2;
+#endif
+
+  return ScryptKernels::smixLanes4;
+}
+
+
+
+// Both PBKDF2 passes of scrypt use the password as the HMAC key, and a
+// Record's is longer than a block, so it is hashed down only once for both.
+void Scrypt::prepareKey(const uint8_t* pass, size_t passLen, HmacKey& key)
+{
+  uint8_t block[HmacKey::BLOCK] = {0};
+  if (passLen > HmacKey::BLOCK)
+  {
+    Botan::SHA_256 sha256;
+    sha256.update(pass, passLen);
+    sha256.final(block);
+  }
+  else if (passLen > 0)
+    memcpy(block, pass, passLen);
+
+  for (size_t j = 0; j < HmacKey::BLOCK; j++)
+  {
+    key.ipad[j] = block[j] ^ 0x36;
+    key.opad[j] = block[j] ^ 0x5c;
+  }
+}
+
+
+
+void Scrypt::pbkdf2(const HmacKey& key,
+                    const uint8_t* salt,
+                    size_t saltLen,
+                    uint8_t* out,
+                    size_t outLen)
+{
+  const size_t BLOCK = HmacKey::BLOCK, DIGEST = 32;
+  Botan::SHA_256 sha256;
+
+  uint8_t inner[DIGEST], block[DIGEST];
+  for (uint32_t i = 1; outLen > 0; i++)
+  {
+    uint8_t counter[4] = {static_cast<uint8_t>(i >> 24),
+                          static_cast<uint8_t>(i >> 16),
+                          static_cast<uint8_t>(i >> 8),
+                          static_cast<uint8_t>(i)};
+
+    sha256.update(key.ipad, BLOCK);
+    sha256.update(salt, saltLen);
+    sha256.update(counter, sizeof(counter));
+    sha256.final(inner);
+
+    sha256.update(key.opad, BLOCK);
+    sha256.update(inner, DIGEST);
+    sha256.final(block);
+
+    size_t n = outLen < DIGEST ? outLen : DIGEST;
+    memcpy(out, block, n);
+    out += n;
+    outLen -= n;
+  }
+}
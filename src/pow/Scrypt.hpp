@@ -0,0 +1,96 @@
+#ifndef SCRYPT_HPP
+#define SCRYPT_HPP
+
+#include "ScryptKernels.hpp"
+#include "ScryptScratch.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+// scrypt (RFC 7914), computing the same output as libscrypt_scrypt, with the
+// Salsa20/8 core and BlockMix vectorized for the CPU. The fastest kernel
+// that the CPU supports is picked the first time scrypt runs. Independent
+// inputs can also be computed side by side, one per SIMD lane.
+class Scrypt
+{
+ public:
+  enum class Kernel : uint8_t
+  {
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+  };
+
+  static int compute(const uint8_t*,
+                     size_t,
+                     const uint8_t*,
+                     size_t,
+                     uint64_t,
+                     uint32_t,
+                     uint32_t,
+                     uint8_t*,
+                     size_t,
+                     const std::atomic<bool>* cancel = nullptr);
+  static int compute(const uint8_t*,
+                     size_t,
+                     const uint8_t*,
+                     size_t,
+                     uint64_t,
+                     uint32_t,
+                     uint32_t,
+                     uint8_t*,
+                     size_t,
+                     ScryptScratch&,
+                     const std::atomic<bool>* cancel = nullptr);
+
+  static const size_t MAX_LANES = 8;
+  static const size_t DEFAULT_LANE_BUDGET = 512 * 1024 * 1024;
+
+  static int computeLanes(const uint8_t* const*,
+                          const size_t*,
+                          const uint8_t*,
+                          size_t,
+                          uint64_t,
+                          uint32_t,
+                          uint32_t,
+                          uint8_t* const*,
+                          size_t,
+                          size_t,
+                          const std::atomic<bool>* cancel = nullptr,
+                          ScryptScratch& = ScryptScratch::local());
+  static size_t getLaneCount(uint64_t, uint32_t);
+  static size_t getLaneBudget();
+  static void setLaneBudget(size_t);
+
+  static Kernel getKernel();
+  static bool setKernel(Kernel);
+  static bool isSupported(Kernel);
+  static const char* getName(Kernel);
+
+  // the steps around SMix, for other implementations such as a PowBackend
+  static int checkParameters(uint64_t, uint32_t, uint32_t, size_t, size_t);
+  static void pbkdf2(const uint8_t*,
+                     size_t,
+                     const uint8_t*,
+                     size_t,
+                     uint8_t*,
+                     size_t);
+
+ private:
+  // the HMAC-SHA256 pads for one password
+  struct HmacKey
+  {
+    static const size_t BLOCK = 64;
+    uint8_t ipad[BLOCK], opad[BLOCK];
+  };
+
+  static void prepareKey(const uint8_t*, size_t, HmacKey&);
+  static void pbkdf2(const HmacKey&, const uint8_t*, size_t, uint8_t*, size_t);
+  static Kernel detectKernel();
+  static ScryptKernels::SMix getSMix(Kernel);
+  static size_t getLaneWidth(size_t);
+  static ScryptKernels::SMixLanes getSMixLanes(size_t);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SCRYPT_KERNELS_HPP
+#define SCRYPT_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCRYPT_HAVE_X86
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define SCRYPT_HAVE_NEON
+#endif
+
+// Implementations of SMix_r(B, N) (RFC 7914, section 5) for Scrypt to pick
+// from. B is 128r bytes, V is 128rN bytes, and XY is 256r + 64 bytes, all
+// 64-byte aligned. A kernel may keep its working blocks in whatever word
+// order suits it, but B is always in the standard little-endian layout.
+// Given a cancellation flag, a kernel polls it every POLL_INTERVAL
+// iterations of ROMix and returns false as soon as it sees it set.
+class ScryptKernels
+{
+ public:
+  static const uint64_t POLL_INTERVAL = 1024;  // ms or less, even on ARM
+
+  static bool isCancelled(const std::atomic<bool>* cancel, uint64_t i)
+  {
+    return cancel && i % POLL_INTERVAL == 0 &&
+           cancel->load(std::memory_order_relaxed);
+  }
+
+  typedef bool (*SMix)(uint8_t*,
+                       size_t,
+                       uint64_t,
+                       uint32_t*,
+                       uint32_t*,
+                       const std::atomic<bool>*);
+
+  static bool smixScalar(uint8_t*,
+                         size_t,
+                         uint64_t,
+                         uint32_t*,
+                         uint32_t*,
+                         const std::atomic<bool>*);
+
+#ifdef SCRYPT_HAVE_X86
+  static bool smixSSE2(uint8_t*,
+                       size_t,
+                       uint64_t,
+                       uint32_t*,
+                       uint32_t*,
+                       const std::atomic<bool>*);
+  static bool smixAVX2(uint8_t*,
+                       size_t,
+                       uint64_t,
+                       uint32_t*,
+                       uint32_t*,
+                       const std::atomic<bool>*);
+#endif
+
+#ifdef SCRYPT_HAVE_NEON
+  static bool smixNEON(uint8_t*,
+                       size_t,
+                       uint64_t,
+                       uint32_t*,
+                       uint32_t*,
+                       const std::atomic<bool>*);
+#endif
+
+  // The same over W independent inputs at once, with B and V given per lane
+  // and XY holding W interleaved copies of the working blocks, so it takes
+  // (256r + 64)W bytes.
+  typedef bool (*SMixLanes)(uint8_t* const*,
+                            size_t,
+                            uint64_t,
+                            uint32_t* const*,
+                            uint32_t*,
+                            const std::atomic<bool>*);
+
+  static bool smixLanes4(uint8_t* const*,
+                         size_t,
+                         uint64_t,
+                         uint32_t* const*,
+                         uint32_t*,
+                         const std::atomic<bool>*);
+
+#ifdef SCRYPT_HAVE_X86
+  static bool smixLanes8AVX2(uint8_t* const*,
+                             size_t,
+                             uint64_t,
+                             uint32_t* const*,
+                             uint32_t*,
+                             const std::atomic<bool>*);
+#endif
+};
+
+#endif
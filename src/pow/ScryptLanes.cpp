@@ -0,0 +1,216 @@
+
+// SMix over several independent inputs at once. Word k of every lane sits
+// side by side in one vector, so Salsa20/8 runs exactly as in the scalar
+// kernel, only on whole vectors, using GCC's generic vector extensions. The
+// lanes draw from V at unrelated indices, so V stays per lane and blocks
+// are transposed on their way in and out of it; this also overlaps the
+// lanes' cache misses on V, which is where scrypt spends its time at large N.
+
+#include "ScryptKernels.hpp"
+#include <utility>
+
+#define LANES_INLINE __attribute__((always_inline)) inline
+
+template <size_t W>
+struct Lanes
+{
+  typedef uint32_t Vector __attribute__((vector_size(4 * W)));
+};
+
+
+
+// x ^= t <<< b, with vectors passed by reference to keep them in registers
+// regardless of the calling convention
+template <typename V>
+static LANES_INLINE void xorRotate(V& x, const V& t, int b)
+{
+  x ^= (t << b) | (t >> (32 - b));
+}
+
+
+
+template <typename V>
+static LANES_INLINE void salsa20_8(V B[16])
+{
+  V x[16];
+  for (int i = 0; i < 16; i++)
+    x[i] = B[i];
+
+  for (int i = 0; i < 8; i += 2)
+  {
+    // operate on columns
+    xorRotate(x[4], x[0] + x[12], 7);
+    xorRotate(x[8], x[4] + x[0], 9);
+    xorRotate(x[12], x[8] + x[4], 13);
+    xorRotate(x[0], x[12] + x[8], 18);
+
+    xorRotate(x[9], x[5] + x[1], 7);
+    xorRotate(x[13], x[9] + x[5], 9);
+    xorRotate(x[1], x[13] + x[9], 13);
+    xorRotate(x[5], x[1] + x[13], 18);
+
+    xorRotate(x[14], x[10] + x[6], 7);
+    xorRotate(x[2], x[14] + x[10], 9);
+    xorRotate(x[6], x[2] + x[14], 13);
+    xorRotate(x[10], x[6] + x[2], 18);
+
+    xorRotate(x[3], x[15] + x[11], 7);
+    xorRotate(x[7], x[3] + x[15], 9);
+    xorRotate(x[11], x[7] + x[3], 13);
+    xorRotate(x[15], x[11] + x[7], 18);
+
+    // operate on rows
+    xorRotate(x[1], x[0] + x[3], 7);
+    xorRotate(x[2], x[1] + x[0], 9);
+    xorRotate(x[3], x[2] + x[1], 13);
+    xorRotate(x[0], x[3] + x[2], 18);
+
+    xorRotate(x[6], x[5] + x[4], 7);
+    xorRotate(x[7], x[6] + x[5], 9);
+    xorRotate(x[4], x[7] + x[6], 13);
+    xorRotate(x[5], x[4] + x[7], 18);
+
+    xorRotate(x[11], x[10] + x[9], 7);
+    xorRotate(x[8], x[11] + x[10], 9);
+    xorRotate(x[9], x[8] + x[11], 13);
+    xorRotate(x[10], x[9] + x[8], 18);
+
+    xorRotate(x[12], x[15] + x[14], 7);
+    xorRotate(x[13], x[12] + x[15], 9);
+    xorRotate(x[14], x[13] + x[12], 13);
+    xorRotate(x[15], x[14] + x[13], 18);
+  }
+
+  for (int i = 0; i < 16; i++)
+    B[i] += x[i];
+}
+
+
+
+// Bout = BlockMix_{salsa20/8, r}(Bin), with X as one block of scratch
+template <typename V>
+static LANES_INLINE void blockmix(const V* Bin, V* Bout, V* X, size_t r)
+{
+  for (int k = 0; k < 16; k++)
+    X[k] = Bin[(2 * r - 1) * 16 + k];
+
+  for (size_t i = 0; i < 2 * r; i += 2)
+  {
+    for (int k = 0; k < 16; k++)
+      X[k] ^= Bin[i * 16 + k];
+    salsa20_8(X);
+    for (int k = 0; k < 16; k++)
+      Bout[i * 8 + k] = X[k];  // even blocks go to the first half
+
+    for (int k = 0; k < 16; k++)
+      X[k] ^= Bin[i * 16 + 16 + k];
+    salsa20_8(X);
+    for (int k = 0; k < 16; k++)
+      Bout[i * 8 + r * 16 + k] = X[k];  // odd blocks to the second half
+  }
+}
+
+
+
+// R, if not 0, is r as a constant, which unrolls BlockMix completely
+template <size_t W, size_t R>
+static LANES_INLINE bool smixLanes(uint8_t* const* B,
+                                   size_t rArg,
+                                   uint64_t N,
+                                   uint32_t* const* V,
+                                   uint32_t* XY,
+                                   const std::atomic<bool>* cancel)
+{
+  const size_t r = R ? R : rArg;
+  typedef typename Lanes<W>::Vector Vector;
+  Vector* X = reinterpret_cast<Vector*>(XY);
+  Vector* Y = X + 32 * r;
+  Vector* Z = Y + 32 * r;
+  const size_t words = 32 * r;
+
+  for (size_t l = 0; l < W; l++)
+    for (size_t k = 0; k < words; k++)
+    {
+      const uint8_t* p = &B[l][4 * k];
+      X[k][l] = uint32_t(p[0]) | (uint32_t(p[1]) << 8) |
+                (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+  for (uint64_t i = 0; i < N; i++)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    for (size_t l = 0; l < W; l++)
+      for (size_t k = 0; k < words; k++)
+        V[l][i * words + k] = X[k][l];
+
+    blockmix(X, Y, Z, r);
+    std::swap(X, Y);
+  }
+
+  for (uint64_t i = 0; i < N; i++)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    const Vector* last = &X[(2 * r - 1) * 16];
+    for (size_t l = 0; l < W; l++)
+    {
+      uint64_t j = ((uint64_t(last[1][l]) << 32) + last[0][l]) & (N - 1);
+      const uint32_t* block = &V[l][j * words];
+      for (size_t k = 0; k < words; k++)
+        X[k][l] ^= block[k];
+    }
+
+    blockmix(X, Y, Z, r);
+    std::swap(X, Y);
+  }
+
+  // N is even, so the final blocks are back in the first half of XY
+  for (size_t l = 0; l < W; l++)
+    for (size_t k = 0; k < words; k++)
+    {
+      uint8_t* p = &B[l][4 * k];
+      uint32_t x = X[k][l];
+      p[0] = static_cast<uint8_t>(x);
+      p[1] = static_cast<uint8_t>(x >> 8);
+      p[2] = static_cast<uint8_t>(x >> 16);
+      p[3] = static_cast<uint8_t>(x >> 24);
+    }
+
+  return true;
+}
+
+
+
+bool ScryptKernels::smixLanes4(uint8_t* const* B,
+                               size_t r,
+                               uint64_t N,
+                               uint32_t* const* V,
+                               uint32_t* XY,
+                               const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smixLanes<4, 1>(B, r, N, V, XY, cancel)
+                : smixLanes<4, 0>(B, r, N, V, XY, cancel);
+}
+
+
+
+#ifdef SCRYPT_HAVE_X86
+
+// eight lanes fill one 256-bit register; on two SSE2 ones they would run
+// out of registers and be no faster than four
+__attribute__((target("avx2"))) bool ScryptKernels::smixLanes8AVX2(
+    uint8_t* const* B,
+    size_t r,
+    uint64_t N,
+    uint32_t* const* V,
+    uint32_t* XY,
+    const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smixLanes<8, 1>(B, r, N, V, XY, cancel)
+                : smixLanes<8, 0>(B, r, N, V, XY, cancel);
+}
+
+#endif
@@ -0,0 +1,191 @@
+
+// NEON Salsa20/8 and BlockMix, for ARM. The blocks use the same diagonal
+// layout as the SSE2 kernel in ScryptX86.cpp, with vext for lane rotations.
+
+#include "ScryptKernels.hpp"
+
+#ifdef SCRYPT_HAVE_NEON
+
+#include <arm_neon.h>
+#include <cstring>
+
+#define NEON_INLINE __attribute__((always_inline)) inline
+
+static inline uint32x4_t rotate(uint32x4_t x, uint32x4_t t, int b)
+{
+  x = veorq_u32(x, vshlq_u32(t, vdupq_n_s32(b)));
+  return veorq_u32(x, vshlq_u32(t, vdupq_n_s32(b - 32)));
+}
+
+
+
+static inline void salsa20_8(uint32x4_t B[4])
+{
+  uint32x4_t X0 = B[0], X1 = B[1], X2 = B[2], X3 = B[3];
+
+  for (int i = 0; i < 8; i += 2)
+  {
+    // operate on columns
+    X1 = rotate(X1, vaddq_u32(X0, X3), 7);
+    X2 = rotate(X2, vaddq_u32(X1, X0), 9);
+    X3 = rotate(X3, vaddq_u32(X2, X1), 13);
+    X0 = rotate(X0, vaddq_u32(X3, X2), 18);
+
+    // rearrange so that the rows line up
+    X1 = vextq_u32(X1, X1, 3);
+    X2 = vextq_u32(X2, X2, 2);
+    X3 = vextq_u32(X3, X3, 1);
+
+    // operate on rows
+    X3 = rotate(X3, vaddq_u32(X0, X1), 7);
+    X2 = rotate(X2, vaddq_u32(X3, X0), 9);
+    X1 = rotate(X1, vaddq_u32(X2, X3), 13);
+    X0 = rotate(X0, vaddq_u32(X1, X2), 18);
+
+    // and back again for the columns
+    X1 = vextq_u32(X1, X1, 1);
+    X2 = vextq_u32(X2, X2, 2);
+    X3 = vextq_u32(X3, X3, 3);
+  }
+
+  B[0] = vaddq_u32(B[0], X0);
+  B[1] = vaddq_u32(B[1], X1);
+  B[2] = vaddq_u32(B[2], X2);
+  B[3] = vaddq_u32(B[3], X3);
+}
+
+
+
+static inline void blkcpy(uint32x4_t* dest, const uint32x4_t* src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dest[i] = src[i];
+}
+
+
+
+static inline void blkxor(uint32x4_t* dest, const uint32x4_t* src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dest[i] = veorq_u32(dest[i], src[i]);
+}
+
+
+
+// Bout = BlockMix_{salsa20/8, r}(Bin), with X as 64 bytes of scratch
+static NEON_INLINE void blockmix(const uint32x4_t* Bin,
+                                 uint32x4_t* Bout,
+                                 uint32x4_t* X,
+                                 size_t r)
+{
+  blkcpy(X, &Bin[8 * r - 4], 4);
+
+  for (size_t i = 0; i < r; i++)
+  {
+    blkxor(X, &Bin[i * 8], 4);
+    salsa20_8(X);
+    blkcpy(&Bout[i * 4], X, 4);
+
+    blkxor(X, &Bin[i * 8 + 4], 4);
+    salsa20_8(X);
+    blkcpy(&Bout[(r + i) * 4], X, 4);
+  }
+}
+
+
+
+// words 0 and 1 of the last block sit at positions 0 and 13 once permuted
+static inline uint64_t integerify(const uint32x4_t* B, size_t r)
+{
+  const uint32_t* X = reinterpret_cast<const uint32_t*>(&B[8 * r - 4]);
+  return (uint64_t(X[13]) << 32) + X[0];
+}
+
+
+
+static inline uint32_t decodeLE(const uint8_t* p)
+{
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+
+
+static inline void encodeLE(uint8_t* p, uint32_t x)
+{
+  p[0] = static_cast<uint8_t>(x);
+  p[1] = static_cast<uint8_t>(x >> 8);
+  p[2] = static_cast<uint8_t>(x >> 16);
+  p[3] = static_cast<uint8_t>(x >> 24);
+}
+
+
+
+// R, if not 0, is r as a constant, which unrolls BlockMix completely
+template <size_t R>
+static NEON_INLINE bool smix(uint8_t* B,
+                             size_t rArg,
+                             uint64_t N,
+                             uint32_t* V,
+                             uint32_t* XY,
+                             const std::atomic<bool>* cancel)
+{
+  const size_t r = R ? R : rArg;
+  uint32x4_t* X = reinterpret_cast<uint32x4_t*>(XY);
+  uint32x4_t* Y = reinterpret_cast<uint32x4_t*>(XY + 32 * r);
+  uint32x4_t* Z = reinterpret_cast<uint32x4_t*>(XY + 64 * r);
+  uint32x4_t* V4 = reinterpret_cast<uint32x4_t*>(V);
+  uint32_t* X32 = XY;
+  const size_t vectors = 8 * r;
+
+  // ARM may run big-endian, so decode explicitly while permuting
+  for (size_t k = 0; k < 2 * r; k++)
+    for (size_t i = 0; i < 16; i++)
+      X32[k * 16 + i] = decodeLE(&B[(k * 16 + (i * 5 % 16)) * 4]);
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    blkcpy(&V4[i * vectors], X, vectors);
+    blockmix(X, Y, Z, r);
+    blkcpy(&V4[(i + 1) * vectors], Y, vectors);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    uint64_t j = integerify(X, r) & (N - 1);
+    blkxor(X, &V4[j * vectors], vectors);
+    blockmix(X, Y, Z, r);
+
+    j = integerify(Y, r) & (N - 1);
+    blkxor(Y, &V4[j * vectors], vectors);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (size_t k = 0; k < 2 * r; k++)
+    for (size_t i = 0; i < 16; i++)
+      encodeLE(&B[(k * 16 + (i * 5 % 16)) * 4], X32[k * 16 + i]);
+
+  return true;
+}
+
+
+
+bool ScryptKernels::smixNEON(uint8_t* B,
+                             size_t r,
+                             uint64_t N,
+                             uint32_t* V,
+                             uint32_t* XY,
+                             const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smix<1>(B, r, N, V, XY, cancel)
+                : smix<0>(B, r, N, V, XY, cancel);
+}
+
+#endif
@@ -0,0 +1,189 @@
+
+// Portable Salsa20/8 and BlockMix, after crypto_scrypt-nosse.c by Colin
+// Percival in libs/libscrypt
+
+#include "ScryptKernels.hpp"
+#include <cstring>
+
+#define SCALAR_INLINE __attribute__((always_inline)) inline
+
+static inline uint32_t rotate(uint32_t a, int b)
+{
+  return (a << b) | (a >> (32 - b));
+}
+
+
+
+static inline uint32_t decodeLE(const uint8_t* p)
+{
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+
+
+static inline void encodeLE(uint8_t* p, uint32_t x)
+{
+  p[0] = static_cast<uint8_t>(x);
+  p[1] = static_cast<uint8_t>(x >> 8);
+  p[2] = static_cast<uint8_t>(x >> 16);
+  p[3] = static_cast<uint8_t>(x >> 24);
+}
+
+
+
+static inline void blkxor(uint32_t* dest, const uint32_t* src, size_t words)
+{
+  for (size_t i = 0; i < words; i++)
+    dest[i] ^= src[i];
+}
+
+
+
+static void salsa20_8(uint32_t B[16])
+{
+  uint32_t x[16];
+  memcpy(x, B, 64);
+
+  for (int i = 0; i < 8; i += 2)
+  {
+    // operate on columns
+    x[4] ^= rotate(x[0] + x[12], 7);
+    x[8] ^= rotate(x[4] + x[0], 9);
+    x[12] ^= rotate(x[8] + x[4], 13);
+    x[0] ^= rotate(x[12] + x[8], 18);
+
+    x[9] ^= rotate(x[5] + x[1], 7);
+    x[13] ^= rotate(x[9] + x[5], 9);
+    x[1] ^= rotate(x[13] + x[9], 13);
+    x[5] ^= rotate(x[1] + x[13], 18);
+
+    x[14] ^= rotate(x[10] + x[6], 7);
+    x[2] ^= rotate(x[14] + x[10], 9);
+    x[6] ^= rotate(x[2] + x[14], 13);
+    x[10] ^= rotate(x[6] + x[2], 18);
+
+    x[3] ^= rotate(x[15] + x[11], 7);
+    x[7] ^= rotate(x[3] + x[15], 9);
+    x[11] ^= rotate(x[7] + x[3], 13);
+    x[15] ^= rotate(x[11] + x[7], 18);
+
+    // operate on rows
+    x[1] ^= rotate(x[0] + x[3], 7);
+    x[2] ^= rotate(x[1] + x[0], 9);
+    x[3] ^= rotate(x[2] + x[1], 13);
+    x[0] ^= rotate(x[3] + x[2], 18);
+
+    x[6] ^= rotate(x[5] + x[4], 7);
+    x[7] ^= rotate(x[6] + x[5], 9);
+    x[4] ^= rotate(x[7] + x[6], 13);
+    x[5] ^= rotate(x[4] + x[7], 18);
+
+    x[11] ^= rotate(x[10] + x[9], 7);
+    x[8] ^= rotate(x[11] + x[10], 9);
+    x[9] ^= rotate(x[8] + x[11], 13);
+    x[10] ^= rotate(x[9] + x[8], 18);
+
+    x[12] ^= rotate(x[15] + x[14], 7);
+    x[13] ^= rotate(x[12] + x[15], 9);
+    x[14] ^= rotate(x[13] + x[12], 13);
+    x[15] ^= rotate(x[14] + x[13], 18);
+  }
+
+  for (int i = 0; i < 16; i++)
+    B[i] += x[i];
+}
+
+
+
+// Bout = BlockMix_{salsa20/8, r}(Bin), with X as 64 bytes of scratch
+static SCALAR_INLINE void blockmix(const uint32_t* Bin,
+                                   uint32_t* Bout,
+                                   uint32_t* X,
+                                   size_t r)
+{
+  memcpy(X, &Bin[(2 * r - 1) * 16], 64);
+
+  for (size_t i = 0; i < 2 * r; i += 2)
+  {
+    blkxor(X, &Bin[i * 16], 16);
+    salsa20_8(X);
+    memcpy(&Bout[i * 8], X, 64);  // even blocks go to the first half
+
+    blkxor(X, &Bin[i * 16 + 16], 16);
+    salsa20_8(X);
+    memcpy(&Bout[i * 8 + r * 16], X, 64);  // odd blocks to the second half
+  }
+}
+
+
+
+static inline uint64_t integerify(const uint32_t* B, size_t r)
+{
+  const uint32_t* X = &B[(2 * r - 1) * 16];
+  return (uint64_t(X[1]) << 32) + X[0];
+}
+
+
+
+// R, if not 0, is r as a constant, which unrolls BlockMix completely
+template <size_t R>
+static SCALAR_INLINE bool smix(uint8_t* B,
+                               size_t rArg,
+                               uint64_t N,
+                               uint32_t* V,
+                               uint32_t* XY,
+                               const std::atomic<bool>* cancel)
+{
+  const size_t r = R ? R : rArg;
+  uint32_t* X = XY;
+  uint32_t* Y = &XY[32 * r];
+  uint32_t* Z = &XY[64 * r];
+  const size_t words = 32 * r;
+
+  for (size_t k = 0; k < words; k++)
+    X[k] = decodeLE(&B[4 * k]);
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    memcpy(&V[i * words], X, 128 * r);
+    blockmix(X, Y, Z, r);
+    memcpy(&V[(i + 1) * words], Y, 128 * r);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    uint64_t j = integerify(X, r) & (N - 1);
+    blkxor(X, &V[j * words], words);
+    blockmix(X, Y, Z, r);
+
+    j = integerify(Y, r) & (N - 1);
+    blkxor(Y, &V[j * words], words);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (size_t k = 0; k < words; k++)
+    encodeLE(&B[4 * k], X[k]);
+
+  return true;
+}
+
+
+
+bool ScryptKernels::smixScalar(uint8_t* B,
+                               size_t r,
+                               uint64_t N,
+                               uint32_t* V,
+                               uint32_t* XY,
+                               const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smix<1>(B, r, N, V, XY, cancel)
+                : smix<0>(B, r, N, V, XY, cancel);
+}
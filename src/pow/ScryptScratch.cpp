@@ -0,0 +1,166 @@
+
+#include "ScryptScratch.hpp"
+#include "../WorkerPlacement.hpp"
+#include <sys/mman.h>
+#include <atomic>
+
+const size_t ScryptScratch::HUGE_PAGE_SIZE;
+static std::atomic<uint8_t> defaultPages_(
+    static_cast<uint8_t>(ScryptScratch::Pages::Transparent));
+
+
+
+ScryptScratch::ScryptScratch(Pages pages)
+    : requested_(pages),
+      backing_(Pages::Normal),
+      base_(nullptr),
+      size_(0),
+      offsetB_(0),
+      offsetXY_(0),
+      laneB_(0),
+      laneV_(0)
+{
+}
+
+
+
+ScryptScratch::~ScryptScratch()
+{
+  release();
+}
+
+
+
+// makes room for scrypt with the given N, r, and p on as many lanes, returns
+// false if the memory could not be mapped. The V arrays come first, so the
+// first one is page-aligned and all of them are 64-byte aligned.
+bool ScryptScratch::reserve(uint64_t N, uint32_t r, uint32_t p, size_t lanes)
+{
+  laneV_ = 128 * r * N;
+  laneB_ = 128 * r * p;
+  size_t needed = (laneV_ + laneB_ + 256 * r + 64) * lanes;
+
+  if (needed > size_ && !map(needed, requested_))
+    return false;
+
+  offsetB_ = laneV_ * lanes;
+  offsetXY_ = offsetB_ + laneB_ * lanes;
+  return true;
+}
+
+
+
+void ScryptScratch::release()
+{
+  if (base_)
+    munmap(base_, size_);
+
+  base_ = nullptr;
+  size_ = 0;
+}
+
+
+
+uint8_t* ScryptScratch::getB(size_t lane) const
+{
+  return base_ + offsetB_ + laneB_ * lane;
+}
+
+
+
+uint32_t* ScryptScratch::getXY() const
+{
+  return reinterpret_cast<uint32_t*>(base_ + offsetXY_);
+}
+
+
+
+uint32_t* ScryptScratch::getV(size_t lane) const
+{
+  return reinterpret_cast<uint32_t*>(base_ + laneV_ * lane);
+}
+
+
+
+size_t ScryptScratch::getSize() const
+{
+  return size_;
+}
+
+
+
+ScryptScratch::Pages ScryptScratch::getPages() const
+{
+  return backing_;
+}
+
+
+
+ScryptScratch& ScryptScratch::local()
+{
+  static thread_local ScryptScratch scratch;
+  return scratch;
+}
+
+
+
+ScryptScratch::Pages ScryptScratch::getDefaultPages()
+{
+  return static_cast<Pages>(defaultPages_.load(std::memory_order_relaxed));
+}
+
+
+
+// applies to scratch areas created afterwards, including threads' local()
+void ScryptScratch::setDefaultPages(Pages pages)
+{
+  defaultPages_.store(static_cast<uint8_t>(pages), std::memory_order_relaxed);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+bool ScryptScratch::map(size_t length, Pages pages)
+{
+  release();
+
+  if (pages != Pages::Normal)  // whole huge pages only
+    length = (length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+  void* memory = MAP_FAILED;
+  const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_HUGETLB
+  if (pages == Pages::Explicit)
+  {
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                  flags | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+      backing_ = Pages::Explicit;
+  }
+#endif
+
+  if (memory == MAP_FAILED)
+  {
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED)
+      return false;
+
+    backing_ = Pages::Normal;
+#ifdef MADV_HUGEPAGE
+    if (pages != Pages::Normal && madvise(memory, length, MADV_HUGEPAGE) == 0)
+      backing_ = Pages::Transparent;
+#endif
+  }
+
+  // nothing is touched yet, so this places every page on the worker's node
+  if (WorkerPlacement::getNode() >= 0)
+    WorkerPlacement::bindMemory(memory, length, WorkerPlacement::getNode());
+
+  base_ = static_cast<uint8_t*>(memory);
+  size_ = length;
+  return true;
+}
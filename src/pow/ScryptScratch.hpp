@@ -0,0 +1,53 @@
+#ifndef SCRYPT_SCRATCH_HPP
+#define SCRYPT_SCRATCH_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// Caller-owned working memory for Scrypt. At the Record parameters each V
+// array is 128 MiB, so mapping and zeroing it on every call costs more than
+// it should. A scratch area grows to the largest size that it has been
+// asked for and is then reused. The memory can be backed by huge pages,
+// either transparent ones or from the explicit hugetlbfs pool, which keeps
+// ROMix's random reads of V from thrashing the TLB. On a worker pinned by
+// the WorkerPlacement, it is placed on that worker's NUMA node.
+class ScryptScratch
+{
+ public:
+  enum class Pages : uint8_t
+  {
+    Normal,
+    Transparent,  // madvise(MADV_HUGEPAGE), best effort
+    Explicit      // MAP_HUGETLB, falling back to Transparent
+  };
+
+  ScryptScratch(Pages = getDefaultPages());
+  ScryptScratch(const ScryptScratch&) = delete;
+  ScryptScratch& operator=(const ScryptScratch&) = delete;
+  ~ScryptScratch();
+
+  bool reserve(uint64_t, uint32_t, uint32_t, size_t lanes = 1);
+  void release();
+
+  uint8_t* getB(size_t lane = 0) const;
+  uint32_t* getXY() const;
+  uint32_t* getV(size_t lane = 0) const;
+  size_t getSize() const;
+  Pages getPages() const;  // the backing actually in use
+
+  // the calling thread's scratch area, created on first use
+  static ScryptScratch& local();
+  static Pages getDefaultPages();
+  static void setDefaultPages(Pages);
+
+ private:
+  static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  bool map(size_t, Pages);
+
+  Pages requested_, backing_;
+  uint8_t* base_;
+  size_t size_, offsetB_, offsetXY_, laneB_, laneV_;
+};
+
+#endif
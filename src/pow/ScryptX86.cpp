@@ -0,0 +1,191 @@
+
+// SSE2 Salsa20/8 and BlockMix, after crypto_scrypt-sse.c by Colin Percival.
+// Each 64-byte block is kept as four vectors whose lanes hold the diagonals
+// of the Salsa20 matrix, so that the column and row rounds only need lane
+// rotations between them. The AVX2 kernel is the same code compiled with
+// VEX encodings, whose non-destructive operands save most register copies.
+
+#include "ScryptKernels.hpp"
+
+#ifdef SCRYPT_HAVE_X86
+
+#include <immintrin.h>
+#include <cstring>
+
+#define SSE2_INLINE __attribute__((target("sse2"), always_inline)) inline
+
+static SSE2_INLINE __m128i rotate(__m128i x, __m128i t, int b)
+{
+  x = _mm_xor_si128(x, _mm_slli_epi32(t, b));
+  return _mm_xor_si128(x, _mm_srli_epi32(t, 32 - b));
+}
+
+
+
+static SSE2_INLINE void salsa20_8(__m128i B[4])
+{
+  __m128i X0 = B[0], X1 = B[1], X2 = B[2], X3 = B[3];
+
+  for (int i = 0; i < 8; i += 2)
+  {
+    // operate on columns
+    X1 = rotate(X1, _mm_add_epi32(X0, X3), 7);
+    X2 = rotate(X2, _mm_add_epi32(X1, X0), 9);
+    X3 = rotate(X3, _mm_add_epi32(X2, X1), 13);
+    X0 = rotate(X0, _mm_add_epi32(X3, X2), 18);
+
+    // rearrange so that the rows line up
+    X1 = _mm_shuffle_epi32(X1, 0x93);
+    X2 = _mm_shuffle_epi32(X2, 0x4E);
+    X3 = _mm_shuffle_epi32(X3, 0x39);
+
+    // operate on rows
+    X3 = rotate(X3, _mm_add_epi32(X0, X1), 7);
+    X2 = rotate(X2, _mm_add_epi32(X3, X0), 9);
+    X1 = rotate(X1, _mm_add_epi32(X2, X3), 13);
+    X0 = rotate(X0, _mm_add_epi32(X1, X2), 18);
+
+    // and back again for the columns
+    X1 = _mm_shuffle_epi32(X1, 0x39);
+    X2 = _mm_shuffle_epi32(X2, 0x4E);
+    X3 = _mm_shuffle_epi32(X3, 0x93);
+  }
+
+  B[0] = _mm_add_epi32(B[0], X0);
+  B[1] = _mm_add_epi32(B[1], X1);
+  B[2] = _mm_add_epi32(B[2], X2);
+  B[3] = _mm_add_epi32(B[3], X3);
+}
+
+
+
+static SSE2_INLINE void blkcpy(__m128i* dest, const __m128i* src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dest[i] = src[i];
+}
+
+
+
+static SSE2_INLINE void blkxor(__m128i* dest, const __m128i* src, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+    dest[i] = _mm_xor_si128(dest[i], src[i]);
+}
+
+
+
+// Bout = BlockMix_{salsa20/8, r}(Bin), with X as 64 bytes of scratch
+static SSE2_INLINE void blockmix(const __m128i* Bin,
+                                 __m128i* Bout,
+                                 __m128i* X,
+                                 size_t r)
+{
+  blkcpy(X, &Bin[8 * r - 4], 4);
+
+  for (size_t i = 0; i < r; i++)
+  {
+    blkxor(X, &Bin[i * 8], 4);
+    salsa20_8(X);
+    blkcpy(&Bout[i * 4], X, 4);
+
+    blkxor(X, &Bin[i * 8 + 4], 4);
+    salsa20_8(X);
+    blkcpy(&Bout[(r + i) * 4], X, 4);
+  }
+}
+
+
+
+// words 0 and 1 of the last block sit at positions 0 and 13 once permuted
+static SSE2_INLINE uint64_t integerify(const __m128i* B, size_t r)
+{
+  const uint32_t* X = reinterpret_cast<const uint32_t*>(&B[8 * r - 4]);
+  return (uint64_t(X[13]) << 32) + X[0];
+}
+
+
+
+// R, if not 0, is r as a constant, which unrolls BlockMix completely
+template <size_t R>
+static SSE2_INLINE bool smix(uint8_t* B,
+                             size_t rArg,
+                             uint64_t N,
+                             uint32_t* V,
+                             uint32_t* XY,
+                             const std::atomic<bool>* cancel)
+{
+  const size_t r = R ? R : rArg;
+  __m128i* X = reinterpret_cast<__m128i*>(XY);
+  __m128i* Y = reinterpret_cast<__m128i*>(XY + 32 * r);
+  __m128i* Z = reinterpret_cast<__m128i*>(XY + 64 * r);
+  __m128i* V4 = reinterpret_cast<__m128i*>(V);
+  uint32_t* X32 = XY;
+  const size_t vectors = 8 * r;
+
+  // x86 is little-endian, so only the words need permuting
+  for (size_t k = 0; k < 2 * r; k++)
+    for (size_t i = 0; i < 16; i++)
+      memcpy(&X32[k * 16 + i], &B[(k * 16 + (i * 5 % 16)) * 4], 4);
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    blkcpy(&V4[i * vectors], X, vectors);
+    blockmix(X, Y, Z, r);
+    blkcpy(&V4[(i + 1) * vectors], Y, vectors);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (uint64_t i = 0; i < N; i += 2)
+  {
+    if (ScryptKernels::isCancelled(cancel, i))
+      return false;
+
+    uint64_t j = integerify(X, r) & (N - 1);
+    blkxor(X, &V4[j * vectors], vectors);
+    blockmix(X, Y, Z, r);
+
+    j = integerify(Y, r) & (N - 1);
+    blkxor(Y, &V4[j * vectors], vectors);
+    blockmix(Y, X, Z, r);
+  }
+
+  for (size_t k = 0; k < 2 * r; k++)
+    for (size_t i = 0; i < 16; i++)
+      memcpy(&B[(k * 16 + (i * 5 % 16)) * 4], &X32[k * 16 + i], 4);
+
+  return true;
+}
+
+
+
+__attribute__((target("sse2"))) bool ScryptKernels::smixSSE2(
+    uint8_t* B,
+    size_t r,
+    uint64_t N,
+    uint32_t* V,
+    uint32_t* XY,
+    const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smix<1>(B, r, N, V, XY, cancel)
+                : smix<0>(B, r, N, V, XY, cancel);
+}
+
+
+
+__attribute__((target("avx2"))) bool ScryptKernels::smixAVX2(
+    uint8_t* B,
+    size_t r,
+    uint64_t N,
+    uint32_t* V,
+    uint32_t* XY,
+    const std::atomic<bool>* cancel)
+{
+  return r == 1 ? smix<1>(B, r, N, V, XY, cancel)
+                : smix<0>(B, r, N, V, XY, cancel);
+}
+
+#endif
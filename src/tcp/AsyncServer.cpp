@@ -0,0 +1,254 @@
+
+#include "AsyncServer.hpp"
+#include "ServerSession.hpp"
+#include "IOExecutor.hpp"
+#include "../crypto/ed25519.h"
+#include "../Log.hpp"
+
+const size_t AsyncServer::DEFAULT_MAX_SESSIONS;
+const int AsyncServer::BACKLOG;
+const int AsyncServer::ACCEPT_RETRY;
+
+std::shared_ptr<AsyncServer> AsyncServer::create(ushort port,
+                                                 const std::string& address)
+{
+  return std::shared_ptr<AsyncServer>(new AsyncServer(port, address));
+}
+
+
+
+// the type's handler; blocking ones go to the ThreadPool
+void AsyncServer::setHandler(const std::string& type,
+                             const Handler& handler,
+                             bool blocking)
+{
+  routes_[type] = {handler, blocking};
+}
+
+
+
+void AsyncServer::setSigningKey(const ED_KEY& secretKey)
+{
+  secretKey_ = secretKey;
+  ed25519_publickey(secretKey_.data(), publicKey_.data());
+  signing_ = true;
+}
+
+
+
+// connections beyond this are closed as soon as they are accepted
+void AsyncServer::setMaxSessions(size_t maxSessions)
+{
+  maxSessions_ = maxSessions;
+}
+
+
+
+// sessions that send nothing for this long are closed; zero for never
+void AsyncServer::setIdleTimeout(std::chrono::milliseconds timeout)
+{
+  idleTimeout_ = timeout;
+}
+
+
+
+// whether to agree to length-prefixed framing when a client offers it
+void AsyncServer::allowFraming(bool allow)
+{
+  framing_ = allow;
+}
+
+
+
+void AsyncServer::allowCompression(bool allow)
+{
+  compression_ = allow;
+}
+
+
+
+void AsyncServer::start()
+{
+  if (running_.exchange(true))
+    Log::get().error("The server is already running!");
+
+  acceptor_.open(endpoint_.protocol());
+  acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+  acceptor_.bind(endpoint_);
+  acceptor_.listen(BACKLOG);
+  LOG_NOTICE("Listening on port " + std::to_string(getPort()) + ".");
+  acceptNext();
+}
+
+
+
+// stops accepting and closes every session
+void AsyncServer::stop()
+{
+  if (!running_.exchange(false))
+    return;
+
+  auto self = shared_from_this();
+  ios_.dispatch([self]()
+                {
+                  boost::system::error_code ignored;
+                  self->acceptor_.close(ignored);
+                  self->retry_.cancel(ignored);
+                });
+
+  std::vector<std::shared_ptr<ServerSession>> open;
+  {
+    std::lock_guard<std::mutex> guard(sessionsMutex_);
+    for (auto& entry : sessions_)
+      if (auto session = entry.second.lock())
+        open.push_back(session);
+  }
+
+  for (auto& session : open)
+    session->close();
+}
+
+
+
+// the bound port, which is the one the OS chose if 0 was asked for
+ushort AsyncServer::getPort() const
+{
+  boost::system::error_code ec;
+  auto local = acceptor_.local_endpoint(ec);
+  return ec ? endpoint_.port() : local.port();
+}
+
+
+
+size_t AsyncServer::getSessionCount() const
+{
+  std::lock_guard<std::mutex> guard(sessionsMutex_);
+  return sessions_.size();
+}
+
+
+
+// the handler for the type, or null if there is none
+const AsyncServer::Route* AsyncServer::findRoute(const std::string& type) const
+{
+  auto route = routes_.find(type);
+  return route == routes_.end() ? nullptr : &route->second;
+}
+
+
+
+bool AsyncServer::isSigning() const
+{
+  return signing_;
+}
+
+
+
+// writes the Ed25519 signature on the bytes to sig
+void AsyncServer::sign(const uint8_t* bytes, size_t len, uint8_t* sig) const
+{
+  ed25519_sign(bytes, len, secretKey_.data(), publicKey_.data(), sig);
+}
+
+
+
+std::chrono::milliseconds AsyncServer::getIdleTimeout() const
+{
+  return idleTimeout_;
+}
+
+
+
+bool AsyncServer::allowsFraming() const
+{
+  return framing_;
+}
+
+
+
+bool AsyncServer::allowsCompression() const
+{
+  return compression_;
+}
+
+
+
+void AsyncServer::addSession(ServerSession* key,
+                             const std::shared_ptr<ServerSession>& session)
+{
+  std::lock_guard<std::mutex> guard(sessionsMutex_);
+  sessions_[key] = session;
+}
+
+
+
+void AsyncServer::removeSession(ServerSession* key)
+{
+  std::lock_guard<std::mutex> guard(sessionsMutex_);
+  sessions_.erase(key);
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+AsyncServer::AsyncServer(ushort port, const std::string& address)
+    : ios_(IOExecutor::get().next()),
+      acceptor_(ios_),
+      retry_(ios_),
+      endpoint_(boost::asio::ip::address::from_string(address), port),
+      signing_(false),
+      framing_(true),
+      compression_(true),
+      maxSessions_(DEFAULT_MAX_SESSIONS),
+      idleTimeout_(std::chrono::minutes(5)),
+      running_(false)
+{
+  secretKey_.fill(0);
+  publicKey_.fill(0);
+}
+
+
+
+// Each session goes to the executor's next io_service, spreading them over
+// the cores when the executor runs one service per core. When accepting
+// fails, as it does when out of file descriptors, it is retried shortly.
+void AsyncServer::acceptNext()
+{
+  auto self = shared_from_this();
+  auto session =
+      std::make_shared<ServerSession>(IOExecutor::get().next(), self);
+  acceptor_.async_accept(
+      session->getSocket(), [self, session](boost::system::error_code ec)
+      {
+        if (!self->running_)
+          return;
+
+        if (!ec)
+        {
+          if (self->getSessionCount() < self->maxSessions_)
+            session->start();
+          else
+          {
+            Log::get().warn("Too many sessions, turning a client away.");
+            session->close();
+          }
+        }
+        else if (ec != boost::asio::error::operation_aborted)
+        {
+          Log::get().warn("Accept failed: " + ec.message());
+          self->retry_.expires_from_now(
+              std::chrono::milliseconds(ACCEPT_RETRY));
+          self->retry_.async_wait([self](boost::system::error_code code)
+                                  {
+                                    if (!code && self->running_)
+                                      self->acceptNext();
+                                  });
+          return;
+        }
+
+        self->acceptNext();
+      });
+}
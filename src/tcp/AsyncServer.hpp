@@ -0,0 +1,92 @@
+#ifndef ASYNC_SERVER_HPP
+#define ASYNC_SERVER_HPP
+
+#include "../Constants.hpp"
+#include <boost/asio.hpp>
+#include <json/json.h>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <mutex>
+#include <map>
+
+class ServerSession;
+
+// The server side of TorStream and AuthenticatedStream. It accepts on the
+// shared IOExecutor and gives each connection an asynchronous
+// ServerSession on the executor's next io_service. A session speaks the
+// same protocol that the streams do. It answers the SYN, agreeing to any
+// framing, compression and raw signing in it that this server allows. It
+// then answers each request, echoing its "id", with whatever the handler
+// for its "type" returns. A server with a signing key signs every
+// response. Handlers run on the session's executor thread unless they were
+// added as blocking, in which case they go to the ThreadPool. Handlers and
+// settings must be in place before start().
+class AsyncServer : public std::enable_shared_from_this<AsyncServer>
+{
+ public:
+  // given a request's "value", returns the response's or throws to send
+  // what() as an error
+  typedef std::function<Json::Value(const Json::Value&)> Handler;
+
+  static const size_t DEFAULT_MAX_SESSIONS = 1 << 16;
+  static const int BACKLOG = 1024;  // pending connections
+  static const int ACCEPT_RETRY = 100;  // ms after accept fails
+
+  static std::shared_ptr<AsyncServer> create(ushort,
+                                             const std::string& = "0.0.0.0");
+
+  void setHandler(const std::string&, const Handler&, bool blocking = false);
+  void setSigningKey(const ED_KEY&);
+  void setMaxSessions(size_t);
+  void setIdleTimeout(std::chrono::milliseconds);
+  void allowFraming(bool);
+  void allowCompression(bool);
+
+  void start();
+  void stop();
+  ushort getPort() const;
+  size_t getSessionCount() const;
+
+  // for ServerSession
+  struct Route
+  {
+    Handler handler;
+    bool blocking;
+  };
+
+  const Route* findRoute(const std::string&) const;
+  bool isSigning() const;
+  void sign(const uint8_t*, size_t, uint8_t*) const;
+  std::chrono::milliseconds getIdleTimeout() const;
+  bool allowsFraming() const;
+  bool allowsCompression() const;
+  void addSession(ServerSession*, const std::shared_ptr<ServerSession>&);
+  void removeSession(ServerSession*);
+
+ private:
+  AsyncServer(ushort, const std::string&);
+  AsyncServer(const AsyncServer&) = delete;
+  void operator=(const AsyncServer&) = delete;
+
+  void acceptNext();
+
+  boost::asio::io_service& ios_;  // the acceptor's, from IOExecutor
+  boost::asio::ip::tcp::acceptor acceptor_;
+  boost::asio::steady_timer retry_;
+  const boost::asio::ip::tcp::endpoint endpoint_;
+  std::unordered_map<std::string, Route> routes_;  // by type
+  bool signing_, framing_, compression_;
+  ED_KEY secretKey_, publicKey_;
+  size_t maxSessions_;
+  std::chrono::milliseconds idleTimeout_;
+  std::atomic<bool> running_;
+
+  mutable std::mutex sessionsMutex_;
+  std::map<ServerSession*, std::weak_ptr<ServerSession>> sessions_;
+};
+
+#endif
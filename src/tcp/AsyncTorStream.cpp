@@ -0,0 +1,498 @@
+#include "AsyncTorStream.hpp"
+#include "AuthenticatedStream.hpp"
+#include "IOExecutor.hpp"
+#include "MirrorStats.hpp"
+#include "MemAllocator.hpp"
+#include "TorStream.hpp"
+#include "../Log.hpp"
+
+using boost::system::error_code;
+
+std::shared_ptr<AsyncTorStream> AsyncTorStream::create(
+    boost::asio::io_service& ios,
+    bool multiplexed)
+{
+  return std::shared_ptr<AsyncTorStream>(new AsyncTorStream(ios, multiplexed));
+}
+
+
+
+// on the shared executor's next io_service
+std::shared_ptr<AsyncTorStream> AsyncTorStream::create(bool multiplexed)
+{
+  return create(IOExecutor::get().next(), multiplexed);
+}
+
+
+
+// verify responses against the server's key; call before connecting
+void AsyncTorStream::setServerKey(const ED_KEY& key)
+{
+  serverKey_ = std::make_shared<ED_KEY>(key);
+}
+
+
+
+// Resolves and connects to the SOCKS port, asks Tor for the remote host,
+// and confirms the protocol with a SYN/ACK exchange, then calls back from
+// the io_service. Requests submitted meanwhile are sent once it succeeds.
+void AsyncTorStream::asyncConnect(const std::string& socksHost,
+                                  ushort socksPort,
+                                  const std::string& remoteHost,
+                                  ushort remotePort,
+                                  const ConnectCallback& callback)
+{
+  auto self = shared_from_this();
+  strand_.dispatch([=]()
+                   {
+                     if (state_ != State::Idle)
+                     {
+                       ios_.post(std::bind(
+                           callback, boost::asio::error::already_started));
+                       return;
+                     }
+
+                     state_ = State::Connecting;
+                     connectStart_ = std::chrono::steady_clock::now();
+                     connected_ = callback;
+                     remoteHost_ = remoteHost;
+                     remotePort_ = remotePort;
+
+                     resolver_.async_resolve(
+                         {socksHost, std::to_string(socksPort)},
+                         strand_.wrap([self](error_code ec,
+                                             boost::asio::ip::tcp::resolver::
+                                                 iterator endpoints)
+                                      {
+                                        if (ec)
+                                          return self->fail(ec);
+
+                                        boost::asio::async_connect(
+                                            self->socket_, endpoints,
+                                            self->strand_.wrap(std::bind(
+                                                &AsyncTorStream::startSocks,
+                                                self, std::placeholders::_1)));
+                                      }));
+                   });
+}
+
+
+
+std::future<void> AsyncTorStream::connect(const std::string& socksHost,
+                                          ushort socksPort,
+                                          const std::string& remoteHost,
+                                          ushort remotePort)
+{
+  auto promise = std::make_shared<std::promise<void>>();
+  asyncConnect(socksHost, socksPort, remoteHost, remotePort,
+               [promise](error_code ec)
+               {
+                 if (ec)
+                   promise->set_exception(std::make_exception_ptr(
+                       boost::system::system_error(ec)));
+                 else
+                   promise->set_value();
+               });
+  return promise->get_future();
+}
+
+
+
+// the callback receives the checked response, or the error that ended the
+// stream before the response arrived
+void AsyncTorStream::asyncSendReceive(const std::string& type,
+                                      const std::string& msg,
+                                      const ResponseCallback& callback)
+{
+  auto self = shared_from_this();
+  strand_.dispatch([=]()
+                   {
+                     if (state_ == State::Closed)
+                       ios_.post(std::bind(callback,
+                                           boost::asio::error::not_connected,
+                                           Json::Value()));
+                     else if (state_ != State::Ready ||
+                              (!multiplexed_ && !inOrder_.empty()))
+                       backlog_.push_back({type, msg, callback});
+                     else
+                       enqueue(type, msg, callback);
+                   });
+}
+
+
+
+std::future<Json::Value> AsyncTorStream::sendReceive(const std::string& type,
+                                                     const std::string& msg)
+{
+  auto promise = std::make_shared<std::promise<Json::Value>>();
+  asyncSendReceive(type, msg, [promise](error_code ec, Json::Value response)
+                   {
+                     if (ec)
+                       promise->set_exception(std::make_exception_ptr(
+                           boost::system::system_error(ec)));
+                     else
+                       promise->set_value(response);
+                   });
+  return promise->get_future();
+}
+
+
+
+bool AsyncTorStream::isReady() const
+{
+  return state_ == State::Ready;
+}
+
+
+
+bool AsyncTorStream::hasServerKey() const
+{
+  return serverKey_ != nullptr;
+}
+
+
+
+// set by asyncConnect; read it only once connected
+const std::string& AsyncTorStream::getRemoteHost() const
+{
+  return remoteHost_;
+}
+
+
+
+// fails whatever is outstanding with operation_aborted
+void AsyncTorStream::close()
+{
+  auto self = shared_from_this();
+  strand_.dispatch([self]()
+                   {
+                     self->fail(boost::asio::error::operation_aborted);
+                   });
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+AsyncTorStream::AsyncTorStream(boost::asio::io_service& ios, bool multiplexed)
+    : ios_(ios),
+      strand_(ios),
+      resolver_(ios),
+      socket_(ios),
+      socks_(socket_),
+      multiplexed_(multiplexed),
+      state_(State::Idle),
+      remotePort_(0),
+      nextId_(0),
+      writing_(false),
+      reading_(false)
+{
+}
+
+
+
+// Socks5 binds its handlers to itself rather than to this stream's owner,
+// so the stream holds on to itself until the handshake is over. With
+// TorStream::isOptimistic(), the greeting, the request and the SYN go out
+// in one write.
+void AsyncTorStream::startSocks(error_code ec)
+{
+  if (ec)
+    return fail(ec);
+
+  handshaking_ = shared_from_this();
+  Socks5::Request request(Socks5::Command::CONNECT,
+                          Socks5::AddressType::DOMAIN_NAME, remoteHost_,
+                          remotePort_);
+  auto onReply = [this](Socks5::Error e, error_code c, Socks5::Reply reply)
+  {
+    strand_.dispatch([this, e, c, reply]()
+                     {
+                       onSocks(e, c, reply);
+                     });
+  };
+
+  if (TorStream::isOptimistic())
+  {
+    Json::Value syn;
+    syn["type"] = "SYN";
+    syn["value"] = "";
+    Json::FastWriter writer;
+    inOrder_.push_back(std::bind(&AsyncTorStream::onSyn, this,
+                                 std::placeholders::_1,
+                                 std::placeholders::_2));
+    socks_.optimisticRequest(request, writer.write(syn), onReply);
+    return;
+  }
+
+  socks_.initialize(
+      {Socks5::AuthMethod::NO_AUTHENTICATION},
+      [this, request, onReply](Socks5::Error err, error_code code,
+                               Socks5::AuthMethod)
+      {
+        strand_.dispatch([this, request, onReply, err, code]()
+                         {
+                           auto self = handshaking_;
+                           if (state_ == State::Closed)
+                             return handshaking_.reset();
+                           if (err != Socks5::Error::NO_ERROR)
+                           {
+                             handshaking_.reset();
+                             return fail(code ? code : boost::asio::error::
+                                                           connection_refused);
+                           }
+
+                           socks_.request(request, onReply);
+                         });
+      });
+}
+
+
+
+// the remote host is connected through Tor; confirm the protocol next,
+// unless the SYN already went out with the handshake
+void AsyncTorStream::onSocks(Socks5::Error err,
+                             error_code ec,
+                             Socks5::Reply reply)
+{
+  auto self = handshaking_;
+  handshaking_.reset();
+  if (state_ == State::Closed)
+    return;  // closed during the handshake
+
+  if (err != Socks5::Error::NO_ERROR ||
+      reply.getReply() != Socks5::ReplyCode::SUCCEEDED)
+  {
+    Log::get().warn("Could not establish a connection with remote host.");
+    return fail(ec ? ec : boost::asio::error::host_unreachable);
+  }
+
+  if (inOrder_.empty())
+    enqueue("SYN", "", std::bind(&AsyncTorStream::onSyn, this,
+                                 std::placeholders::_1,
+                                 std::placeholders::_2));
+  else
+    readNext();
+}
+
+
+
+void AsyncTorStream::onSyn(error_code ec, Json::Value response)
+{
+  if (ec)
+    return;  // fail() already reported it
+
+  if (response["type"] == "success" && response["value"] == "ACK")
+  {
+    LOG_NOTICE("Server confirmed up.");
+    finishConnect(error_code());
+  }
+  else
+    fail(boost::system::errc::make_error_code(
+        boost::system::errc::protocol_error));
+}
+
+
+
+void AsyncTorStream::finishConnect(error_code ec)
+{
+  if (ec)
+    return fail(ec);
+
+  state_ = State::Ready;
+  MirrorStats::get().recordConnect(
+      remoteHost_, std::chrono::steady_clock::now() - connectStart_);
+
+  ConnectCallback callback;
+  callback.swap(connected_);
+  if (callback)
+    callback(ec);
+  flushBacklog();
+}
+
+
+
+// writes the request, with an id if multiplexed, and starts reading
+void AsyncTorStream::enqueue(const std::string& type,
+                             const std::string& msg,
+                             const ResponseCallback& callback)
+{
+  Json::Value outVal;
+  outVal["type"] = type;
+  outVal["value"] = msg;
+
+  // round trips are timed from here, except for the SYN's
+  ResponseCallback timed = callback;
+  if (state_ == State::Ready)
+  {
+    const auto sent = std::chrono::steady_clock::now();
+    const std::string host = remoteHost_;
+    timed = [callback, sent, host](error_code ec, Json::Value response)
+    {
+      if (!ec)
+        MirrorStats::get().recordRequest(
+            host, std::chrono::steady_clock::now() - sent);
+      callback(ec, response);
+    };
+  }
+
+  // the SYN goes without an id, as it does for TorStream
+  if (multiplexed_ && state_ == State::Ready)
+  {
+    outVal["id"] = nextId_;
+    byId_[nextId_++] = timed;
+  }
+  else
+    inOrder_.push_back(timed);
+
+  Json::FastWriter writer;
+  outbox_.push_back(writer.write(outVal));
+  writeNext();
+  readNext();
+}
+
+
+
+// sends what was waiting for the connection or for the previous response
+void AsyncTorStream::flushBacklog()
+{
+  while (state_ == State::Ready && !backlog_.empty() &&
+         (multiplexed_ || inOrder_.empty()))
+  {
+    Pending pending = backlog_.front();
+    backlog_.pop_front();
+    enqueue(pending.type, pending.value, pending.callback);
+  }
+}
+
+
+
+void AsyncTorStream::writeNext()
+{
+  if (writing_ || outbox_.empty())
+    return;
+
+  writing_ = true;
+  auto self = shared_from_this();
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(outbox_.front()),
+      strand_.wrap(makeHandler(writeAlloc_, [self](error_code ec, size_t)
+                                            {
+                                              self->writing_ = false;
+                                              if (ec)
+                                                return self->fail(ec);
+
+                                              self->outbox_.pop_front();
+                                              self->writeNext();
+                                            })));
+}
+
+
+
+// reads while responses are awaited, so an idle stream holds no handler
+void AsyncTorStream::readNext()
+{
+  if (reading_ || (inOrder_.empty() && byId_.empty()))
+    return;
+
+  reading_ = true;
+  auto self = shared_from_this();
+  boost::asio::async_read_until(
+      socket_, inbox_, '\n',
+      strand_.wrap(makeHandler(readAlloc_, [self](error_code ec, size_t)
+                                           {
+                                             self->reading_ = false;
+                                             if (ec)
+                                               return self->fail(ec);
+
+                                             std::istream is(&self->inbox_);
+                                             std::string line;
+                                             std::getline(is, line);
+                                             self->dispatch(line);
+                                             self->readNext();
+                                           })));
+}
+
+
+
+void AsyncTorStream::dispatch(const std::string& line)
+{
+  Json::Value response = TorStream::parseResponse(line);
+
+  // the SYN's ACK is unsigned, as it is for TorStream
+  if (serverKey_ && state_ == State::Ready)
+    response = AuthenticatedStream::verifyResponse(*serverKey_, response);
+
+  ResponseCallback callback;
+  if (multiplexed_ && inOrder_.empty())
+  {
+    auto entry = byId_.end();
+    if (response.isMember("id") && response["id"].isUInt())
+      entry = byId_.find(response["id"].asUInt());
+
+    if (entry == byId_.end())
+    {
+      Log::get().warn("Dropping a response to an unknown request.");
+      return;
+    }
+
+    callback.swap(entry->second);
+    byId_.erase(entry);
+    response.removeMember("id");
+  }
+  else if (!inOrder_.empty())
+  {
+    callback.swap(inOrder_.front());
+    inOrder_.pop_front();
+  }
+  else
+  {
+    Log::get().warn("Dropping an unexpected response.");
+    return;
+  }
+
+  callback(error_code(), response);
+  flushBacklog();
+}
+
+
+
+// closes the stream and reports ec to everything that is still waiting
+void AsyncTorStream::fail(error_code ec)
+{
+  if (state_ == State::Closed)
+    return;
+
+  // a SOCKS5 handshake in progress still holds on to the stream, until its
+  // handler sees the closed socket
+  // closing on purpose says nothing about the endpoint
+  if (ec != boost::asio::error::operation_aborted &&
+      (state_ == State::Connecting || !inOrder_.empty() || !byId_.empty()))
+    MirrorStats::get().recordFailure(remoteHost_);
+
+  state_ = State::Closed;
+  error_code ignored;
+  resolver_.cancel();
+  socket_.close(ignored);
+
+  std::vector<ResponseCallback> waiting;
+  for (auto& entry : byId_)
+    waiting.push_back(entry.second);
+  for (auto& callback : inOrder_)
+    waiting.push_back(callback);
+  for (auto& pending : backlog_)
+    waiting.push_back(pending.callback);
+  byId_.clear();
+  inOrder_.clear();
+  backlog_.clear();
+  outbox_.clear();
+
+  ConnectCallback callback;
+  callback.swap(connected_);
+  if (callback)
+    callback(ec);
+  for (auto& response : waiting)
+    response(ec, Json::Value());
+}
@@ -0,0 +1,115 @@
+#ifndef ASYNC_TOR_STREAM_HPP
+#define ASYNC_TOR_STREAM_HPP
+
+#include "socks5/Socks5.hpp"
+#include "HandleAlloc.hpp"
+#include "../Constants.hpp"
+#include <json/json.h>
+#include <functional>
+#include <future>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+
+// The asynchronous counterpart of TorStream, run by the caller's
+// io_service or the shared IOExecutor: connecting, the SOCKS5 handshake,
+// the protocol confirmation, and each request complete through callbacks,
+// so that one thread can drive many streams and hundreds of outstanding requests. Multiplexed
+// streams write requests as soon as they are submitted and match responses
+// by "id"; otherwise requests queue up and go out one at a time. With a
+// server key, responses are verified as AuthenticatedStream does.
+// Requests may be submitted from any thread. The future-returning forms
+// must not be waited on from a thread that runs the io_service.
+class AsyncTorStream : public std::enable_shared_from_this<AsyncTorStream>
+{
+ public:
+  typedef std::function<void(boost::system::error_code)> ConnectCallback;
+  typedef std::function<void(boost::system::error_code, Json::Value)>
+      ResponseCallback;
+
+  static std::shared_ptr<AsyncTorStream> create(boost::asio::io_service&,
+                                                bool multiplexed = false);
+  static std::shared_ptr<AsyncTorStream> create(bool multiplexed = false);
+
+  void setServerKey(const ED_KEY&);
+  void asyncConnect(const std::string&,
+                    ushort,
+                    const std::string&,
+                    ushort,
+                    const ConnectCallback&);
+  std::future<void> connect(const std::string&,
+                            ushort,
+                            const std::string&,
+                            ushort);
+
+  void asyncSendReceive(const std::string&,
+                        const std::string&,
+                        const ResponseCallback&);
+  std::future<Json::Value> sendReceive(const std::string&, const std::string&);
+
+  bool isReady() const;
+  bool hasServerKey() const;
+  const std::string& getRemoteHost() const;
+  void close();
+
+ private:
+  enum class State : uint8_t
+  {
+    Idle,
+    Connecting,
+    Ready,
+    Closed
+  };
+
+  AsyncTorStream(boost::asio::io_service&, bool);
+  AsyncTorStream(const AsyncTorStream&) = delete;
+  void operator=(const AsyncTorStream&) = delete;
+
+  void startSocks(boost::system::error_code);
+  void onSocks(Socks5::Error, boost::system::error_code, Socks5::Reply);
+  void onSyn(boost::system::error_code, Json::Value);
+  void finishConnect(boost::system::error_code);
+  void enqueue(const std::string&, const std::string&, const ResponseCallback&);
+  void flushBacklog();
+  void writeNext();
+  void readNext();
+  void dispatch(const std::string&);
+  void fail(boost::system::error_code);
+
+  boost::asio::io_service& ios_;
+  boost::asio::io_service::strand strand_;
+  boost::asio::ip::tcp::resolver resolver_;
+  boost::asio::ip::tcp::socket socket_;
+  Socks5::Socks5 socks_;
+  const bool multiplexed_;
+  std::shared_ptr<ED_KEY> serverKey_;
+
+  std::atomic<State> state_;
+  std::string remoteHost_;
+  ushort remotePort_;
+  std::chrono::steady_clock::time_point connectStart_;
+  ConnectCallback connected_;
+  std::shared_ptr<AsyncTorStream> handshaking_;  // alive until SOCKS is done
+
+  struct Pending
+  {
+    std::string type, value;
+    ResponseCallback callback;
+  };
+
+  // everything below is only touched from within strand_
+  std::deque<std::string> outbox_;  // the front is being written
+  std::deque<Pending> backlog_;  // not sent yet
+  std::deque<ResponseCallback> inOrder_;  // awaiting, without ids
+  std::map<Json::UInt, ResponseCallback> byId_;  // awaiting, multiplexed
+  Json::UInt nextId_;
+  boost::asio::streambuf inbox_;
+  bool writing_, reading_;
+  HandleAlloc writeAlloc_, readAlloc_;  // for the I/O handlers
+};
+
+#endif
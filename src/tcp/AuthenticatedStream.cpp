@@ -1,7 +1,11 @@
 
 #include "AuthenticatedStream.hpp"
 #include "../Log.hpp"
-#include <botan/base64.h>
+#include "../Metrics.hpp"
+#include "../Tracer.hpp"
+#include "../encoding/Codec.hpp"
+#include "../crypto/KeyCache.hpp"
+#include <vector>
 
 
 AuthenticatedStream::AuthenticatedStream(const std::string& socksHost,
@@ -9,24 +13,45 @@ AuthenticatedStream::AuthenticatedStream(const std::string& socksHost,
                                          const std::string& remoteHost,
                                          ushort remotePort,
                                          const std::string& pubKey64)
-    : TorStream(socksHost, socksPort, remoteHost, remotePort)
+    : TorStream(socksHost, socksPort, remoteHost, remotePort, true)
 {
-  if (Botan::base64_decode(publicKey_.data(), pubKey64) !=
+  if (Codec::base64Decode(pubKey64, publicKey_.data(), publicKey_.size()) !=
       Const::ED25519_KEY_LEN)
     Log::get().error("Invalid length for public key.");
 
   rootSig_.fill(0);
+  verifier_ = KeyCache::get().loadEd25519(publicKey_);
 }
 
 
 
-Json::Value AuthenticatedStream::sendReceive(const std::string& type,
-                                             const std::string& msg)
+// with a key that is already decoded, such as from a Config::Node
+AuthenticatedStream::AuthenticatedStream(const std::string& socksHost,
+                                         ushort socksPort,
+                                         const std::string& remoteHost,
+                                         ushort remotePort,
+                                         const ED_KEY& publicKey)
+    : TorStream(socksHost, socksPort, remoteHost, remotePort, true),
+      publicKey_(publicKey),
+      verifier_(KeyCache::get().loadEd25519(publicKey))
+{
+  rootSig_.fill(0);
+}
+
+
+
+// the reader thread calls checkResponse, so it must stop before this goes
+AuthenticatedStream::~AuthenticatedStream()
 {
-  Log::get().notice("AuthStream sendReceive called");
+  stopMultiplexing();
+}
+
 
-  Json::Value received = TorStream::sendReceive(type, msg);
 
+// replaces a response whose signature does not check out with an error
+Json::Value AuthenticatedStream::verifyResponse(const ED_KEY& publicKey,
+                                                Json::Value received)
+{
   if (!received.isMember("signature"))
   {
     received["type"] = "error";
@@ -38,20 +63,26 @@ Json::Value AuthenticatedStream::sendReceive(const std::string& type,
     return received;
 
   ED_SIGNATURE sig;
-  if (Botan::base64_decode(sig.data(), received["signature"].asString()) !=
-      sig.size())
+  if (Codec::base64Decode(received["signature"].asString(), sig.data(),
+                          sig.size()) != sig.size())
   {
     received["type"] = "error";
     received["value"] = "Bad signature size from server.";
     return received;
   }
 
+  static Metrics::Counter& verifications = Metrics::get().counter(
+      "onions_signature_verifications_total{algorithm=\"ed25519\"}",
+      "Signatures checked, by algorithm.");
+  verifications.add();
+  Tracer::Span span("ed25519.verify");
+
   // check signature on transmission
   std::string data =
       received["type"].toStyledString() + received["value"].toStyledString();
   const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.c_str());
-  int check =
-      ed25519_sign_open(bytes, data.size(), publicKey_.data(), sig.data());
+  int check = KeyCache::get().loadEd25519(publicKey)->verify(
+      bytes, data.size(), sig.data());
 
   if (check == 1)
   {
@@ -66,3 +97,45 @@ Json::Value AuthenticatedStream::sendReceive(const std::string& type,
 
   return received;
 }
+
+
+
+// ************************** PROTECTED METHODS **************************** //
+
+
+
+// Verifies the server's signature on each response, plain or multiplexed.
+// Raw-signed responses were verified before they were parsed.
+Json::Value AuthenticatedStream::checkResponse(Json::Value received)
+{
+  if (isSigningRaw())
+    return received;
+  return verifyResponse(publicKey_, received);
+}
+
+
+
+// A lone payload is checked against the key precomputed once up front.
+// Several, as the reader thread collects when responses are pipelined, go
+// through one Ed25519 batch verification.
+void AuthenticatedStream::verifyPayloads(const uint8_t** signatures,
+                                         const uint8_t** payloads,
+                                         size_t* lengths,
+                                         size_t n,
+                                         int* valid)
+{
+  static Metrics::Counter& verifications = Metrics::get().counter(
+      "onions_signature_verifications_total{algorithm=\"ed25519\"}",
+      "Signatures checked, by algorithm.");
+  verifications.add(n);
+  Tracer::Span span("ed25519.verify");
+
+  if (n == 1)
+  {
+    valid[0] = verifier_->verify(payloads[0], lengths[0], signatures[0]) == 0;
+    return;
+  }
+
+  std::vector<const uint8_t*> keys(n, publicKey_.data());
+  ed25519_sign_open_batch(payloads, lengths, keys.data(), signatures, n, valid);
+}
@@ -3,11 +3,14 @@
 #define AUTHENTICATED_STREAM_HPP
 
 #include "TorStream.hpp"
-#include "../crypto/ed25519.h"
+#include "../crypto/Ed25519Key.hpp"
 #include "../Constants.hpp"
 #include <memory>
 #include <chrono>
 
+// A TorStream that verifies the server's Ed25519 signature on each response.
+// It offers raw signing, in which the payload bytes are signed as sent; with
+// servers that do not accept it, the signature member is checked instead.
 class AuthenticatedStream : public TorStream
 {
  public:
@@ -16,11 +19,27 @@ class AuthenticatedStream : public TorStream
                       const std::string&,
                       ushort,
                       const std::string&);
-  Json::Value sendReceive(const std::string&, const std::string&);
+  AuthenticatedStream(const std::string&,
+                      ushort,
+                      const std::string&,
+                      ushort,
+                      const ED_KEY&);
+  ~AuthenticatedStream();
+
+  static Json::Value verifyResponse(const ED_KEY&, Json::Value);
+
+ protected:
+  Json::Value checkResponse(Json::Value) override;
+  void verifyPayloads(const uint8_t**,
+                      const uint8_t**,
+                      size_t*,
+                      size_t,
+                      int*) override;
 
  private:
   ED_KEY publicKey_;
   ED_SIGNATURE rootSig_;
+  Ed25519KeyPtr verifier_;
 };
 
 #endif
@@ -1,47 +1,155 @@
-
 #ifndef HANDLE_ALLOC_HPP
 #define HANDLE_ALLOC_HPP
 
 #include <boost/noncopyable.hpp>
 #include <boost/aligned_storage.hpp>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
 
 // Class to manage the memory to be used for handler-based custom allocation.
-// It contains a single block of memory which may be returned for allocation
-// requests. If the memory is in use when an allocation request is made, the
-// allocator delegates allocation to the global heap.
+// Each allocator holds a small slab of SLOTS blocks of SLOT_SIZE bytes, so
+// that several handlers may be outstanding at once. Requests that do not
+// fit go to thread-local free lists of power-of-two size classes up to
+// MAX_BLOCK bytes, which keep blocks after they are freed, from whichever
+// thread, for the next allocation on that thread. Only larger requests, or
+// the first request of a class on a thread, reach the global heap.
 class HandleAlloc : private boost::noncopyable
 {
  public:
-  HandleAlloc() : in_use_(false) {}
+  static const size_t SLOTS = 4;
+  static const size_t SLOT_SIZE = 256;
+  static const size_t MAX_BLOCK = 4096;
+  static const size_t MAX_CACHED = 64;  // blocks per class and thread
+
+  HandleAlloc() : inUse_(0) {}
 
   void* allocate(std::size_t size)
   {
-    if (!in_use_ && size < storage_.size)
+    if (size <= SLOT_SIZE)
+    {
+      uint32_t used = inUse_.load(std::memory_order_relaxed);
+      while (used != FULL)
+      {
+        const uint32_t slot = lowestClear(used);
+        if (inUse_.compare_exchange_weak(used, used | (1u << slot),
+                                         std::memory_order_acquire))
+          return slab_[slot].address();
+      }
+    }
+
+    return allocateBlock(size);
+  }
+
+  void deallocate(void* pointer)
+  {
+    const uint8_t* bytes = static_cast<uint8_t*>(pointer);
+    const uint8_t* first = static_cast<uint8_t*>(slab_[0].address());
+    if (bytes >= first && bytes < first + sizeof(slab_))
     {
-      in_use_ = true;
-      return storage_.address();
+      const size_t slot = size_t(bytes - first) / sizeof(slab_[0]);
+      inUse_.fetch_and(~(1u << slot), std::memory_order_release);
     }
     else
+      deallocateBlock(pointer);
+  }
+
+ private:
+  static const uint32_t FULL = (1u << SLOTS) - 1;
+  static const size_t CLASSES = 7;  // 64 bytes to MAX_BLOCK
+  static const uint8_t UNCACHED = 0xFF;
+
+  // prefixed to each block, keeping the alignment of operator new
+  union Header
+  {
+    uint8_t sizeClass;
+    Header* next;  // while on a free list
+    std::max_align_t align;
+  };
+
+  struct FreeList
+  {
+    Header* head[CLASSES] = {};
+    size_t count[CLASSES] = {};
+
+    ~FreeList()
     {
-      return ::operator new(size);
+      for (size_t c = 0; c < CLASSES; c++)
+        while (head[c])
+        {
+          Header* block = head[c];
+          head[c] = block->next;
+          ::operator delete(block);
+        }
     }
+  };
+
+  static uint32_t lowestClear(uint32_t used)
+  {
+    uint32_t slot = 0;
+    while (used & (1u << slot))
+      slot++;
+    return slot;
   }
 
-  void deallocate(void* pointer)
+  static uint8_t getClass(size_t size)
+  {
+    uint8_t sizeClass = 0;
+    while ((size_t(64) << sizeClass) < size)
+      sizeClass++;
+    return sizeClass;
+  }
+
+  static FreeList& getFreeList()
   {
-    if (pointer == storage_.address())
+    static thread_local FreeList list;
+    return list;
+  }
+
+  static void* allocateBlock(size_t size)
+  {
+    if (size > MAX_BLOCK)
     {
-      in_use_ = false;
+      Header* block =
+          static_cast<Header*>(::operator new(sizeof(Header) + size));
+      block->sizeClass = UNCACHED;
+      return block + 1;
+    }
+
+    const uint8_t sizeClass = getClass(size);
+    FreeList& list = getFreeList();
+    Header* block = list.head[sizeClass];
+    if (block)
+    {
+      list.head[sizeClass] = block->next;
+      list.count[sizeClass]--;
     }
     else
+      block = static_cast<Header*>(
+          ::operator new(sizeof(Header) + (size_t(64) << sizeClass)));
+
+    block->sizeClass = sizeClass;
+    return block + 1;
+  }
+
+  static void deallocateBlock(void* pointer)
+  {
+    Header* block = static_cast<Header*>(pointer) - 1;
+    const uint8_t sizeClass = block->sizeClass;
+    FreeList& list = getFreeList();
+    if (sizeClass == UNCACHED || list.count[sizeClass] == MAX_CACHED)
     {
-      ::operator delete(pointer);
+      ::operator delete(block);
+      return;
     }
+
+    block->next = list.head[sizeClass];
+    list.head[sizeClass] = block;
+    list.count[sizeClass]++;
   }
 
- private:
-  boost::aligned_storage<1024> storage_;
-  bool in_use_;
+  boost::aligned_storage<SLOT_SIZE> slab_[SLOTS];
+  std::atomic<uint32_t> inUse_;
 };
 
 #endif
@@ -0,0 +1,172 @@
+#include "HedgedRequest.hpp"
+#include "MirrorStats.hpp"
+#include "IOExecutor.hpp"
+#include "../Log.hpp"
+#include <algorithm>
+#include <functional>
+
+using boost::system::error_code;
+
+const double HedgedRequest::DEFAULT_PERCENTILE = 0.95;
+const unsigned HedgedRequest::DEFAULT_DELAY;
+const unsigned HedgedRequest::MIN_DELAY;
+
+
+// the backup may be null, in which case this is a plain request; the
+// callback runs once, with the winning response or the last failure
+void HedgedRequest::asyncSendReceive(
+    const std::shared_ptr<AsyncTorStream>& primary,
+    const std::shared_ptr<AsyncTorStream>& backup,
+    const std::string& type,
+    const std::string& msg,
+    const AsyncTorStream::ResponseCallback& callback,
+    double percentile)
+{
+  // an unsigned answer could win, so either stream must check signatures
+  if (!primary->hasServerKey() || (backup && !backup->hasServerKey()))
+  {
+    Log::get().warn("Refusing to hedge over a stream without a server key.");
+    IOExecutor::get().next().post(
+        std::bind(callback,
+                  boost::system::errc::make_error_code(
+                      boost::system::errc::operation_not_permitted),
+                  Json::Value()));
+    return;
+  }
+
+  std::shared_ptr<HedgedRequest> request(
+      new HedgedRequest(primary, backup, type, msg, callback));
+  request->strand_.dispatch([request, percentile]()
+                            {
+                              request->start(percentile);
+                            });
+}
+
+
+
+std::future<Json::Value> HedgedRequest::sendReceive(
+    const std::shared_ptr<AsyncTorStream>& primary,
+    const std::shared_ptr<AsyncTorStream>& backup,
+    const std::string& type,
+    const std::string& msg,
+    double percentile)
+{
+  auto promise = std::make_shared<std::promise<Json::Value>>();
+  asyncSendReceive(primary, backup, type, msg,
+                   [promise](error_code ec, Json::Value response)
+                   {
+                     if (ec)
+                       promise->set_exception(std::make_exception_ptr(
+                           boost::system::system_error(ec)));
+                     else
+                       promise->set_value(response);
+                   },
+                   percentile);
+  return promise->get_future();
+}
+
+
+
+// how long to wait on the given endpoint before hedging
+std::chrono::milliseconds HedgedRequest::getDelay(const std::string& address,
+                                                  double percentile)
+{
+  MirrorStats::Clock::duration rtt;
+  if (!MirrorStats::get().getPercentile(address, percentile, rtt))
+    return std::chrono::milliseconds(DEFAULT_DELAY);
+
+  return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(rtt),
+                  std::chrono::milliseconds(MIN_DELAY));
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+HedgedRequest::HedgedRequest(const std::shared_ptr<AsyncTorStream>& primary,
+                             const std::shared_ptr<AsyncTorStream>& backup,
+                             const std::string& type,
+                             const std::string& msg,
+                             const AsyncTorStream::ResponseCallback& callback)
+    : ios_(IOExecutor::get().next()),
+      strand_(ios_),
+      timer_(ios_),
+      streams_{primary, backup},
+      type_(type),
+      value_(msg),
+      callback_(callback),
+      sent_(0),
+      answered_(0),
+      finished_(false)
+{
+}
+
+
+
+void HedgedRequest::start(double percentile)
+{
+  send(0);
+  if (!streams_[1])
+    return;
+
+  auto self = shared_from_this();
+  timer_.expires_from_now(getDelay(streams_[0]->getRemoteHost(), percentile));
+  timer_.async_wait(strand_.wrap([self](error_code ec)
+                                 {
+                                   if (!ec && !self->finished_ &&
+                                       self->sent_ == 1)
+                                   {
+                                     LOG_NOTICE("Hedging a request.");
+                                     self->send(1);
+                                   }
+                                 }));
+}
+
+
+
+void HedgedRequest::send(size_t index)
+{
+  sent_++;
+  auto self = shared_from_this();
+  streams_[index]->asyncSendReceive(
+      type_, value_, strand_.wrap([self](error_code ec, Json::Value response)
+                                  {
+                                    self->onResponse(ec, response);
+                                  }));
+}
+
+
+
+void HedgedRequest::onResponse(error_code ec, Json::Value response)
+{
+  answered_++;
+  if (finished_)
+    return;
+
+  if (!ec && response["type"].asString() != "error")
+  {
+    finished_ = true;
+    timer_.cancel();
+    callback_(ec, response);
+    return;
+  }
+
+  lastError_ = ec;
+  lastResponse_ = response;
+
+  // the primary failed before its time was up, so hedge at once
+  if (sent_ == 1 && streams_[1])
+  {
+    timer_.cancel();
+    send(1);
+    return;
+  }
+
+  if (answered_ == sent_)
+  {
+    finished_ = true;
+    callback_(lastError_, lastResponse_);
+  }
+}
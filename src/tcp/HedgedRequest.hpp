@@ -0,0 +1,69 @@
+#ifndef HEDGED_REQUEST_HPP
+#define HEDGED_REQUEST_HPP
+
+#include "AsyncTorStream.hpp"
+#include <boost/asio/steady_timer.hpp>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <string>
+
+// Sends a request to a primary stream and, if no trustworthy response has
+// come back after the given percentile of the primary's recent round trips
+// or if the primary fails, sends it to a backup stream as well. The first
+// response that is not an error wins. Both streams must have their mirror's
+// key set, so that an answer that fails its signature check is an error and
+// cannot win; otherwise the request fails with operation_not_permitted
+// without being sent. Requests cannot be withdrawn from a server, so
+// the losing response is dropped when it arrives and the streams stay
+// usable. Without round trips on record, the backup waits DEFAULT_DELAY.
+class HedgedRequest : public std::enable_shared_from_this<HedgedRequest>
+{
+ public:
+  static const double DEFAULT_PERCENTILE;
+  static const unsigned DEFAULT_DELAY = 1000;  // milliseconds
+  static const unsigned MIN_DELAY = 20;        // milliseconds
+
+  static void asyncSendReceive(const std::shared_ptr<AsyncTorStream>&,
+                               const std::shared_ptr<AsyncTorStream>&,
+                               const std::string&,
+                               const std::string&,
+                               const AsyncTorStream::ResponseCallback&,
+                               double percentile = DEFAULT_PERCENTILE);
+  static std::future<Json::Value> sendReceive(
+      const std::shared_ptr<AsyncTorStream>&,
+      const std::shared_ptr<AsyncTorStream>&,
+      const std::string&,
+      const std::string&,
+      double percentile = DEFAULT_PERCENTILE);
+
+  static std::chrono::milliseconds getDelay(const std::string&, double);
+
+ private:
+  HedgedRequest(const std::shared_ptr<AsyncTorStream>&,
+                const std::shared_ptr<AsyncTorStream>&,
+                const std::string&,
+                const std::string&,
+                const AsyncTorStream::ResponseCallback&);
+  HedgedRequest(const HedgedRequest&) = delete;
+  void operator=(const HedgedRequest&) = delete;
+
+  void start(double);
+  void send(size_t);
+  void onResponse(boost::system::error_code, Json::Value);
+
+  boost::asio::io_service& ios_;
+  boost::asio::io_service::strand strand_;
+  boost::asio::steady_timer timer_;
+  std::shared_ptr<AsyncTorStream> streams_[2];  // primary, backup
+  const std::string type_, value_;
+  const AsyncTorStream::ResponseCallback callback_;
+
+  // only touched from within strand_
+  size_t sent_, answered_;
+  bool finished_;
+  boost::system::error_code lastError_;
+  Json::Value lastResponse_;
+};
+
+#endif
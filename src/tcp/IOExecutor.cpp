@@ -0,0 +1,118 @@
+#include "IOExecutor.hpp"
+#include "../Log.hpp"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <cstdint>
+
+std::atomic<size_t> IOExecutor::threadCount_(0);
+std::atomic<bool> IOExecutor::perCore_(false);
+std::atomic<bool> IOExecutor::started_(false);
+thread_local bool IOExecutor::isExecutor_ = false;
+
+
+// 0 threads means one per hardware thread; false once get() has been called
+bool IOExecutor::configure(size_t nThreads, bool perCore)
+{
+  if (started_)
+  {
+    Log::get().warn("The I/O executor is already running.");
+    return false;
+  }
+
+  threadCount_ = nThreads;
+  perCore_ = perCore;
+  return true;
+}
+
+
+
+// the service for a new socket; sockets stay on the service they started on
+boost::asio::io_service& IOExecutor::next()
+{
+  return *services_[next_++ % services_.size()];
+}
+
+
+
+size_t IOExecutor::getThreadCount() const
+{
+  return threads_.size();
+}
+
+
+
+size_t IOExecutor::getServiceCount() const
+{
+  return services_.size();
+}
+
+
+
+bool IOExecutor::isExecutorThread()
+{
+  return isExecutor_;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+IOExecutor::IOExecutor(size_t nThreads, bool perCore) : next_(0)
+{
+  started_ = true;
+  if (nThreads == 0)
+    nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  const size_t nServices = perCore ? nThreads : 1;
+  for (size_t n = 0; n < nServices; n++)
+  {
+    services_.emplace_back(new boost::asio::io_service());
+    work_.emplace_back(new boost::asio::io_service::work(*services_.back()));
+  }
+
+  for (size_t n = 0; n < nThreads; n++)
+    threads_.push_back(std::thread(&IOExecutor::run, this,
+                                   std::ref(*services_[n % nServices]),
+                                   perCore ? n : SIZE_MAX));
+}
+
+
+
+// a handler that throws is logged rather than taking the thread down
+void IOExecutor::run(boost::asio::io_service& ios, size_t core)
+{
+  isExecutor_ = true;
+  if (core != SIZE_MAX)
+    pin(core);
+
+  while (true)
+  {
+    try
+    {
+      ios.run();
+      return;
+    }
+    catch (std::exception& ex)
+    {
+      Log::get().warn(std::string("I/O handler failed: ") + ex.what());
+    }
+  }
+}
+
+
+
+void IOExecutor::pin(size_t core)
+{
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(core % std::max(std::thread::hardware_concurrency(), 1u), &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    Log::get().warn("Could not pin an I/O thread to its core.");
+#else
+  (void)core;
+#endif
+}
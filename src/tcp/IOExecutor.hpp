@@ -0,0 +1,52 @@
+#ifndef IO_EXECUTOR_HPP
+#define IO_EXECUTOR_HPP
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+// The event loop shared by every stream in the process: a pool of threads
+// running either one io_service between them, or one io_service per thread
+// with each thread pinned to a core, in which case next() hands services out
+// round-robin. TorStream, AuthenticatedStream and their SOCKS5 handshakes
+// run here instead of on a loop of their own. The shape is fixed by the
+// first call to get(), so configure() must come before any stream exists.
+// Handlers must not block waiting on other handlers, and so no stream should
+// be constructed from within one.
+class IOExecutor
+{
+ public:
+  static IOExecutor& get()
+  {
+    static IOExecutor* instance =  // handlers may run during exit
+        new IOExecutor(threadCount_, perCore_);
+    return *instance;
+  }
+
+  static bool configure(size_t nThreads, bool perCore = false);
+  boost::asio::io_service& next();
+  size_t getThreadCount() const;
+  size_t getServiceCount() const;
+  static bool isExecutorThread();
+
+ private:
+  IOExecutor(size_t, bool);
+  IOExecutor(IOExecutor const&) = delete;
+  void operator=(IOExecutor const&) = delete;
+
+  void run(boost::asio::io_service&, size_t);
+  static void pin(size_t);
+
+  std::vector<std::unique_ptr<boost::asio::io_service>> services_;
+  std::vector<std::unique_ptr<boost::asio::io_service::work>> work_;
+  std::vector<std::thread> threads_;
+  std::atomic<size_t> next_;
+
+  static std::atomic<size_t> threadCount_;
+  static std::atomic<bool> perCore_, started_;
+  static thread_local bool isExecutor_;
+};
+
+#endif
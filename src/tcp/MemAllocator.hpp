@@ -3,10 +3,13 @@
 #define MEM_ALLOCATOR_HPP
 
 #include "HandleAlloc.hpp"
+#include <boost/asio/handler_invoke_hook.hpp>
+#include <boost/asio/detail/handler_invoke_helpers.hpp>
 
 // Wrapper class template for handler objects to allow handler memory
 // allocation to be customized. Calls to operator() are forwarded to the
-// encapsulated handler.
+// encapsulated handler, and so is invocation, so that a wrapped strand
+// handler still runs within its strand.
 template <typename Handler>
 class MemAllocator
 {
@@ -38,9 +41,33 @@ class MemAllocator
     this_handler->allocator_.deallocate(pointer);
   }
 
+  template <typename Function>
+  friend void asio_handler_invoke(Function& function,
+                                  MemAllocator<Handler>* this_handler)
+  {
+    boost_asio_handler_invoke_helpers::invoke(function,
+                                              this_handler->handler_);
+  }
+
+  template <typename Function>
+  friend void asio_handler_invoke(const Function& function,
+                                  MemAllocator<Handler>* this_handler)
+  {
+    boost_asio_handler_invoke_helpers::invoke(function,
+                                              this_handler->handler_);
+  }
+
  private:
   HandleAlloc& allocator_;
   Handler handler_;
 };
 
+
+
+template <typename Handler>
+inline MemAllocator<Handler> makeHandler(HandleAlloc& a, Handler h)
+{
+  return MemAllocator<Handler>(a, h);
+}
+
 #endif
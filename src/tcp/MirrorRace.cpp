@@ -0,0 +1,164 @@
+#include "MirrorRace.hpp"
+#include "IOExecutor.hpp"
+#include "MirrorStats.hpp"
+#include "../Log.hpp"
+
+using boost::system::error_code;
+
+const unsigned MirrorRace::DEFAULT_STAGGER;
+
+
+// the callback runs once, on an executor thread
+void MirrorRace::asyncConnect(const std::string& socksHost,
+                              ushort socksPort,
+                              const std::vector<Config::Node>& mirrors,
+                              const Callback& callback,
+                              std::chrono::milliseconds stagger,
+                              bool multiplexed)
+{
+  std::shared_ptr<MirrorRace> race(new MirrorRace(
+      socksHost, socksPort, mirrors, callback, stagger, multiplexed));
+
+  race->strand_.dispatch([race]()
+                         {
+                           if (race->mirrors_.empty())
+                           {
+                             race->finished_ = true;
+                             race->callback_(boost::asio::error::not_found,
+                                             Result());
+                           }
+                           else
+                             race->startNext();
+                         });
+}
+
+
+
+// races the mirrors currently in mirrors.json, best ranked first
+std::future<MirrorRace::Result> MirrorRace::connect(
+    const std::string& socksHost,
+    ushort socksPort,
+    std::chrono::milliseconds stagger,
+    bool multiplexed)
+{
+  auto promise = std::make_shared<std::promise<Result>>();
+  asyncConnect(socksHost, socksPort,
+               MirrorStats::get().rank(Config::getMirrors()->nodes),
+               [promise](error_code ec, Result result)
+               {
+                 if (ec)
+                   promise->set_exception(std::make_exception_ptr(
+                       boost::system::system_error(ec)));
+                 else
+                   promise->set_value(result);
+               },
+               stagger, multiplexed);
+  return promise->get_future();
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+MirrorRace::MirrorRace(const std::string& socksHost,
+                       ushort socksPort,
+                       const std::vector<Config::Node>& mirrors,
+                       const Callback& callback,
+                       std::chrono::milliseconds stagger,
+                       bool multiplexed)
+    : ios_(IOExecutor::get().next()),
+      strand_(ios_),
+      timer_(ios_),
+      socksHost_(socksHost),
+      socksPort_(socksPort),
+      mirrors_(mirrors),
+      callback_(callback),
+      stagger_(stagger),
+      multiplexed_(multiplexed),
+      started_(0),
+      failed_(0),
+      finished_(false)
+{
+}
+
+
+
+void MirrorRace::startNext()
+{
+  if (finished_ || started_ == mirrors_.size())
+    return;
+
+  const size_t index = started_++;
+  const Config::Node& mirror = mirrors_[index];
+  LOG_NOTICE("Connecting to mirror " + mirror.address + "...");
+
+  auto stream = AsyncTorStream::create(ios_, multiplexed_);
+  stream->setServerKey(mirror.key);
+  attempts_.push_back(stream);
+
+  auto self = shared_from_this();
+  stream->asyncConnect(socksHost_, socksPort_, mirror.address,
+                       Const::SERVER_PORT,
+                       strand_.wrap([self, index](error_code ec)
+                                    {
+                                      self->onAttempt(index, ec);
+                                    }));
+  scheduleNext();
+}
+
+
+
+// the next attempt starts after the stagger unless a failure starts it first
+void MirrorRace::scheduleNext()
+{
+  if (started_ == mirrors_.size())
+    return;
+
+  auto self = shared_from_this();
+  timer_.expires_from_now(stagger_);
+  timer_.async_wait(strand_.wrap([self](error_code ec)
+                                 {
+                                   if (!ec)
+                                     self->startNext();
+                                 }));
+}
+
+
+
+void MirrorRace::onAttempt(size_t index, error_code ec)
+{
+  if (finished_)
+    return;
+
+  if (ec)
+  {
+    Log::get().warn("Mirror " + mirrors_[index].address + " failed: " +
+                    ec.message());
+    attempts_[index].reset();
+    lastError_ = ec;
+    if (++failed_ < mirrors_.size())
+    {
+      timer_.cancel();
+      startNext();
+      return;
+    }
+
+    finished_ = true;
+    callback_(lastError_, Result());
+    return;
+  }
+
+  finished_ = true;
+  timer_.cancel();
+  for (size_t n = 0; n < attempts_.size(); n++)
+    if (n != index && attempts_[n])
+      attempts_[n]->close();
+
+  Result result;
+  result.stream = attempts_[index];
+  result.mirror = mirrors_[index];
+  attempts_.clear();
+  callback_(error_code(), result);
+}
@@ -0,0 +1,79 @@
+#ifndef MIRROR_RACE_HPP
+#define MIRROR_RACE_HPP
+
+#include "AsyncTorStream.hpp"
+#include "../Config.hpp"
+#include <boost/asio/steady_timer.hpp>
+#include <functional>
+#include <future>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <string>
+
+// Connects to one of several mirrors in the manner of happy eyeballs: the
+// first attempt starts at once and each further one after a stagger, or as
+// soon as an earlier attempt fails. The first stream to confirm the
+// protocol wins and the other attempts are closed, so a slow or dead mirror
+// costs at most one stagger rather than a whole SOCKS timeout. Mirrors are
+// tried in the order given. The streams verify responses with their
+// mirror's key, and run on the shared IOExecutor.
+class MirrorRace : public std::enable_shared_from_this<MirrorRace>
+{
+ public:
+  struct Result
+  {
+    std::shared_ptr<AsyncTorStream> stream;
+    Config::Node mirror;
+  };
+
+  typedef std::function<void(boost::system::error_code, Result)> Callback;
+
+  static const unsigned DEFAULT_STAGGER = 300;  // milliseconds
+
+  static void asyncConnect(const std::string&,
+                           ushort,
+                           const std::vector<Config::Node>&,
+                           const Callback&,
+                           std::chrono::milliseconds stagger =
+                               std::chrono::milliseconds(DEFAULT_STAGGER),
+                           bool multiplexed = true);
+  static std::future<Result> connect(
+      const std::string&,
+      ushort,
+      std::chrono::milliseconds stagger =
+          std::chrono::milliseconds(DEFAULT_STAGGER),
+      bool multiplexed = true);
+
+ private:
+  MirrorRace(const std::string&,
+             ushort,
+             const std::vector<Config::Node>&,
+             const Callback&,
+             std::chrono::milliseconds,
+             bool);
+  MirrorRace(const MirrorRace&) = delete;
+  void operator=(const MirrorRace&) = delete;
+
+  void startNext();
+  void scheduleNext();
+  void onAttempt(size_t, boost::system::error_code);
+
+  boost::asio::io_service& ios_;
+  boost::asio::io_service::strand strand_;
+  boost::asio::steady_timer timer_;
+  const std::string socksHost_;
+  const ushort socksPort_;
+  const std::vector<Config::Node> mirrors_;
+  const Callback callback_;
+  const std::chrono::milliseconds stagger_;
+  const bool multiplexed_;
+
+  // only touched from within strand_
+  std::vector<std::shared_ptr<AsyncTorStream>> attempts_;  // by mirror
+  size_t started_, failed_;
+  bool finished_;
+  boost::system::error_code lastError_;
+};
+
+#endif
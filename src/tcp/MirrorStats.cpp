@@ -0,0 +1,244 @@
+#include "MirrorStats.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+
+const double MirrorStats::ALPHA = 0.2;
+const double MirrorStats::ERROR_COST = 10000;
+const size_t MirrorStats::WINDOW;
+
+
+void MirrorStats::recordConnect(const std::string& address,
+                                Clock::duration elapsed)
+{
+  static Metrics::Histogram& connects = Metrics::get().histogram(
+      "onions_stream_connect_seconds", "Time to connect and confirm a stream.");
+  connects.observeDuration(elapsed);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  Entry& entry = entries_[address];
+  blend(entry.connectMs,
+        std::chrono::duration<double, std::milli>(elapsed).count(),
+        entry.connects++);
+  blend(entry.errorRate, 0, entry.samples);
+  entry.samples++;
+}
+
+
+
+void MirrorStats::recordRequest(const std::string& address,
+                                Clock::duration elapsed)
+{
+  static Metrics::Histogram& rtts = Metrics::get().histogram(
+      "onions_stream_rtt_seconds", "Round trips of stream requests.");
+  rtts.observeDuration(elapsed);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  Entry& entry = entries_[address];
+  blend(entry.rttMs, std::chrono::duration<double, std::milli>(elapsed).count(),
+        entry.requests++);
+  blend(entry.errorRate, 0, entry.samples);
+  entry.samples++;
+
+  auto& recent = recent_[address];
+  if (recent.size() == WINDOW)
+    recent.pop_front();
+  recent.push_back(elapsed);
+}
+
+
+
+// a connect or request that failed
+void MirrorStats::recordFailure(const std::string& address)
+{
+  static Metrics::Counter& failures = Metrics::get().counter(
+      "onions_stream_failures_total", "Failed stream connects and requests.");
+  failures.add();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  Entry& entry = entries_[address];
+  blend(entry.errorRate, 1, entry.samples);
+  entry.samples++;
+}
+
+
+
+bool MirrorStats::lookup(const std::string& address, Entry& entry) const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto found = entries_.find(address);
+  if (found == entries_.end())
+    return false;
+
+  entry = found->second;
+  return true;
+}
+
+
+
+// the expected milliseconds to an answer; lower is better
+double MirrorStats::getScore(const std::string& address) const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto found = entries_.find(address);
+  return found == entries_.end() ? 0 : score(found->second);
+}
+
+
+
+// the given fraction of recent round trips took at most this long; false
+// without any round trips recorded since the start
+bool MirrorStats::getPercentile(const std::string& address,
+                                double fraction,
+                                Clock::duration& rtt) const
+{
+  std::vector<Clock::duration> sorted;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto found = recent_.find(address);
+    if (found == recent_.end() || found->second.empty())
+      return false;
+    sorted.assign(found->second.begin(), found->second.end());
+  }
+
+  fraction = std::min(std::max(fraction, 0.0), 1.0);
+  auto nth = sorted.begin() +
+             static_cast<ptrdiff_t>(fraction * double(sorted.size() - 1) + 0.5);
+  std::nth_element(sorted.begin(), nth, sorted.end());
+  rtt = *nth;
+  return true;
+}
+
+
+
+// best first; ties keep their order
+std::vector<Config::Node> MirrorStats::rank(
+    const std::vector<Config::Node>& nodes) const
+{
+  std::vector<std::pair<double, size_t>> scores;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+      auto found = entries_.find(nodes[n].address);
+      scores.push_back(
+          {found == entries_.end() ? 0 : score(found->second), n});
+    }
+  }
+
+  std::stable_sort(scores.begin(), scores.end());
+  std::vector<Config::Node> ranked;
+  ranked.reserve(nodes.size());
+  for (const auto& entry : scores)
+    ranked.push_back(nodes[entry.second]);
+  return ranked;
+}
+
+
+
+void MirrorStats::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  entries_.clear();
+  recent_.clear();
+}
+
+
+
+bool MirrorStats::save(const std::string& path) const
+{
+  Json::Value json(Json::objectValue);
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (const auto& entry : entries_)
+    {
+      Json::Value& stats = json[entry.first];
+      stats["connectMs"] = entry.second.connectMs;
+      stats["rttMs"] = entry.second.rttMs;
+      stats["errorRate"] = entry.second.errorRate;
+      stats["samples"] = Json::UInt64(entry.second.samples);
+      stats["connects"] = Json::UInt64(entry.second.connects);
+      stats["requests"] = Json::UInt64(entry.second.requests);
+    }
+  }
+
+  // write to a temporary file first so that a crash cannot truncate the file
+  const std::string tmpPath = path + ".tmp";
+  std::ofstream file(tmpPath, std::ofstream::trunc);
+  if (!file.is_open())
+  {
+    Log::get().warn("Cannot open mirror statistics " + tmpPath);
+    return false;
+  }
+
+  Json::StyledStreamWriter writer;
+  writer.write(file, json);
+  file.close();
+  if (file.fail() || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+  {
+    Log::get().warn("Failed to write mirror statistics " + path);
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// replaces the statistics of the endpoints in the file
+bool MirrorStats::load(const std::string& path)
+{
+  std::ifstream file(path);
+  if (!file.is_open())
+  {
+    Log::get().warn("Cannot open mirror statistics " + path);
+    return false;
+  }
+
+  Json::Value json;
+  Json::Reader reader;
+  if (!reader.parse(file, json) || !json.isObject())
+  {
+    Log::get().warn("Mirror statistics " + path + " are corrupt.");
+    return false;
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (const auto& address : json.getMemberNames())
+  {
+    const Json::Value& stats = json[address];
+    Entry& entry = entries_[address];
+    entry.connectMs = stats.get("connectMs", 0).asDouble();
+    entry.rttMs = stats.get("rttMs", 0).asDouble();
+    entry.errorRate = stats.get("errorRate", 0).asDouble();
+    entry.samples = stats.get("samples", 0).asUInt64();
+
+    // files from before the counts were kept had an average or none
+    entry.connects = stats.get("connects", entry.connectMs > 0).asUInt64();
+    entry.requests = stats.get("requests", entry.rttMs > 0).asUInt64();
+  }
+
+  return true;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// the first sample sets the average outright
+void MirrorStats::blend(double& average, double sample, uint64_t samples)
+{
+  average = samples == 0 ? sample : average + ALPHA * (sample - average);
+}
+
+
+
+double MirrorStats::score(const Entry& entry)
+{
+  const double latency = entry.requests > 0 ? entry.rttMs : entry.connectMs;
+  return latency + entry.errorRate * ERROR_COST;
+}
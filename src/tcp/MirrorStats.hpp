@@ -0,0 +1,70 @@
+#ifndef MIRROR_STATS_HPP
+#define MIRROR_STATS_HPP
+
+#include "../Config.hpp"
+#include <unordered_map>
+#include <chrono>
+#include <vector>
+#include <deque>
+#include <string>
+#include <mutex>
+
+// Exponentially weighted moving averages of each endpoint's connect time,
+// request round trip and error rate, as TorStream and AsyncTorStream see
+// them, keyed by the remote address. rank() orders mirrors or Quorum nodes
+// by expected latency, penalizing errors, so that connection attempts go to
+// the fastest reliable ones first. Endpoints without samples rank first so
+// that they get measured. The last WINDOW round trips are also kept, for
+// percentiles. The averages can be saved and loaded as JSON.
+class MirrorStats
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry
+  {
+    double connectMs;  // EWMA, 0 if never connected
+    double rttMs;      // EWMA, 0 if never answered
+    double errorRate;  // EWMA of failures over connects and requests
+    uint64_t samples;
+    uint64_t connects;  // samples of connectMs
+    uint64_t requests;  // samples of rttMs
+  };
+
+  static MirrorStats& get()
+  {
+    static MirrorStats instance;
+    return instance;
+  }
+
+  static const double ALPHA;       // weight of each new sample
+  static const double ERROR_COST;  // milliseconds a certain failure costs
+  static const size_t WINDOW = 64;  // recent round trips per endpoint
+
+  void recordConnect(const std::string&, Clock::duration);
+  void recordRequest(const std::string&, Clock::duration);
+  void recordFailure(const std::string&);
+
+  bool lookup(const std::string&, Entry&) const;
+  double getScore(const std::string&) const;
+  bool getPercentile(const std::string&, double, Clock::duration&) const;
+  std::vector<Config::Node> rank(const std::vector<Config::Node>&) const;
+  void clear();
+
+  bool save(const std::string&) const;
+  bool load(const std::string&);
+
+ private:
+  MirrorStats() = default;
+  MirrorStats(MirrorStats const&) = delete;
+  void operator=(MirrorStats const&) = delete;
+
+  static void blend(double&, double, uint64_t);
+  static double score(const Entry&);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::unordered_map<std::string, std::deque<Clock::duration>> recent_;
+};
+
+#endif
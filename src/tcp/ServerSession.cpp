@@ -0,0 +1,597 @@
+
+#include "ServerSession.hpp"
+#include "AsyncServer.hpp"
+#include "MemAllocator.hpp"
+#include "TorStream.hpp"
+#include "../encoding/Deflate.hpp"
+#include "../encoding/Codec.hpp"
+#include "../ThreadPool.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include "../Tracer.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+using boost::system::error_code;
+
+const size_t ServerSession::READ_SIZE;
+const size_t ServerSession::MAX_OUTBOX;
+const size_t ServerSession::SEND_SIZE;
+
+ServerSession::ServerSession(boost::asio::io_service& ios,
+                             const std::shared_ptr<AsyncServer>& server)
+    : server_(server),
+      strand_(ios),
+      socket_(ios),
+      idleTimer_(ios),
+      framing_(Framing::Line),
+      compressing_(false),
+      signingRaw_(false),
+      synced_(false),
+      open_(true),
+      reading_(false),
+      writing_(false),
+      needed_(0),
+      inFlight_(0)
+{
+}
+
+
+
+ServerSession::~ServerSession()
+{
+  server_->removeSession(this);
+}
+
+
+
+boost::asio::ip::tcp::socket& ServerSession::getSocket()
+{
+  return socket_;
+}
+
+
+
+// called once the socket is connected
+void ServerSession::start()
+{
+  server_->addSession(this, shared_from_this());
+
+  error_code ignored;
+  socket_.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+
+  auto self = shared_from_this();
+  strand_.dispatch([self]()
+                   {
+                     self->armIdleTimer();
+                     self->readNext();
+                   });
+}
+
+
+
+// may be called from any thread; handlers still pending see the closed
+// socket and drop their references to the session
+void ServerSession::close()
+{
+  auto self = shared_from_this();
+  strand_.dispatch([self]()
+                   {
+                     if (!self->open_)
+                       return;
+
+                     self->open_ = false;
+                     error_code ignored;
+                     self->idleTimer_.cancel(ignored);
+                     self->socket_.shutdown(
+                         boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                     self->socket_.close(ignored);
+                   });
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// Handles every complete message already in inbox_, then reads more,
+// unless the client is not keeping up with the responses. A read takes at
+// least the rest of a frame that has begun to arrive.
+void ServerSession::readNext()
+{
+  const auto isBackedUp = [this]()
+  {
+    return outbox_.size() + transfers_.size() >= MAX_OUTBOX;
+  };
+
+  while (open_ && !isBackedUp() && extract())
+    ;
+
+  if (!open_ || reading_ || isBackedUp())
+    return;
+
+  reading_ = true;
+  auto self = shared_from_this();
+  socket_.async_read_some(
+      inbox_.prepare(std::max(READ_SIZE, needed_)),
+      strand_.wrap(makeHandler(readAlloc_, [self](error_code ec, size_t n)
+                                           {
+                                             self->reading_ = false;
+                                             if (ec)
+                                               return self->close();
+
+                                             self->inbox_.commit(n);
+                                             self->armIdleTimer();
+                                             self->readNext();
+                                           })));
+}
+
+
+
+// handles the first complete message in inbox_, if there is one
+bool ServerSession::extract()
+{
+  const char* data = boost::asio::buffer_cast<const char*>(inbox_.data());
+  const size_t size = inbox_.size();
+  needed_ = 0;
+
+  if (framing_ == Framing::Line)
+  {
+    const char* end = static_cast<const char*>(std::memchr(data, '\n', size));
+    if (!end)
+    {
+      if (size > TorStream::MAX_FRAME)
+      {
+        Log::get().warn("Oversized request from a client.");
+        close();
+      }
+      return false;
+    }
+
+    const size_t len = static_cast<size_t>(end - data) + 1;
+    handle(data, len);
+    inbox_.consume(len);
+    return true;
+  }
+
+  if (size < TorStream::HEADER_LEN)
+    return false;
+
+  const uint8_t* header = reinterpret_cast<const uint8_t*>(data);
+  const uint32_t word = (uint32_t(header[0]) << 24) |
+                       (uint32_t(header[1]) << 16) |
+                       (uint32_t(header[2]) << 8) | header[3];
+  const size_t len = word & ~TorStream::COMPRESSED;
+  if (len > TorStream::MAX_FRAME)
+  {
+    Log::get().warn("Oversized frame from a client.");
+    close();
+    return false;
+  }
+
+  if (size < TorStream::HEADER_LEN + len)
+  {
+    needed_ = TorStream::HEADER_LEN + len - size;
+    return false;
+  }
+
+  const char* payload = data + TorStream::HEADER_LEN;
+  if (word & TorStream::COMPRESSED)
+  {
+    if (!compressing_ ||
+        !Deflate::decompress(payload, len, inflated_, TorStream::MAX_FRAME))
+    {
+      Log::get().warn("Invalid compressed frame from a client.");
+      close();
+      return false;
+    }
+
+    handle(inflated_.data(), inflated_.size());
+  }
+  else
+    handle(payload, len);
+
+  inbox_.consume(TorStream::HEADER_LEN + len);
+  return true;
+}
+
+
+
+// Answers the first message if it is a SYN, and heartbeats at once, and
+// otherwise passes the request to the handler for its type. Blocking
+// handlers run on the ThreadPool and respond through the strand when they
+// finish.
+void ServerSession::handle(const char* message, size_t len)
+{
+  Tracer::Context context;
+  Tracer::Span span("server.handle");
+  Json::Value request = TorStream::parseResponse(message, len);
+  const Json::Value id = request.get("id", Json::Value());
+  if (request.isMember("error"))
+    return respond(id, "error", request["error"]);
+  if (!request["type"].isString())
+    return respond(id, "error", "Invalid request type.");
+
+  const std::string type = request["type"].asString();
+  const bool first = !synced_;
+  synced_ = true;
+  if (first && type == "SYN")
+    return acknowledge(request);
+  if (type == TorStream::HEARTBEAT_TYPE)
+    return respond(id, "success", "pong");
+  if (type == Export::REQUEST_TYPE && !request["value"].isString())
+    return respond(id, "error", "Invalid export request.");
+  if (type == Export::REQUEST_TYPE)
+    return streamExport(id, request["value"].asString());
+
+  const AsyncServer::Route* route = server_->findRoute(type);
+  if (!route)
+    return respond(id, "error", "Unknown request type.");
+
+  if (!route->blocking)
+  {
+    try
+    {
+      Tracer::Span handling("server.handler");
+      respond(id, "success", route->handler(request["value"]));
+    }
+    catch (std::exception& e)
+    {
+      respond(id, "error", e.what());
+    }
+    return;
+  }
+
+  auto self = shared_from_this();
+  const AsyncServer::Handler handler = route->handler;
+  const Json::Value value = request["value"];
+  const uint64_t traced = context.getRequest();
+  ThreadPool::get().submit([self, handler, id, value, traced]()
+                           {
+                             Tracer::Context context(traced);
+                             Tracer::Span span("server.handler");
+                             std::string outcome = "success";
+                             Json::Value result;
+                             try
+                             {
+                               result = handler(value);
+                             }
+                             catch (std::exception& e)
+                             {
+                               outcome = "error";
+                               result = e.what();
+                             }
+
+                             self->strand_.post([self, id, outcome, result]()
+                                                {
+                                                  self->respond(id, outcome,
+                                                                result);
+                                                });
+                           });
+}
+
+
+
+// Agrees to what the SYN offers and the server allows. The ACK goes out in
+// newline framing, as the client switches only after reading it.
+void ServerSession::acknowledge(const Json::Value& syn)
+{
+  Json::Value ack;
+  ack["type"] = "success";
+  ack["value"] = "ACK";
+
+  // an option that is not a string is not asked for
+  const auto asks = [&syn](const char* option, const char* choice)
+  {
+    return syn[option].isString() && syn[option].asString() == choice;
+  };
+
+  const bool length = server_->allowsFraming() && asks("framing", "length");
+  if (length)
+  {
+    ack["framing"] = "length";
+    if (server_->allowsCompression() && asks("compression", "deflate"))
+      ack["compression"] = "deflate";
+    if (server_->isSigning() && asks("signing", "raw"))
+      ack["signing"] = "raw";
+  }
+
+  send(ack);
+  if (length)
+  {
+    framing_ = Framing::Length;
+    compressing_ = ack.isMember("compression");
+    signingRaw_ = ack.isMember("signing");
+  }
+}
+
+
+
+// Responds with the header of the requested range of the current Export,
+// and queues the range to follow it without passing through memory.
+void ServerSession::streamExport(const Json::Value& id, const std::string& text)
+{
+  Export::Range range;
+  Json::Value header;
+  try
+  {
+    header = Export::answer(text, range);
+  }
+  catch (std::exception& e)
+  {
+    return respond(id, "error", e.what());
+  }
+
+  respond(id, "success", header);
+  if (open_ && range.length > 0)
+  {
+    transfers_.push_back(
+        {range.source, range.offset, range.length, outbox_.size()});
+    writeNext();
+  }
+}
+
+
+
+void ServerSession::respond(const Json::Value& id,
+                            const std::string& type,
+                            const Json::Value& value)
+{
+  Json::Value response;
+  response["type"] = type;
+  response["value"] = value;
+  if (!id.isNull())
+    response["id"] = id;
+  send(response);
+}
+
+
+
+// Serializes and queues a response. With raw signing, the signature on the
+// payload bytes as sent, deflated or not, goes ahead of them in the frame;
+// otherwise it is a member over the type and value, as verifyResponse
+// expects.
+void ServerSession::send(Json::Value response)
+{
+  if (!open_)
+    return;
+
+  if (server_->isSigning() && !signingRaw_)
+  {
+    std::string data =
+        response["type"].toStyledString() + response["value"].toStyledString();
+    ED_SIGNATURE sig;
+    server_->sign(reinterpret_cast<const uint8_t*>(data.data()), data.size(),
+                  sig.data());
+    response["signature"] = Codec::base64Encode(sig.data(), sig.size());
+  }
+
+  Json::FastWriter writer;
+  std::string payload = writer.write(response);
+  if (framing_ == Framing::Line)
+  {
+    outbox_.push_back(std::move(payload));
+    return writeNext();
+  }
+
+  payload.pop_back();  // FastWriter's newline
+
+  bool deflated = false;
+  if (compressing_ && payload.size() >= TorStream::COMPRESS_THRESHOLD &&
+      Deflate::compress(payload.data(), payload.size(), deflated_) &&
+      deflated_.size() < payload.size())
+  {
+    payload.swap(deflated_);
+    deflated = true;
+  }
+
+  const size_t sigLen = signingRaw_ ? TorStream::SIGNATURE_LEN : 0;
+  uint32_t word = static_cast<uint32_t>(sigLen + payload.size());
+  if (deflated)
+    word |= TorStream::COMPRESSED;
+
+  std::string frame(TorStream::HEADER_LEN + sigLen + payload.size(), '\0');
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(&frame[0]);
+  bytes[0] = static_cast<uint8_t>(word >> 24);
+  bytes[1] = static_cast<uint8_t>(word >> 16);
+  bytes[2] = static_cast<uint8_t>(word >> 8);
+  bytes[3] = static_cast<uint8_t>(word);
+  std::memcpy(bytes + TorStream::HEADER_LEN + sigLen, payload.data(),
+              payload.size());
+  if (signingRaw_)
+    server_->sign(bytes + TorStream::HEADER_LEN + sigLen, payload.size(),
+                  bytes + TorStream::HEADER_LEN);
+
+  outbox_.push_back(std::move(frame));
+  writeNext();
+}
+
+
+
+// writes everything queued so far in one gathered write, up to the next
+// Export range, which then goes out on its own
+void ServerSession::writeNext()
+{
+  if (writing_ || !open_)
+    return;
+
+  if (!transfers_.empty() && transfers_.front().ahead == 0)
+    return streamNext();
+
+  if (outbox_.empty())
+    return;
+
+  writing_ = true;
+  inFlight_ = transfers_.empty() ? outbox_.size() : transfers_.front().ahead;
+  std::vector<boost::asio::const_buffer> buffers;
+  buffers.reserve(inFlight_);
+  for (size_t j = 0; j < inFlight_; j++)
+    buffers.push_back(boost::asio::buffer(outbox_[j]));
+
+  auto self = shared_from_this();
+  boost::asio::async_write(
+      socket_, buffers,
+      strand_.wrap(makeHandler(writeAlloc_, [self](error_code ec, size_t)
+                                            {
+                                              self->writing_ = false;
+                                              if (ec)
+                                                return self->close();
+
+                                              self->outbox_.erase(
+                                                  self->outbox_.begin(),
+                                                  self->outbox_.begin() +
+                                                      self->inFlight_);
+                                              for (auto& transfer :
+                                                   self->transfers_)
+                                                transfer.ahead -=
+                                                    self->inFlight_;
+                                              self->writeNext();
+                                              self->readNext();
+                                            })));
+}
+
+
+
+// Sends the front Export range from its file for as long as the socket
+// takes it, then waits until the socket has room for more. The kernel
+// copies straight from the page cache with sendfile; elsewhere pieces of
+// SEND_SIZE go through spool_.
+void ServerSession::streamNext()
+{
+  static Metrics::Counter& streamed = Metrics::get().counter(
+      "onions_export_streamed_bytes_total",
+      "Bytes of exports sent to syncing peers.");
+
+#ifdef __linux__
+  // Unlike send, sendfile cannot be told not to raise SIGPIPE if the peer
+  // has gone. Rather than change the process's disposition, the signal is
+  // held back on this thread while the range is sent, and one that the
+  // sending raised is taken off this thread before it is let through again.
+  struct PipeGuard
+  {
+    sigset_t pipe, previous;
+    bool wasPending;
+
+    PipeGuard()
+    {
+      sigemptyset(&pipe);
+      sigaddset(&pipe, SIGPIPE);
+      sigset_t pending;
+      wasPending = sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &pipe, &previous);
+    }
+
+    ~PipeGuard()
+    {
+      sigset_t pending;
+      if (!wasPending && sigpending(&pending) == 0 &&
+          sigismember(&pending, SIGPIPE))
+      {
+        const timespec now = {0, 0};
+        int taken;
+        do
+          taken = sigtimedwait(&pipe, nullptr, &now);
+        while (taken < 0 && errno == EINTR);
+      }
+      pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+  } pipeGuard;
+#elif defined(SO_NOSIGPIPE)
+  const int noSigPipe = 1;
+  setsockopt(socket_.native_handle(), SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe,
+             sizeof(noSigPipe));
+#endif
+
+  writing_ = true;
+  Transfer& transfer = transfers_.front();
+  error_code ec;
+  socket_.native_non_blocking(true, ec);
+  while (!ec && transfer.left > 0)
+  {
+    const int fd = transfer.source->getFileDescriptor();
+    const size_t count = std::min<uint64_t>(transfer.left, SEND_SIZE);
+#ifdef __linux__
+    off_t offset = static_cast<off_t>(transfer.offset);
+    const ssize_t sent = ::sendfile(socket_.native_handle(), fd, &offset, count);
+#else
+    spool_.resize(count);
+    ssize_t sent = pread(fd, &spool_[0], count, transfer.offset);
+    if (sent > 0)
+#ifdef MSG_NOSIGNAL
+      sent = ::send(socket_.native_handle(), spool_.data(), sent, MSG_NOSIGNAL);
+#else
+      sent = ::send(socket_.native_handle(), spool_.data(), sent, 0);
+#endif
+#endif
+
+    if (sent > 0)
+    {
+      transfer.offset += sent;
+      transfer.left -= sent;
+      streamed.add(sent);
+    }
+    else if (sent < 0 && errno == EINTR)
+      continue;
+    else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      auto self = shared_from_this();
+      socket_.async_wait(
+          boost::asio::ip::tcp::socket::wait_write,
+          strand_.wrap(makeHandler(writeAlloc_, [self](error_code waited)
+                                                {
+                                                  if (!waited && self->open_)
+                                                    return self->streamNext();
+
+                                                  self->writing_ = false;
+                                                  self->close();
+                                                })));
+      return;
+    }
+    else
+      ec = boost::asio::error::broken_pipe;  // or the file fell short
+  }
+
+  writing_ = false;
+  if (ec)
+    return close();
+
+  transfers_.pop_front();
+  writeNext();
+  readNext();
+}
+
+
+
+// (re)starts the countdown to closing an idle session
+void ServerSession::armIdleTimer()
+{
+  const auto timeout = server_->getIdleTimeout();
+  if (timeout.count() <= 0)
+    return;
+
+  idleTimer_.expires_from_now(timeout);
+  std::weak_ptr<ServerSession> weak = shared_from_this();
+  idleTimer_.async_wait(strand_.wrap([weak](error_code ec)
+                                     {
+                                       auto self = weak.lock();
+                                       if (ec || !self)
+                                         return;
+                                       if (self->idleTimer_.expires_at() >
+                                           boost::asio::steady_timer::
+                                               clock_type::now())
+                                         return;  // re-armed since
+
+                                       LOG_NOTICE("Closing an idle session.");
+                                       self->close();
+                                     }));
+}
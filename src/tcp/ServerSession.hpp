@@ -0,0 +1,85 @@
+#ifndef SERVER_SESSION_HPP
+#define SERVER_SESSION_HPP
+
+#include "HandleAlloc.hpp"
+#include "../containers/Export.hpp"
+#include <boost/asio.hpp>
+#include <json/json.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <deque>
+
+class AsyncServer;
+
+// One client connection of an AsyncServer. Reads go into one buffer, from
+// which every complete message is handled before the next read, so that
+// pipelined requests cost no extra wakeups. Responses queue up and go out
+// one write at a time; while too many are waiting, nothing more is read.
+// Ranges of an Export go out in their turn straight from its file, with
+// sendfile where there is one. Everything happens within the session's
+// strand.
+class ServerSession : public std::enable_shared_from_this<ServerSession>
+{
+ public:
+  static const size_t READ_SIZE = 4096;  // bytes per read
+  static const size_t MAX_OUTBOX = 256;  // queued responses
+  static const size_t SEND_SIZE = 1 << 20;  // bytes of an Export per call
+
+  ServerSession(boost::asio::io_service&, const std::shared_ptr<AsyncServer>&);
+  ~ServerSession();
+
+  boost::asio::ip::tcp::socket& getSocket();
+  void start();
+  void close();
+
+ private:
+  enum class Framing : uint8_t
+  {
+    Line,
+    Length
+  };
+
+  // a range of an Export, sent once the responses ahead of it are
+  struct Transfer
+  {
+    ExportPtr source;
+    uint64_t offset, left;
+    size_t ahead;  // of the messages in outbox_
+  };
+
+  ServerSession(const ServerSession&) = delete;
+  void operator=(const ServerSession&) = delete;
+
+  void readNext();
+  bool extract();
+  void handle(const char*, size_t);
+  void acknowledge(const Json::Value&);
+  void streamExport(const Json::Value&, const std::string&);
+  void respond(const Json::Value&, const std::string&, const Json::Value&);
+  void send(Json::Value);
+  void writeNext();
+  void streamNext();
+  void armIdleTimer();
+
+  std::shared_ptr<AsyncServer> server_;
+  boost::asio::io_service::strand strand_;
+  boost::asio::ip::tcp::socket socket_;
+  boost::asio::steady_timer idleTimer_;
+
+  // everything below is only touched from within strand_
+  Framing framing_;
+  bool compressing_, signingRaw_, synced_;
+  bool open_, reading_, writing_;
+  boost::asio::streambuf inbox_;
+  size_t needed_;  // bytes missing from a partly read frame
+  std::vector<char> inflated_;
+  std::string deflated_;
+  std::deque<std::string> outbox_;
+  size_t inFlight_;  // how many from the front of outbox_ are being written
+  std::deque<Transfer> transfers_;
+  std::string spool_;  // a piece of a Transfer, without sendfile
+  HandleAlloc readAlloc_, writeAlloc_;  // for the I/O handlers
+};
+
+#endif
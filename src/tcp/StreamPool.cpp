@@ -0,0 +1,466 @@
+#include "StreamPool.hpp"
+#include "AuthenticatedStream.hpp"
+#include "MirrorStats.hpp"
+#include "../encoding/Codec.hpp"
+#include "../Log.hpp"
+#include "../Metrics.hpp"
+#include <sys/socket.h>
+#include <exception>
+#include <cerrno>
+
+const size_t StreamPool::DEFAULT_MAX_IDLE;
+const unsigned StreamPool::DEFAULT_IDLE_TIMEOUT;
+const unsigned StreamPool::DEFAULT_HEARTBEAT;
+const unsigned StreamPool::DEFAULT_HEARTBEAT_TIMEOUT;
+
+StreamPool::StreamPool(size_t maxIdle, std::chrono::seconds idleTimeout)
+    : maxIdle_(maxIdle),
+      idleTimeout_(idleTimeout),
+      hits_(0),
+      misses_(0),
+      spares_({"", 0, 0, 0, 0}),
+      heartbeat_(DEFAULT_HEARTBEAT),
+      heartbeatTimeout_(DEFAULT_HEARTBEAT_TIMEOUT),
+      stopping_(false)
+{
+}
+
+
+
+StreamPool::~StreamPool()
+{
+  stopMaintenance();
+}
+
+
+
+StreamPool::Lease StreamPool::acquire(const std::string& socksHost,
+                                      ushort socksPort,
+                                      const std::string& remoteHost,
+                                      ushort remotePort)
+{
+  return acquire(makeKey(socksHost, socksPort, remoteHost, remotePort),
+                 [=]()
+                 {
+                   return new TorStream(socksHost, socksPort, remoteHost,
+                                        remotePort);
+                 });
+}
+
+
+
+// an AuthenticatedStream, which is only shared with leases for the same key
+StreamPool::Lease StreamPool::acquire(const std::string& socksHost,
+                                      ushort socksPort,
+                                      const std::string& remoteHost,
+                                      ushort remotePort,
+                                      const ED_KEY& publicKey)
+{
+  return acquire(makeKey(socksHost, socksPort, remoteHost, remotePort,
+                         publicKey),
+                 [=]()
+                 {
+                   return new AuthenticatedStream(socksHost, socksPort,
+                                                  remoteHost, remotePort,
+                                                  publicKey);
+                 });
+}
+
+
+
+void StreamPool::clear()
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  idle_.clear();
+}
+
+
+
+// Starts the thread that sends heartbeats, replaces the streams that fail
+// them and keeps the spares open, or restarts it with new settings.
+void StreamPool::startMaintenance(std::chrono::seconds heartbeat,
+                                  std::chrono::milliseconds timeout)
+{
+  stopMaintenance();
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  heartbeat_ = heartbeat;
+  heartbeatTimeout_ = timeout;
+  stopping_ = false;
+  maintainer_ = std::thread(&StreamPool::maintain, this);
+}
+
+
+
+void StreamPool::stopMaintenance()
+{
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+
+  wake_.notify_all();
+  if (maintainer_.joinable())
+    maintainer_.join();
+}
+
+
+
+// Keeps perMirror idle authenticated streams open to each of the given
+// number of best ranked mirrors, once maintenance runs; 0 mirrors for none.
+// The ranking is taken again on every pass, so the spares follow it.
+void StreamPool::setSpares(const std::string& socksHost,
+                           ushort socksPort,
+                           size_t mirrors,
+                           size_t perMirror,
+                           ushort remotePort)
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  spares_ = {socksHost, socksPort, mirrors, perMirror, remotePort};
+}
+
+
+
+size_t StreamPool::getIdleCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return idle_.size();
+}
+
+
+
+size_t StreamPool::getHitCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+
+
+size_t StreamPool::getMissCount() const
+{
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+
+
+StreamPool::Lease::Lease(StreamPool& pool,
+                         const std::string& key,
+                         std::unique_ptr<TorStream> stream)
+    : pool_(&pool), key_(key), stream_(std::move(stream))
+{
+}
+
+
+
+StreamPool::Lease::Lease(Lease&& other)
+    : pool_(other.pool_),
+      key_(std::move(other.key_)),
+      stream_(std::move(other.stream_))
+{
+  other.pool_ = nullptr;
+}
+
+
+
+// a stream that was in use when an exception was thrown is in an unknown
+// state, so it is dropped rather than returned
+StreamPool::Lease::~Lease()
+{
+  if (pool_ && stream_ && !std::uncaught_exception())
+    pool_->release(key_, std::move(stream_));
+}
+
+
+
+// drops the stream instead of returning it, such as after a bad response
+void StreamPool::Lease::invalidate()
+{
+  pool_ = nullptr;
+}
+
+
+
+// ************************** PRIVATE METHODS ****************************** //
+
+
+
+// reuses the most recently returned healthy stream, or creates one
+StreamPool::Lease StreamPool::acquire(const std::string& key,
+                                      const Factory& create)
+{
+  {  // for replacing the key's streams in the background
+    std::lock_guard<std::mutex> guard(mutex_);
+    factories_.emplace(key, create);
+  }
+
+  while (true)
+  {
+    std::unique_ptr<TorStream> stream;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      prune(Clock::now());
+      for (auto idle = idle_.rbegin(); idle != idle_.rend(); ++idle)
+        if (idle->key == key)
+        {
+          stream = std::move(idle->stream);
+          idle_.erase(std::next(idle).base());
+          break;
+        }
+
+      if (!stream)
+      {
+        misses_++;
+        break;
+      }
+    }
+
+    // checked outside the lock; a dead stream is dropped and the next tried
+    if (isHealthy(*stream))
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      hits_++;
+      return Lease(*this, key, std::move(stream));
+    }
+  }
+
+  // the SOCKS5 handshake and confirmProtocol() happen here
+  return Lease(*this, key, std::unique_ptr<TorStream>(create()));
+}
+
+
+
+void StreamPool::release(const std::string& key,
+                         std::unique_ptr<TorStream> stream)
+{
+  if (!stream->isReady())
+    return;
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto now = Clock::now();
+  prune(now);
+
+  Idle idle;
+  idle.key = key;
+  idle.stream = std::move(stream);
+  idle.since = now;
+  idle_.push_back(std::move(idle));
+
+  if (idle_.size() > maxIdle_)
+    idle_.pop_front();
+}
+
+
+
+// drops the streams that have been idle for too long; the caller locks
+void StreamPool::prune(Clock::time_point now)
+{
+  while (!idle_.empty() && now - idle_.front().since >= idleTimeout_)
+    idle_.pop_front();
+}
+
+
+
+// Each pass sends the heartbeats that are due, then opens streams to make
+// up for those that failed and for missing spares.
+void StreamPool::maintain()
+{
+  const std::chrono::seconds TICK(1);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_)
+  {
+    lock.unlock();
+    checkIdle();
+    replenish();
+    lock.lock();
+    wake_.wait_for(lock, TICK, [this]() { return stopping_; });
+  }
+}
+
+
+
+// Takes the streams that are due a heartbeat out of the pool, so that no
+// lease gets them meanwhile, pings them outside the lock and puts back
+// those that answer. Those that do not are owed a replacement.
+void StreamPool::checkIdle()
+{
+  static Metrics::Counter& failures = Metrics::get().counter(
+      "onions_stream_heartbeat_failures_total",
+      "Pooled streams dropped as they missed a heartbeat.");
+
+  std::vector<Idle> due;
+  std::chrono::milliseconds timeout;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const auto now = Clock::now();
+    prune(now);
+    timeout = heartbeatTimeout_;
+    for (auto idle = idle_.begin(); idle != idle_.end();)
+      if (now - idle->since >= heartbeat_)
+      {
+        due.push_back(std::move(*idle));
+        idle = idle_.erase(idle);
+      }
+      else
+        ++idle;
+  }
+
+  for (auto& idle : due)
+  {
+    if (isHealthy(*idle.stream) && idle.stream->ping(timeout))
+      release(idle.key, std::move(idle.stream));
+    else
+    {
+      failures.add();
+      auto owed = owed_.emplace(idle.key, Owed{0, Clock::now()}).first;
+      owed->second.count++;
+    }
+  }
+}
+
+
+
+// Opens the streams that are owed and the missing spares, as far as the
+// pool has room, skipping keys that failed to connect within a heartbeat.
+void StreamPool::replenish()
+{
+  static Metrics::Counter& opened = Metrics::get().counter(
+      "onions_stream_warmups_total",
+      "Streams opened in advance by the StreamPool.");
+
+  const auto now = Clock::now();
+  std::unordered_map<std::string, size_t> needed;
+  for (auto owed = owed_.begin(); owed != owed_.end();)
+    if (now - owed->second.since >= idleTimeout_)
+      owed = owed_.erase(owed);
+    else
+    {
+      needed[owed->first] = owed->second.count;
+      ++owed;
+    }
+
+  Spares spares;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    spares = spares_;
+  }
+
+  std::vector<Config::Node> ranked;
+  if (spares.mirrors > 0)
+  {
+    try
+    {
+      ranked = MirrorStats::get().rank(Config::getMirrors()->nodes);
+    }
+    catch (const std::exception& e)
+    {
+      Log::get().warn("No mirrors for spare streams: " + std::string(e.what()));
+    }
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    for (size_t j = 0; j < ranked.size() && j < spares.mirrors; j++)
+    {
+      const Config::Node node = ranked[j];
+      const std::string key =
+          makeKey(spares.socksHost, spares.socksPort, node.address,
+                  spares.remotePort, node.key);
+      factories_.emplace(key, [spares, node]()
+                         {
+                           return new AuthenticatedStream(
+                               spares.socksHost, spares.socksPort,
+                               node.address, spares.remotePort, node.key);
+                         });
+
+      size_t count = 0;
+      for (const auto& idle : idle_)
+        count += idle.key == key;
+      if (count < spares.perMirror)
+        needed[key] = std::max(needed[key], spares.perMirror - count);
+    }
+  }
+
+  for (const auto& entry : needed)
+  {
+    const std::string& key = entry.first;
+    auto failure = failed_.find(key);
+    if (failure != failed_.end() && now - failure->second < heartbeat_)
+      continue;
+
+    for (size_t n = 0; n < entry.second; n++)
+    {
+      Factory create;
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (stopping_ || idle_.size() >= maxIdle_)
+          return;
+        create = factories_[key];
+      }
+
+      std::unique_ptr<TorStream> stream;
+      try
+      {
+        stream.reset(create());
+      }
+      catch (const std::exception& e)
+      {
+        Log::get().warn("Cannot open a stream in advance: " +
+                        std::string(e.what()));
+      }
+
+      if (!stream || !stream->isReady())
+      {
+        failed_[key] = Clock::now();
+        break;
+      }
+
+      failed_.erase(key);
+      auto owed = owed_.find(key);
+      if (owed != owed_.end() && --owed->second.count == 0)
+        owed_.erase(owed);
+
+      opened.add();
+      release(key, std::move(stream));
+    }
+  }
+}
+
+
+
+// Open, with nothing to read: the server never sends unprompted, so data
+// or an end of stream here means that the stream is stale or was closed.
+bool StreamPool::isHealthy(TorStream& stream)
+{
+  auto socket = stream.getSocket();
+  if (!socket->is_open())
+    return false;
+
+  char byte;
+  ssize_t n = recv(socket->native_handle(), &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+
+
+std::string StreamPool::makeKey(const std::string& socksHost,
+                                ushort socksPort,
+                                const std::string& remoteHost,
+                                ushort remotePort)
+{
+  return socksHost + ":" + std::to_string(socksPort) + "/" + remoteHost +
+         ":" + std::to_string(remotePort);
+}
+
+
+
+// for AuthenticatedStreams, which only serve leases for the same key
+std::string StreamPool::makeKey(const std::string& socksHost,
+                                ushort socksPort,
+                                const std::string& remoteHost,
+                                ushort remotePort,
+                                const ED_KEY& publicKey)
+{
+  return makeKey(socksHost, socksPort, remoteHost, remotePort) + "/" +
+         Codec::hexEncode(publicKey.data(), publicKey.size());
+}
@@ -0,0 +1,166 @@
+#ifndef STREAM_POOL_HPP
+#define STREAM_POOL_HPP
+
+#include "TorStream.hpp"
+#include "../Constants.hpp"
+#include <condition_variable>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <deque>
+
+// Keeps established, protocol-confirmed streams for reuse, keyed by the
+// SOCKS endpoint, the remote host and port, and for authenticated streams
+// the server's key, so that a lookup skips the SOCKS5 handshake and the Tor
+// circuit setup behind it. A Lease returns its stream when it goes out of
+// scope, unless it was invalidated or is being destroyed by an exception.
+// Idle streams are dropped after the idle timeout, when the pool is full,
+// or if the socket was closed or has unexpected data waiting.
+//
+// Tor drops idle circuits without a word, so a pool may also be
+// maintained by a thread of its own. That thread sends a heartbeat on each
+// stream that has been idle for a heartbeat interval, with a deadline much
+// shorter than a lookup's. A stream that answers counts as freshly
+// returned. One that does not is dropped, and a new stream to the same
+// place is opened in the background, with another try every heartbeat
+// interval up to the idle timeout if that fails. The thread can also keep
+// spare streams open to the best ranked mirrors, so that lookups rarely
+// have to wait for a circuit to be built.
+class StreamPool
+{
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  class Lease
+  {
+   public:
+    Lease(Lease&&);
+    ~Lease();
+    TorStream* operator->() const { return stream_.get(); }
+    TorStream& operator*() const { return *stream_; }
+    void invalidate();
+
+   private:
+    friend class StreamPool;
+    Lease(StreamPool&, const std::string&, std::unique_ptr<TorStream>);
+    Lease(const Lease&) = delete;
+    void operator=(const Lease&) = delete;
+
+    StreamPool* pool_;
+    std::string key_;
+    std::unique_ptr<TorStream> stream_;
+  };
+
+  static const size_t DEFAULT_MAX_IDLE = 16;
+  static const unsigned DEFAULT_IDLE_TIMEOUT = 120;  // seconds
+  static const unsigned DEFAULT_HEARTBEAT = 30;  // seconds
+  static const unsigned DEFAULT_HEARTBEAT_TIMEOUT = 5000;  // milliseconds
+
+  StreamPool(size_t maxIdle = DEFAULT_MAX_IDLE,
+             std::chrono::seconds idleTimeout =
+                 std::chrono::seconds(DEFAULT_IDLE_TIMEOUT));
+  ~StreamPool();
+
+  static StreamPool& get()
+  {
+    static StreamPool* instance = new StreamPool();  // outlives any Lease
+    return *instance;
+  }
+
+  Lease acquire(const std::string&, ushort, const std::string&, ushort);
+  Lease acquire(const std::string&,
+                ushort,
+                const std::string&,
+                ushort,
+                const ED_KEY&);
+  void clear();
+
+  void startMaintenance(std::chrono::seconds heartbeat =
+                            std::chrono::seconds(DEFAULT_HEARTBEAT),
+                        std::chrono::milliseconds timeout =
+                            std::chrono::milliseconds(
+                                DEFAULT_HEARTBEAT_TIMEOUT));
+  void stopMaintenance();
+  void setSpares(const std::string&,
+                 ushort,
+                 size_t,
+                 size_t perMirror = 1,
+                 ushort remotePort = Const::SERVER_PORT);
+
+  size_t getIdleCount() const;
+  size_t getHitCount() const;
+  size_t getMissCount() const;
+
+ private:
+  typedef std::function<TorStream*()> Factory;
+
+  struct Idle
+  {
+    std::string key;
+    std::unique_ptr<TorStream> stream;
+    Clock::time_point since;  // returned, or last answered a heartbeat
+  };
+
+  // replacements for streams that missed a heartbeat, until the idle timeout
+  struct Owed
+  {
+    size_t count;
+    Clock::time_point since;
+  };
+
+  // spare streams to the best ranked mirrors in Config::getMirrors()
+  struct Spares
+  {
+    std::string socksHost;
+    ushort socksPort;
+    size_t mirrors, perMirror;
+    ushort remotePort;
+  };
+
+  StreamPool(const StreamPool&) = delete;
+  void operator=(const StreamPool&) = delete;
+
+  Lease acquire(const std::string&, const Factory&);
+  void release(const std::string&, std::unique_ptr<TorStream>);
+  void prune(Clock::time_point);
+  void maintain();
+  void checkIdle();
+  void replenish();
+  static bool isHealthy(TorStream&);
+  static std::string makeKey(const std::string&,
+                             ushort,
+                             const std::string&,
+                             ushort);
+  static std::string makeKey(const std::string&,
+                             ushort,
+                             const std::string&,
+                             ushort,
+                             const ED_KEY&);
+
+  const size_t maxIdle_;
+  const std::chrono::seconds idleTimeout_;
+
+  mutable std::mutex mutex_;
+  std::deque<Idle> idle_;  // least recently returned at the front
+  size_t hits_, misses_;
+  std::unordered_map<std::string, Factory> factories_;  // by key
+  Spares spares_;
+
+  // maintenance
+  std::chrono::seconds heartbeat_;
+  std::chrono::milliseconds heartbeatTimeout_;
+  bool stopping_;
+  std::condition_variable wake_;
+  std::thread maintainer_;
+
+  // only touched by the maintenance thread
+  std::unordered_map<std::string, Owed> owed_;
+  std::unordered_map<std::string, Clock::time_point> failed_;
+};
+
+#endif
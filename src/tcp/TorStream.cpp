@@ -1,46 +1,85 @@
 
 #include "TorStream.hpp"
+#include "IOExecutor.hpp"
+#include "MirrorStats.hpp"
+#include "../encoding/Deflate.hpp"
 #include "../Log.hpp"
+#include "../Tracer.hpp"
 #include <chrono>
+#include <algorithm>
+#include <array>
 #include <thread>
 
-
+const size_t TorStream::MAX_FRAME;
+const size_t TorStream::COMPRESS_THRESHOLD;
+const size_t TorStream::MAX_BATCH;
+const uint32_t TorStream::COMPRESSED;
+const size_t TorStream::HEADER_LEN;
+const size_t TorStream::SIGNATURE_LEN;
+const std::string TorStream::HEARTBEAT_TYPE = "ping";
+std::atomic<bool> TorStream::optimistic_(true);
+std::mutex TorStream::defaultsMutex_;
+TorStream::Deadlines TorStream::defaults_ = {  // circuits can be slow to build
+    std::chrono::seconds(30), std::chrono::seconds(60),
+    std::chrono::seconds(30), std::chrono::seconds(60)};
+
+// Connects through the shared IOExecutor, blocking until the SOCKS5
+// handshake and the protocol confirmation are done or have failed, or
+// throwing a Timeout if they take too long. The outcome and the time it
+// took go to MirrorStats.
 TorStream::TorStream(const std::string& socksHost,
                      ushort socksPort,
                      const std::string& remoteHost,
                      ushort remotePort)
-    : socket_(std::make_shared<boost::asio::ip::tcp::socket>(ios_)),
+    : TorStream(socksHost, socksPort, remoteHost, remotePort, false)
+{
+}
+
+
+
+// subclasses that check signatures offer raw signing with the SYN
+TorStream::TorStream(const std::string& socksHost,
+                     ushort socksPort,
+                     const std::string& remoteHost,
+                     ushort remotePort,
+                     bool offerSigning)
+    : ios_(IOExecutor::get().next()),
+      socket_(std::make_shared<boost::asio::ip::tcp::socket>(ios_)),
       socks_(std::make_shared<Socks5::Socks5>(*socket_)),
-      ready_(false)
+      remoteHost_(remoteHost),
+      ready_(false),
+      deadlines_(getDefaultDeadlines()),
+      framing_(Framing::Line),
+      offerSigning_(offerSigning),
+      compressing_(false),
+      signing_(false),
+      nextId_(0),
+      closed_(false)
 {
-  boost::asio::ip::tcp::resolver resolver(ios_);
-  boost::asio::ip::tcp::endpoint endpoint =
-      *resolver.resolve({socksHost, std::to_string(socksPort)});
-  socket_->connect(endpoint);
+  Tracer::Context context;
+  const auto start = std::chrono::steady_clock::now();
+  try
+  {
+    connect(socksHost, socksPort, remotePort);
+  }
+  catch (std::exception&)
+  {
+    MirrorStats::get().recordFailure(remoteHost_);
+    throw;
+  }
 
-  socks_->initialize({Socks5::AuthMethod::NO_AUTHENTICATION},
-                     [&](Socks5::Error err, boost::system::error_code ec,
-                         Socks5::AuthMethod method)
-                     {
-                       // notify callback
-                       TorStream::initCallback(err, ec, method);
+  if (ready_)
+    MirrorStats::get().recordConnect(remoteHost_,
+                                     std::chrono::steady_clock::now() - start);
+  else
+    MirrorStats::get().recordFailure(remoteHost_);
+}
 
-                       // connect to remote host
-                       Socks5::Request request(Socks5::Command::CONNECT,
-                                               Socks5::AddressType::DOMAIN_NAME,
-                                               remoteHost, remotePort);
 
-                       // send request, call TorStream's contact callback
-                       socks_->request(
-                           request,  // https://ideone.com/jdlQoe
-                           [this](Socks5::Error e, boost::system::error_code c,
-                                  Socks5::Reply r)
-                           {
-                             this->contactCallback(e, c, r);
-                           });
-                     });
 
-  ios_.run();
+TorStream::~TorStream()
+{
+  stopMultiplexing();
 }
 
 
@@ -48,54 +87,273 @@ TorStream::TorStream(const std::string& socksHost,
 Json::Value TorStream::sendReceive(const std::string& type,
                                    const std::string& msg)
 {
-  if (!ready_)
+  Tracer::Context context;
+  Tracer::Span span("stream.request");
+  if (isMultiplexed())
   {
-    Log::get().warn("Stream not ready. Waiting for connection to remote host.");
-    waitUntilReady();
+    // the stream carries on, and a late response will find no one waiting
+    Json::UInt id;
+    auto response = submit(type, msg, id);
+    if (deadlines_.receive.count() > 0 &&
+        response.wait_for(deadlines_.receive) == std::future_status::timeout)
+    {
+      abandon(id);
+      Log::get().warn("Timed out waiting for a multiplexed response.");
+      throw Timeout(Timeout::Operation::Receive);
+    }
+    return response.get();
   }
 
-  Json::Value outVal;
-  outVal["type"] = type;
-  outVal["value"] = msg;
-  Json::FastWriter writer;
-  boost::asio::write(*socket_, boost::asio::buffer(writer.write(outVal)));
+  return exchange(type, msg, nullptr);
+}
+
+
+
+// Sends a request whose successful response is followed by as many raw
+// bytes as its value's "length", such as a range of an Export, and puts
+// them into the buffer. Only the response itself is verified, as usual;
+// the bytes must be checked by what they are. Not for multiplexed streams.
+Json::Value TorStream::sendReceiveRaw(const std::string& type,
+                                      const std::string& msg,
+                                      std::string& bytes)
+{
+  Tracer::Context context;
+  Tracer::Span span("stream.request");
+  if (isMultiplexed())
+    Log::get().error("Raw responses need a stream that is not multiplexed.");
+
+  return exchange(type, msg, &bytes);
+}
+
+
+
+// Sends a heartbeat and waits at most the timeout for the answer. Any
+// answer shows that the circuit is alive, so servers that do not know the
+// heartbeat and reply with an error still pass. As for any request, a
+// timeout shuts the stream down.
+bool TorStream::ping(std::chrono::milliseconds timeout)
+{
+  const Deadlines saved = deadlines_;
+  deadlines_.send = deadlines_.receive = timeout;
+
+  bool alive = true;
+  try
+  {
+    sendReceive(HEARTBEAT_TYPE, "");
+  }
+  catch (const std::exception&)
+  {
+    alive = false;
+  }
+
+  deadlines_ = saved;
+  return alive;
+}
+
+
+
+SocketPtr TorStream::getSocket() const
+{
+  return socket_;
+}
+
+
+
+// true once the remote host has confirmed the protocol
+bool TorStream::isReady() const
+{
+  return ready_;
+}
+
+
+
+TorStream::Framing TorStream::getFraming() const
+{
+  return framing_;
+}
+
+
+
+bool TorStream::isCompressing() const
+{
+  return compressing_;
+}
+
+
+
+// whether frames from the server carry signatures on their raw payloads
+bool TorStream::isSigningRaw() const
+{
+  return signing_;
+}
+
+
+
+// whether new streams send the SOCKS5 handshake and the SYN in one write;
+// on by default, as Tor's SOCKS port needs no authentication
+void TorStream::setOptimistic(bool optimistic)
+{
+  optimistic_ = optimistic;
+}
+
+
+
+bool TorStream::isOptimistic()
+{
+  return optimistic_;
+}
+
+
+
+// replaces the deadlines this stream was constructed with; only those for
+// sending and receiving matter by then
+void TorStream::setDeadlines(const Deadlines& deadlines)
+{
+  deadlines_ = deadlines;
+}
 
-  // read from socket until newline
-  Log::get().notice("Receiving response from remote host... ");
-  boost::asio::streambuf response;
-  boost::asio::read_until(*socket_, response, "\n");
 
-  // convert to string
-  std::istream is(&response);
-  std::string responseStr((std::istreambuf_iterator<char>(is)),
-                          std::istreambuf_iterator<char>());
 
-  // parse into JSON object
+TorStream::Deadlines TorStream::getDeadlines() const
+{
+  return deadlines_;
+}
+
+
+
+// the deadlines that new streams start with
+void TorStream::setDefaultDeadlines(const Deadlines& deadlines)
+{
+  std::lock_guard<std::mutex> guard(defaultsMutex_);
+  defaults_ = deadlines;
+}
+
+
+
+TorStream::Deadlines TorStream::getDefaultDeadlines()
+{
+  std::lock_guard<std::mutex> guard(defaultsMutex_);
+  return defaults_;
+}
+
+
+
+boost::asio::io_service& TorStream::getIO()
+{
+  return ios_;
+}
+
+
+
+// Starts the reader thread. The server must support the "id" envelope;
+// from here on, sendReceive() also goes through submit().
+void TorStream::enableMultiplexing()
+{
+  if (!ready_)
+    waitUntilReady();
+
+  std::lock_guard<std::mutex> guard(pendingMutex_);
+  if (!reader_.joinable())
+    reader_ = std::thread(&TorStream::readResponses, this);
+}
+
+
+
+bool TorStream::isMultiplexed() const
+{
+  return reader_.joinable();
+}
+
+
+
+// Sends a request without waiting for earlier ones to be answered. The
+// future holds the response, or the exception if the stream failed first.
+std::future<Json::Value> TorStream::submit(const std::string& type,
+                                           const std::string& msg)
+{
+  Json::UInt id;
+  return submit(type, msg, id);
+}
+
+
+
+// the type and value of a response line, or an "error" member if invalid
+Json::Value TorStream::parseResponse(const std::string& responseStr)
+{
+  return parseResponse(responseStr.data(), responseStr.size());
+}
+
+
+
+// parses straight from the receive buffer
+Json::Value TorStream::parseResponse(const char* response, size_t len)
+{
+  Tracer::Span span("json.parse");
   Json::Reader reader;
   Json::Value responseVal;
-  if (!reader.parse(responseStr, responseVal))
+  const bool parsed = reader.parse(response, response + len, responseVal, false);
+  if (!responseVal.isObject())  // such as "[1]" or "5", which have no members
+    responseVal = Json::Value(Json::objectValue);
+  if (!parsed)
     responseVal["error"] = "Failed to parse response from server.";
 
   if (!responseVal.isMember("type") || !responseVal.isMember("value"))
     responseVal["error"] = "Invalid response from server.";
 
-  Log::get().notice("I/O complete.");
-
   return responseVal;
 }
 
 
 
-SocketPtr TorStream::getSocket() const
+TorStream::Timeout::Timeout(Operation operation)
+    : std::runtime_error(describe(operation)), operation_(operation)
 {
-  return socket_;
 }
 
 
 
-boost::asio::io_service& TorStream::getIO()
+TorStream::Timeout::Operation TorStream::Timeout::getOperation() const
 {
-  return ios_;
+  return operation_;
+}
+
+
+
+// ************************** PROTECTED METHODS **************************** //
+
+
+
+// checks a parsed response; subclasses may verify more, such as signatures
+Json::Value TorStream::checkResponse(Json::Value response)
+{
+  return response;
+}
+
+
+
+// Checks the signatures on n raw-signed payloads, setting valid[i] to 1
+// for each that holds. Only subclasses that offer raw signing get any.
+void TorStream::verifyPayloads(const uint8_t**,
+                               const uint8_t**,
+                               size_t*,
+                               size_t n,
+                               int* valid)
+{
+  std::fill(valid, valid + n, 1);
+}
+
+
+
+// ends the reader thread, failing any requests still waiting; subclasses
+// that override checkResponse call this first from their destructors
+void TorStream::stopMultiplexing()
+{
+  if (!reader_.joinable())
+    return;
+
+  boost::system::error_code ec;
+  socket_->shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+  reader_.join();
 }
 
 
@@ -104,18 +362,257 @@ boost::asio::io_service& TorStream::getIO()
 
 
 
-bool TorStream::confirmProtocol()
+// The reader thread: dispatches each response to the matching future.
+// Frames that arrived together are read, and their signatures verified,
+// as one batch. A bad signature means the ids cannot be trusted either,
+// so it fails the whole stream.
+void TorStream::readResponses()
+{
+  try
+  {
+    while (true)
+    {
+      readMessages(MAX_BATCH);
+      for (auto& frame : frames_)
+      {
+        if (frame.valid != 1)
+          Log::get().error("Bad Ed25519 signature from server.");
+        deliver(frame.response);
+      }
+    }
+  }
+  catch (std::exception&)
+  {
+    // the stream failed or was shut down, so nothing else will arrive
+    std::lock_guard<std::mutex> guard(pendingMutex_);
+    closed_ = true;
+    ready_ = false;
+    if (!pending_.empty())
+      MirrorStats::get().recordFailure(remoteHost_);
+    for (auto& entry : pending_)
+      entry.second.promise.set_exception(std::current_exception());
+    pending_.clear();
+  }
+}
+
+
+
+// hands a multiplexed response to the future waiting for its id
+void TorStream::deliver(Json::Value& response)
+{
+  if (!response.isMember("id") || !response["id"].isUInt())
+  {
+    Log::get().warn("Dropping a multiplexed response without an id.");
+    return;
+  }
+
+  const Json::UInt id = response["id"].asUInt();
+  response.removeMember("id");
+
+  Pending pending;
+  {
+    std::lock_guard<std::mutex> guard(pendingMutex_);
+    auto entry = pending_.find(id);
+    if (entry == pending_.end())
+    {
+      Log::get().warn("Dropping a response to an unknown request.");
+      return;
+    }
+
+    pending = std::move(entry->second);
+    pending_.erase(entry);
+  }
+
+  MirrorStats::get().recordRequest(
+      remoteHost_, std::chrono::steady_clock::now() - pending.sent);
+  try
+  {
+    pending.promise.set_value(checkResponse(response));
+  }
+  catch (std::exception&)
+  {
+    pending.promise.set_exception(std::current_exception());
+  }
+}
+
+
+
+// Sends a request without waiting for earlier ones to be answered, and
+// gives the id it was sent with.
+std::future<Json::Value> TorStream::submit(const std::string& type,
+                                           const std::string& msg,
+                                           Json::UInt& id)
+{
+  if (!isMultiplexed())
+    Log::get().error("Multiplexing is not enabled on this stream!");
+
+  std::future<Json::Value> response;
+  {
+    std::lock_guard<std::mutex> guard(pendingMutex_);
+    if (closed_)
+      Log::get().error("The multiplexed stream has closed.");
+
+    id = nextId_++;
+    Pending& pending = pending_[id];
+    pending.sent = std::chrono::steady_clock::now();
+    response = pending.promise.get_future();
+  }
+
+  Json::Value outVal;
+  outVal["type"] = type;
+  outVal["value"] = msg;
+  outVal["id"] = id;
+
+  try
+  {
+    std::lock_guard<std::mutex> guard(writeMutex_);
+    Deadline(*this, Timeout::Operation::Send, deadlines_.send)
+        .run([&] { writeMessage(outVal); });
+  }
+  catch (std::exception&)
+  {
+    abandon(id);
+    throw;
+  }
+
+  return response;
+}
+
+
+
+// forgets a request, so that its response is dropped if it ever comes
+void TorStream::abandon(Json::UInt id)
+{
+  std::lock_guard<std::mutex> guard(pendingMutex_);
+  pending_.erase(id);
+}
+
+
+
+// The SOCKS5 handshake on the executor, then the protocol confirmation.
+// Optimistically, the greeting, the CONNECT request and the SYN all go out
+// in one write, saving two round trips to Tor's SOCKS port. Connecting to
+// the port and everything after it each have a deadline.
+void TorStream::connect(const std::string& socksHost,
+                        ushort socksPort,
+                        ushort remotePort)
+{
+  boost::asio::ip::tcp::resolver resolver(ios_);
+  boost::asio::ip::tcp::endpoint endpoint =
+      *resolver.resolve({socksHost, std::to_string(socksPort)});
+
+  Tracer::Span span("socks.connect");
+  Deadline(*this, Timeout::Operation::Connect, deadlines_.connect)
+      .run([&]
+           {
+             std::promise<boost::system::error_code> connected;
+             auto result = connected.get_future();
+             socket_->async_connect(
+                 endpoint, [&connected](const boost::system::error_code& ec)
+                 {
+                   connected.set_value(ec);
+                 });
+
+             auto ec = result.get();
+             if (ec)
+               throw boost::system::system_error(ec);
+           });
+
+  Tracer::Span handshake("socks.handshake");  // with Tor's circuit and SYN
+  Deadline(*this, Timeout::Operation::Handshake, deadlines_.handshake)
+      .run([&] { negotiate(remotePort); });
+}
+
+
+
+void TorStream::negotiate(ushort remotePort)
+{
+
+  // the callbacks run on an executor thread, so errors are carried back here
+  std::promise<void> handshake;
+  auto handshakeDone = handshake.get_future();
+  auto onContact = [this, &handshake](Socks5::Error e,
+                                      boost::system::error_code c,
+                                      Socks5::Reply r)
+  {
+    try
+    {
+      this->contactCallback(e, c, r);
+      handshake.set_value();
+    }
+    catch (std::exception&)
+    {
+      handshake.set_exception(std::current_exception());
+    }
+  };
+
+  // connect to remote host
+  Socks5::Request request(Socks5::Command::CONNECT,
+                          Socks5::AddressType::DOMAIN_NAME, remoteHost_,
+                          remotePort);
+
+  const bool optimistic = isOptimistic();
+  if (optimistic)
+  {
+    Json::FastWriter writer;
+    socks_->optimisticRequest(request, writer.write(makeSyn(offerSigning_)),
+                              onContact);
+  }
+  else
+    socks_->initialize(
+        {Socks5::AuthMethod::NO_AUTHENTICATION},
+        [&](Socks5::Error err, boost::system::error_code ec,
+            Socks5::AuthMethod method)
+        {
+          try
+          {
+            // notify callback
+            TorStream::initCallback(err, ec, method);
+
+            // send request, call TorStream's contact callback
+            socks_->request(request,  // https://ideone.com/jdlQoe
+                            onContact);
+          }
+          catch (std::exception&)
+          {
+            handshake.set_exception(std::current_exception());
+          }
+        });
+
+  handshakeDone.get();
+  if (ready_ && !confirmProtocol(optimistic))
+    ready_ = false;
+}
+
+
+
+// Offers length-prefixed framing, compression and perhaps raw signing with
+// the SYN. Servers that do not know them ignore the members and keep to
+// newline framing; those that do echo what they accept in the ACK, and
+// both sides switch after it. The others need length-prefixed framing.
+bool TorStream::confirmProtocol(bool synSent)
 {
-  auto response = sendReceive("SYN", "");
+  if (!synSent)
+    writeMessage(makeSyn(offerSigning_));
+
+  auto response = checkResponse(readMessage());
   if (response["type"] == "success" && response["value"] == "ACK")
   {
-    Log::get().notice("Server confirmed up.");
+    if (response.get("framing", "").asString() == "length")
+    {
+      framing_ = Framing::Length;
+      compressing_ = response.get("compression", "").asString() == "deflate";
+      signing_ = offerSigning_ &&
+                 response.get("signing", "").asString() == "raw";
+    }
+
+    LOG_NOTICE("Server confirmed up.");
     return true;
   }
   else
   {
     Json::FastWriter writer;
-    Log::get().notice(writer.write(response));
+    LOG_NOTICE(writer.write(response));
     Log::get().error("Server did not return a valid response!");
     return false;
   }
@@ -123,12 +620,255 @@ bool TorStream::confirmProtocol()
 
 
 
+Json::Value TorStream::makeSyn(bool offerSigning)
+{
+  Json::Value syn;
+  syn["type"] = "SYN";
+  syn["value"] = "";
+  syn["framing"] = "length";
+  syn["compression"] = "deflate";
+  if (offerSigning)
+    syn["signing"] = "raw";
+  return syn;
+}
+
+
+
+// one request and its response, and the raw bytes after it if wanted
+Json::Value TorStream::exchange(const std::string& type,
+                                const std::string& msg,
+                                std::string* raw)
+{
+  if (!ready_)
+  {
+    Log::get().warn("Stream not ready. Waiting for connection to remote host.");
+    waitUntilReady();
+  }
+
+  Json::Value outVal;
+  outVal["type"] = type;
+  outVal["value"] = msg;
+
+  Json::Value response;
+  const auto sent = std::chrono::steady_clock::now();
+  try
+  {
+    {
+      Tracer::Span sending("stream.send");
+      Deadline(*this, Timeout::Operation::Send, deadlines_.send)
+          .run([&] { writeMessage(outVal); });
+    }
+    LOG_NOTICE("Receiving response from remote host... ");
+    Tracer::Span receiving("stream.receive");
+    Deadline(*this, Timeout::Operation::Receive, deadlines_.receive)
+        .run([&]
+             {
+               response = readMessage();
+               if (raw && response["type"].asString() == "success")
+                 readRaw(response["value"], *raw);
+             });
+    LOG_NOTICE("I/O complete.");
+  }
+  catch (std::exception&)
+  {
+    MirrorStats::get().recordFailure(remoteHost_);
+    throw;
+  }
+
+  MirrorStats::get().recordRequest(remoteHost_,
+                                   std::chrono::steady_clock::now() - sent);
+  return checkResponse(response);
+}
+
+
+
+// writes one message in the current framing; callers serialize writes
+void TorStream::writeMessage(const Json::Value& message)
+{
+  Json::FastWriter writer;
+  std::string payload = writer.write(message);
+
+  if (framing_ == Framing::Line)
+  {
+    boost::asio::write(*socket_, boost::asio::buffer(payload));
+    return;
+  }
+
+  payload.pop_back();  // FastWriter's newline
+
+  // the top bit of the length marks a deflated payload
+  uint32_t len = static_cast<uint32_t>(payload.size());
+  if (compressing_ && payload.size() >= COMPRESS_THRESHOLD &&
+      Deflate::compress(payload.data(), payload.size(), deflated_) &&
+      deflated_.size() < payload.size())
+  {
+    payload.swap(deflated_);
+    len = static_cast<uint32_t>(payload.size()) | COMPRESSED;
+  }
+
+  const uint8_t header[4] = {static_cast<uint8_t>(len >> 24),
+                             static_cast<uint8_t>(len >> 16),
+                             static_cast<uint8_t>(len >> 8),
+                             static_cast<uint8_t>(len)};
+
+  std::array<boost::asio::const_buffer, 2> buffers = {
+      {boost::asio::buffer(header), boost::asio::buffer(payload)}};
+  boost::asio::write(*socket_, buffers);
+}
+
+
+
+// reads and parses one message, leaving any bytes after it for the next
+Json::Value TorStream::readMessage()
+{
+  readMessages(1);
+  return frames_.front().response;
+}
+
+
+
+// Reads one message into frames_, blocking if need be, and in Length
+// framing up to max - 1 more if they are already in inbox_. Raw-signed
+// payloads, as they were sent and so before inflating, are verified in one
+// call; those that fail become errors and are not parsed.
+void TorStream::readMessages(size_t max)
+{
+  frames_.clear();
+  if (framing_ == Framing::Line)
+  {
+    size_t len = boost::asio::read_until(*socket_, inbox_, '\n');
+    const char* line = boost::asio::buffer_cast<const char*>(inbox_.data());
+    frames_.push_back({0, 0, 1, parseResponse(line, len)});
+    inbox_.consume(len);
+    return;
+  }
+
+  uint32_t word;
+  fillInbox(HEADER_LEN);
+  peekHeader(0, word);
+  fillInbox(HEADER_LEN + (word & ~COMPRESSED));
+
+  // the first frame, then any complete ones already behind it
+  size_t end = 0;
+  while (frames_.size() < max && peekHeader(end, word))
+  {
+    const size_t len = word & ~COMPRESSED;
+    if (inbox_.size() < end + HEADER_LEN + len)
+      break;
+    if (signing_ && len < SIGNATURE_LEN)
+      Log::get().error("Unsigned frame from server.");
+
+    frames_.push_back({end + HEADER_LEN, word, 1, Json::Value()});
+    end += HEADER_LEN + len;
+  }
+
+  const char* data = boost::asio::buffer_cast<const char*>(inbox_.data());
+  const size_t sigLen = signing_ ? SIGNATURE_LEN : 0;
+  if (signing_)
+  {
+    std::vector<const uint8_t*> signatures, payloads;
+    std::vector<size_t> lengths;
+    std::vector<int> valid(frames_.size(), 0);
+    for (const auto& frame : frames_)
+    {
+      const uint8_t* bytes =
+          reinterpret_cast<const uint8_t*>(data + frame.offset);
+      signatures.push_back(bytes);
+      payloads.push_back(bytes + SIGNATURE_LEN);
+      lengths.push_back((frame.word & ~COMPRESSED) - SIGNATURE_LEN);
+    }
+
+    verifyPayloads(signatures.data(), payloads.data(), lengths.data(),
+                   frames_.size(), valid.data());
+    for (size_t j = 0; j < frames_.size(); j++)
+      frames_[j].valid = valid[j];
+  }
+
+  for (auto& frame : frames_)
+  {
+    if (frame.valid != 1)
+    {
+      frame.response["type"] = "error";
+      frame.response["value"] = "Bad Ed25519 signature from server.";
+      continue;
+    }
+
+    frame.response =
+        decodeFrame(data + frame.offset + sigLen,
+                    (frame.word & ~COMPRESSED) - sigLen,
+                    (frame.word & COMPRESSED) != 0);
+  }
+
+  inbox_.consume(end);
+}
+
+
+
+// takes the bytes that follow a response announcing their "length"
+void TorStream::readRaw(const Json::Value& value, std::string& bytes)
+{
+  if (!value.isObject() || !value["length"].isUInt64() ||
+      value["length"].asUInt64() > MAX_FRAME)
+    Log::get().error("Invalid raw response from server.");
+
+  const size_t length = value["length"].asUInt64();
+  fillInbox(length);
+  bytes.assign(boost::asio::buffer_cast<const char*>(inbox_.data()), length);
+  inbox_.consume(length);
+}
+
+
+
+// reads from the socket until inbox_ holds at least len bytes, taking
+// whatever else has arrived too
+void TorStream::fillInbox(size_t len)
+{
+  if (inbox_.size() < len)
+    boost::asio::read(*socket_, inbox_,
+                      boost::asio::transfer_at_least(len - inbox_.size()));
+}
+
+
+
+// the length header at offset in inbox_, if it is all there yet
+bool TorStream::peekHeader(size_t offset, uint32_t& word) const
+{
+  if (inbox_.size() < offset + HEADER_LEN)
+    return false;
+
+  const uint8_t* header =
+      boost::asio::buffer_cast<const uint8_t*>(inbox_.data()) + offset;
+  word = (uint32_t(header[0]) << 24) | (uint32_t(header[1]) << 16) |
+         (uint32_t(header[2]) << 8) | header[3];
+  if ((word & ~COMPRESSED) > MAX_FRAME)
+    Log::get().error("Oversized frame from server.");
+  return true;
+}
+
+
+
+// parses a frame's payload, inflating it first if it is marked as deflated
+Json::Value TorStream::decodeFrame(const char* payload,
+                                   size_t len,
+                                   bool deflated)
+{
+  if (!deflated)
+    return parseResponse(payload, len);
+
+  if (!compressing_ ||
+      !Deflate::decompress(payload, len, inflated_, MAX_FRAME))
+    Log::get().error("Invalid compressed frame from server.");
+  return parseResponse(inflated_.data(), inflated_.size());
+}
+
+
+
 void TorStream::initCallback(Socks5::Error err,
                              boost::system::error_code ec,
                              Socks5::AuthMethod)
 {
   if (err == Socks5::Error::NO_ERROR)
-    Log::get().notice("Successfully connected to Tor's Socks5 port.");
+    LOG_NOTICE("Successfully connected to Tor's Socks5 port.");
   else if (err == Socks5::Error::INIT_SEND_ERROR)
     Log::get().error("Socks5 send error: " + ec.message());
   else if (err == Socks5::Error::INIT_RECEIVE_ERROR)
@@ -148,8 +888,6 @@ void TorStream::contactCallback(Socks5::Error err,
   {
     // Log::get().notice("Stream established with remote host.");
     ready_ = true;
-    if (!confirmProtocol())
-      ready_ = false;
   }
   else
   {
@@ -180,9 +918,98 @@ void TorStream::contactCallback(Socks5::Error err,
 
 
 
+// A stream only becomes ready while it connects, so this gives up once
+// the handshake deadline has passed.
 void TorStream::waitUntilReady() const
 {
+  const auto start = std::chrono::steady_clock::now();
   std::chrono::milliseconds time(50);
   while (!ready_)
+  {
+    if (deadlines_.handshake.count() > 0 &&
+        std::chrono::steady_clock::now() - start >= deadlines_.handshake)
+      throw Timeout(Timeout::Operation::Handshake);
     std::this_thread::sleep_for(time);
+  }
+}
+
+
+
+std::string TorStream::Timeout::describe(Operation operation)
+{
+  switch (operation)
+  {
+    case Operation::Connect:
+      return "Timed out connecting to Tor's Socks5 port.";
+    case Operation::Handshake:
+      return "Timed out establishing a stream with the remote host.";
+    case Operation::Send:
+      return "Timed out sending to the remote host.";
+    default:
+      return "Timed out waiting for the remote host.";
+  }
+}
+
+
+
+// The timer runs on the executor. If it fires first, it cancels anything
+// pending on the socket and shuts it down, so that blocking reads and writes
+// on other threads return too, and the stream is unusable afterwards.
+TorStream::Deadline::Deadline(TorStream& stream,
+                              Timeout::Operation operation,
+                              std::chrono::milliseconds limit)
+    : stream_(stream),
+      operation_(operation),
+      timer_(stream.ios_),
+      expired_(std::make_shared<std::atomic<bool>>(false))
+{
+  if (limit.count() <= 0)
+    return;
+
+  SocketPtr socket = stream.socket_;
+  auto expired = expired_;
+  timer_.expires_from_now(limit);
+  timer_.async_wait([socket, expired](const boost::system::error_code& ec)
+                    {
+                      if (ec)
+                        return;  // cancelled
+
+                      *expired = true;
+                      boost::system::error_code ignored;
+                      socket->cancel(ignored);
+                      socket->shutdown(
+                          boost::asio::ip::tcp::socket::shutdown_both, ignored);
+                    });
+}
+
+
+
+TorStream::Deadline::~Deadline()
+{
+  boost::system::error_code ignored;
+  timer_.cancel(ignored);
+}
+
+
+
+// runs the operation, turning whatever it ended with into a Timeout if the
+// deadline passed in the meantime
+void TorStream::Deadline::run(const std::function<void()>& operation)
+{
+  try
+  {
+    operation();
+  }
+  catch (std::exception&)
+  {
+    if (!*expired_)
+      throw;
+  }
+
+  if (*expired_)
+  {
+    stream_.ready_ = false;
+    Log::get().warn(Timeout(operation_).what());
+    throw Timeout(operation_);
+  }
 }
@@ -4,32 +4,201 @@
 
 #include "socks5/Socks5.hpp"
 #include <json/json.h>
+#include <functional>
+#include <stdexcept>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <string>
+#include <vector>
+#include <mutex>
+#include <map>
 
 typedef std::shared_ptr<boost::asio::ip::tcp::socket> SocketPtr;
 
+// A JSON request and response stream to a remote host through Tor's SOCKS5
+// port. By default each sendReceive() waits for its response before the
+// next request can be sent. Once multiplexing is enabled, requests carry an
+// "id" that the server echoes, so any number of them may be in flight at
+// once from different threads; a reader thread matches the responses,
+// which may arrive in any order, to their futures. Messages are framed by
+// a newline unless the server accepts length-prefixed framing, offered
+// with the SYN, in which case each is a 4-byte big-endian length followed
+// by the JSON, read into a reused buffer and parsed in place. Servers may
+// also accept deflate, which then applies to payloads from
+// COMPRESS_THRESHOLD bytes in either direction. Subclasses that verify the
+// server may offer raw signing, in which each frame from the server carries
+// an Ed25519 signature on its payload bytes ahead of them, checked before
+// they are parsed; frames already buffered are checked together. A raw
+// response, as for an Export range, is followed by the bytes it announces,
+// outside of any framing. Each blocking step has a deadline, enforced by a
+// timer on the executor that shuts the socket down, after which the step
+// throws a Timeout.
 class TorStream
 {
  public:
+  enum class Framing : uint8_t
+  {
+    Line,
+    Length
+  };
+
+  // how long each step may take; zero for no limit
+  struct Deadlines
+  {
+    std::chrono::milliseconds connect;    // TCP to the SOCKS port
+    std::chrono::milliseconds handshake;  // SOCKS5, then the SYN and ACK
+    std::chrono::milliseconds send;
+    std::chrono::milliseconds receive;
+  };
+
+  class Timeout : public std::runtime_error
+  {
+   public:
+    enum class Operation : uint8_t
+    {
+      Connect,
+      Handshake,
+      Send,
+      Receive
+    };
+
+    explicit Timeout(Operation);
+    Operation getOperation() const;
+
+   private:
+    static std::string describe(Operation);
+
+    Operation operation_;
+  };
+
+  static const size_t MAX_FRAME = 1 << 26;  // bytes
+  static const size_t COMPRESS_THRESHOLD = 1024;  // bytes
+  static const size_t MAX_BATCH = 32;  // frames verified together
+  static const size_t HEADER_LEN = 4;
+  static const size_t SIGNATURE_LEN = 64;
+  static const uint32_t COMPRESSED = 1u << 31;  // in a frame's length
+  static const std::string HEARTBEAT_TYPE;
+
   TorStream(const std::string&, ushort, const std::string&, ushort);
-  virtual ~TorStream() {}
+  virtual ~TorStream();
   virtual Json::Value sendReceive(const std::string&, const std::string&);
+  Json::Value sendReceiveRaw(const std::string&,
+                             const std::string&,
+                             std::string&);
+  bool ping(std::chrono::milliseconds);
   SocketPtr getSocket() const;
+  bool isReady() const;
   boost::asio::io_service& getIO();
 
+  void enableMultiplexing();
+  bool isMultiplexed() const;
+  std::future<Json::Value> submit(const std::string&, const std::string&);
+
+  Framing getFraming() const;
+  bool isCompressing() const;
+  bool isSigningRaw() const;
+
+  static void setOptimistic(bool);
+  static bool isOptimistic();
+
+  void setDeadlines(const Deadlines&);
+  Deadlines getDeadlines() const;
+  static void setDefaultDeadlines(const Deadlines&);
+  static Deadlines getDefaultDeadlines();
+
+  static Json::Value parseResponse(const std::string&);
+  static Json::Value parseResponse(const char*, size_t);
+
+ protected:
+  TorStream(const std::string&, ushort, const std::string&, ushort, bool);
+  virtual Json::Value checkResponse(Json::Value);
+  virtual void verifyPayloads(const uint8_t**,
+                              const uint8_t**,
+                              size_t*,
+                              size_t,
+                              int*);
+  void stopMultiplexing();
+
  private:
-  bool confirmProtocol();
+  struct Pending
+  {
+    std::promise<Json::Value> promise;
+    std::chrono::steady_clock::time_point sent;
+  };
+
+  // arms a timer for one operation, cancelled when this goes out of scope
+  class Deadline
+  {
+   public:
+    Deadline(TorStream&, Timeout::Operation, std::chrono::milliseconds);
+    ~Deadline();
+    void run(const std::function<void()>&);
+
+   private:
+    TorStream& stream_;
+    const Timeout::Operation operation_;
+    boost::asio::steady_timer timer_;
+    std::shared_ptr<std::atomic<bool>> expired_;
+  };
+
+  struct Frame
+  {
+    size_t offset;  // of the payload in inbox_
+    uint32_t word;  // the length header
+    int valid;      // 1 unless its signature failed
+    Json::Value response;
+  };
+
+  std::future<Json::Value> submit(const std::string&,
+                                  const std::string&,
+                                  Json::UInt&);
+  void abandon(Json::UInt);
+  void connect(const std::string&, ushort, ushort);
+  void negotiate(ushort);
+  bool confirmProtocol(bool);
+  static Json::Value makeSyn(bool);
   void waitUntilReady() const;
+  Json::Value exchange(const std::string&, const std::string&, std::string*);
+  void readResponses();
+  void deliver(Json::Value&);
+  void writeMessage(const Json::Value&);
+  Json::Value readMessage();
+  void readMessages(size_t);
+  void readRaw(const Json::Value&, std::string&);
+  void fillInbox(size_t);
+  bool peekHeader(size_t, uint32_t&) const;
+  Json::Value decodeFrame(const char*, size_t, bool);
 
   static void initCallback(Socks5::Error,
                            boost::system::error_code,
                            Socks5::AuthMethod);
   void contactCallback(Socks5::Error, boost::system::error_code, Socks5::Reply);
 
-  boost::asio::io_service ios_;
+  boost::asio::io_service& ios_;  // shared, from IOExecutor
   SocketPtr socket_;
   std::shared_ptr<Socks5::Socks5> socks_;
+  const std::string remoteHost_;
   bool ready_;
+  Deadlines deadlines_;
+  Framing framing_;
+  const bool offerSigning_;
+  bool compressing_, signing_;
+  boost::asio::streambuf inbox_;
+  std::vector<Frame> frames_;  // the last ones read
+  std::vector<char> inflated_;
+  std::string deflated_;
+
+  std::mutex writeMutex_, pendingMutex_;
+  std::map<Json::UInt, Pending> pending_;  // by id
+  Json::UInt nextId_;
+  bool closed_;
+  std::thread reader_;
+
+  static std::atomic<bool> optimistic_;
+  static std::mutex defaultsMutex_;
+  static Deadlines defaults_;
 };
 
 #endif
@@ -34,14 +34,57 @@ void Socks5::initialize(std::initializer_list<AuthMethod> methods,
 void Socks5::request(Request req, RequestCallback callback)
 {
   requestCallbackFunc_ = callback;
+  request_ = std::make_shared<Request>(req);
 
   using namespace std::placeholders;
-  boost::asio::mutable_buffers_1 buffer = req.toBuffer();
+  boost::asio::mutable_buffers_1 buffer = request_->toBuffer();
   socket_.async_send(buffer, std::bind(&Socks5::requestCallback, this, _1, _2));
 }
 
 
 
+// Sends the greeting offering no authentication, the request and any early
+// application data in one write, then reads the method selection and the
+// reply together, so the handshake costs one round trip instead of two.
+// Tor holds the early data until the stream is open, as it does for
+// optimistic data, but nothing past the reply is read here. Method
+// selection errors are reported as INIT_RECEIVE_ERROR.
+void Socks5::optimisticRequest(Request req,
+                               const std::string& earlyData,
+                               RequestCallback callback)
+{
+  requestCallbackFunc_ = callback;
+  request_ = std::make_shared<Request>(req);
+
+  boost::asio::mutable_buffers_1 buffer = request_->toBuffer();
+  const uint8_t* requestBytes =
+      boost::asio::buffer_cast<const uint8_t*>(buffer);
+  optimistic_ = {0x05, 0x01,
+                 static_cast<uint8_t>(AuthMethod::NO_AUTHENTICATION)};
+  optimistic_.insert(optimistic_.end(), requestBytes,
+                     requestBytes + boost::asio::buffer_size(buffer));
+  optimistic_.insert(optimistic_.end(), earlyData.begin(), earlyData.end());
+
+  using namespace std::placeholders;
+  boost::asio::async_write(
+      socket_, boost::asio::buffer(optimistic_),
+      [this](boost::system::error_code ec, size_t)
+      {
+        if (ec.value() != 0)
+        {
+          requestCallbackFunc_(Error::INIT_SEND_ERROR, ec, Reply());
+          return;
+        }
+
+        boost::asio::async_read(
+            socket_, boost::asio::buffer(optimisticReply_),
+            std::bind(&Socks5::optimisticRemaining, this, _1, _2),
+            std::bind(&Socks5::optimisticReplyCallback, this, _1, _2));
+      });
+}
+
+
+
 void Socks5::initializeCallback(boost::system::error_code ec, size_t)
 {
   if (ec.value() != 0)
@@ -106,4 +149,56 @@ void Socks5::requestReplyCallback(boost::system::error_code ec, size_t bufsize)
     requestCallbackFunc_(Error::NO_ERROR, ec, Reply(buffer));
   }
 }
+
+
+
+// the bytes still needed to complete the method selection and the reply,
+// which ends with an address of the length its type gives
+size_t Socks5::optimisticRemaining(boost::system::error_code ec,
+                                   size_t got) const
+{
+  const size_t header = 2 + 5;  // selection, then up to the address's first
+  if (ec.value() != 0)
+    return 0;
+  if (got < header)
+    return header - got;
+  if (optimisticReply_[1] !=
+      static_cast<uint8_t>(AuthMethod::NO_AUTHENTICATION))
+    return 0;
+
+  size_t total;
+  switch (static_cast<AddressType>(optimisticReply_[5]))
+  {
+    case AddressType::IP_V4:
+      total = 2 + 4 + 4 + 2;
+      break;
+    case AddressType::IP_V6:
+      total = 2 + 4 + 16 + 2;
+      break;
+    case AddressType::DOMAIN_NAME:
+      total = 2 + 4 + 1 + optimisticReply_[6] + 2;
+      break;
+    default:
+      return 0;
+  }
+
+  return total > got ? total - got : 0;
+}
+
+
+
+void Socks5::optimisticReplyCallback(boost::system::error_code ec,
+                                     size_t bufsize)
+{
+  if (ec.value() != 0)
+    requestCallbackFunc_(Error::REPLY_RECEIVE_ERROR, ec, Reply());
+  else if (optimisticReply_[1] !=
+           static_cast<uint8_t>(AuthMethod::NO_AUTHENTICATION))
+    requestCallbackFunc_(Error::INIT_RECEIVE_ERROR, ec, Reply());
+  else
+  {
+    boost::asio::mutable_buffer buffer(optimisticReply_ + 2, bufsize - 2);
+    requestCallbackFunc_(Error::NO_ERROR, ec, Reply(buffer));
+  }
+}
 }
@@ -7,6 +7,9 @@
 #include "Enums.hpp"
 #include <boost/asio.hpp>
 #include <cstdint>
+#include <memory>
+#include <vector>
+#include <string>
 
 namespace Socks5
 {
@@ -22,6 +25,7 @@ class Socks5
 
   void initialize(std::initializer_list<AuthMethod>, InitCallback);
   void request(Request, RequestCallback);
+  void optimisticRequest(Request, const std::string&, RequestCallback);
 
  private:
   void initializeCallback(boost::system::error_code, size_t);
@@ -30,12 +34,17 @@ class Socks5
   void requestCallback(boost::system::error_code, size_t);
   void requestReply();
   void requestReplyCallback(boost::system::error_code, size_t);
+  size_t optimisticRemaining(boost::system::error_code, size_t) const;
+  void optimisticReplyCallback(boost::system::error_code, size_t);
 
   boost::asio::ip::tcp::socket& socket_;
   InitCallback initializeCallbackFunc_;
   RequestCallback requestCallbackFunc_;
+  std::shared_ptr<Request> request_;  // its buffer is sent asynchronously
 
   unsigned char buffer_[255];
+  std::vector<uint8_t> optimistic_;  // greeting, request and early data
+  uint8_t optimisticReply_[2 + 262];  // method selection and reply
 
   struct initRequest
   {